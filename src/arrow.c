@@ -0,0 +1,1033 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "arrow.h"
+
+/*
+ * Writer of Apache Arrow IPC streams. Each message consists of a continuation
+ * marker, length of metadata, metadata encoded as a flatbuffer (Message.fbs,
+ * Schema.fbs) and a message body. The stream starts with a schema message,
+ * followed by record batches and an end-of-stream marker. Flatbuffers are
+ * built front-to-back: a parent table is written first and offsets of its
+ * children are patched once the children are written behind it.
+ */
+
+#define ARROW_METADATA_V5 4
+
+/* Values of union MessageHeader */
+#define ARROW_HEADER_SCHEMA 1
+#define ARROW_HEADER_RECORD_BATCH 3
+
+/* Values of union Type */
+#define ARROW_TYPE_INT 2
+#define ARROW_TYPE_FLOATING_POINT 3
+#define ARROW_TYPE_BINARY 4
+#define ARROW_TYPE_UTF8 5
+
+#define ARROW_PRECISION_DOUBLE 2
+
+#define ARROW_ALIGN 8
+
+struct fb_field
+{
+	int slot;
+	int size;
+	uint64_t value;
+	size_t pos;
+};
+
+static int
+abuf_reserve (struct arrow_buff *buff, size_t len)
+{
+	uint8_t *data;
+	size_t size;
+
+	if ( buff->len + len <= buff->size )
+		return 0;
+
+	for ( size = (buff->size > 0) ? buff->size:1024; size < buff->len + len; size *= 2 )
+		;
+
+	data = (uint8_t*) realloc (buff->data, size);
+
+	if ( data == NULL )
+		return 1;
+
+	buff->data = data;
+	buff->size = size;
+
+	return 0;
+}
+
+static int
+abuf_append (struct arrow_buff *buff, const void *data, size_t len)
+{
+	if ( abuf_reserve (buff, len) != 0 )
+		return 1;
+
+	memcpy (buff->data + buff->len, data, len);
+	buff->len += len;
+
+	return 0;
+}
+
+static int
+abuf_zero (struct arrow_buff *buff, size_t len)
+{
+	if ( abuf_reserve (buff, len) != 0 )
+		return 1;
+
+	memset (buff->data + buff->len, 0, len);
+	buff->len += len;
+
+	return 0;
+}
+
+static void
+abuf_put (struct arrow_buff *buff, size_t pos, uint64_t val, int size)
+{
+	int i;
+
+	for ( i = 0; i < size; i++ )
+		buff->data[pos + i] = (uint8_t) (val >> (i * 8));
+}
+
+static int
+abuf_append_le (struct arrow_buff *buff, uint64_t val, int size)
+{
+	if ( abuf_reserve (buff, size) != 0 )
+		return 1;
+
+	abuf_put (buff, buff->len, val, size);
+	buff->len += size;
+
+	return 0;
+}
+
+static int
+abuf_align (struct arrow_buff *buff, size_t align, size_t rem)
+{
+	size_t pad;
+
+	pad = (align + rem - (buff->len % align)) % align;
+
+	return abuf_zero (buff, pad);
+}
+
+static void
+abuf_free (struct arrow_buff *buff)
+{
+	if ( buff->data != NULL )
+		free (buff->data);
+
+	memset (buff, 0, sizeof (struct arrow_buff));
+}
+
+/* ================== */
+/* Flatbuffer builder */
+/* ================== */
+
+/* Write a table and its vtable. Offset fields (size 4, value ignored) are
+ * left zero, their positions are returned in pos, to be patched with
+ * fb_patch. Return position of the table, or 0 on failure. */
+static size_t
+fb_table (struct arrow_buff *fb, int nslots, struct fb_field *fields, size_t cnt)
+{
+	uint16_t off[16];
+	size_t vt, tbl, end, i;
+	int size;
+
+	memset (off, 0, sizeof (off));
+	end = 4;
+
+	/* Place fields by size to keep them aligned, table itself is aligned
+	 * to 8 bytes. */
+	for ( size = 8; size > 0; size /= 2 ){
+		for ( i = 0; i < cnt; i++ ){
+			if ( fields[i].size != size )
+				continue;
+
+			end = (end + size - 1) / size * size;
+			off[fields[i].slot] = end;
+			end += size;
+		}
+	}
+
+	end = (end + 3) / 4 * 4;
+
+	if ( abuf_align (fb, 4, 0) != 0 )
+		return 0;
+
+	vt = fb->len;
+
+	if ( abuf_append_le (fb, 4 + nslots * 2, 2) != 0 || abuf_append_le (fb, end, 2) != 0 )
+		return 0;
+
+	for ( i = 0; i < (size_t) nslots; i++ ){
+		if ( abuf_append_le (fb, off[i], 2) != 0 )
+			return 0;
+	}
+
+	if ( abuf_align (fb, 8, 0) != 0 )
+		return 0;
+
+	tbl = fb->len;
+
+	if ( abuf_zero (fb, end) != 0 )
+		return 0;
+
+	abuf_put (fb, tbl, tbl - vt, 4);
+
+	for ( i = 0; i < cnt; i++ ){
+		fields[i].pos = tbl + off[fields[i].slot];
+		abuf_put (fb, fields[i].pos, fields[i].value, fields[i].size);
+	}
+
+	return tbl;
+}
+
+static void
+fb_patch (struct arrow_buff *fb, size_t pos, size_t target)
+{
+	abuf_put (fb, pos, target - pos, 4);
+}
+
+static size_t
+fb_string (struct arrow_buff *fb, const char *str)
+{
+	size_t pos, len;
+
+	len = strlen (str);
+
+	if ( abuf_align (fb, 4, 0) != 0 )
+		return 0;
+
+	pos = fb->len;
+
+	if ( abuf_append_le (fb, len, 4) != 0 || abuf_append (fb, str, len + 1) != 0 )
+		return 0;
+
+	return pos;
+}
+
+/* Vector of offsets, elements are patched later. */
+static size_t
+fb_vector (struct arrow_buff *fb, size_t cnt)
+{
+	size_t pos;
+
+	if ( abuf_align (fb, 4, 0) != 0 )
+		return 0;
+
+	pos = fb->len;
+
+	if ( abuf_append_le (fb, cnt, 4) != 0 || abuf_zero (fb, cnt * 4) != 0 )
+		return 0;
+
+	return pos;
+}
+
+/* Vector of structs consisting of two longs (FieldNode, Buffer). */
+static size_t
+fb_vector_long2 (struct arrow_buff *fb, const int64_t *val, size_t cnt)
+{
+	size_t pos, i;
+
+	/* Elements must be aligned to 8 bytes. */
+	if ( abuf_align (fb, 8, 4) != 0 )
+		return 0;
+
+	pos = fb->len;
+
+	if ( abuf_append_le (fb, cnt, 4) != 0 )
+		return 0;
+
+	for ( i = 0; i < cnt * 2; i++ ){
+		if ( abuf_append_le (fb, (uint64_t) val[i], 8) != 0 )
+			return 0;
+	}
+
+	return pos;
+}
+
+/* Start a message, return position of the offset to the header. */
+static size_t
+fb_message (struct arrow_buff *fb, int header_type, int64_t body_len)
+{
+	struct fb_field fields[4] = {
+		{ 0, 2, ARROW_METADATA_V5, 0 },
+		{ 1, 1, 0, 0 },
+		{ 2, 4, 0, 0 },
+		{ 3, 8, 0, 0 }
+	};
+	size_t msg;
+
+	fields[1].value = header_type;
+	fields[3].value = (uint64_t) body_len;
+
+	fb->len = 0;
+
+	/* Offset to the root table. */
+	if ( abuf_zero (fb, 4) != 0 )
+		return 0;
+
+	msg = fb_table (fb, 5, fields, 4);
+
+	if ( msg == 0 )
+		return 0;
+
+	fb_patch (fb, 0, msg);
+
+	return fields[2].pos;
+}
+
+static int
+arrow_write_message (struct arrow_writer *writer)
+{
+	uint8_t prefix[8];
+
+	if ( abuf_align (&(writer->meta), ARROW_ALIGN, 0) != 0 )
+		return ENOMEM;
+
+	/* Continuation marker and length of metadata. */
+	memset (prefix, 0xff, 4);
+	prefix[4] = writer->meta.len & 0xff;
+	prefix[5] = (writer->meta.len >> 8) & 0xff;
+	prefix[6] = (writer->meta.len >> 16) & 0xff;
+	prefix[7] = (writer->meta.len >> 24) & 0xff;
+
+	if ( fwrite (prefix, 1, 8, writer->file) != 8 )
+		return errno;
+
+	if ( fwrite (writer->meta.data, 1, writer->meta.len, writer->file) != writer->meta.len )
+		return errno;
+
+	return 0;
+}
+
+/* ====== */
+/* Writer */
+/* ====== */
+
+int
+arrow_open (struct arrow_writer *writer, const char *path, size_t batch_size)
+{
+	memset (writer, 0, sizeof (struct arrow_writer));
+
+	writer->batch_size = (batch_size > 0) ? batch_size:ARROW_BATCH_SIZE;
+	writer->file = fopen (path, "wb");
+
+	if ( writer->file == NULL )
+		return errno;
+
+	return 0;
+}
+
+int
+arrow_add_column (struct arrow_writer *writer, const char *name, int type)
+{
+	struct arrow_column *columns, *column;
+
+	columns = (struct arrow_column*) realloc (writer->columns, sizeof (struct arrow_column) * (writer->column_cnt + 1));
+
+	if ( columns == NULL )
+		return ENOMEM;
+
+	writer->columns = columns;
+	column = &(columns[writer->column_cnt]);
+	memset (column, 0, sizeof (struct arrow_column));
+
+	column->name = strdup (name);
+	column->type = type;
+
+	if ( column->name == NULL )
+		return ENOMEM;
+
+	/* The first offset of a variable-length column is always zero. */
+	if ( (type == ARROW_UTF8 || type == ARROW_BINARY) && abuf_append_le (&(column->offsets), 0, 4) != 0 ){
+		free (column->name);
+		return ENOMEM;
+	}
+
+	writer->column_cnt++;
+
+	return 0;
+}
+
+int
+arrow_write_schema (struct arrow_writer *writer)
+{
+	struct arrow_buff *fb;
+	struct arrow_column *column;
+	struct fb_field schema_fields[2] = {
+		{ 0, 2, 0, 0 },
+		{ 1, 4, 0, 0 }
+	};
+	struct fb_field field_fields[5] = {
+		{ 0, 4, 0, 0 },
+		{ 1, 1, 1, 0 },
+		{ 2, 1, 0, 0 },
+		{ 3, 4, 0, 0 },
+		{ 5, 4, 0, 0 }
+	};
+	struct fb_field int_fields[2] = {
+		{ 0, 4, 64, 0 },
+		{ 1, 1, 1, 0 }
+	};
+	struct fb_field float_fields[1] = {
+		{ 0, 2, ARROW_PRECISION_DOUBLE, 0 }
+	};
+	size_t header, schema, vec, field, pos, i;
+
+	fb = &(writer->meta);
+
+	header = fb_message (fb, ARROW_HEADER_SCHEMA, 0);
+
+	if ( header == 0 )
+		return ENOMEM;
+
+	schema = fb_table (fb, 4, schema_fields, 2);
+
+	if ( schema == 0 )
+		return ENOMEM;
+
+	fb_patch (fb, header, schema);
+
+	vec = fb_vector (fb, writer->column_cnt);
+
+	if ( vec == 0 )
+		return ENOMEM;
+
+	fb_patch (fb, schema_fields[1].pos, vec);
+
+	for ( i = 0; i < writer->column_cnt; i++ ){
+		column = &(writer->columns[i]);
+
+		switch ( column->type ){
+			case ARROW_INT64:
+				field_fields[2].value = ARROW_TYPE_INT;
+				break;
+
+			case ARROW_DOUBLE:
+				field_fields[2].value = ARROW_TYPE_FLOATING_POINT;
+				break;
+
+			case ARROW_UTF8:
+				field_fields[2].value = ARROW_TYPE_UTF8;
+				break;
+
+			case ARROW_BINARY:
+				field_fields[2].value = ARROW_TYPE_BINARY;
+				break;
+		}
+
+		field = fb_table (fb, 6, field_fields, 5);
+
+		if ( field == 0 )
+			return ENOMEM;
+
+		fb_patch (fb, vec + 4 + i * 4, field);
+
+		pos = fb_string (fb, column->name);
+
+		if ( pos == 0 )
+			return ENOMEM;
+
+		fb_patch (fb, field_fields[0].pos, pos);
+
+		switch ( column->type ){
+			case ARROW_INT64:
+				pos = fb_table (fb, 2, int_fields, 2);
+				break;
+
+			case ARROW_DOUBLE:
+				pos = fb_table (fb, 1, float_fields, 1);
+				break;
+
+			default:
+				pos = fb_table (fb, 0, NULL, 0);
+				break;
+		}
+
+		if ( pos == 0 )
+			return ENOMEM;
+
+		fb_patch (fb, field_fields[3].pos, pos);
+
+		/* Readers require the vector of children, even if it's empty. */
+		pos = fb_vector (fb, 0);
+
+		if ( pos == 0 )
+			return ENOMEM;
+
+		fb_patch (fb, field_fields[4].pos, pos);
+	}
+
+	return arrow_write_message (writer);
+}
+
+static int
+arrow_validity (struct arrow_column *column, size_t row, int valid)
+{
+	if ( row % 8 == 0 && abuf_zero (&(column->validity), 1) != 0 )
+		return ENOMEM;
+
+	if ( valid )
+		column->validity.data[row / 8] |= 1 << (row % 8);
+	else
+		column->null_cnt++;
+
+	return 0;
+}
+
+int
+arrow_append_int (struct arrow_writer *writer, size_t col, int64_t val)
+{
+	struct arrow_column *column;
+
+	column = &(writer->columns[col]);
+
+	if ( arrow_validity (column, writer->rows, 1) != 0 || abuf_append_le (&(column->values), (uint64_t) val, 8) != 0 )
+		return ENOMEM;
+
+	return 0;
+}
+
+int
+arrow_append_double (struct arrow_writer *writer, size_t col, double val)
+{
+	struct arrow_column *column;
+	union { double d; uint64_t u; } dval;
+
+	column = &(writer->columns[col]);
+	dval.d = val;
+
+	if ( arrow_validity (column, writer->rows, 1) != 0 || abuf_append_le (&(column->values), dval.u, 8) != 0 )
+		return ENOMEM;
+
+	return 0;
+}
+
+int
+arrow_append_bytes (struct arrow_writer *writer, size_t col, const void *data, size_t len)
+{
+	struct arrow_column *column;
+
+	column = &(writer->columns[col]);
+
+	/* Offsets are 32-bit signed integers. */
+	if ( column->values.len + len > INT32_MAX )
+		return EOVERFLOW;
+
+	if ( arrow_validity (column, writer->rows, 1) != 0 || abuf_append (&(column->values), data, len) != 0
+			|| abuf_append_le (&(column->offsets), column->values.len, 4) != 0 )
+		return ENOMEM;
+
+	return 0;
+}
+
+int
+arrow_append_null (struct arrow_writer *writer, size_t col)
+{
+	struct arrow_column *column;
+
+	column = &(writer->columns[col]);
+
+	if ( arrow_validity (column, writer->rows, 0) != 0 )
+		return ENOMEM;
+
+	switch ( column->type ){
+		case ARROW_INT64:
+		case ARROW_DOUBLE:
+			if ( abuf_zero (&(column->values), 8) != 0 )
+				return ENOMEM;
+			break;
+
+		default:
+			if ( abuf_append_le (&(column->offsets), column->values.len, 4) != 0 )
+				return ENOMEM;
+			break;
+	}
+
+	return 0;
+}
+
+static int
+arrow_write_buffer (struct arrow_writer *writer, const struct arrow_buff *buff, size_t len)
+{
+	static const uint8_t pad[ARROW_ALIGN];
+
+	if ( len > 0 && fwrite (buff->data, 1, len, writer->file) != len )
+		return errno;
+
+	len = (ARROW_ALIGN - (len % ARROW_ALIGN)) % ARROW_ALIGN;
+
+	if ( len > 0 && fwrite (pad, 1, len, writer->file) != len )
+		return errno;
+
+	return 0;
+}
+
+#define arrow_padded(len) (((len) + ARROW_ALIGN - 1) / ARROW_ALIGN * ARROW_ALIGN)
+
+static int
+arrow_write_batch (struct arrow_writer *writer)
+{
+	struct arrow_buff *fb;
+	struct arrow_column *column;
+	struct fb_field batch_fields[3] = {
+		{ 0, 8, 0, 0 },
+		{ 1, 4, 0, 0 },
+		{ 2, 4, 0, 0 }
+	};
+	int64_t *nodes, *buffers, body_len;
+	size_t header, batch, pos, nbuff, len, i;
+	int error;
+
+	fb = &(writer->meta);
+
+	nodes = (int64_t*) malloc (sizeof (int64_t) * 2 * writer->column_cnt);
+	buffers = (int64_t*) malloc (sizeof (int64_t) * 6 * writer->column_cnt);
+
+	if ( nodes == NULL || buffers == NULL ){
+		error = ENOMEM;
+		goto cleanup;
+	}
+
+	/* Lay out buffers of the message body. */
+	body_len = 0;
+	nbuff = 0;
+
+	for ( i = 0; i < writer->column_cnt; i++ ){
+		column = &(writer->columns[i]);
+
+		nodes[i * 2] = writer->rows;
+		nodes[i * 2 + 1] = column->null_cnt;
+
+		/* Validity bitmap may be omitted if there are no nulls. */
+		len = (column->null_cnt > 0) ? column->validity.len:0;
+		buffers[nbuff * 2] = body_len;
+		buffers[nbuff * 2 + 1] = len;
+		body_len += arrow_padded (len);
+		nbuff++;
+
+		if ( column->type == ARROW_UTF8 || column->type == ARROW_BINARY ){
+			buffers[nbuff * 2] = body_len;
+			buffers[nbuff * 2 + 1] = column->offsets.len;
+			body_len += arrow_padded (column->offsets.len);
+			nbuff++;
+		}
+
+		buffers[nbuff * 2] = body_len;
+		buffers[nbuff * 2 + 1] = column->values.len;
+		body_len += arrow_padded (column->values.len);
+		nbuff++;
+	}
+
+	error = ENOMEM;
+	header = fb_message (fb, ARROW_HEADER_RECORD_BATCH, body_len);
+
+	if ( header == 0 )
+		goto cleanup;
+
+	batch_fields[0].value = writer->rows;
+	batch = fb_table (fb, 3, batch_fields, 3);
+
+	if ( batch == 0 )
+		goto cleanup;
+
+	fb_patch (fb, header, batch);
+
+	pos = fb_vector_long2 (fb, nodes, writer->column_cnt);
+
+	if ( pos == 0 )
+		goto cleanup;
+
+	fb_patch (fb, batch_fields[1].pos, pos);
+
+	pos = fb_vector_long2 (fb, buffers, nbuff);
+
+	if ( pos == 0 )
+		goto cleanup;
+
+	fb_patch (fb, batch_fields[2].pos, pos);
+
+	error = arrow_write_message (writer);
+
+	if ( error != 0 )
+		goto cleanup;
+
+	for ( i = 0; i < writer->column_cnt; i++ ){
+		column = &(writer->columns[i]);
+
+		if ( column->null_cnt > 0 ){
+			error = arrow_write_buffer (writer, &(column->validity), column->validity.len);
+
+			if ( error != 0 )
+				goto cleanup;
+		}
+
+		if ( column->type == ARROW_UTF8 || column->type == ARROW_BINARY ){
+			error = arrow_write_buffer (writer, &(column->offsets), column->offsets.len);
+
+			if ( error != 0 )
+				goto cleanup;
+		}
+
+		error = arrow_write_buffer (writer, &(column->values), column->values.len);
+
+		if ( error != 0 )
+			goto cleanup;
+
+		/* Reset the column for the next batch. */
+		column->validity.len = 0;
+		column->values.len = 0;
+		column->null_cnt = 0;
+		column->offsets.len = (column->type == ARROW_UTF8 || column->type == ARROW_BINARY) ? 4:0;
+	}
+
+	writer->rows = 0;
+	writer->batches++;
+
+cleanup:
+	if ( nodes != NULL )
+		free (nodes);
+
+	if ( buffers != NULL )
+		free (buffers);
+
+	return error;
+}
+
+int
+arrow_end_row (struct arrow_writer *writer)
+{
+	writer->rows++;
+
+	if ( writer->rows == writer->batch_size )
+		return arrow_write_batch (writer);
+
+	return 0;
+}
+
+int
+arrow_close (struct arrow_writer *writer)
+{
+	static const uint8_t eos[8] = { 0xff, 0xff, 0xff, 0xff, 0x00, 0x00, 0x00, 0x00 };
+	size_t i;
+	int error;
+
+	error = writer->error;
+
+	if ( writer->file != NULL ){
+
+		if ( error == 0 && writer->rows > 0 )
+			error = arrow_write_batch (writer);
+
+		if ( error == 0 && fwrite (eos, 1, sizeof (eos), writer->file) != sizeof (eos) )
+			error = errno;
+
+		if ( fclose (writer->file) != 0 && error == 0 )
+			error = errno;
+
+		writer->file = NULL;
+	}
+
+	for ( i = 0; i < writer->column_cnt; i++ ){
+		free (writer->columns[i].name);
+		abuf_free (&(writer->columns[i].validity));
+		abuf_free (&(writer->columns[i].values));
+		abuf_free (&(writer->columns[i].offsets));
+	}
+
+	if ( writer->columns != NULL )
+		free (writer->columns);
+
+	abuf_free (&(writer->meta));
+
+	writer->columns = NULL;
+	writer->column_cnt = 0;
+
+	return error;
+}
+
+/* ======= */
+/* Lua API */
+/* ======= */
+
+static int
+arrow_parse_type (const char *str)
+{
+	if ( strcmp (str, "int64") == 0 || strcmp (str, "integer") == 0 )
+		return ARROW_INT64;
+	else if ( strcmp (str, "double") == 0 || strcmp (str, "number") == 0 )
+		return ARROW_DOUBLE;
+	else if ( strcmp (str, "utf8") == 0 || strcmp (str, "string") == 0 )
+		return ARROW_UTF8;
+	else if ( strcmp (str, "binary") == 0 )
+		return ARROW_BINARY;
+
+	return -1;
+}
+
+static struct arrow_writer*
+arrow_lua_check (lua_State *lua_state)
+{
+	struct arrow_writer *writer;
+
+	writer = (struct arrow_writer*) luaL_checkudata (lua_state, 1, ARROW_WRITER_MT);
+
+	if ( writer->file == NULL )
+		luaL_error (lua_state, "writer is closed");
+
+	return writer;
+}
+
+/* writer:append (record) */
+static int
+arrow_lua_append (lua_State *lua_state)
+{
+	struct arrow_writer *writer;
+	struct arrow_column *column;
+	const char *str;
+	lua_Number num;
+	size_t len, i;
+	int base, ltype, rval;
+
+	writer = arrow_lua_check (lua_state);
+	luaL_checktype (lua_state, 2, LUA_TTABLE);
+
+	if ( writer->error != 0 )
+		return luaL_error (lua_state, "cannot write a record: %s", strerror (writer->error));
+
+	if ( ! lua_checkstack (lua_state, writer->column_cnt + 1) )
+		return luaL_error (lua_state, "Lua stack is full");
+
+	/* Check all values first, so that a bad record leaves the batch intact. */
+	base = lua_gettop (lua_state);
+
+	for ( i = 0; i < writer->column_cnt; i++ ){
+		column = &(writer->columns[i]);
+		lua_getfield (lua_state, 2, column->name);
+		ltype = lua_type (lua_state, -1);
+
+		if ( ltype == LUA_TNIL )
+			continue;
+
+		switch ( column->type ){
+			case ARROW_INT64:
+				if ( ltype != LUA_TNUMBER )
+					return luaL_error (lua_state, "field '%s': number expected, got %s", column->name, lua_typename (lua_state, ltype));
+#if LUA_VERSION_NUM >= 503
+				if ( lua_isinteger (lua_state, -1) )
+					break;
+#endif
+				/* Integral and within [-2^63, 2^63), NaN fails both. */
+				num = lua_tonumber (lua_state, -1);
+
+				if ( ! (num == floor (num) && num >= -9223372036854775808.0 && num < 9223372036854775808.0) )
+					return luaL_error (lua_state, "field '%s': integer expected, got %f", column->name, (double) num);
+				break;
+
+			case ARROW_DOUBLE:
+				if ( ltype != LUA_TNUMBER )
+					return luaL_error (lua_state, "field '%s': number expected, got %s", column->name, lua_typename (lua_state, ltype));
+				break;
+
+			default:
+				if ( ltype != LUA_TSTRING )
+					return luaL_error (lua_state, "field '%s': string expected, got %s", column->name, lua_typename (lua_state, ltype));
+				break;
+		}
+	}
+
+	for ( i = 0; i < writer->column_cnt; i++ ){
+		column = &(writer->columns[i]);
+
+		if ( lua_isnil (lua_state, base + i + 1) ){
+			rval = arrow_append_null (writer, i);
+			goto next;
+		}
+
+		switch ( column->type ){
+			case ARROW_INT64:
+#if LUA_VERSION_NUM >= 503
+				if ( lua_isinteger (lua_state, base + i + 1) ){
+					rval = arrow_append_int (writer, i, lua_tointeger (lua_state, base + i + 1));
+					break;
+				}
+#endif
+				num = lua_tonumber (lua_state, base + i + 1);
+				rval = arrow_append_int (writer, i, (int64_t) num);
+				break;
+
+			case ARROW_DOUBLE:
+				rval = arrow_append_double (writer, i, lua_tonumber (lua_state, base + i + 1));
+				break;
+
+			default:
+				str = lua_tolstring (lua_state, base + i + 1, &len);
+				rval = arrow_append_bytes (writer, i, str, len);
+				break;
+		}
+
+next:
+		/* Columns are now out of sync, writer cannot be used anymore. */
+		if ( rval != 0 ){
+			writer->error = rval;
+			return luaL_error (lua_state, "cannot write a record: %s", strerror (rval));
+		}
+	}
+
+	rval = arrow_end_row (writer);
+
+	if ( rval != 0 ){
+		writer->error = rval;
+		return luaL_error (lua_state, "cannot write a record batch: %s", strerror (rval));
+	}
+
+	return 0;
+}
+
+/* writer:close () */
+static int
+arrow_lua_close (lua_State *lua_state)
+{
+	struct arrow_writer *writer;
+	int rval;
+
+	writer = arrow_lua_check (lua_state);
+	rval = arrow_close (writer);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot close writer: %s", strerror (rval));
+
+	return 0;
+}
+
+static int
+arrow_lua_gc (lua_State *lua_state)
+{
+	struct arrow_writer *writer;
+
+	writer = (struct arrow_writer*) luaL_checkudata (lua_state, 1, ARROW_WRITER_MT);
+
+	if ( writer->file != NULL )
+		arrow_close (writer);
+
+	return 0;
+}
+
+static const luaL_Reg arrow_methods[] = {
+	{ "append", arrow_lua_append },
+	{ "close", arrow_lua_close },
+	{ NULL, NULL }
+};
+
+/* capdiss.arrow (path, { { name, type }, ... } [, batch_size]) */
+static int
+arrow_lua_open (lua_State *lua_state)
+{
+	struct arrow_writer *writer;
+	const char *path, *name, *type_str;
+	lua_Integer batch_size;
+	int i, cnt, type, rval;
+
+	path = luaL_checkstring (lua_state, 1);
+	luaL_checktype (lua_state, 2, LUA_TTABLE);
+	batch_size = luaL_optinteger (lua_state, 3, ARROW_BATCH_SIZE);
+
+	luaL_argcheck (lua_state, batch_size > 0, 3, "batch size must be positive");
+
+	cnt = (int) lua_rawlen (lua_state, 2);
+
+	luaL_argcheck (lua_state, cnt > 0, 2, "schema has no fields");
+
+	if ( luaL_newmetatable (lua_state, ARROW_WRITER_MT) ){
+		lua_newtable (lua_state);
+		luaL_setfuncs (lua_state, arrow_methods, 0);
+		lua_setfield (lua_state, -2, "__index");
+		lua_pushcfunction (lua_state, arrow_lua_gc);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	writer = (struct arrow_writer*) lua_newuserdata (lua_state, sizeof (struct arrow_writer));
+	memset (writer, 0, sizeof (struct arrow_writer));
+	luaL_setmetatable (lua_state, ARROW_WRITER_MT);
+
+	rval = arrow_open (writer, path, batch_size);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot open '%s': %s", path, strerror (rval));
+
+	for ( i = 1; i <= cnt; i++ ){
+		lua_rawgeti (lua_state, 2, i);
+
+		if ( ! lua_istable (lua_state, -1) )
+			return luaL_argerror (lua_state, 2, "schema field must be a table { name, type }");
+
+		lua_rawgeti (lua_state, -1, 1);
+		lua_rawgeti (lua_state, -2, 2);
+
+		name = lua_tostring (lua_state, -2);
+		type_str = lua_tostring (lua_state, -1);
+
+		if ( name == NULL || type_str == NULL )
+			return luaL_argerror (lua_state, 2, "schema field must be a table { name, type }");
+
+		type = arrow_parse_type (type_str);
+
+		if ( type == -1 )
+			return luaL_error (lua_state, "field '%s': unknown type '%s'", name, type_str);
+
+		rval = arrow_add_column (writer, name, type);
+
+		if ( rval != 0 )
+			return luaL_error (lua_state, "cannot allocate memory");
+
+		lua_pop (lua_state, 3);
+	}
+
+	rval = arrow_write_schema (writer);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot write schema: %s", strerror (rval));
+
+	return 1;
+}
+
+const luaL_Reg arrow_api[] = {
+	{ "arrow", arrow_lua_open },
+	{ NULL, NULL }
+};
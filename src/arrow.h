@@ -0,0 +1,95 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _ARROW_H
+#define _ARROW_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#define ARROW_BATCH_SIZE 65536
+
+#define ARROW_WRITER_MT "capdiss.arrow"
+
+enum
+{
+	ARROW_INT64 = 1,
+	ARROW_DOUBLE = 2,
+	ARROW_UTF8 = 3,
+	ARROW_BINARY = 4
+};
+
+struct arrow_buff
+{
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+struct arrow_column
+{
+	char *name;
+	int type;
+	struct arrow_buff validity;
+	struct arrow_buff values;
+	struct arrow_buff offsets;
+	size_t null_cnt;
+};
+
+struct arrow_writer
+{
+	FILE *file;
+	struct arrow_column *columns;
+	size_t column_cnt;
+	size_t rows;
+	size_t batch_size;
+	struct arrow_buff meta;
+	unsigned long batches;
+	int error;
+};
+
+extern const luaL_Reg arrow_api[];
+
+extern int arrow_open (struct arrow_writer *writer, const char *path, size_t batch_size);
+
+extern int arrow_add_column (struct arrow_writer *writer, const char *name, int type);
+
+extern int arrow_write_schema (struct arrow_writer *writer);
+
+extern int arrow_append_int (struct arrow_writer *writer, size_t col, int64_t val);
+
+extern int arrow_append_double (struct arrow_writer *writer, size_t col, double val);
+
+extern int arrow_append_bytes (struct arrow_writer *writer, size_t col, const void *data, size_t len);
+
+extern int arrow_append_null (struct arrow_writer *writer, size_t col);
+
+extern int arrow_end_row (struct arrow_writer *writer);
+
+extern int arrow_close (struct arrow_writer *writer);
+
+#endif
+
@@ -0,0 +1,613 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <pcap.h>
+
+#if defined (__x86_64__) && defined (__GNUC__) && ! defined (_WIN32)
+#include <sys/mman.h>
+#define BPFJIT_X86 1
+#endif
+
+#include "bpfjit.h"
+
+/* Not defined by older versions of libpcap. */
+#ifndef BPF_MOD
+#define BPF_MOD 0x90
+#endif
+
+#ifndef BPF_XOR
+#define BPF_XOR 0xa0
+#endif
+
+/*
+ * Classic BPF programs (as produced by pcap_compile) are translated into
+ * x86-64 machine code, semantics follow bpf_filter of libpcap: loads out of
+ * the captured data and division by zero reject the frame, shifts by 32 bits
+ * or more clear the accumulator. Programs that cannot be translated (and all
+ * programs on other platforms) are run by bpf_filter.
+ *
+ * Register usage: eax accumulator (A), r8d index register (X), rdi frame
+ * data, esi wire length, r10d captured length, ecx/edx/r9/r11 scratch. The
+ * scratch memory (M[]) lives on the stack.
+ */
+
+static int bpfjit_enabled = 1;
+
+void
+bpfjit_enable (int enable)
+{
+	bpfjit_enabled = enable;
+}
+
+#ifdef BPFJIT_X86
+
+/* Condition codes of a near jump (second byte of 0x0f 0x8?) */
+#define BPFJIT_JB 0x82
+#define BPFJIT_JAE 0x83
+#define BPFJIT_JE 0x84
+#define BPFJIT_JNE 0x85
+#define BPFJIT_JBE 0x86
+#define BPFJIT_JA 0x87
+#define BPFJIT_JMP 0
+
+struct bpfjit_fixup
+{
+	size_t pos;
+	uint32_t target;
+};
+
+struct bpfjit_gen
+{
+	uint8_t *code;
+	size_t len;
+	size_t *off;
+	struct bpfjit_fixup *fixup;
+	size_t fixup_cnt;
+	uint32_t cnt;
+};
+
+static void
+bpfjit_emit (struct bpfjit_gen *gen, int n, ...)
+{
+	va_list ap;
+
+	va_start (ap, n);
+
+	while ( n-- > 0 )
+		gen->code[gen->len++] = (uint8_t) va_arg (ap, int);
+
+	va_end (ap);
+}
+
+static void
+bpfjit_emit32 (struct bpfjit_gen *gen, uint32_t val)
+{
+	bpfjit_emit (gen, 4, val & 0xff, (val >> 8) & 0xff, (val >> 16) & 0xff, val >> 24);
+}
+
+/* Jump to an instruction, target 'cnt' is the exit rejecting the frame.
+ * Offsets are filled in once all instructions are emitted. */
+static void
+bpfjit_jump (struct bpfjit_gen *gen, int cc, uint32_t target)
+{
+	if ( cc == BPFJIT_JMP )
+		bpfjit_emit (gen, 1, 0xe9);
+	else
+		bpfjit_emit (gen, 2, 0x0f, cc);
+
+	gen->fixup[gen->fixup_cnt].pos = gen->len;
+	gen->fixup[gen->fixup_cnt].target = target;
+	gen->fixup_cnt++;
+
+	bpfjit_emit32 (gen, 0);
+}
+
+static int
+bpfjit_invert (int cc)
+{
+	switch ( cc ){
+		case BPFJIT_JB: return BPFJIT_JAE;
+		case BPFJIT_JAE: return BPFJIT_JB;
+		case BPFJIT_JE: return BPFJIT_JNE;
+		case BPFJIT_JNE: return BPFJIT_JE;
+		case BPFJIT_JBE: return BPFJIT_JA;
+		default: return BPFJIT_JBE;
+	}
+}
+
+/* Reject the frame unless 'size' bytes at constant offset 'k' were
+ * captured: cmp r10d, k + size; jb exit */
+static void
+bpfjit_check_abs (struct bpfjit_gen *gen, uint32_t k, uint32_t size)
+{
+	if ( k > INT32_MAX - size ){
+		bpfjit_jump (gen, BPFJIT_JMP, gen->cnt);
+		return;
+	}
+
+	bpfjit_emit (gen, 3, 0x41, 0x81, 0xfa);
+	bpfjit_emit32 (gen, k + size);
+	bpfjit_jump (gen, BPFJIT_JB, gen->cnt);
+}
+
+/* Offset X + k into r11, computed in 64 bits so that it cannot overflow,
+ * reject the frame unless 'size' bytes there were captured. */
+static void
+bpfjit_check_ind (struct bpfjit_gen *gen, uint32_t k, uint32_t size)
+{
+	/* mov r11d, r8d; mov r9d, k; add r11, r9 */
+	bpfjit_emit (gen, 3, 0x45, 0x89, 0xc3);
+	bpfjit_emit (gen, 2, 0x41, 0xb9);
+	bpfjit_emit32 (gen, k);
+	bpfjit_emit (gen, 3, 0x4d, 0x01, 0xcb);
+
+	/* lea r9, [r11 + size]; cmp r9, r10; ja exit */
+	bpfjit_emit (gen, 4, 0x4d, 0x8d, 0x4b, size);
+	bpfjit_emit (gen, 3, 0x4d, 0x39, 0xd1);
+	bpfjit_jump (gen, BPFJIT_JA, gen->cnt);
+}
+
+/* Conditional jump of a BPF instruction, the flags are already set. */
+static void
+bpfjit_branch (struct bpfjit_gen *gen, uint32_t i, int cc, uint32_t jt, uint32_t jf)
+{
+	uint32_t next;
+
+	next = i + 1;
+
+	if ( jt == jf ){
+		if ( jt != 0 )
+			bpfjit_jump (gen, BPFJIT_JMP, next + jt);
+	} else if ( jt == 0 ){
+		bpfjit_jump (gen, bpfjit_invert (cc), next + jf);
+	} else {
+		bpfjit_jump (gen, cc, next + jt);
+
+		if ( jf != 0 )
+			bpfjit_jump (gen, BPFJIT_JMP, next + jf);
+	}
+}
+
+/* Return 0 if the instruction was translated. */
+static int
+bpfjit_insn (struct bpfjit_gen *gen, uint32_t i, const struct bpf_insn *insn)
+{
+	uint32_t k;
+	int cc;
+
+	k = insn->k;
+
+	switch ( insn->code ){
+		case BPF_RET|BPF_K:
+			/* mov eax, k; add rsp, 64; ret */
+			bpfjit_emit (gen, 1, 0xb8);
+			bpfjit_emit32 (gen, k);
+			bpfjit_emit (gen, 5, 0x48, 0x83, 0xc4, BPFJIT_MEMWORDS * 4, 0xc3);
+			break;
+
+		case BPF_RET|BPF_A:
+			bpfjit_emit (gen, 5, 0x48, 0x83, 0xc4, BPFJIT_MEMWORDS * 4, 0xc3);
+			break;
+
+		case BPF_LD|BPF_W|BPF_ABS:
+			/* mov eax, [rdi + k]; bswap eax */
+			bpfjit_check_abs (gen, k, 4);
+			bpfjit_emit (gen, 2, 0x8b, 0x87);
+			bpfjit_emit32 (gen, k);
+			bpfjit_emit (gen, 2, 0x0f, 0xc8);
+			break;
+
+		case BPF_LD|BPF_H|BPF_ABS:
+			/* movzx eax, word [rdi + k]; rol ax, 8 */
+			bpfjit_check_abs (gen, k, 2);
+			bpfjit_emit (gen, 3, 0x0f, 0xb7, 0x87);
+			bpfjit_emit32 (gen, k);
+			bpfjit_emit (gen, 4, 0x66, 0xc1, 0xc0, 0x08);
+			break;
+
+		case BPF_LD|BPF_B|BPF_ABS:
+			/* movzx eax, byte [rdi + k] */
+			bpfjit_check_abs (gen, k, 1);
+			bpfjit_emit (gen, 3, 0x0f, 0xb6, 0x87);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_LD|BPF_W|BPF_IND:
+			/* mov eax, [rdi + r11]; bswap eax */
+			bpfjit_check_ind (gen, k, 4);
+			bpfjit_emit (gen, 4, 0x42, 0x8b, 0x04, 0x1f);
+			bpfjit_emit (gen, 2, 0x0f, 0xc8);
+			break;
+
+		case BPF_LD|BPF_H|BPF_IND:
+			/* movzx eax, word [rdi + r11]; rol ax, 8 */
+			bpfjit_check_ind (gen, k, 2);
+			bpfjit_emit (gen, 5, 0x42, 0x0f, 0xb7, 0x04, 0x1f);
+			bpfjit_emit (gen, 4, 0x66, 0xc1, 0xc0, 0x08);
+			break;
+
+		case BPF_LD|BPF_B|BPF_IND:
+			/* movzx eax, byte [rdi + r11] */
+			bpfjit_check_ind (gen, k, 1);
+			bpfjit_emit (gen, 5, 0x42, 0x0f, 0xb6, 0x04, 0x1f);
+			break;
+
+		case BPF_LDX|BPF_MSH|BPF_B:
+			/* movzx r8d, byte [rdi + k]; and r8d, 0xf; shl r8d, 2 */
+			bpfjit_check_abs (gen, k, 1);
+			bpfjit_emit (gen, 4, 0x44, 0x0f, 0xb6, 0x87);
+			bpfjit_emit32 (gen, k);
+			bpfjit_emit (gen, 4, 0x41, 0x83, 0xe0, 0x0f);
+			bpfjit_emit (gen, 4, 0x41, 0xc1, 0xe0, 0x02);
+			break;
+
+		case BPF_LD|BPF_W|BPF_LEN:
+			/* mov eax, esi */
+			bpfjit_emit (gen, 2, 0x89, 0xf0);
+			break;
+
+		case BPF_LDX|BPF_W|BPF_LEN:
+			/* mov r8d, esi */
+			bpfjit_emit (gen, 3, 0x41, 0x89, 0xf0);
+			break;
+
+		case BPF_LD|BPF_IMM:
+			bpfjit_emit (gen, 1, 0xb8);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_LDX|BPF_IMM:
+			bpfjit_emit (gen, 2, 0x41, 0xb8);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_LD|BPF_MEM:
+			if ( k >= BPFJIT_MEMWORDS )
+				return 1;
+			/* mov eax, [rsp + 4k] */
+			bpfjit_emit (gen, 4, 0x8b, 0x44, 0x24, k * 4);
+			break;
+
+		case BPF_LDX|BPF_MEM:
+			if ( k >= BPFJIT_MEMWORDS )
+				return 1;
+			bpfjit_emit (gen, 5, 0x44, 0x8b, 0x44, 0x24, k * 4);
+			break;
+
+		case BPF_ST:
+			if ( k >= BPFJIT_MEMWORDS )
+				return 1;
+			bpfjit_emit (gen, 4, 0x89, 0x44, 0x24, k * 4);
+			break;
+
+		case BPF_STX:
+			if ( k >= BPFJIT_MEMWORDS )
+				return 1;
+			bpfjit_emit (gen, 5, 0x44, 0x89, 0x44, 0x24, k * 4);
+			break;
+
+		case BPF_JMP|BPF_JA:
+			if ( (uint64_t) i + 1 + k >= gen->cnt )
+				return 1;
+			if ( k != 0 )
+				bpfjit_jump (gen, BPFJIT_JMP, i + 1 + k);
+			break;
+
+		case BPF_JMP|BPF_JEQ|BPF_K:
+		case BPF_JMP|BPF_JGT|BPF_K:
+		case BPF_JMP|BPF_JGE|BPF_K:
+		case BPF_JMP|BPF_JSET|BPF_K:
+		case BPF_JMP|BPF_JEQ|BPF_X:
+		case BPF_JMP|BPF_JGT|BPF_X:
+		case BPF_JMP|BPF_JGE|BPF_X:
+		case BPF_JMP|BPF_JSET|BPF_X:
+			if ( i + 1 + insn->jt >= gen->cnt || i + 1 + insn->jf >= gen->cnt )
+				return 1;
+
+			if ( BPF_OP (insn->code) == BPF_JSET ){
+				/* test eax, k | test eax, r8d */
+				if ( BPF_SRC (insn->code) == BPF_K ){
+					bpfjit_emit (gen, 1, 0xa9);
+					bpfjit_emit32 (gen, k);
+				} else {
+					bpfjit_emit (gen, 3, 0x44, 0x85, 0xc0);
+				}
+				cc = BPFJIT_JNE;
+			} else {
+				/* cmp eax, k | cmp eax, r8d */
+				if ( BPF_SRC (insn->code) == BPF_K ){
+					bpfjit_emit (gen, 1, 0x3d);
+					bpfjit_emit32 (gen, k);
+				} else {
+					bpfjit_emit (gen, 3, 0x44, 0x39, 0xc0);
+				}
+				cc = (BPF_OP (insn->code) == BPF_JEQ) ? BPFJIT_JE:(BPF_OP (insn->code) == BPF_JGT) ? BPFJIT_JA:BPFJIT_JAE;
+			}
+
+			bpfjit_branch (gen, i, cc, insn->jt, insn->jf);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_K:
+			bpfjit_emit (gen, 1, 0x05);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_K:
+			bpfjit_emit (gen, 1, 0x2d);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_K:
+			/* imul eax, eax, k */
+			bpfjit_emit (gen, 2, 0x69, 0xc0);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_K:
+			bpfjit_emit (gen, 1, 0x25);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_K:
+			bpfjit_emit (gen, 1, 0x0d);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_K:
+			bpfjit_emit (gen, 1, 0x35);
+			bpfjit_emit32 (gen, k);
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_K:
+			/* shl eax, k | xor eax, eax */
+			if ( k < 32 )
+				bpfjit_emit (gen, 3, 0xc1, 0xe0, k);
+			else
+				bpfjit_emit (gen, 2, 0x31, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_RSH|BPF_K:
+			if ( k < 32 )
+				bpfjit_emit (gen, 3, 0xc1, 0xe8, k);
+			else
+				bpfjit_emit (gen, 2, 0x31, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_K:
+		case BPF_ALU|BPF_MOD|BPF_K:
+			if ( k == 0 ){
+				bpfjit_jump (gen, BPFJIT_JMP, gen->cnt);
+				break;
+			}
+
+			/* mov r11d, k; xor edx, edx; div r11d */
+			bpfjit_emit (gen, 2, 0x41, 0xbb);
+			bpfjit_emit32 (gen, k);
+			bpfjit_emit (gen, 5, 0x31, 0xd2, 0x41, 0xf7, 0xf3);
+
+			/* mov eax, edx */
+			if ( BPF_OP (insn->code) == BPF_MOD )
+				bpfjit_emit (gen, 2, 0x89, 0xd0);
+			break;
+
+		case BPF_ALU|BPF_ADD|BPF_X:
+			bpfjit_emit (gen, 3, 0x44, 0x01, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_SUB|BPF_X:
+			bpfjit_emit (gen, 3, 0x44, 0x29, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_MUL|BPF_X:
+			/* imul eax, r8d */
+			bpfjit_emit (gen, 4, 0x41, 0x0f, 0xaf, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_AND|BPF_X:
+			bpfjit_emit (gen, 3, 0x44, 0x21, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_OR|BPF_X:
+			bpfjit_emit (gen, 3, 0x44, 0x09, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_XOR|BPF_X:
+			bpfjit_emit (gen, 3, 0x44, 0x31, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_LSH|BPF_X:
+		case BPF_ALU|BPF_RSH|BPF_X:
+			/* mov ecx, r8d; shl/shr eax, cl */
+			bpfjit_emit (gen, 3, 0x44, 0x89, 0xc1);
+			bpfjit_emit (gen, 2, 0xd3, (BPF_OP (insn->code) == BPF_LSH) ? 0xe0:0xe8);
+
+			/* cmp r8d, 32; jb +2; xor eax, eax */
+			bpfjit_emit (gen, 4, 0x41, 0x83, 0xf8, 0x20);
+			bpfjit_emit (gen, 4, 0x72, 0x02, 0x31, 0xc0);
+			break;
+
+		case BPF_ALU|BPF_DIV|BPF_X:
+		case BPF_ALU|BPF_MOD|BPF_X:
+			/* test r8d, r8d; jz exit; xor edx, edx; div r8d */
+			bpfjit_emit (gen, 3, 0x45, 0x85, 0xc0);
+			bpfjit_jump (gen, BPFJIT_JE, gen->cnt);
+			bpfjit_emit (gen, 5, 0x31, 0xd2, 0x41, 0xf7, 0xf0);
+
+			if ( BPF_OP (insn->code) == BPF_MOD )
+				bpfjit_emit (gen, 2, 0x89, 0xd0);
+			break;
+
+		case BPF_ALU|BPF_NEG:
+			bpfjit_emit (gen, 2, 0xf7, 0xd8);
+			break;
+
+		case BPF_MISC|BPF_TAX:
+			/* mov r8d, eax */
+			bpfjit_emit (gen, 3, 0x41, 0x89, 0xc0);
+			break;
+
+		case BPF_MISC|BPF_TXA:
+			/* mov eax, r8d */
+			bpfjit_emit (gen, 3, 0x44, 0x89, 0xc0);
+			break;
+
+		default:
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+bpfjit_translate (struct bpfjit *jit, const struct bpf_program *prog)
+{
+	struct bpfjit_gen gen;
+	uint32_t i;
+	int32_t rel;
+	int uses_mem, rval;
+
+	memset (&gen, 0, sizeof (struct bpfjit_gen));
+
+	gen.cnt = prog->bf_len;
+	gen.code = (uint8_t*) malloc ((size_t) (gen.cnt + 2) * BPFJIT_INSN_MAX);
+	gen.off = (size_t*) malloc (sizeof (size_t) * (gen.cnt + 1));
+	gen.fixup = (struct bpfjit_fixup*) malloc (sizeof (struct bpfjit_fixup) * (gen.cnt * 3 + 1));
+	rval = ENOMEM;
+
+	if ( gen.code == NULL || gen.off == NULL || gen.fixup == NULL )
+		goto done;
+
+	/* sub rsp, 64; xor eax, eax; xor r8d, r8d; mov r10d, edx */
+	bpfjit_emit (&gen, 4, 0x48, 0x83, 0xec, BPFJIT_MEMWORDS * 4);
+	bpfjit_emit (&gen, 5, 0x31, 0xc0, 0x45, 0x31, 0xc0);
+	bpfjit_emit (&gen, 3, 0x41, 0x89, 0xd2);
+
+	uses_mem = 0;
+
+	for ( i = 0; i < gen.cnt; i++ ){
+		if ( prog->bf_insns[i].code == (BPF_LD|BPF_MEM) || prog->bf_insns[i].code == (BPF_LDX|BPF_MEM) )
+			uses_mem = 1;
+	}
+
+	/* Scratch memory starts zeroed: xor r9d, r9d; mov [rsp + 8i], r9 */
+	if ( uses_mem ){
+		bpfjit_emit (&gen, 3, 0x45, 0x31, 0xc9);
+
+		for ( i = 0; i < BPFJIT_MEMWORDS / 2; i++ )
+			bpfjit_emit (&gen, 5, 0x4c, 0x89, 0x4c, 0x24, i * 8);
+	}
+
+	rval = EINVAL;
+
+	for ( i = 0; i < gen.cnt; i++ ){
+		gen.off[i] = gen.len;
+
+		if ( bpfjit_insn (&gen, i, &(prog->bf_insns[i])) != 0 )
+			goto done;
+	}
+
+	/* Exit rejecting the frame: xor eax, eax; add rsp, 64; ret */
+	gen.off[gen.cnt] = gen.len;
+	bpfjit_emit (&gen, 2, 0x31, 0xc0);
+	bpfjit_emit (&gen, 5, 0x48, 0x83, 0xc4, BPFJIT_MEMWORDS * 4, 0xc3);
+
+	for ( i = 0; i < gen.fixup_cnt; i++ ){
+		rel = (int32_t) (gen.off[gen.fixup[i].target] - (gen.fixup[i].pos + 4));
+		memcpy (gen.code + gen.fixup[i].pos, &rel, 4);
+	}
+
+	jit->code_size = gen.len;
+	jit->code = mmap (NULL, jit->code_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if ( jit->code == MAP_FAILED ){
+		jit->code = NULL;
+		rval = errno;
+		goto done;
+	}
+
+	memcpy (jit->code, gen.code, gen.len);
+
+	if ( mprotect (jit->code, jit->code_size, PROT_READ | PROT_EXEC) == -1 ){
+		rval = errno;
+		munmap (jit->code, jit->code_size);
+		jit->code = NULL;
+		goto done;
+	}
+
+	/* Object to function pointer conversion is not defined by ISO C. */
+	memcpy (&(jit->func), &(jit->code), sizeof (jit->func));
+	rval = 0;
+
+done:
+	free (gen.code);
+	free (gen.off);
+	free (gen.fixup);
+
+	return rval;
+}
+
+#endif
+
+/* Translate a program into machine code. Return 0 on success, otherwise the
+ * program is run by bpf_filter. The program must outlive the object. */
+int
+bpfjit_compile (struct bpfjit *jit, const struct bpf_program *prog)
+{
+	memset (jit, 0, sizeof (struct bpfjit));
+
+	jit->insns = prog->bf_insns;
+
+	if ( ! bpfjit_enabled || prog->bf_len == 0 )
+		return ENOSYS;
+
+#ifdef BPFJIT_X86
+	return bpfjit_translate (jit, prog);
+#else
+	return ENOSYS;
+#endif
+}
+
+u_int
+bpfjit_filter (const struct bpfjit *jit, const u_char *pkt, u_int wirelen, u_int buflen)
+{
+	if ( jit->func != NULL )
+		return jit->func (pkt, wirelen, buflen);
+
+	return bpf_filter (jit->insns, pkt, wirelen, buflen);
+}
+
+void
+bpfjit_free (struct bpfjit *jit)
+{
+#ifdef BPFJIT_X86
+	if ( jit->code != NULL )
+		munmap (jit->code, jit->code_size);
+#endif
+
+	memset (jit, 0, sizeof (struct bpfjit));
+}
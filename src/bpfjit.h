@@ -0,0 +1,56 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _BPFJIT_H
+#define _BPFJIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pcap.h>
+
+/* Scratch memory of a filter program (BPF_MEMWORDS in libpcap). */
+#define BPFJIT_MEMWORDS 16
+
+/* Upper bound of machine code emitted for a single instruction. */
+#define BPFJIT_INSN_MAX 48
+
+typedef u_int (*bpfjit_func) (const u_char *pkt, u_int wirelen, u_int buflen);
+
+struct bpfjit
+{
+	struct bpf_insn *insns;
+	bpfjit_func func;
+	void *code;
+	size_t code_size;
+};
+
+extern void bpfjit_enable (int enable);
+
+extern int bpfjit_compile (struct bpfjit *jit, const struct bpf_program *prog);
+
+extern u_int bpfjit_filter (const struct bpfjit *jit, const u_char *pkt, u_int wirelen, u_int buflen);
+
+extern void bpfjit_free (struct bpfjit *jit);
+
+#endif
+
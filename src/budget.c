@@ -0,0 +1,186 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <string.h>
+#include <time.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "budget.h"
+
+/* Hook functions do not take any user data, there's only one Lua state
+ * anyway. */
+static struct budget *budget_active;
+
+static double
+budget_clock (void)
+{
+#ifdef _WIN32
+	return (double) clock () / CLOCKS_PER_SEC * 1000000.0;
+#else
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec * 1000000.0 + now.tv_nsec / 1000.0;
+#endif
+}
+
+/* Hook installed by the script itself (debug.sethook) keeps running, the
+ * budget hook calls it for the events it has asked for. */
+static void
+budget_chain (struct budget *budget, lua_State *lua_state, lua_Debug *ar)
+{
+	if ( budget->prev_hook == NULL )
+		return;
+
+	if ( ar->event != LUA_HOOKCOUNT ){
+		budget->prev_hook (lua_state, ar);
+		return;
+	}
+
+	if ( (budget->prev_mask & LUA_MASKCOUNT) == 0 )
+		return;
+
+	budget->prev_left -= budget->hook_count;
+
+	if ( budget->prev_left <= 0 ){
+		budget->prev_left += budget->prev_count;
+		budget->prev_hook (lua_state, ar);
+	}
+}
+
+static void
+budget_hook (lua_State *lua_state, lua_Debug *ar)
+{
+	struct budget *budget;
+
+	budget = budget_active;
+
+	if ( budget == NULL )
+		return;
+
+	budget_chain (budget, lua_state, ar);
+
+	if ( ar->event != LUA_HOOKCOUNT )
+		return;
+
+	/* The script caught the error (pcall) and went on, raise it again
+	 * until the call is over. */
+	if ( budget->exceeded ){
+		luaL_error (lua_state, "execution budget exceeded");
+		return;
+	}
+
+	budget->used += budget->hook_count;
+
+	if ( budget->insns > 0 && budget->used >= budget->insns )
+		budget->exceeded = 1;
+	else if ( budget->usec > 0 && (budget_clock () - budget->start) >= budget->usec )
+		budget->exceeded = 1;
+
+	if ( ! budget->exceeded )
+		return;
+
+	budget->offenders++;
+
+	if ( budget->policy == BUDGET_LOG ){
+		/* Let the function finish, report it only once. */
+		lua_sethook (lua_state, budget->prev_hook, budget->prev_mask, budget->prev_count);
+		budget_active = NULL;
+		return;
+	}
+
+	/* Check every instruction from now on. */
+	budget->hook_count = 1;
+	lua_sethook (lua_state, budget_hook, budget->prev_mask | LUA_MASKCOUNT, 1);
+
+	luaL_error (lua_state, "execution budget exceeded");
+}
+
+int
+budget_init (struct budget *budget, unsigned long insns, unsigned long usec, const char *policy)
+{
+	memset (budget, 0, sizeof (struct budget));
+
+	budget->insns = insns;
+	budget->usec = usec;
+	budget->count = BUDGET_COUNT;
+
+	/* Be precise with small budgets. */
+	if ( insns > 0 && insns < BUDGET_COUNT )
+		budget->count = insns;
+
+	if ( strcmp (policy, "abort") == 0 )
+		budget->policy = BUDGET_ABORT;
+	else if ( strcmp (policy, "skip") == 0 )
+		budget->policy = BUDGET_SKIP;
+	else if ( strcmp (policy, "log") == 0 )
+		budget->policy = BUDGET_LOG;
+	else
+		return 1;
+
+	return 0;
+}
+
+void
+budget_start (struct budget *budget, lua_State *lua_state)
+{
+	budget->used = 0;
+	budget->exceeded = 0;
+
+	if ( budget->insns == 0 && budget->usec == 0 )
+		return;
+
+	if ( budget->usec > 0 )
+		budget->start = budget_clock ();
+
+	budget->prev_hook = lua_gethook (lua_state);
+	budget->prev_mask = lua_gethookmask (lua_state);
+	budget->prev_count = lua_gethookcount (lua_state);
+	budget->prev_left = budget->prev_count;
+	budget->hook_count = budget->count;
+
+	if ( budget->prev_hook == NULL )
+		budget->prev_mask = 0;
+
+	/* Instructions are counted in steps of the smaller count. */
+	if ( (budget->prev_mask & LUA_MASKCOUNT) && budget->prev_count > 0 && budget->prev_count < budget->hook_count )
+		budget->hook_count = budget->prev_count;
+
+	budget_active = budget;
+	lua_sethook (lua_state, budget_hook, budget->prev_mask | LUA_MASKCOUNT, budget->hook_count);
+}
+
+void
+budget_stop (struct budget *budget, lua_State *lua_state)
+{
+	if ( budget->insns == 0 && budget->usec == 0 )
+		return;
+
+	/* Unless the script has replaced the hook in the meantime. */
+	if ( lua_gethook (lua_state) == budget_hook )
+		lua_sethook (lua_state, budget->prev_hook, budget->prev_mask, budget->prev_count);
+
+	budget_active = NULL;
+}
@@ -0,0 +1,63 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _BUDGET_H
+#define _BUDGET_H
+
+#include <lua.h>
+
+/* Number of instructions between two checks of the budget. */
+#define BUDGET_COUNT 4096
+
+enum
+{
+	BUDGET_ABORT = 0,
+	BUDGET_SKIP = 1,
+	BUDGET_LOG = 2
+};
+
+struct budget
+{
+	unsigned long insns;
+	unsigned long usec;
+	int policy;
+	int count;
+	unsigned long used;
+	double start;
+	int exceeded;
+	unsigned long offenders;
+	int hook_count;
+	lua_Hook prev_hook;
+	int prev_mask;
+	int prev_count;
+	int prev_left;
+};
+
+extern int budget_init (struct budget *budget, unsigned long insns, unsigned long usec, const char *policy);
+
+extern void budget_start (struct budget *budget, lua_State *lua_state);
+
+extern void budget_stop (struct budget *budget, lua_State *lua_state);
+
+#endif
+
@@ -0,0 +1,480 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "cache.h"
+#include "simd.h"
+
+/*
+ * Result cache. A partial result returned by function 'finish' for an input
+ * file is stored in a directory, one file per entry:
+ *
+ *    0  8  magic "CAPDCCH1"
+ *    8  4  script hash
+ *   12  4  content hash of the input file (or zero)
+ *   16  8  size of the input file
+ *   24  8  modification time of the input file (nanoseconds since the epoch)
+ *   32  4  flags
+ *   36  4  length of the path
+ *   40     path of the input file
+ *          partial result (serial.h)
+ *
+ * All numbers are stored in little-endian byte order. The script hash covers
+ * the script and everything else that changes what the script sees (its
+ * arguments, packet filter...). An entry is named after CRC32C of the path
+ * and CRC32C of the rest of the key, a run with a different script or a
+ * modified file simply does not find it (the key is compared in full, a
+ * collision of names is a miss).
+ */
+
+static void
+cache_set_le (uint8_t *data, uint64_t val, size_t len)
+{
+	size_t i;
+
+	for ( i = 0; i < len; i++ )
+		data[i] = (uint8_t) (val >> (i * 8));
+}
+
+/* Compute CRC32C of the contents of a file. */
+static int
+cache_crc_file (const char *path, uint32_t *crc)
+{
+	FILE *file;
+	uint8_t *buff;
+	size_t len;
+	int rval;
+
+	buff = (uint8_t*) malloc (CACHE_BLOCK);
+
+	if ( buff == NULL )
+		return ENOMEM;
+
+	file = fopen (path, "rb");
+
+	if ( file == NULL ){
+		rval = errno;
+		free (buff);
+		return rval;
+	}
+
+	while ( (len = fread (buff, 1, CACHE_BLOCK, file)) > 0 )
+		*crc = simd_crc32c (buff, len, *crc);
+
+	rval = ferror (file) ? EIO:0;
+
+	fclose (file);
+	free (buff);
+
+	return rval;
+}
+
+static void
+cache_header (const struct cache *cache, const struct cache_file *file, const char *path, uint8_t *hdr)
+{
+	memcpy (hdr, CACHE_MAGIC, 8);
+	cache_set_le (hdr + 8, cache->script_hash, 4);
+	cache_set_le (hdr + 12, file->content_hash, 4);
+	cache_set_le (hdr + 16, file->size, 8);
+	cache_set_le (hdr + 24, (uint64_t) file->mtime, 8);
+	cache_set_le (hdr + 32, cache->use_content ? CACHE_FLAG_CONTENT:0, 4);
+	cache_set_le (hdr + 36, strlen (path), 4);
+}
+
+/* Return a path of an entry, with an optional suffix. */
+static char*
+cache_entry_path (const struct cache *cache, const struct cache_file *file, const char *suffix)
+{
+	char *path;
+
+	path = (char*) malloc (strlen (cache->dir) + CACHE_NAME_LEN + strlen (suffix) + 2);
+
+	if ( path == NULL )
+		return NULL;
+
+	sprintf (path, "%s/%s%s", cache->dir, file->name, suffix);
+
+	return path;
+}
+
+/* Open an entry and check that its key matches. Return 0 if it does, ENOENT
+ * if there is no such entry, EINVAL if it belongs to a different key. */
+static int
+cache_open (const struct cache *cache, const struct cache_file *file, const char *path, FILE **entry)
+{
+	uint8_t hdr[CACHE_HDR_LEN], stored[CACHE_HDR_LEN];
+	char *entry_path, *stored_path;
+	size_t path_len;
+	int rval;
+
+	entry_path = cache_entry_path (cache, file, "");
+
+	if ( entry_path == NULL )
+		return ENOMEM;
+
+	*entry = fopen (entry_path, "rb");
+	rval = errno;
+
+	free (entry_path);
+
+	if ( *entry == NULL )
+		return rval;
+
+	cache_header (cache, file, path, hdr);
+	path_len = strlen (path);
+	rval = EINVAL;
+
+	stored_path = (char*) malloc (path_len + 1);
+
+	if ( stored_path == NULL ){
+		rval = ENOMEM;
+	} else if ( fread (stored, 1, CACHE_HDR_LEN, *entry) == CACHE_HDR_LEN && memcmp (hdr, stored, CACHE_HDR_LEN) == 0
+			&& fread (stored_path, 1, path_len, *entry) == path_len && memcmp (path, stored_path, path_len) == 0 ){
+		rval = 0;
+	}
+
+	free (stored_path);
+
+	if ( rval != 0 ){
+		fclose (*entry);
+		*entry = NULL;
+	}
+
+	return rval;
+}
+
+int
+cache_init (struct cache *cache, const char *dir, int use_content)
+{
+	memset (cache, 0, sizeof (struct cache));
+
+	cache->use_content = use_content;
+	cache->dir = strdup (dir);
+
+	if ( cache->dir == NULL )
+		return ENOMEM;
+
+#ifdef _WIN32
+	if ( _mkdir (dir) == -1 && errno != EEXIST )
+#else
+	if ( mkdir (dir, 0777) == -1 && errno != EEXIST )
+#endif
+		return errno;
+
+	return 0;
+}
+
+/* Add data to the script hash. */
+void
+cache_salt (struct cache *cache, const void *data, size_t len)
+{
+	cache->script_hash = simd_crc32c ((const uint8_t*) data, len, cache->script_hash);
+}
+
+int
+cache_salt_file (struct cache *cache, const char *path)
+{
+	return cache_crc_file (path, &(cache->script_hash));
+}
+
+/* Read the rest of an entry, the stored result. */
+static int
+cache_read (FILE *entry, struct cache_file *file)
+{
+	uint8_t *data;
+	size_t size, len;
+
+	size = 0;
+
+	for ( ;; ){
+		if ( file->len == size ){
+			size = (size > 0) ? (size * 2):CACHE_BLOCK;
+			data = (uint8_t*) realloc (file->data, size);
+
+			if ( data == NULL )
+				return ENOMEM;
+
+			file->data = data;
+		}
+
+		len = fread (file->data + file->len, 1, size - file->len, entry);
+
+		if ( len == 0 )
+			return ferror (entry) ? EIO:0;
+
+		file->len += len;
+	}
+}
+
+/* Determine identity of the input files and load results stored for them.
+ * A result that cannot be decoded is ignored, the file is read again. Files
+ * that cannot be identified (or read, if the content hash is used) are left
+ * to the reader. */
+int
+cache_lookup (struct cache *cache, const struct flist *files, lua_State *lua_state)
+{
+	struct flist_path *iter;
+	struct cache_file *file;
+	struct stat st;
+	uint8_t hdr[CACHE_HDR_LEN];
+	FILE *entry;
+	size_t i;
+	int top, rval;
+
+	for ( iter = files->head, i = 0; iter != NULL; iter = iter->next )
+		i++;
+
+	cache->file = (struct cache_file*) calloc ((i > 0) ? i:1, sizeof (struct cache_file));
+
+	if ( cache->file == NULL )
+		return ENOMEM;
+
+	cache->file_cnt = i;
+
+	if ( ! lua_checkstack (lua_state, 1) )
+		return ENOMEM;
+
+	for ( iter = files->head, i = 0; iter != NULL; iter = iter->next, i++ ){
+		file = &(cache->file[i]);
+
+		if ( strcmp (iter->path, "-") == 0 || stat (iter->path, &st) == -1 || ! S_ISREG (st.st_mode) )
+			continue;
+
+		file->size = st.st_size;
+#ifdef _WIN32
+		file->mtime = (int64_t) st.st_mtime * 1000000000;
+#else
+		/* A file rewritten within the same second has a different mtime. */
+		file->mtime = (int64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+
+		if ( cache->use_content && cache_crc_file (iter->path, &(file->content_hash)) != 0 )
+			continue;
+
+		file->usable = 1;
+
+		cache_header (cache, file, iter->path, hdr);
+		sprintf (file->name, "%08x%08x", (unsigned int) simd_crc32c ((const uint8_t*) iter->path, strlen (iter->path), 0),
+			(unsigned int) simd_crc32c (hdr + 8, CACHE_HDR_LEN - 8, 0));
+
+		if ( cache_open (cache, file, iter->path, &entry) != 0 )
+			continue;
+
+		rval = cache_read (entry, file);
+
+		fclose (entry);
+
+		if ( rval == ENOMEM )
+			return rval;
+
+		top = lua_gettop (lua_state);
+
+		if ( rval == 0 && serial_decode (lua_state, file->data, file->len) == 0 )
+			file->hit = 1;
+
+		lua_settop (lua_state, top);
+
+		if ( ! file->hit ){
+			free (file->data);
+			file->data = NULL;
+			file->len = 0;
+		}
+	}
+
+	return 0;
+}
+
+/* Push a result of a file loaded by the lookup on the stack. Return 0 on
+ * success, EINVAL if there is no such result. */
+int
+cache_get (struct cache *cache, size_t idx, lua_State *lua_state)
+{
+	struct cache_file *file;
+	int top, rval;
+
+	file = &(cache->file[idx]);
+
+	if ( ! file->hit )
+		return EINVAL;
+
+	top = lua_gettop (lua_state);
+	rval = 0;
+
+	if ( serial_decode (lua_state, file->data, file->len) != 0 ){
+		lua_settop (lua_state, top);
+		rval = EINVAL;
+	} else {
+		cache->hits++;
+	}
+
+	free (file->data);
+	file->data = NULL;
+	file->len = 0;
+
+	return rval;
+}
+
+/* Create and open a temporary file for writing, replacing 'XXXXXX' at the
+ * end of the path with a unique name. */
+static FILE*
+cache_tmp_open (char *path)
+{
+#ifndef _WIN32
+	FILE *file;
+	mode_t mask;
+	int fd, err;
+
+	fd = mkstemp (path);
+
+	if ( fd == -1 )
+		return NULL;
+
+	/* Entries get the same permissions as files created by fopen. */
+	mask = umask (0);
+	umask (mask);
+	fchmod (fd, 0666 & ~mask);
+
+	file = fdopen (fd, "wb");
+
+	if ( file == NULL ){
+		err = errno;
+		close (fd);
+		remove (path);
+		errno = err;
+	}
+
+	return file;
+#else
+	if ( _mktemp (path) == NULL )
+		return NULL;
+
+	return fopen (path, "wb");
+#endif
+}
+
+/* Store a value at index val_idx as a result of a file. Results of files
+ * without an identity are not stored. Return 0 on success, EINVAL if the
+ * value cannot be serialized, ELOOP if tables are nested too deep, or an
+ * errno value. */
+int
+cache_put (struct cache *cache, size_t idx, const char *path, lua_State *lua_state, int val_idx)
+{
+	struct cache_file *file;
+	struct serial_buff buff;
+	uint8_t hdr[CACHE_HDR_LEN];
+	char *entry_path, *tmp_path;
+	FILE *out;
+	int rval;
+
+	file = &(cache->file[idx]);
+
+	memset (&buff, 0, sizeof (struct serial_buff));
+
+	rval = serial_encode (&buff, lua_state, val_idx);
+
+	if ( rval != 0 || ! file->usable ){
+		serial_free (&buff);
+		return rval;
+	}
+
+	entry_path = cache_entry_path (cache, file, "");
+	tmp_path = cache_entry_path (cache, file, ".XXXXXX");
+
+	if ( entry_path == NULL || tmp_path == NULL ){
+		rval = ENOMEM;
+		goto cleanup;
+	}
+
+	/* Written under a temporary name of its own, a concurrent run never reads
+	 * a partial entry, nor writes to the same file. */
+	out = cache_tmp_open (tmp_path);
+
+	if ( out == NULL ){
+		rval = errno;
+		goto cleanup;
+	}
+
+	cache_header (cache, file, path, hdr);
+
+	if ( fwrite (hdr, 1, CACHE_HDR_LEN, out) != CACHE_HDR_LEN || fwrite (path, 1, strlen (path), out) != strlen (path)
+			|| fwrite (buff.data, 1, buff.len, out) != buff.len )
+		rval = EIO;
+
+	if ( fclose (out) != 0 && rval == 0 )
+		rval = errno;
+
+	if ( rval != 0 ){
+		remove (tmp_path);
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	remove (entry_path);
+#endif
+
+	if ( rename (tmp_path, entry_path) != 0 ){
+		rval = errno;
+		remove (tmp_path);
+		goto cleanup;
+	}
+
+	cache->stored++;
+
+cleanup:
+	free (entry_path);
+	free (tmp_path);
+	serial_free (&buff);
+
+	return rval;
+}
+
+void
+cache_free (struct cache *cache)
+{
+	size_t i;
+
+	for ( i = 0; i < cache->file_cnt; i++ )
+		free (cache->file[i].data);
+
+	free (cache->dir);
+	free (cache->file);
+
+	memset (cache, 0, sizeof (struct cache));
+}
@@ -0,0 +1,92 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "flist.h"
+#include "serial.h"
+
+#define CACHE_MAGIC "CAPDCCH1"
+
+/* Fixed part of an entry, followed by the path of the file. */
+#define CACHE_HDR_LEN 40
+
+/* Two hexadecimal CRC32C values */
+#define CACHE_NAME_LEN 16
+
+/* Block size used to compute a content hash of a file. */
+#define CACHE_BLOCK (1024 * 1024)
+
+/* Content hash of a file is part of the key */
+#define CACHE_FLAG_CONTENT 0x01
+
+/*
+ * Identity of an input file. A file that is not a regular file (standard
+ * input, a pipe) has no identity and its result is never stored. A stored
+ * result is loaded by the lookup, so that the set of files to be read cannot
+ * change afterwards.
+ */
+struct cache_file
+{
+	uint64_t size;
+	int64_t mtime;
+	uint32_t content_hash;
+	int usable;
+	int hit;
+	uint8_t *data;
+	size_t len;
+	char name[CACHE_NAME_LEN + 1];
+};
+
+struct cache
+{
+	char *dir;
+	int use_content;
+	uint32_t script_hash;
+	struct cache_file *file;
+	size_t file_cnt;
+	unsigned long hits;
+	unsigned long stored;
+};
+
+extern int cache_init (struct cache *cache, const char *dir, int use_content);
+
+extern void cache_salt (struct cache *cache, const void *data, size_t len);
+
+extern int cache_salt_file (struct cache *cache, const char *path);
+
+extern int cache_lookup (struct cache *cache, const struct flist *files, lua_State *lua_state);
+
+extern int cache_get (struct cache *cache, size_t idx, lua_State *lua_state);
+
+extern int cache_put (struct cache *cache, size_t idx, const char *path, lua_State *lua_state, int val_idx);
+
+extern void cache_free (struct cache *cache);
+
+#endif
+
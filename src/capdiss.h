@@ -28,5 +28,31 @@
 #define CAPDISS_VERSION_MINOR 3
 #define CAPDISS_VERSION_PATCH 1
 
+/* Values of long options without a short equivalent. */
+enum
+{
+	CAPDISS_OPT_REASM_MEMCAP = 256,
+	CAPDISS_OPT_REASM_FLOWCAP,
+	CAPDISS_OPT_REASM_TIMEOUT,
+	CAPDISS_OPT_DEDUP_WINDOW,
+	CAPDISS_OPT_DEDUP_TIME,
+	CAPDISS_OPT_DEDUP_IGNORE,
+	CAPDISS_OPT_BUDGET_INSNS,
+	CAPDISS_OPT_BUDGET_TIME,
+	CAPDISS_OPT_BUDGET_POLICY,
+	CAPDISS_OPT_EMIT_OUTPUT,
+	CAPDISS_OPT_EMIT_FORMAT,
+	CAPDISS_OPT_IO_DEPTH,
+	CAPDISS_OPT_IO_BLOCK,
+	CAPDISS_OPT_PROGRESS,
+	CAPDISS_OPT_STATS_FILE,
+	CAPDISS_OPT_FILES_FROM,
+	CAPDISS_OPT_PREFETCH,
+	CAPDISS_OPT_NO_JIT,
+	CAPDISS_OPT_DECAP,
+	CAPDISS_OPT_CACHE,
+	CAPDISS_OPT_CACHE_HASH
+};
+
 #endif
 
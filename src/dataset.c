@@ -0,0 +1,767 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "dataset.h"
+
+/*
+ * Immutable key/value datasets, compiled from text by capdiss-dataset and
+ * mapped read-only, so that all processes using the same dataset share its
+ * pages. Nothing is parsed when a dataset is opened, bounds of entries are
+ * checked when they are accessed.
+ */
+
+#define DATASET_MT "capdiss.dataset"
+
+#define DATASET_HASH_M 0xc6a4a7935bd1e995ULL
+
+struct dataset_item
+{
+	char *key;
+	size_t key_len;
+	char *val;
+	size_t val_len;
+	int type;
+	double num;
+	unsigned long lineno;
+	uint64_t hash;
+};
+
+uint64_t
+dataset_hash (const char *key, size_t len)
+{
+	uint64_t hash, k;
+	size_t i;
+
+	hash = 0x9e3779b97f4a7c15ULL ^ (len * DATASET_HASH_M);
+
+	for ( i = 0; i + 8 <= len; i += 8 ){
+		memcpy (&k, key + i, 8);
+		k *= DATASET_HASH_M;
+		k ^= k >> 47;
+		k *= DATASET_HASH_M;
+		hash ^= k;
+		hash *= DATASET_HASH_M;
+	}
+
+	if ( i < len ){
+		k = 0;
+		memcpy (&k, key + i, len - i);
+		hash ^= k;
+		hash *= DATASET_HASH_M;
+	}
+
+	hash ^= hash >> 47;
+	hash *= DATASET_HASH_M;
+	hash ^= hash >> 47;
+
+	return hash;
+}
+
+static int
+dataset_check (struct dataset *ds)
+{
+	const struct dataset_hdr *hdr;
+	uint64_t size;
+
+	size = ds->size;
+
+	if ( size < DATASET_HDR_LEN )
+		return EINVAL;
+
+	hdr = (const struct dataset_hdr*) ds->map;
+
+	if ( memcmp (hdr->magic, DATASET_MAGIC, 8) != 0 || hdr->version != DATASET_VERSION || hdr->byte_order != DATASET_BYTE_ORDER )
+		return EINVAL;
+
+	if ( hdr->slot_cnt == 0 || (hdr->slot_cnt & (hdr->slot_cnt - 1)) != 0 || hdr->cnt >= hdr->slot_cnt || hdr->cnt >= UINT32_MAX )
+		return EINVAL;
+
+	if ( hdr->slot_off > size || hdr->slot_cnt > (size - hdr->slot_off) / sizeof (uint32_t) || (hdr->slot_off % sizeof (uint32_t)) != 0 )
+		return EINVAL;
+
+	if ( hdr->entry_off > size || hdr->cnt > (size - hdr->entry_off) / sizeof (struct dataset_entry) || (hdr->entry_off % 8) != 0 )
+		return EINVAL;
+
+	if ( hdr->pool_off > size || hdr->pool_size > size - hdr->pool_off )
+		return EINVAL;
+
+	ds->hdr = hdr;
+	ds->slot = (const uint32_t*) (ds->map + hdr->slot_off);
+	ds->entry = (const struct dataset_entry*) (ds->map + hdr->entry_off);
+	ds->pool = (const char*) (ds->map + hdr->pool_off);
+
+	return 0;
+}
+
+/* Return 0 on success, otherwise an error number (EINVAL if the file is not
+ * a valid dataset). */
+int
+dataset_open (struct dataset *ds, const char *path)
+{
+#ifndef _WIN32
+	struct stat st;
+	void *map;
+	int fd, rval;
+
+	memset (ds, 0, sizeof (struct dataset));
+
+	fd = open (path, O_RDONLY);
+
+	if ( fd == -1 )
+		return errno;
+
+	if ( fstat (fd, &st) == -1 ){
+		rval = errno;
+		close (fd);
+		return rval;
+	}
+
+	if ( st.st_size < DATASET_HDR_LEN ){
+		close (fd);
+		return EINVAL;
+	}
+
+	map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	rval = errno;
+	close (fd);
+
+	if ( map == MAP_FAILED )
+		return rval;
+
+	ds->map = (const uint8_t*) map;
+	ds->size = st.st_size;
+	ds->mapped = 1;
+#else
+	/* Without mmap the dataset is read into memory of the process. */
+	FILE *file;
+	uint8_t *buff;
+	long size;
+	int rval;
+
+	memset (ds, 0, sizeof (struct dataset));
+
+	file = fopen (path, "rb");
+
+	if ( file == NULL )
+		return errno;
+
+	if ( fseek (file, 0, SEEK_END) != 0 || (size = ftell (file)) == -1 || fseek (file, 0, SEEK_SET) != 0 ){
+		rval = errno;
+		fclose (file);
+		return rval;
+	}
+
+	if ( size < DATASET_HDR_LEN ){
+		fclose (file);
+		return EINVAL;
+	}
+
+	buff = (uint8_t*) malloc (size);
+
+	if ( buff == NULL ){
+		fclose (file);
+		return ENOMEM;
+	}
+
+	if ( fread (buff, 1, size, file) != (size_t) size ){
+		free (buff);
+		fclose (file);
+		return EIO;
+	}
+
+	fclose (file);
+
+	ds->map = buff;
+	ds->size = size;
+#endif
+
+	rval = dataset_check (ds);
+
+	if ( rval != 0 )
+		dataset_close (ds);
+
+	return rval;
+}
+
+static int
+dataset_inpool (const struct dataset *ds, uint64_t off, uint64_t len)
+{
+	return off <= ds->hdr->pool_size && len <= ds->hdr->pool_size - off;
+}
+
+const struct dataset_entry*
+dataset_find (const struct dataset *ds, const char *key, size_t len)
+{
+	const struct dataset_entry *entry;
+	uint64_t hash, mask, idx, i;
+	uint32_t val;
+
+	hash = dataset_hash (key, len);
+	mask = ds->hdr->slot_cnt - 1;
+
+	for ( i = 0, idx = hash & mask; i < ds->hdr->slot_cnt; i++, idx = (idx + 1) & mask ){
+		val = ds->slot[idx];
+
+		if ( val == 0 || val > ds->hdr->cnt )
+			return NULL;
+
+		entry = &(ds->entry[val - 1]);
+
+		if ( entry->hash == hash && entry->key_len == len && dataset_inpool (ds, entry->key_off, entry->key_len)
+				&& memcmp (ds->pool + entry->key_off, key, len) == 0 )
+			return entry;
+	}
+
+	return NULL;
+}
+
+double
+dataset_number (const struct dataset_entry *entry)
+{
+	double num;
+
+	memcpy (&num, &(entry->val_off), sizeof (double));
+
+	return num;
+}
+
+/* Return NULL if the string is out of bounds of the dataset. */
+const char*
+dataset_string (const struct dataset *ds, const struct dataset_entry *entry, size_t *len)
+{
+	if ( ! dataset_inpool (ds, entry->val_off, entry->val_len) )
+		return NULL;
+
+	*len = entry->val_len;
+
+	return ds->pool + entry->val_off;
+}
+
+void
+dataset_close (struct dataset *ds)
+{
+	if ( ds->map != NULL ){
+#ifndef _WIN32
+		if ( ds->mapped )
+			munmap ((void*) ds->map, ds->size);
+#else
+		free ((void*) ds->map);
+#endif
+	}
+
+	memset (ds, 0, sizeof (struct dataset));
+}
+
+static int
+dataset_item_cmp (const void *a, const void *b)
+{
+	const struct dataset_item *ia, *ib;
+	int rval;
+
+	ia = (const struct dataset_item*) a;
+	ib = (const struct dataset_item*) b;
+
+	rval = memcmp (ia->key, ib->key, (ia->key_len < ib->key_len) ? ia->key_len:ib->key_len);
+
+	if ( rval != 0 )
+		return rval;
+
+	if ( ia->key_len != ib->key_len )
+		return (ia->key_len < ib->key_len) ? -1:1;
+
+	return (ia->lineno < ib->lineno) ? -1:(ia->lineno > ib->lineno);
+}
+
+/* Parse a line 'key<delim>value', a line without the delimiter has no value. */
+static void
+dataset_parse_line (struct dataset_item *item, char *line, size_t len, char delim, int strings)
+{
+	char *sep, *end;
+
+	item->key = line;
+	sep = (char*) memchr (line, delim, len);
+
+	if ( sep == NULL ){
+		item->key_len = len;
+		item->val = line + len;
+		item->val_len = 0;
+		item->type = DATASET_TRUE;
+		return;
+	}
+
+	item->key_len = sep - line;
+	item->val = sep + 1;
+	item->val_len = len - item->key_len - 1;
+	item->type = DATASET_STRING;
+
+	if ( strings || item->val_len == 0 )
+		return;
+
+	if ( (item->val[0] >= '0' && item->val[0] <= '9') || item->val[0] == '-' || item->val[0] == '+' || item->val[0] == '.' ){
+		errno = 0;
+		item->num = strtod (item->val, &end);
+
+		if ( errno == 0 && end == item->val + item->val_len )
+			item->type = DATASET_NUMBER;
+	}
+}
+
+static int
+dataset_write (FILE *file, struct dataset_item *item, size_t cnt)
+{
+	struct dataset_hdr hdr;
+	struct dataset_entry entry;
+	uint32_t *slot;
+	uint64_t mask, idx, off;
+	size_t i;
+	int rval;
+
+	memset (&hdr, 0, sizeof (struct dataset_hdr));
+	memcpy (hdr.magic, DATASET_MAGIC, 8);
+	hdr.version = DATASET_VERSION;
+	hdr.byte_order = DATASET_BYTE_ORDER;
+	hdr.cnt = cnt;
+
+	/* Load factor of the hash table is kept below 0.5 */
+	for ( hdr.slot_cnt = 8; hdr.slot_cnt < cnt * 2; hdr.slot_cnt *= 2 )
+		;
+
+	hdr.slot_off = DATASET_HDR_LEN;
+	hdr.entry_off = (hdr.slot_off + hdr.slot_cnt * sizeof (uint32_t) + 7) & ~((uint64_t) 7);
+	hdr.pool_off = hdr.entry_off + cnt * sizeof (struct dataset_entry);
+
+	for ( i = 0; i < cnt; i++ )
+		hdr.pool_size += item[i].key_len + ((item[i].type == DATASET_STRING) ? item[i].val_len:0);
+
+	slot = (uint32_t*) calloc (hdr.slot_cnt, sizeof (uint32_t));
+
+	if ( slot == NULL )
+		return ENOMEM;
+
+	mask = hdr.slot_cnt - 1;
+
+	for ( i = 0; i < cnt; i++ ){
+		item[i].hash = dataset_hash (item[i].key, item[i].key_len);
+
+		for ( idx = item[i].hash & mask; slot[idx] != 0; idx = (idx + 1) & mask )
+			;
+
+		slot[idx] = i + 1;
+	}
+
+	rval = EIO;
+
+	if ( fwrite (&hdr, sizeof (struct dataset_hdr), 1, file) != 1 )
+		goto done;
+
+	if ( fseek (file, hdr.slot_off, SEEK_SET) != 0 || fwrite (slot, sizeof (uint32_t), hdr.slot_cnt, file) != hdr.slot_cnt )
+		goto done;
+
+	if ( fseek (file, hdr.entry_off, SEEK_SET) != 0 )
+		goto done;
+
+	for ( i = 0, off = 0; i < cnt; i++ ){
+		memset (&entry, 0, sizeof (struct dataset_entry));
+
+		entry.hash = item[i].hash;
+		entry.key_off = off;
+		entry.key_len = item[i].key_len;
+		entry.type = item[i].type;
+		off += item[i].key_len;
+
+		if ( item[i].type == DATASET_NUMBER ){
+			memcpy (&(entry.val_off), &(item[i].num), sizeof (double));
+		} else if ( item[i].type == DATASET_STRING ){
+			entry.val_off = off;
+			entry.val_len = item[i].val_len;
+			off += item[i].val_len;
+		}
+
+		if ( fwrite (&entry, sizeof (struct dataset_entry), 1, file) != 1 )
+			goto done;
+	}
+
+	for ( i = 0; i < cnt; i++ ){
+		if ( fwrite (item[i].key, 1, item[i].key_len, file) != item[i].key_len )
+			goto done;
+
+		if ( item[i].type == DATASET_STRING && fwrite (item[i].val, 1, item[i].val_len, file) != item[i].val_len )
+			goto done;
+	}
+
+	rval = 0;
+
+done:
+	free (slot);
+
+	return rval;
+}
+
+/*
+ * Compile a text file into a dataset, one entry per line: key, delimiter and
+ * value. Empty lines and lines starting with '#' are ignored, the last of
+ * duplicate keys wins. Values are stored as numbers if they look like one,
+ * unless 'strings' is set. Return 0 on success, otherwise an error number,
+ * 'lineno' is set to the offending line of the source file (if any).
+ */
+int
+dataset_build (const char *src, const char *dst, char delim, int strings, unsigned long *lineno)
+{
+	struct dataset_item *item, *tmp;
+	size_t item_cnt, item_size, len, i, j;
+	char *line, *tmp_path;
+	FILE *in, *out;
+	int rval;
+
+	*lineno = 0;
+	item = NULL;
+	item_cnt = 0;
+	item_size = 0;
+	out = NULL;
+	tmp_path = NULL;
+
+	line = (char*) malloc (DATASET_LINE_MAX);
+
+	if ( line == NULL )
+		return ENOMEM;
+
+	in = fopen (src, "rb");
+
+	if ( in == NULL ){
+		rval = errno;
+		free (line);
+		return rval;
+	}
+
+	while ( fgets (line, DATASET_LINE_MAX, in) != NULL ){
+		(*lineno)++;
+		len = strlen (line);
+
+		if ( len == DATASET_LINE_MAX - 1 && line[len - 1] != '\n' && getc (in) != EOF ){
+			rval = EINVAL;
+			goto cleanup;
+		}
+
+		while ( len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r') )
+			len--;
+
+		if ( len == 0 || line[0] == '#' )
+			continue;
+
+		if ( item_cnt == item_size ){
+			item_size = (item_size == 0) ? 1024:item_size * 2;
+			tmp = (struct dataset_item*) realloc (item, item_size * sizeof (struct dataset_item));
+
+			if ( tmp == NULL ){
+				rval = ENOMEM;
+				goto cleanup;
+			}
+
+			item = tmp;
+		}
+
+		memset (&(item[item_cnt]), 0, sizeof (struct dataset_item));
+
+		item[item_cnt].key = (char*) malloc (len + 1);
+
+		if ( item[item_cnt].key == NULL ){
+			rval = ENOMEM;
+			goto cleanup;
+		}
+
+		memcpy (item[item_cnt].key, line, len);
+		item[item_cnt].key[len] = '\0';
+		item[item_cnt].lineno = *lineno;
+
+		dataset_parse_line (&(item[item_cnt]), item[item_cnt].key, len, delim, strings);
+		item_cnt++;
+	}
+
+	if ( ferror (in) ){
+		rval = EIO;
+		goto cleanup;
+	}
+
+	*lineno = 0;
+
+	if ( item_cnt >= UINT32_MAX / 2 ){
+		rval = EFBIG;
+		goto cleanup;
+	}
+
+	if ( item_cnt > 0 )
+		qsort (item, item_cnt, sizeof (struct dataset_item), dataset_item_cmp);
+
+	/* Keep the last line of each key */
+	for ( i = 0, j = 0; i < item_cnt; i++ ){
+		if ( i + 1 < item_cnt && item[i].key_len == item[i + 1].key_len && memcmp (item[i].key, item[i + 1].key, item[i].key_len) == 0 ){
+			free (item[i].key);
+			continue;
+		}
+
+		item[j++] = item[i];
+	}
+
+	item_cnt = j;
+
+	/* Written under a temporary name, processes using the previous version
+	 * keep their mapping. */
+	tmp_path = (char*) malloc (strlen (dst) + sizeof (".tmp"));
+
+	if ( tmp_path == NULL ){
+		rval = ENOMEM;
+		goto cleanup;
+	}
+
+	sprintf (tmp_path, "%s.tmp", dst);
+
+	out = fopen (tmp_path, "wb");
+
+	if ( out == NULL ){
+		rval = errno;
+		goto cleanup;
+	}
+
+	rval = dataset_write (out, item, item_cnt);
+
+	if ( fclose (out) != 0 && rval == 0 )
+		rval = errno;
+
+	out = NULL;
+
+	if ( rval != 0 ){
+		remove (tmp_path);
+		goto cleanup;
+	}
+
+#ifdef _WIN32
+	remove (dst);
+#endif
+
+	if ( rename (tmp_path, dst) != 0 ){
+		rval = errno;
+		remove (tmp_path);
+	}
+
+cleanup:
+	for ( i = 0; i < item_cnt; i++ )
+		free (item[i].key);
+
+	free (item);
+	free (line);
+	free (tmp_path);
+	fclose (in);
+
+	return rval;
+}
+
+static struct dataset*
+dataset_lua_check (lua_State *lua_state, int arg)
+{
+	return (struct dataset*) luaL_checkudata (lua_state, arg, DATASET_MT);
+}
+
+static void
+dataset_lua_push (lua_State *lua_state, const struct dataset *ds, const struct dataset_entry *entry)
+{
+	const char *str;
+	double num;
+	size_t len;
+
+	switch ( entry->type ){
+		case DATASET_NUMBER:
+			num = dataset_number (entry);
+
+			/* Integers stay integers with Lua 5.3 */
+			if ( num == floor (num) && fabs (num) <= 9007199254740992.0 )
+				lua_pushinteger (lua_state, (lua_Integer) num);
+			else
+				lua_pushnumber (lua_state, num);
+			break;
+
+		case DATASET_STRING:
+			str = dataset_string (ds, entry, &len);
+
+			if ( str == NULL ){
+				luaL_error (lua_state, "cannot read dataset: entry out of bounds");
+				return;
+			}
+
+			lua_pushlstring (lua_state, str, len);
+			break;
+
+		default:
+			lua_pushboolean (lua_state, 1);
+			break;
+	}
+}
+
+/* dataset:get (key), returns the value (true for keys without a value) or
+ * nil */
+static int
+dataset_lua_get (lua_State *lua_state)
+{
+	const struct dataset_entry *entry;
+	struct dataset *ds;
+	const char *key;
+	size_t len;
+
+	ds = dataset_lua_check (lua_state, 1);
+	key = luaL_checklstring (lua_state, 2, &len);
+
+	entry = dataset_find (ds, key, len);
+
+	if ( entry == NULL ){
+		lua_pushnil (lua_state);
+		return 1;
+	}
+
+	dataset_lua_push (lua_state, ds, entry);
+
+	return 1;
+}
+
+static int
+dataset_lua_iter (lua_State *lua_state)
+{
+	const struct dataset_entry *entry;
+	struct dataset *ds;
+	lua_Integer idx;
+
+	ds = dataset_lua_check (lua_state, lua_upvalueindex (1));
+	idx = lua_tointeger (lua_state, lua_upvalueindex (2));
+
+	if ( idx < 0 || (uint64_t) idx >= ds->hdr->cnt )
+		return 0;
+
+	entry = &(ds->entry[idx]);
+
+	if ( ! dataset_inpool (ds, entry->key_off, entry->key_len) )
+		return luaL_error (lua_state, "cannot read dataset: entry out of bounds");
+
+	lua_pushinteger (lua_state, idx + 1);
+	lua_replace (lua_state, lua_upvalueindex (2));
+
+	lua_pushlstring (lua_state, ds->pool + entry->key_off, entry->key_len);
+	dataset_lua_push (lua_state, ds, entry);
+
+	return 2;
+}
+
+/* dataset:pairs (), iterates over keys in byte order */
+static int
+dataset_lua_pairs (lua_State *lua_state)
+{
+	dataset_lua_check (lua_state, 1);
+
+	lua_pushvalue (lua_state, 1);
+	lua_pushinteger (lua_state, 0);
+	lua_pushcclosure (lua_state, dataset_lua_iter, 2);
+
+	return 1;
+}
+
+static int
+dataset_lua_len (lua_State *lua_state)
+{
+	struct dataset *ds;
+
+	ds = dataset_lua_check (lua_state, 1);
+
+	lua_pushinteger (lua_state, ds->hdr->cnt);
+
+	return 1;
+}
+
+static int
+dataset_lua_gc (lua_State *lua_state)
+{
+	struct dataset *ds;
+
+	ds = dataset_lua_check (lua_state, 1);
+
+	dataset_close (ds);
+
+	return 0;
+}
+
+static const luaL_Reg dataset_methods[] = {
+	{ "get", dataset_lua_get },
+	{ "pairs", dataset_lua_pairs },
+	{ NULL, NULL }
+};
+
+/* capdiss.dataset (path) */
+static int
+dataset_lua_new (lua_State *lua_state)
+{
+	struct dataset *ds;
+	const char *path;
+	int rval;
+
+	path = luaL_checkstring (lua_state, 1);
+
+	if ( luaL_newmetatable (lua_state, DATASET_MT) ){
+		lua_newtable (lua_state);
+		luaL_setfuncs (lua_state, dataset_methods, 0);
+		lua_setfield (lua_state, -2, "__index");
+		lua_pushcfunction (lua_state, dataset_lua_len);
+		lua_setfield (lua_state, -2, "__len");
+		lua_pushcfunction (lua_state, dataset_lua_gc);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	ds = (struct dataset*) lua_newuserdata (lua_state, sizeof (struct dataset));
+	rval = dataset_open (ds, path);
+
+	if ( rval == EINVAL )
+		return luaL_error (lua_state, "cannot open dataset '%s': not a dataset", path);
+	else if ( rval != 0 )
+		return luaL_error (lua_state, "cannot open dataset '%s': %s", path, strerror (rval));
+
+	luaL_setmetatable (lua_state, DATASET_MT);
+
+	return 1;
+}
+
+const luaL_Reg dataset_api[] = {
+	{ "dataset", dataset_lua_new },
+	{ NULL, NULL }
+};
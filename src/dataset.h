@@ -0,0 +1,108 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _DATASET_H
+#define _DATASET_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#define DATASET_MAGIC "CAPDSET1"
+#define DATASET_VERSION 1
+
+/* Written in host byte order, a file built on a machine of the other byte
+ * order is rejected. */
+#define DATASET_BYTE_ORDER 0x01020304U
+
+#define DATASET_HDR_LEN 64
+
+/* Longest line of a source file. */
+#define DATASET_LINE_MAX 65536
+
+enum
+{
+	DATASET_TRUE = 0,
+	DATASET_NUMBER,
+	DATASET_STRING
+};
+
+/*
+ * File layout: header, hash table (indexes of entries increased by one, zero
+ * marks an empty slot, linear probing), entries sorted by key and a pool of
+ * keys and string values. Offsets in entries are relative to the pool.
+ */
+struct dataset_hdr
+{
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint64_t cnt;
+	uint64_t slot_cnt;
+	uint64_t slot_off;
+	uint64_t entry_off;
+	uint64_t pool_off;
+	uint64_t pool_size;
+};
+
+struct dataset_entry
+{
+	uint64_t hash;
+	uint64_t key_off;
+	uint64_t val_off;
+	uint32_t key_len;
+	uint32_t val_len;
+	uint32_t type;
+	uint32_t reserved;
+};
+
+struct dataset
+{
+	const uint8_t *map;
+	size_t size;
+	int mapped;
+	const struct dataset_hdr *hdr;
+	const uint32_t *slot;
+	const struct dataset_entry *entry;
+	const char *pool;
+};
+
+extern const luaL_Reg dataset_api[];
+
+extern uint64_t dataset_hash (const char *key, size_t len);
+
+extern int dataset_open (struct dataset *ds, const char *path);
+
+extern const struct dataset_entry *dataset_find (const struct dataset *ds, const char *key, size_t len);
+
+extern double dataset_number (const struct dataset_entry *entry);
+
+extern const char *dataset_string (const struct dataset *ds, const struct dataset_entry *entry, size_t *len);
+
+extern void dataset_close (struct dataset *ds);
+
+extern int dataset_build (const char *src, const char *dst, char delim, int strings, unsigned long *lineno);
+
+#endif
+
@@ -0,0 +1,421 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pcap.h>
+
+#include "decap.h"
+#include "netframe.h"
+
+/*
+ * Encapsulations are stripped from the outside in, until a layer that is not
+ * one of the configured encapsulations is found. The result is the innermost
+ * frame that can be passed without copying: an Ethernet frame if it carries
+ * no VLAN tags, otherwise the network layer datagram it carries. A header of
+ * a configured encapsulation that is truncated or not understood fails the
+ * whole frame, which is then passed unchanged.
+ */
+
+#define DECAP_ETHERTYPE_MPLS 0x8847
+#define DECAP_ETHERTYPE_MPLS_MC 0x8848
+#define DECAP_ETHERTYPE_TEB 0x6558
+
+#define DECAP_IPPROTO_UDP 17
+#define DECAP_IPPROTO_GRE 47
+
+enum
+{
+	DECAP_STATE_ETH = 0,
+	DECAP_STATE_IP,
+	DECAP_STATE_MPLS,
+	DECAP_STATE_GRE,
+	DECAP_STATE_VXLAN,
+	DECAP_STATE_GTP
+};
+
+/* Comma separated list of 'vlan', 'mpls', 'gre', 'vxlan', 'gtp' or 'all'. */
+int
+decap_init (struct decap *decap, const char *list)
+{
+	char *copy, *item;
+
+	memset (decap, 0, sizeof (struct decap));
+
+	copy = strdup (list);
+
+	if ( copy == NULL ){
+		snprintf (decap->errbuff, sizeof (decap->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	for ( item = strtok (copy, ","); item != NULL; item = strtok (NULL, ",") ){
+
+		if ( strcmp (item, "vlan") == 0 ){
+			decap->mask |= DECAP_VLAN;
+		} else if ( strcmp (item, "mpls") == 0 ){
+			decap->mask |= DECAP_MPLS;
+		} else if ( strcmp (item, "gre") == 0 ){
+			decap->mask |= DECAP_GRE;
+		} else if ( strcmp (item, "vxlan") == 0 ){
+			decap->mask |= DECAP_VXLAN;
+		} else if ( strcmp (item, "gtp") == 0 ){
+			decap->mask |= DECAP_GTP;
+		} else if ( strcmp (item, "all") == 0 ){
+			decap->mask |= DECAP_ALL;
+		} else {
+			snprintf (decap->errbuff, sizeof (decap->errbuff), "invalid encapsulation '%s'", item);
+			free (copy);
+			return 1;
+		}
+	}
+
+	free (copy);
+
+	if ( decap->mask == 0 ){
+		snprintf (decap->errbuff, sizeof (decap->errbuff), "no encapsulation given");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+decap_id (struct decap_result *res, uint32_t id)
+{
+	if ( res->id_cnt == DECAP_IDS_MAX )
+		return 1;
+
+	res->id[res->id_cnt++] = id;
+
+	return 0;
+}
+
+static int
+decap_ethertype_ip (uint16_t type)
+{
+	return type == NETFRAME_ETHERTYPE_IPV4 || type == NETFRAME_ETHERTYPE_IPV6;
+}
+
+/* Strip encapsulations of a frame. Return 0 on success ('res' describes the
+ * inner frame, which is the whole frame if there was nothing to strip), 1 if
+ * the frame failed to decapsulate ('res' describes the whole frame). */
+int
+decap_frame (struct decap *decap, int linktype, const uint8_t *data, size_t len, struct decap_result *res)
+{
+	size_t off, next, elen;
+	uint32_t label, key;
+	uint16_t type, flags;
+	uint8_t proto, ext;
+	int state, tagged, keep_eth, stripped;
+
+	decap->frames++;
+
+	res->offset = 0;
+	res->linktype = linktype;
+	res->id_cnt = 0;
+
+	if ( linktype == DLT_EN10MB ){
+		state = DECAP_STATE_ETH;
+		off = 0;
+	} else if ( netframe_l3 (linktype, data, len, &off, &type) == 0 ){
+		state = DECAP_STATE_IP;
+	} else {
+		return 0;
+	}
+
+	keep_eth = 1;
+	stripped = 0;
+
+	for ( ;; ){
+		switch ( state ){
+			case DECAP_STATE_ETH:
+				if ( len < off + 14 )
+					goto stop;
+
+				type = netframe_get16 (data + off + 12);
+				next = off + 14;
+				tagged = 0;
+
+				while ( (decap->mask & DECAP_VLAN) && (type == 0x8100 || type == 0x88a8 || type == 0x9100) ){
+					if ( len < next + 4 || decap_id (res, netframe_get16 (data + next) & 0x0fff) != 0 )
+						goto fail;
+
+					type = netframe_get16 (data + next + 2);
+					next += 4;
+					tagged = 1;
+					stripped++;
+				}
+
+				/* Tags cannot be removed from the frame without copying it,
+				 * a tagged frame is replaced by the datagram it carries. */
+				if ( ! tagged || ! decap_ethertype_ip (type) ){
+					res->offset = off;
+					res->linktype = DLT_EN10MB;
+				}
+
+				/* An untagged frame stays the result, unless the datagram
+				 * it carries is decapsulated further. */
+				keep_eth = ! tagged;
+				off = next;
+
+				if ( decap_ethertype_ip (type) )
+					state = DECAP_STATE_IP;
+				else if ( (decap->mask & DECAP_MPLS) && (type == DECAP_ETHERTYPE_MPLS || type == DECAP_ETHERTYPE_MPLS_MC) )
+					state = DECAP_STATE_MPLS;
+				else
+					goto stop;
+				break;
+
+			case DECAP_STATE_IP:
+				if ( ! keep_eth ){
+					res->offset = off;
+					res->linktype = DLT_RAW;
+				}
+
+				keep_eth = 0;
+
+				if ( len < off + 1 )
+					goto stop;
+
+				switch ( data[off] >> 4 ){
+					case 4:
+						if ( len < off + 20 || (data[off] & 0x0f) < 5 )
+							goto stop;
+
+						/* Fragments are not decapsulated */
+						if ( (netframe_get16 (data + off + 6) & 0x3fff) != 0 )
+							goto stop;
+
+						proto = data[off + 9];
+						next = off + (data[off] & 0x0f) * 4;
+						break;
+
+					case 6:
+						if ( len < off + 40 )
+							goto stop;
+
+						proto = data[off + 6];
+						next = off + 40;
+						break;
+
+					default:
+						goto stop;
+				}
+
+				if ( proto == DECAP_IPPROTO_GRE && (decap->mask & DECAP_GRE) ){
+					off = next;
+					state = DECAP_STATE_GRE;
+					break;
+				}
+
+				if ( proto != DECAP_IPPROTO_UDP || len < next + 8 )
+					goto stop;
+
+				if ( (decap->mask & DECAP_VXLAN) && netframe_get16 (data + next + 2) == DECAP_VXLAN_PORT )
+					state = DECAP_STATE_VXLAN;
+				else if ( (decap->mask & DECAP_GTP) && netframe_get16 (data + next + 2) == DECAP_GTPU_PORT )
+					state = DECAP_STATE_GTP;
+				else
+					goto stop;
+
+				off = next + 8;
+				break;
+
+			case DECAP_STATE_MPLS:
+				keep_eth = 0;
+
+				do {
+					if ( len < off + 4 )
+						goto fail;
+
+					label = netframe_get32 (data + off);
+
+					if ( decap_id (res, label >> 12) != 0 )
+						goto fail;
+
+					off += 4;
+					stripped++;
+				} while ( (label & 0x100) == 0 );
+
+				if ( len < off + 1 )
+					goto fail;
+
+				switch ( data[off] >> 4 ){
+					case 4:
+					case 6:
+						state = DECAP_STATE_IP;
+						break;
+
+					/* Pseudowire control word, followed by an Ethernet frame */
+					case 0:
+						off += 4;
+						state = DECAP_STATE_ETH;
+						break;
+
+					default:
+						goto fail;
+				}
+				break;
+
+			case DECAP_STATE_GRE:
+				keep_eth = 0;
+
+				if ( len < off + 4 )
+					goto fail;
+
+				flags = netframe_get16 (data + off);
+				type = netframe_get16 (data + off + 2);
+
+				/* Version 0 without source routing */
+				if ( (flags & 0x4007) != 0 )
+					goto fail;
+
+				next = off + 4;
+				key = 0;
+
+				if ( flags & 0x8000 )
+					next += 4;
+
+				if ( flags & 0x2000 ){
+					if ( len < next + 4 )
+						goto fail;
+
+					key = netframe_get32 (data + next);
+					next += 4;
+				}
+
+				if ( flags & 0x1000 )
+					next += 4;
+
+				if ( len < next || decap_id (res, key) != 0 )
+					goto fail;
+
+				off = next;
+				stripped++;
+
+				if ( decap_ethertype_ip (type) )
+					state = DECAP_STATE_IP;
+				else if ( type == DECAP_ETHERTYPE_TEB )
+					state = DECAP_STATE_ETH;
+				else if ( (decap->mask & DECAP_MPLS) && (type == DECAP_ETHERTYPE_MPLS || type == DECAP_ETHERTYPE_MPLS_MC) )
+					state = DECAP_STATE_MPLS;
+				else
+					goto fail;
+				break;
+
+			case DECAP_STATE_VXLAN:
+				keep_eth = 0;
+
+				/* Flag I, VNI is valid */
+				if ( len < off + 8 || (data[off] & 0x08) == 0 )
+					goto fail;
+
+				if ( decap_id (res, netframe_get32 (data + off + 4) >> 8) != 0 )
+					goto fail;
+
+				off += 8;
+				stripped++;
+				state = DECAP_STATE_ETH;
+				break;
+
+			case DECAP_STATE_GTP:
+				keep_eth = 0;
+
+				if ( len < off + 8 )
+					goto fail;
+
+				flags = data[off];
+
+				/* GTPv1 */
+				if ( (flags >> 5) != 1 || (flags & 0x10) == 0 )
+					goto fail;
+
+				/* Signalling messages (echo, error indication) carry no
+				 * user data. */
+				if ( data[off + 1] != 0xff )
+					goto stop;
+
+				key = netframe_get32 (data + off + 4);
+				next = off + 8;
+
+				/* Sequence number, N-PDU number and a chain of extension
+				 * headers */
+				if ( flags & 0x07 ){
+					if ( len < next + 4 )
+						goto fail;
+
+					ext = data[next + 3];
+					next += 4;
+
+					while ( ext != 0 ){
+						if ( len < next + 1 )
+							goto fail;
+
+						elen = data[next] * 4;
+
+						if ( elen == 0 || len < next + elen )
+							goto fail;
+
+						ext = data[next + elen - 1];
+						next += elen;
+					}
+				}
+
+				if ( len < next + 1 || decap_id (res, key) != 0 )
+					goto fail;
+
+				off = next;
+				stripped++;
+
+				if ( (data[off] >> 4) != 4 && (data[off] >> 4) != 6 )
+					goto fail;
+
+				state = DECAP_STATE_IP;
+				break;
+		}
+	}
+
+stop:
+	/* Tags of a frame that carries no datagram are left in place, the frame
+	 * is not decapsulated after all. */
+	if ( res->offset == 0 && res->linktype == linktype ){
+		res->id_cnt = 0;
+		stripped = 0;
+	}
+
+	if ( stripped > 0 )
+		decap->decapsulated++;
+
+	return 0;
+
+fail:
+	decap->failed++;
+
+	res->offset = 0;
+	res->linktype = linktype;
+	res->id_cnt = 0;
+
+	return 1;
+}
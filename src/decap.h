@@ -0,0 +1,67 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _DECAP_H
+#define _DECAP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DECAP_VLAN 0x01
+#define DECAP_MPLS 0x02
+#define DECAP_GRE 0x04
+#define DECAP_VXLAN 0x08
+#define DECAP_GTP 0x10
+#define DECAP_ALL 0x1f
+
+/* UDP destination ports of VXLAN and GTP-U. */
+#define DECAP_VXLAN_PORT 4789
+#define DECAP_GTPU_PORT 2152
+
+/* Largest number of tunnel identifiers (VLAN IDs, MPLS labels, GRE keys,
+ * VNIs, TEIDs) of a frame, frames with more fail to decapsulate. */
+#define DECAP_IDS_MAX 16
+
+struct decap_result
+{
+	size_t offset;
+	int linktype;
+	size_t id_cnt;
+	uint32_t id[DECAP_IDS_MAX];
+};
+
+struct decap
+{
+	unsigned int mask;
+	unsigned long frames;
+	unsigned long decapsulated;
+	unsigned long failed;
+	char errbuff[128];
+};
+
+extern int decap_init (struct decap *decap, const char *list);
+
+extern int decap_frame (struct decap *decap, int linktype, const uint8_t *data, size_t len, struct decap_result *res);
+
+#endif
+
@@ -0,0 +1,316 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pcap.h>
+
+#include "dedup.h"
+#include "netframe.h"
+
+#define DEDUP_HASH_M 0xc6a4a7935bd1e995ULL
+
+static int
+dedup_parse_ignore (struct dedup *dedup, const char *ignore)
+{
+	char *list, *item, *end;
+	unsigned long off, len;
+
+	list = strdup (ignore);
+
+	if ( list == NULL ){
+		snprintf (dedup->errbuff, sizeof (dedup->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	for ( item = strtok (list, ","); item != NULL; item = strtok (NULL, ",") ){
+
+		if ( strcmp (item, "ttl") == 0 ){
+			dedup->ignore |= DEDUP_IGNORE_TTL;
+		} else if ( strcmp (item, "ipcsum") == 0 ){
+			dedup->ignore |= DEDUP_IGNORE_IPCSUM;
+		} else if ( strcmp (item, "l2") == 0 ){
+			dedup->ignore |= DEDUP_IGNORE_L2;
+		} else {
+			/* Byte range <offset>:<length> */
+			off = strtoul (item, &end, 10);
+
+			if ( end == item || *end != ':' )
+				goto invalid;
+
+			item = end + 1;
+			len = strtoul (item, &end, 10);
+
+			if ( end == item || *end != '\0' || len == 0 )
+				goto invalid;
+
+			if ( dedup->range_cnt == DEDUP_MAXRANGE ){
+				snprintf (dedup->errbuff, sizeof (dedup->errbuff), "too many byte ranges (max. %d)", DEDUP_MAXRANGE);
+				free (list);
+				return 1;
+			}
+
+			dedup->range[dedup->range_cnt].off = off;
+			dedup->range[dedup->range_cnt].len = len;
+			dedup->range_cnt++;
+		}
+	}
+
+	free (list);
+
+	return 0;
+
+invalid:
+	snprintf (dedup->errbuff, sizeof (dedup->errbuff), "invalid field '%s'", item);
+	free (list);
+
+	return 1;
+}
+
+int
+dedup_init (struct dedup *dedup, size_t window, double time, const char *ignore)
+{
+	size_t hsize;
+
+	memset (dedup, 0, sizeof (struct dedup));
+
+	if ( window == 0 ){
+		snprintf (dedup->errbuff, sizeof (dedup->errbuff), "window must not be empty");
+		return 1;
+	}
+
+	dedup->window = window;
+	dedup->time = time;
+
+	if ( dedup_parse_ignore (dedup, ignore) != 0 )
+		return 1;
+
+	/* Keep the load factor of the hash table below 0.5. */
+	for ( hsize = 16; hsize < window * 2; hsize *= 2 )
+		;
+
+	dedup->hmask = hsize - 1;
+	dedup->ring = (struct dedup_slot*) calloc (window, sizeof (struct dedup_slot));
+	dedup->htable = (struct dedup_entry*) calloc (hsize, sizeof (struct dedup_entry));
+
+	if ( dedup->ring == NULL || dedup->htable == NULL ){
+		snprintf (dedup->errbuff, sizeof (dedup->errbuff), "cannot allocate memory");
+		dedup_free (dedup);
+		return 1;
+	}
+
+	return 0;
+}
+
+static uint64_t
+dedup_hash (const uint8_t *data, size_t len)
+{
+	uint64_t hash, k;
+	size_t i;
+
+	hash = 0x9e3779b97f4a7c15ULL ^ (len * DEDUP_HASH_M);
+
+	for ( i = 0; i + 8 <= len; i += 8 ){
+		memcpy (&k, data + i, 8);
+		k *= DEDUP_HASH_M;
+		k ^= k >> 47;
+		k *= DEDUP_HASH_M;
+		hash ^= k;
+		hash *= DEDUP_HASH_M;
+	}
+
+	if ( i < len ){
+		k = 0;
+		memcpy (&k, data + i, len - i);
+		hash ^= k;
+		hash *= DEDUP_HASH_M;
+	}
+
+	hash ^= hash >> 47;
+	hash *= DEDUP_HASH_M;
+	hash ^= hash >> 47;
+
+	/* Zero marks an empty slot in the hash table. */
+	return (hash == 0) ? 1:hash;
+}
+
+static void
+dedup_mask (uint8_t *data, size_t len, size_t off, size_t mask_len)
+{
+	if ( off >= len )
+		return;
+
+	if ( off + mask_len > len )
+		mask_len = len - off;
+
+	memset (data + off, 0, mask_len);
+}
+
+/* Remove an entry from the hash table (linear probing, backward shift
+ * deletion). */
+static void
+dedup_htable_del (struct dedup *dedup, size_t idx)
+{
+	size_t next, home;
+
+	for ( ;; ){
+		dedup->htable[idx].hash = 0;
+		next = idx;
+
+		for ( ;; ){
+			next = (next + 1) & dedup->hmask;
+
+			if ( dedup->htable[next].hash == 0 )
+				return;
+
+			home = dedup->htable[next].hash & dedup->hmask;
+
+			/* Move the entry, if its home slot is not located cyclically
+			 * between idx and next. */
+			if ( (next > idx && (home <= idx || home > next)) || (next < idx && (home <= idx && home > next)) )
+				break;
+		}
+
+		dedup->htable[idx] = dedup->htable[next];
+		idx = next;
+	}
+}
+
+/* Return 1 if the frame is a duplicate of a frame seen within the window. */
+int
+dedup_frame (struct dedup *dedup, int linktype, const struct pcap_pkthdr *pkt_hdr, const uint8_t *pkt_data)
+{
+	struct dedup_slot *slot;
+	const uint8_t *data;
+	uint8_t *buff;
+	size_t len, idx, off, i;
+	uint64_t hash;
+	uint16_t ethertype;
+	double ts;
+
+	dedup->frames++;
+
+	data = pkt_data;
+	len = pkt_hdr->caplen;
+	ts = pkt_hdr->ts.tv_sec + (pkt_hdr->ts.tv_usec / 1000000.0);
+
+	if ( (dedup->ignore || dedup->range_cnt > 0) ){
+
+		if ( len > dedup->buff_size ){
+			buff = (uint8_t*) realloc (dedup->buff, len);
+
+			/* Out of memory, do not drop anything. */
+			if ( buff == NULL )
+				return 0;
+
+			dedup->buff = buff;
+			dedup->buff_size = len;
+		}
+
+		memcpy (dedup->buff, pkt_data, len);
+		data = dedup->buff;
+
+		for ( i = 0; i < dedup->range_cnt; i++ )
+			dedup_mask (dedup->buff, len, dedup->range[i].off, dedup->range[i].len);
+
+		if ( dedup->ignore && netframe_l3 (linktype, data, len, &off, &ethertype) == 0 ){
+
+			if ( ethertype == NETFRAME_ETHERTYPE_IPV4 ){
+				if ( dedup->ignore & DEDUP_IGNORE_TTL )
+					dedup_mask (dedup->buff, len, off + 8, 1);
+
+				if ( dedup->ignore & DEDUP_IGNORE_IPCSUM )
+					dedup_mask (dedup->buff, len, off + 10, 2);
+			} else if ( dedup->ignore & DEDUP_IGNORE_TTL ){
+				dedup_mask (dedup->buff, len, off + 7, 1);
+			}
+
+			if ( dedup->ignore & DEDUP_IGNORE_L2 ){
+				data += off;
+				len -= off;
+			}
+		}
+	}
+
+	hash = dedup_hash (data, len);
+
+	for ( idx = hash & dedup->hmask; dedup->htable[idx].hash != 0; idx = (idx + 1) & dedup->hmask ){
+
+		if ( dedup->htable[idx].hash != hash )
+			continue;
+
+		slot = &(dedup->ring[dedup->htable[idx].seq % dedup->window]);
+
+		if ( dedup->time <= 0 || ts - slot->ts <= dedup->time ){
+			dedup->dropped++;
+			return 1;
+		}
+
+		/* Seen, but too long ago. Forget the old frame. */
+		dedup_htable_del (dedup, idx);
+		break;
+	}
+
+	/* Evict the oldest frame from the window. */
+	slot = &(dedup->ring[dedup->seq % dedup->window]);
+
+	if ( dedup->seq >= dedup->window ){
+		for ( idx = slot->hash & dedup->hmask; dedup->htable[idx].hash != 0; idx = (idx + 1) & dedup->hmask ){
+			if ( dedup->htable[idx].hash == slot->hash && dedup->htable[idx].seq == dedup->seq - dedup->window ){
+				dedup_htable_del (dedup, idx);
+				break;
+			}
+		}
+	}
+
+	slot->hash = hash;
+	slot->ts = ts;
+
+	for ( idx = hash & dedup->hmask; dedup->htable[idx].hash != 0; idx = (idx + 1) & dedup->hmask )
+		;
+
+	dedup->htable[idx].hash = hash;
+	dedup->htable[idx].seq = dedup->seq;
+	dedup->seq++;
+
+	return 0;
+}
+
+void
+dedup_free (struct dedup *dedup)
+{
+	if ( dedup->ring != NULL )
+		free (dedup->ring);
+
+	if ( dedup->htable != NULL )
+		free (dedup->htable);
+
+	if ( dedup->buff != NULL )
+		free (dedup->buff);
+
+	dedup->ring = NULL;
+	dedup->htable = NULL;
+	dedup->buff = NULL;
+}
@@ -0,0 +1,87 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _DEDUP_H
+#define _DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pcap.h>
+
+#define DEDUP_WINDOW 1024
+#define DEDUP_TIME 1.0
+#define DEDUP_IGNORE "ttl,ipcsum"
+
+#define DEDUP_MAXRANGE 16
+
+enum
+{
+	DEDUP_IGNORE_TTL = 0x01,
+	DEDUP_IGNORE_IPCSUM = 0x02,
+	DEDUP_IGNORE_L2 = 0x04
+};
+
+struct dedup_range
+{
+	size_t off;
+	size_t len;
+};
+
+struct dedup_entry
+{
+	uint64_t hash;
+	unsigned long seq;
+};
+
+struct dedup_slot
+{
+	uint64_t hash;
+	double ts;
+};
+
+struct dedup
+{
+	size_t window;
+	double time;
+	int ignore;
+	struct dedup_range range[DEDUP_MAXRANGE];
+	size_t range_cnt;
+	struct dedup_slot *ring;
+	struct dedup_entry *htable;
+	size_t hmask;
+	unsigned long seq;
+	uint8_t *buff;
+	size_t buff_size;
+	unsigned long frames;
+	unsigned long dropped;
+	char errbuff[128];
+};
+
+extern int dedup_init (struct dedup *dedup, size_t window, double time, const char *ignore);
+
+extern int dedup_frame (struct dedup *dedup, int linktype, const struct pcap_pkthdr *pkt_hdr, const uint8_t *pkt_data);
+
+extern void dedup_free (struct dedup *dedup);
+
+#endif
+
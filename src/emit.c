@@ -0,0 +1,950 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "emit.h"
+
+int
+emit_parse_format (const char *str)
+{
+	if ( strcmp (str, "jsonl") == 0 )
+		return EMIT_JSONL;
+	else if ( strcmp (str, "csv") == 0 )
+		return EMIT_CSV;
+	else if ( strcmp (str, "bin") == 0 )
+		return EMIT_BIN;
+
+	return -1;
+}
+
+static int
+emit_write (int fd, const char *data, size_t len)
+{
+	ssize_t rval;
+
+	while ( len > 0 ){
+		rval = write (fd, data, len);
+
+		if ( rval == -1 ){
+			if ( errno == EINTR )
+				continue;
+
+			return errno;
+		}
+
+		data += rval;
+		len -= rval;
+	}
+
+	return 0;
+}
+
+#ifndef _WIN32
+/* Writer thread, writes full buffers in order. */
+static void*
+emit_writer (void *arg)
+{
+	struct emit *emit;
+	struct emit_buff *buff;
+	int error;
+
+	emit = (struct emit*) arg;
+
+	pthread_mutex_lock (&(emit->lock));
+
+	for ( ;; ){
+		while ( emit->full == 0 && ! emit->stop )
+			pthread_cond_wait (&(emit->cond_full), &(emit->lock));
+
+		if ( emit->full == 0 )
+			break;
+
+		buff = &(emit->buff[emit->head]);
+		pthread_mutex_unlock (&(emit->lock));
+
+		error = emit_write (emit->fd, buff->data, buff->len);
+
+		pthread_mutex_lock (&(emit->lock));
+
+		if ( error != 0 && emit->error == 0 )
+			emit->error = error;
+
+		buff->len = 0;
+		emit->head = (emit->head + 1) % EMIT_BUFF_CNT;
+		emit->full--;
+		pthread_cond_signal (&(emit->cond_free));
+	}
+
+	pthread_mutex_unlock (&(emit->lock));
+
+	return NULL;
+}
+#endif
+
+int
+emit_init (struct emit *emit, int fd, int format)
+{
+	memset (emit, 0, sizeof (struct emit));
+
+	emit->fd = fd;
+	emit->format = format;
+
+#ifndef _WIN32
+	if ( pthread_mutex_init (&(emit->lock), NULL) != 0 )
+		return 1;
+
+	if ( pthread_cond_init (&(emit->cond_full), NULL) != 0 ){
+		pthread_mutex_destroy (&(emit->lock));
+		return 1;
+	}
+
+	if ( pthread_cond_init (&(emit->cond_free), NULL) != 0 ){
+		pthread_cond_destroy (&(emit->cond_full));
+		pthread_mutex_destroy (&(emit->lock));
+		return 1;
+	}
+#endif
+
+	return 0;
+}
+
+/* Start the writer thread and allocate buffers, when the first record is
+ * emitted. Scripts not using 'capdiss.emit' do not pay anything. */
+static void
+emit_buff_free (struct emit *emit)
+{
+	size_t i;
+
+	for ( i = 0; i < EMIT_BUFF_CNT; i++ ){
+		if ( emit->buff[i].data != NULL )
+			free (emit->buff[i].data);
+
+		emit->buff[i].data = NULL;
+		emit->buff[i].size = 0;
+	}
+}
+
+/* Allocate buffers and start the writer thread. On failure nothing is kept,
+ * so the next record may try again. */
+static int
+emit_start (struct emit *emit)
+{
+	size_t i;
+#ifndef _WIN32
+	sigset_t set, saved;
+	int rval;
+#endif
+
+	for ( i = 0; i < EMIT_BUFF_CNT; i++ ){
+		emit->buff[i].data = (char*) malloc (EMIT_BUFF_SIZE);
+
+		if ( emit->buff[i].data == NULL ){
+			emit_buff_free (emit);
+			return ENOMEM;
+		}
+
+		emit->buff[i].size = EMIT_BUFF_SIZE;
+	}
+
+#ifndef _WIN32
+	/* Signals are handled by the main thread only, the writer inherits the
+	 * signal mask. */
+	sigfillset (&set);
+	pthread_sigmask (SIG_SETMASK, &set, &saved);
+	rval = pthread_create (&(emit->thread), NULL, emit_writer, emit);
+	pthread_sigmask (SIG_SETMASK, &saved, NULL);
+
+	if ( rval != 0 ){
+		emit_buff_free (emit);
+		return EAGAIN;
+	}
+#endif
+
+	emit->started = 1;
+
+	return 0;
+}
+
+/* Pass the buffer being filled to the writer thread, and wait for a free
+ * one. */
+static int
+emit_submit (struct emit *emit)
+{
+#ifdef _WIN32
+	int error;
+
+	error = emit_write (emit->fd, emit->buff[emit->cur].data, emit->buff[emit->cur].len);
+	emit->buff[emit->cur].len = 0;
+
+	return error;
+#else
+	int error;
+
+	pthread_mutex_lock (&(emit->lock));
+
+	emit->full++;
+	pthread_cond_signal (&(emit->cond_full));
+
+	while ( emit->full == EMIT_BUFF_CNT )
+		pthread_cond_wait (&(emit->cond_free), &(emit->lock));
+
+	emit->cur = (emit->head + emit->full) % EMIT_BUFF_CNT;
+	error = emit->error;
+
+	pthread_mutex_unlock (&(emit->lock));
+
+	return error;
+#endif
+}
+
+static int
+emit_flush_record (struct emit *emit)
+{
+	struct emit_buff *buff;
+	char *data;
+	int error;
+
+	buff = &(emit->buff[emit->cur]);
+
+	if ( buff->len + emit->rec.len > buff->size ){
+
+		if ( buff->len > 0 ){
+			error = emit_submit (emit);
+
+			if ( error != 0 )
+				return error;
+
+			buff = &(emit->buff[emit->cur]);
+		}
+
+		/* Record does not fit into an empty buffer. */
+		if ( emit->rec.len > buff->size ){
+			data = (char*) realloc (buff->data, emit->rec.len);
+
+			if ( data == NULL )
+				return ENOMEM;
+
+			buff->data = data;
+			buff->size = emit->rec.len;
+		}
+	}
+
+	memcpy (buff->data + buff->len, emit->rec.data, emit->rec.len);
+	buff->len += emit->rec.len;
+	emit->records++;
+
+	return 0;
+}
+
+int
+emit_close (struct emit *emit)
+{
+	int error;
+	size_t i;
+
+	error = 0;
+
+	if ( emit->started ){
+
+		if ( emit->buff[emit->cur].len > 0 )
+			error = emit_submit (emit);
+
+#ifndef _WIN32
+		pthread_mutex_lock (&(emit->lock));
+		emit->stop = 1;
+		pthread_cond_signal (&(emit->cond_full));
+		pthread_mutex_unlock (&(emit->lock));
+
+		pthread_join (emit->thread, NULL);
+
+		if ( error == 0 )
+			error = emit->error;
+#endif
+	}
+
+	emit_buff_free (emit);
+
+	if ( emit->rec.data != NULL )
+		free (emit->rec.data);
+
+	for ( i = 0; i < emit->column_cnt; i++ )
+		free (emit->columns[i]);
+
+	if ( emit->columns != NULL )
+		free (emit->columns);
+
+#ifndef _WIN32
+	pthread_cond_destroy (&(emit->cond_free));
+	pthread_cond_destroy (&(emit->cond_full));
+	pthread_mutex_destroy (&(emit->lock));
+#endif
+
+	memset (emit, 0, sizeof (struct emit));
+
+	return error;
+}
+
+/* ============= */
+/* Serialization */
+/* ============= */
+
+static int
+rec_reserve (struct emit_buff *rec, size_t len)
+{
+	char *data;
+	size_t size;
+
+	if ( rec->len + len <= rec->size )
+		return 0;
+
+	for ( size = (rec->size > 0) ? rec->size:256; size < rec->len + len; size *= 2 )
+		;
+
+	data = (char*) realloc (rec->data, size);
+
+	if ( data == NULL )
+		return 1;
+
+	rec->data = data;
+	rec->size = size;
+
+	return 0;
+}
+
+static int
+rec_append (struct emit_buff *rec, const void *data, size_t len)
+{
+	if ( rec_reserve (rec, len) != 0 )
+		return 1;
+
+	memcpy (rec->data + rec->len, data, len);
+	rec->len += len;
+
+	return 0;
+}
+
+static int
+rec_append_le (struct emit_buff *rec, uint64_t val, size_t len)
+{
+	uint8_t bytes[8];
+	size_t i;
+
+	for ( i = 0; i < len; i++ )
+		bytes[i] = (uint8_t) (val >> (i * 8));
+
+	return rec_append (rec, bytes, len);
+}
+
+/* Return 1 if a value on the stack is a number without a fraction. */
+static int
+emit_isinteger (lua_State *lua_state, int idx, int64_t *val)
+{
+	lua_Number num;
+
+#if LUA_VERSION_NUM >= 503
+	if ( lua_isinteger (lua_state, idx) ){
+		*val = (int64_t) lua_tointeger (lua_state, idx);
+		return 1;
+	}
+#endif
+
+	num = lua_tonumber (lua_state, idx);
+
+	if ( num >= -9007199254740992.0 && num <= 9007199254740992.0 && num == (lua_Number) (int64_t) num ){
+		*val = (int64_t) num;
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+emit_number (struct emit_buff *rec, lua_State *lua_state, int idx)
+{
+	char str[32];
+	int64_t ival;
+	int len;
+
+	if ( emit_isinteger (lua_state, idx, &ival) )
+		len = snprintf (str, sizeof (str), "%lld", (long long) ival);
+	else
+		len = snprintf (str, sizeof (str), "%.17g", (double) lua_tonumber (lua_state, idx));
+
+	return rec_append (rec, str, len);
+}
+
+/* JSON has no representation of NaN and infinity, such numbers are written
+ * as null. */
+static int
+emit_json_number (struct emit_buff *rec, lua_State *lua_state, int idx)
+{
+	if ( ! isfinite ((double) lua_tonumber (lua_state, idx)) )
+		return rec_append (rec, "null", 4);
+
+	return emit_number (rec, lua_state, idx);
+}
+
+/* Length of a valid UTF-8 sequence at the beginning of a string, 0 if
+ * the sequence is not valid. */
+static size_t
+emit_utf8_len (const unsigned char *str, size_t len)
+{
+	unsigned char lo, hi;
+	size_t need, i;
+
+	/* Range of the second byte excludes overlong forms, surrogates
+	 * (U+D800..U+DFFF) and code points above U+10FFFF (RFC 3629). */
+	lo = 0x80;
+	hi = 0xbf;
+
+	if ( str[0] < 0x80 ){
+		return 1;
+	} else if ( str[0] >= 0xc2 && str[0] <= 0xdf ){
+		need = 2;
+	} else if ( str[0] >= 0xe0 && str[0] <= 0xef ){
+		need = 3;
+
+		if ( str[0] == 0xe0 )
+			lo = 0xa0;
+		else if ( str[0] == 0xed )
+			hi = 0x9f;
+	} else if ( str[0] >= 0xf0 && str[0] <= 0xf4 ){
+		need = 4;
+
+		if ( str[0] == 0xf0 )
+			lo = 0x90;
+		else if ( str[0] == 0xf4 )
+			hi = 0x8f;
+	} else {
+		return 0;
+	}
+
+	if ( need > len || str[1] < lo || str[1] > hi )
+		return 0;
+
+	for ( i = 2; i < need; i++ ){
+		if ( (str[i] & 0xc0) != 0x80 )
+			return 0;
+	}
+
+	return need;
+}
+
+/* Write a JSON string. Bytes that are not part of a valid UTF-8 sequence are
+ * escaped as if they were Latin-1 characters. */
+static int
+emit_json_string (struct emit_buff *rec, const char *str, size_t len)
+{
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *ustr;
+	char esc[6];
+	size_t i, seq;
+
+	ustr = (const unsigned char*) str;
+
+	if ( rec_append (rec, "\"", 1) != 0 )
+		return 1;
+
+	for ( i = 0; i < len; i += seq ){
+		seq = emit_utf8_len (ustr + i, len - i);
+
+		if ( seq > 1 ){
+			if ( rec_append (rec, str + i, seq) != 0 )
+				return 1;
+
+			continue;
+		}
+
+		seq = 1;
+
+		if ( ustr[i] == '"' || ustr[i] == '\\' ){
+			esc[0] = '\\';
+			esc[1] = str[i];
+
+			if ( rec_append (rec, esc, 2) != 0 )
+				return 1;
+		} else if ( ustr[i] < 0x20 || ustr[i] >= 0x7f ){
+			esc[0] = '\\';
+			esc[1] = 'u';
+			esc[2] = '0';
+			esc[3] = '0';
+			esc[4] = hex[ustr[i] >> 4];
+			esc[5] = hex[ustr[i] & 0x0f];
+
+			if ( rec_append (rec, esc, 6) != 0 )
+				return 1;
+		} else {
+			if ( rec_append (rec, str + i, 1) != 0 )
+				return 1;
+		}
+	}
+
+	return rec_append (rec, "\"", 1);
+}
+
+/* Write a CSV field, quoted if needed. Bytes that are not part of a valid
+ * UTF-8 sequence are replaced by U+FFFD, CSV has no way to escape them. */
+static int
+emit_csv_string (struct emit_buff *rec, const char *str, size_t len)
+{
+	const unsigned char *ustr;
+	size_t i, seq;
+	int quote, valid;
+
+	ustr = (const unsigned char*) str;
+	quote = 0;
+	valid = 1;
+
+	for ( i = 0; i < len; i += seq ){
+		seq = emit_utf8_len (ustr + i, len - i);
+
+		if ( seq == 0 ){
+			valid = 0;
+			seq = 1;
+		} else if ( str[i] == ',' || str[i] == '"' || str[i] == '\r' || str[i] == '\n' ){
+			quote = 1;
+		}
+	}
+
+	if ( ! quote && valid )
+		return rec_append (rec, str, len);
+
+	if ( quote && rec_append (rec, "\"", 1) != 0 )
+		return 1;
+
+	for ( i = 0; i < len; i += seq ){
+		seq = emit_utf8_len (ustr + i, len - i);
+
+		if ( seq == 0 ){
+			if ( rec_append (rec, "\xef\xbf\xbd", 3) != 0 )
+				return 1;
+
+			seq = 1;
+			continue;
+		}
+
+		if ( str[i] == '"' && rec_append (rec, "\"", 1) != 0 )
+			return 1;
+
+		if ( rec_append (rec, str + i, seq) != 0 )
+			return 1;
+	}
+
+	return quote ? rec_append (rec, "\"", 1):0;
+}
+
+static int
+emit_csv_value (struct emit_buff *rec, lua_State *lua_state, int idx)
+{
+	const char *str;
+	size_t len;
+
+	switch ( lua_type (lua_state, idx) ){
+		case LUA_TNIL:
+			return 0;
+
+		case LUA_TBOOLEAN:
+			return lua_toboolean (lua_state, idx) ? rec_append (rec, "true", 4):rec_append (rec, "false", 5);
+
+		case LUA_TNUMBER:
+			return emit_number (rec, lua_state, idx);
+
+		case LUA_TSTRING:
+			str = lua_tolstring (lua_state, idx, &len);
+			return emit_csv_string (rec, str, len);
+	}
+
+	return -1;
+}
+
+static int
+emit_compare_str (const void *a, const void *b)
+{
+	return strcmp (*(char* const*) a, *(char* const*) b);
+}
+
+/* Columns of CSV output are given by the keys of the first record, in
+ * alphabetical order. */
+static int
+emit_csv_header (struct emit *emit, lua_State *lua_state, int idx)
+{
+	char **columns;
+	size_t i;
+
+	lua_pushnil (lua_state);
+
+	while ( lua_next (lua_state, idx) != 0 ){
+		lua_pop (lua_state, 1);
+
+		if ( lua_type (lua_state, -1) != LUA_TSTRING ){
+			lua_pop (lua_state, 1);
+			return -1;
+		}
+
+		columns = (char**) realloc (emit->columns, sizeof (char*) * (emit->column_cnt + 1));
+
+		if ( columns == NULL ){
+			lua_pop (lua_state, 1);
+			return 1;
+		}
+
+		emit->columns = columns;
+		emit->columns[emit->column_cnt] = strdup (lua_tostring (lua_state, -1));
+
+		if ( emit->columns[emit->column_cnt] == NULL ){
+			lua_pop (lua_state, 1);
+			return 1;
+		}
+
+		emit->column_cnt++;
+	}
+
+	qsort (emit->columns, emit->column_cnt, sizeof (char*), emit_compare_str);
+
+	for ( i = 0; i < emit->column_cnt; i++ ){
+		if ( i > 0 && rec_append (&(emit->rec), ",", 1) != 0 )
+			return 1;
+
+		if ( emit_csv_string (&(emit->rec), emit->columns[i], strlen (emit->columns[i])) != 0 )
+			return 1;
+	}
+
+	return rec_append (&(emit->rec), "\n", 1);
+}
+
+static int
+emit_csv (struct emit *emit, lua_State *lua_state, int idx)
+{
+	size_t i;
+	int rval;
+
+	if ( emit->columns == NULL ){
+		rval = emit_csv_header (emit, lua_state, idx);
+
+		if ( rval != 0 )
+			return rval;
+	}
+
+	for ( i = 0; i < emit->column_cnt; i++ ){
+		if ( i > 0 && rec_append (&(emit->rec), ",", 1) != 0 )
+			return 1;
+
+		lua_getfield (lua_state, idx, emit->columns[i]);
+		rval = emit_csv_value (&(emit->rec), lua_state, -1);
+		lua_pop (lua_state, 1);
+
+		if ( rval != 0 )
+			return rval;
+	}
+
+	return rec_append (&(emit->rec), "\n", 1);
+}
+
+static int
+emit_jsonl (struct emit *emit, lua_State *lua_state, int idx)
+{
+	struct emit_buff *rec;
+	const char *str;
+	size_t len;
+	int first, rval;
+
+	rec = &(emit->rec);
+	first = 1;
+
+	if ( rec_append (rec, "{", 1) != 0 )
+		return 1;
+
+	lua_pushnil (lua_state);
+
+	while ( lua_next (lua_state, idx) != 0 ){
+
+		if ( lua_type (lua_state, -2) != LUA_TSTRING ){
+			lua_pop (lua_state, 2);
+			return -1;
+		}
+
+		if ( ! first && rec_append (rec, ",", 1) != 0 )
+			goto nomem;
+
+		first = 0;
+		str = lua_tolstring (lua_state, -2, &len);
+
+		if ( emit_json_string (rec, str, len) != 0 || rec_append (rec, ":", 1) != 0 )
+			goto nomem;
+
+		switch ( lua_type (lua_state, -1) ){
+			case LUA_TBOOLEAN:
+				rval = lua_toboolean (lua_state, -1) ? rec_append (rec, "true", 4):rec_append (rec, "false", 5);
+				break;
+
+			case LUA_TNUMBER:
+				rval = emit_json_number (rec, lua_state, -1);
+				break;
+
+			case LUA_TSTRING:
+				str = lua_tolstring (lua_state, -1, &len);
+				rval = emit_json_string (rec, str, len);
+				break;
+
+			default:
+				lua_pop (lua_state, 2);
+				return -1;
+		}
+
+		if ( rval != 0 )
+			goto nomem;
+
+		lua_pop (lua_state, 1);
+	}
+
+	return rec_append (rec, "}\n", 2);
+
+nomem:
+	lua_pop (lua_state, 2);
+	return 1;
+}
+
+static int
+emit_bin (struct emit *emit, lua_State *lua_state, int idx)
+{
+	struct emit_buff *rec;
+	const char *str;
+	size_t len, cnt;
+	int64_t ival;
+	union { double d; uint64_t u; } dval;
+	int rval;
+
+	rec = &(emit->rec);
+	cnt = 0;
+
+	/* Length and number of fields are filled in later. */
+	if ( rec_append (rec, "\0\0\0\0\0\0", 6) != 0 )
+		return 1;
+
+	lua_pushnil (lua_state);
+
+	while ( lua_next (lua_state, idx) != 0 ){
+
+		if ( lua_type (lua_state, -2) != LUA_TSTRING ){
+			lua_pop (lua_state, 2);
+			return -1;
+		}
+
+		str = lua_tolstring (lua_state, -2, &len);
+
+		if ( len > 0xffff ){
+			lua_pop (lua_state, 2);
+			return -1;
+		}
+
+		switch ( lua_type (lua_state, -1) ){
+			case LUA_TBOOLEAN:
+				rval = rec_append_le (rec, EMIT_TYPE_BOOLEAN, 1)
+					|| rec_append_le (rec, len, 2)
+					|| rec_append (rec, str, len)
+					|| rec_append_le (rec, lua_toboolean (lua_state, -1), 1);
+				break;
+
+			case LUA_TNUMBER:
+				if ( emit_isinteger (lua_state, -1, &ival) ){
+					rval = rec_append_le (rec, EMIT_TYPE_INTEGER, 1)
+						|| rec_append_le (rec, len, 2)
+						|| rec_append (rec, str, len)
+						|| rec_append_le (rec, (uint64_t) ival, 8);
+				} else {
+					dval.d = lua_tonumber (lua_state, -1);
+					rval = rec_append_le (rec, EMIT_TYPE_DOUBLE, 1)
+						|| rec_append_le (rec, len, 2)
+						|| rec_append (rec, str, len)
+						|| rec_append_le (rec, dval.u, 8);
+				}
+				break;
+
+			case LUA_TSTRING:
+				rval = rec_append_le (rec, EMIT_TYPE_STRING, 1)
+					|| rec_append_le (rec, len, 2)
+					|| rec_append (rec, str, len);
+
+				str = lua_tolstring (lua_state, -1, &len);
+				rval = rval
+					|| rec_append_le (rec, len, 4)
+					|| rec_append (rec, str, len);
+				break;
+
+			default:
+				lua_pop (lua_state, 2);
+				return -1;
+		}
+
+		if ( rval != 0 ){
+			lua_pop (lua_state, 2);
+			return 1;
+		}
+
+		cnt++;
+		lua_pop (lua_state, 1);
+	}
+
+	if ( cnt > 0xffff )
+		return -1;
+
+	len = rec->len - 4;
+	rec->data[0] = len & 0xff;
+	rec->data[1] = (len >> 8) & 0xff;
+	rec->data[2] = (len >> 16) & 0xff;
+	rec->data[3] = (len >> 24) & 0xff;
+	rec->data[4] = cnt & 0xff;
+	rec->data[5] = (cnt >> 8) & 0xff;
+
+	return 0;
+}
+
+/* Pass records formatted by another emitter (a worker process) and stored in
+ * a file fd. If skip_header is non-zero, the first line of the data (a CSV
+ * header) is dropped. */
+int
+emit_append (struct emit *emit, int fd, int skip_header)
+{
+	char data[65536];
+	const char *eol;
+	ssize_t len;
+	size_t off;
+	int error;
+
+	if ( emit->error != 0 )
+		return emit->error;
+
+	if ( ! emit->started ){
+		error = emit_start (emit);
+
+		if ( error != 0 )
+			return error;
+	}
+
+	if ( lseek (fd, 0, SEEK_SET) == -1 )
+		return errno;
+
+	for ( ;; ){
+		len = read (fd, data, sizeof (data));
+
+		if ( len == -1 && errno == EINTR )
+			continue;
+
+		if ( len == -1 )
+			return errno;
+
+		if ( len == 0 )
+			break;
+
+		off = 0;
+
+		if ( skip_header ){
+			eol = (const char*) memchr (data, '\n', len);
+
+			if ( eol == NULL )
+				continue;
+
+			off = eol - data + 1;
+			skip_header = 0;
+		}
+
+		emit->rec.len = 0;
+
+		if ( rec_append (&(emit->rec), data + off, len - off) != 0 )
+			return ENOMEM;
+
+		error = emit_flush_record (emit);
+
+		if ( error != 0 )
+			return error;
+	}
+
+	return 0;
+}
+
+/* capdiss.emit (record) */
+static int
+emit_lua_emit (lua_State *lua_state)
+{
+	struct emit *emit;
+	int rval;
+
+	emit = (struct emit*) lua_touserdata (lua_state, lua_upvalueindex (1));
+	luaL_checktype (lua_state, 1, LUA_TTABLE);
+
+	if ( emit->error != 0 )
+		return luaL_error (lua_state, "cannot write a record: %s", strerror (emit->error));
+
+	if ( ! emit->started ){
+		rval = emit_start (emit);
+
+		if ( rval != 0 )
+			return luaL_error (lua_state, "cannot initialize output: %s", strerror (rval));
+	}
+
+	if ( ! lua_checkstack (lua_state, 3) )
+		return luaL_error (lua_state, "Lua stack is full");
+
+	emit->rec.len = 0;
+
+	switch ( emit->format ){
+		case EMIT_CSV:
+			rval = emit_csv (emit, lua_state, 1);
+			break;
+
+		case EMIT_BIN:
+			rval = emit_bin (emit, lua_state, 1);
+			break;
+
+		default:
+			rval = emit_jsonl (emit, lua_state, 1);
+			break;
+	}
+
+	if ( rval == -1 )
+		return luaL_argerror (lua_state, 1, "record must be a flat table with string keys and boolean, number or string values");
+	else if ( rval != 0 )
+		return luaL_error (lua_state, "cannot allocate memory");
+
+	rval = emit_flush_record (emit);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot write a record: %s", strerror (rval));
+
+	return 0;
+}
+
+const luaL_Reg emit_api[] = {
+	{ "emit", emit_lua_emit },
+	{ NULL, NULL }
+};
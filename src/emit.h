@@ -0,0 +1,108 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _EMIT_H
+#define _EMIT_H
+
+#include <stddef.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#define EMIT_BUFF_SIZE (1024 * 1024)
+#define EMIT_BUFF_CNT 4
+
+/*
+ * Records emitted in binary format:
+ *
+ *   uint32 length of the record (excluding this field)
+ *   uint16 number of fields
+ *   fields:
+ *     uint8  type (1 = boolean, 2 = integer, 3 = double, 4 = string)
+ *     uint16 length of a key
+ *     key
+ *     value (boolean: uint8, integer: int64, double: IEEE 754 binary64,
+ *            string: uint32 length followed by data)
+ *
+ * All numbers are stored in little-endian byte order.
+ */
+enum
+{
+	EMIT_JSONL = 1,
+	EMIT_CSV = 2,
+	EMIT_BIN = 3
+};
+
+enum
+{
+	EMIT_TYPE_BOOLEAN = 1,
+	EMIT_TYPE_INTEGER = 2,
+	EMIT_TYPE_DOUBLE = 3,
+	EMIT_TYPE_STRING = 4
+};
+
+struct emit_buff
+{
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+struct emit
+{
+	int fd;
+	int format;
+	struct emit_buff buff[EMIT_BUFF_CNT];
+	size_t cur;
+	size_t head;
+	size_t full;
+	struct emit_buff rec;
+	char **columns;
+	size_t column_cnt;
+	unsigned long records;
+	int error;
+	int started;
+	int stop;
+#ifndef _WIN32
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond_full;
+	pthread_cond_t cond_free;
+#endif
+};
+
+extern const luaL_Reg emit_api[];
+
+extern int emit_parse_format (const char *str);
+
+extern int emit_init (struct emit *emit, int fd, int format);
+
+extern int emit_append (struct emit *emit, int fd, int skip_header);
+
+extern int emit_close (struct emit *emit);
+
+#endif
+
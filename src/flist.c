@@ -21,8 +21,10 @@
 * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 * SOFTWARE.
 */
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 
 #include "flist.h"
 
@@ -60,6 +62,62 @@ flist_add (struct flist *list, const char *path)
 	return 0;
 }
 
+/* Append paths listed in a file, one per line, '-' reads the list from
+ * standard input. Empty lines are skipped. */
+int
+flist_load (struct flist *list, const char *path)
+{
+	FILE *file;
+	char line[FLIST_LINE_MAX];
+	size_t len;
+	int rval, err;
+
+	if ( strcmp (path, "-") == 0 )
+		file = stdin;
+	else
+		file = fopen (path, "r");
+
+	if ( file == NULL )
+		return 1;
+
+	rval = 0;
+
+	while ( fgets (line, sizeof (line), file) != NULL ){
+		len = strlen (line);
+
+		if ( len > 0 && line[len - 1] != '\n' && ! feof (file) ){
+			errno = ENAMETOOLONG;
+			rval = 1;
+			break;
+		}
+
+		while ( len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r') )
+			line[--len] = '\0';
+
+		if ( len == 0 )
+			continue;
+
+		if ( flist_add (list, line) == 1 ){
+			rval = 1;
+			break;
+		}
+	}
+
+	if ( rval == 0 && ferror (file) ){
+		errno = EIO;
+		rval = 1;
+	}
+
+	err = errno;
+
+	if ( file != stdin )
+		fclose (file);
+
+	errno = err;
+
+	return rval;
+}
+
 void
 flist_free (struct flist *list)
 {
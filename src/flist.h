@@ -24,6 +24,9 @@
 #ifndef _FLIST_H
 #define _FLIST_H
 
+/* Longest line of a file list (option '--files-from'). */
+#define FLIST_LINE_MAX 4096
+
 struct flist
 {
 	struct flist_path *head;
@@ -40,6 +43,8 @@ extern void flist_init (struct flist *list);
 
 extern int flist_add (struct flist *list, const char *path);
 
+extern int flist_load (struct flist *list, const char *path);
+
 extern void flist_free (struct flist *list);
 
 #endif
@@ -0,0 +1,613 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#if defined (__linux__) && defined (__has_include)
+#if __has_include (<linux/io_uring.h>)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined (__NR_io_uring_setup) && defined (__NR_io_uring_enter)
+#define IOREAD_HAVE_URING 1
+#endif
+#endif
+#endif
+
+#include "ioread.h"
+
+/*
+ * Input layer reading files in large blocks. Blocks are read in the order of
+ * files and offsets, up to 'depth' of them are in flight at once, regardless
+ * of whether they belong to the current file or to one of the upcoming ones.
+ * The consumer always gets blocks in order, waiting only for the block at the
+ * head of the queue.
+ *
+ * Reads are submitted via io_uring if the kernel supports it (and it is not
+ * blocked by seccomp policy). Otherwise blocks are read synchronously by
+ * pread, with the kernel asked to read the scheduled ranges ahead.
+ */
+
+#ifndef _WIN32
+
+#ifdef IOREAD_HAVE_URING
+
+static int
+uring_setup (struct ioread_uring *ring, unsigned entries)
+{
+	struct io_uring_params params;
+
+	memset (&params, 0, sizeof (params));
+	memset (ring, 0, sizeof (struct ioread_uring));
+
+	ring->fd = syscall (__NR_io_uring_setup, entries, &params);
+
+	if ( ring->fd == -1 )
+		return errno;
+
+	ring->sq_len = params.sq_off.array + params.sq_entries * sizeof (unsigned);
+	ring->cq_len = params.cq_off.cqes + params.cq_entries * sizeof (struct io_uring_cqe);
+	ring->sqes_len = params.sq_entries * sizeof (struct io_uring_sqe);
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if ( params.features & IORING_FEAT_SINGLE_MMAP ){
+		if ( ring->cq_len > ring->sq_len )
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = 0;
+	}
+#endif
+
+	ring->sq_ptr = mmap (NULL, ring->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+
+	if ( ring->sq_ptr == MAP_FAILED )
+		goto fail;
+
+	if ( ring->cq_len > 0 ){
+		ring->cq_ptr = mmap (NULL, ring->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+
+		if ( ring->cq_ptr == MAP_FAILED )
+			goto fail;
+	} else {
+		ring->cq_ptr = ring->sq_ptr;
+	}
+
+	ring->sqes = mmap (NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+
+	if ( ring->sqes == MAP_FAILED )
+		goto fail;
+
+	ring->sq_tail = (unsigned*) ((char*) ring->sq_ptr + params.sq_off.tail);
+	ring->sq_mask = (unsigned*) ((char*) ring->sq_ptr + params.sq_off.ring_mask);
+	ring->sq_array = (unsigned*) ((char*) ring->sq_ptr + params.sq_off.array);
+	ring->cq_head = (unsigned*) ((char*) ring->cq_ptr + params.cq_off.head);
+	ring->cq_tail = (unsigned*) ((char*) ring->cq_ptr + params.cq_off.tail);
+	ring->cq_mask = (unsigned*) ((char*) ring->cq_ptr + params.cq_off.ring_mask);
+	ring->cqes = (char*) ring->cq_ptr + params.cq_off.cqes;
+
+	return 0;
+
+fail:
+	if ( ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED )
+		munmap (ring->sq_ptr, ring->sq_len);
+
+	if ( ring->cq_len > 0 && ring->cq_ptr != NULL && ring->cq_ptr != MAP_FAILED )
+		munmap (ring->cq_ptr, ring->cq_len);
+
+	close (ring->fd);
+	ring->fd = -1;
+
+	return ENOMEM;
+}
+
+static void
+uring_free (struct ioread_uring *ring)
+{
+	munmap (ring->sqes, ring->sqes_len);
+
+	if ( ring->cq_len > 0 )
+		munmap (ring->cq_ptr, ring->cq_len);
+
+	munmap (ring->sq_ptr, ring->sq_len);
+	close (ring->fd);
+}
+
+static void
+uring_push (struct ioread_uring *ring, int fd, struct ioread_block *block)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+
+	tail = *ring->sq_tail;
+	idx = tail & *ring->sq_mask;
+
+	sqe = &(((struct io_uring_sqe*) ring->sqes)[idx]);
+	memset (sqe, 0, sizeof (struct io_uring_sqe));
+
+	block->iov.iov_base = block->data + block->len;
+	block->iov.iov_len = block->want - block->len;
+
+	sqe->opcode = IORING_OP_READV;
+	sqe->fd = fd;
+	sqe->off = block->offset + block->len;
+	sqe->addr = (uint64_t) (uintptr_t) &(block->iov);
+	sqe->len = 1;
+	sqe->user_data = (uint64_t) (uintptr_t) block;
+
+	ring->sq_array[idx] = idx;
+	__atomic_store_n (ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	ring->queued++;
+}
+
+static int
+uring_enter (struct ioread_uring *ring, unsigned min_complete)
+{
+	int rval;
+
+	rval = syscall (__NR_io_uring_enter, ring->fd, ring->queued, min_complete, (min_complete > 0) ? IORING_ENTER_GETEVENTS:0, NULL, 0);
+
+	if ( rval == -1 ){
+		if ( errno == EINTR || errno == EAGAIN || errno == EBUSY )
+			return 0;
+
+		return errno;
+	}
+
+	ring->queued -= rval;
+
+	return 0;
+}
+
+/* Process completed reads, wait for at least one if there are none. */
+static int
+uring_reap (struct ioread *io)
+{
+	struct ioread_uring *ring;
+	struct io_uring_cqe *cqe;
+	struct ioread_block *block;
+	unsigned head;
+	int res, rval;
+
+	ring = &(io->ring);
+	head = *ring->cq_head;
+
+	if ( head == __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE) ){
+		rval = uring_enter (ring, 1);
+
+		if ( rval != 0 )
+			return rval;
+	}
+
+	while ( head != __atomic_load_n (ring->cq_tail, __ATOMIC_ACQUIRE) ){
+		cqe = &(((struct io_uring_cqe*) ring->cqes)[head & *ring->cq_mask]);
+		block = (struct ioread_block*) (uintptr_t) cqe->user_data;
+		res = cqe->res;
+
+		head++;
+		__atomic_store_n (ring->cq_head, head, __ATOMIC_RELEASE);
+
+		if ( res == -EINTR || res == -EAGAIN ){
+			uring_push (ring, io->files[block->file].fd, block);
+		} else if ( res < 0 ){
+			block->error = -res;
+			block->state = IOREAD_DONE;
+		} else if ( res == 0 ){
+			/* File was truncated since it was opened. */
+			block->state = IOREAD_DONE;
+		} else {
+			block->len += res;
+
+			if ( block->len < block->want )
+				uring_push (ring, io->files[block->file].fd, block);
+			else
+				block->state = IOREAD_DONE;
+		}
+	}
+
+	return 0;
+}
+
+#endif
+
+static int
+ioread_open_file (struct ioread *io, struct ioread_file *file)
+{
+	struct stat st;
+
+	file->fd = open (file->path, O_RDONLY);
+
+	if ( file->fd == -1 ){
+		file->error = errno;
+		return 1;
+	}
+
+	if ( fstat (file->fd, &st) == -1 )
+		file->error = errno;
+	else if ( ! S_ISREG (st.st_mode) )
+		file->error = EINVAL;
+
+	if ( file->error != 0 ){
+		close (file->fd);
+		file->fd = -1;
+		return 1;
+	}
+
+	file->size = st.st_size;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise (file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+	return 0;
+}
+
+static void
+ioread_close_file (struct ioread_file *file)
+{
+	if ( file->fd != -1 )
+		close (file->fd);
+
+	file->fd = -1;
+}
+
+/* Schedule reads of the next blocks until the queue is full. */
+static int
+ioread_fill (struct ioread *io)
+{
+	struct ioread_file *file;
+	struct ioread_block *block;
+	uint64_t left;
+
+	while ( io->cnt < io->depth && io->sched_file < io->file_cnt ){
+		file = &(io->files[io->sched_file]);
+
+		if ( file->fd == -1 && file->error == 0 )
+			ioread_open_file (io, file);
+
+		if ( file->fd == -1 || io->sched_off >= file->size ){
+			io->sched_file++;
+			io->sched_off = 0;
+			continue;
+		}
+
+		block = &(io->blocks[(io->head + io->cnt) % io->depth]);
+		left = file->size - io->sched_off;
+
+		block->file = io->sched_file;
+		block->offset = io->sched_off;
+		block->want = (left < io->block_size) ? left:io->block_size;
+		block->len = 0;
+		block->error = 0;
+		block->state = IOREAD_PENDING;
+
+#ifdef IOREAD_HAVE_URING
+		if ( io->mode == IOREAD_URING )
+			uring_push (&(io->ring), file->fd, block);
+#endif
+
+#ifdef POSIX_FADV_WILLNEED
+		if ( io->mode == IOREAD_PLAIN )
+			posix_fadvise (file->fd, block->offset, block->want, POSIX_FADV_WILLNEED);
+#endif
+
+		io->sched_off += block->want;
+		io->cnt++;
+	}
+
+#ifdef IOREAD_HAVE_URING
+	if ( io->mode == IOREAD_URING && io->ring.queued > 0 )
+		return uring_enter (&(io->ring), 0);
+#endif
+
+	return 0;
+}
+
+static int
+ioread_wait (struct ioread *io, struct ioread_block *block)
+{
+	ssize_t rval;
+
+	if ( io->mode == IOREAD_PLAIN ){
+		while ( block->len < block->want ){
+			rval = pread (io->files[block->file].fd, block->data + block->len, block->want - block->len, block->offset + block->len);
+
+			if ( rval == -1 ){
+				if ( errno == EINTR )
+					continue;
+
+				block->error = errno;
+				break;
+			} else if ( rval == 0 ){
+				break;
+			}
+
+			block->len += rval;
+		}
+
+		block->state = IOREAD_DONE;
+	}
+
+#ifdef IOREAD_HAVE_URING
+	while ( block->state != IOREAD_DONE ){
+		rval = uring_reap (io);
+
+		if ( rval != 0 )
+			return rval;
+	}
+#endif
+
+	return 0;
+}
+
+/* Release the block handed out to the consumer. */
+static void
+ioread_release (struct ioread *io)
+{
+	if ( ! io->held )
+		return;
+
+	io->blocks[io->head].state = IOREAD_FREE;
+	io->head = (io->head + 1) % io->depth;
+	io->cnt--;
+	io->held = 0;
+}
+
+int
+ioread_init (struct ioread *io, size_t depth, size_t block_size)
+{
+	size_t i;
+
+	memset (io, 0, sizeof (struct ioread));
+
+	io->depth = (depth > 0) ? depth:IOREAD_DEPTH;
+	io->block_size = (block_size > 0) ? block_size:IOREAD_BLOCK;
+
+	io->blocks = (struct ioread_block*) calloc (io->depth, sizeof (struct ioread_block));
+
+	if ( io->blocks == NULL )
+		return ENOMEM;
+
+	for ( i = 0; i < io->depth; i++ ){
+		io->blocks[i].data = (uint8_t*) malloc (io->block_size);
+
+		if ( io->blocks[i].data == NULL ){
+			ioread_free (io);
+			return ENOMEM;
+		}
+	}
+
+	io->mode = IOREAD_PLAIN;
+
+#ifdef IOREAD_HAVE_URING
+	if ( uring_setup (&(io->ring), io->depth) == 0 )
+		io->mode = IOREAD_URING;
+#endif
+
+	return 0;
+}
+
+int
+ioread_add (struct ioread *io, const char *path)
+{
+	struct ioread_file *files;
+
+	files = (struct ioread_file*) realloc (io->files, sizeof (struct ioread_file) * (io->file_cnt + 1));
+
+	if ( files == NULL )
+		return ENOMEM;
+
+	io->files = files;
+	memset (&(files[io->file_cnt]), 0, sizeof (struct ioread_file));
+	files[io->file_cnt].fd = -1;
+
+	/* Placeholder for an input not read by this layer (standard input). */
+	if ( path == NULL ){
+		files[io->file_cnt].error = EINVAL;
+	} else {
+		files[io->file_cnt].path = strdup (path);
+
+		if ( files[io->file_cnt].path == NULL )
+			return ENOMEM;
+	}
+
+	io->file_cnt++;
+
+	return 0;
+}
+
+/* Move on to the next file added by ioread_add. Unread blocks of the current
+ * file are dropped. Return 0 if the file is ready to be read. */
+int
+ioread_begin (struct ioread *io)
+{
+	struct ioread_block *block;
+	int rval;
+
+	ioread_release (io);
+
+	if ( io->started ){
+		while ( io->cnt > 0 && io->blocks[io->head].file == io->cur ){
+			block = &(io->blocks[io->head]);
+
+			/* Buffer may be released only once the read is done. */
+			if ( io->mode == IOREAD_URING && block->state == IOREAD_PENDING ){
+				rval = ioread_wait (io, block);
+
+				if ( rval != 0 )
+					return rval;
+			}
+
+			io->held = 1;
+			ioread_release (io);
+		}
+
+		if ( io->sched_file == io->cur ){
+			io->sched_file++;
+			io->sched_off = 0;
+		}
+
+		ioread_close_file (&(io->files[io->cur]));
+		io->cur++;
+	} else {
+		io->started = 1;
+		io->cur = 0;
+	}
+
+	if ( io->cur >= io->file_cnt )
+		return EINVAL;
+
+	rval = ioread_fill (io);
+
+	if ( rval != 0 )
+		return rval;
+
+	if ( io->files[io->cur].fd == -1 && io->files[io->cur].error == 0 )
+		ioread_open_file (io, &(io->files[io->cur]));
+
+	return io->files[io->cur].error;
+}
+
+/* Get the next block of the current file, which remains valid until the next
+ * call. On the end of the file, len is set to 0. */
+int
+ioread_get (struct ioread *io, const uint8_t **data, size_t *len)
+{
+	struct ioread_block *block;
+	int rval;
+
+	ioread_release (io);
+
+	rval = ioread_fill (io);
+
+	if ( rval != 0 )
+		return rval;
+
+	*len = 0;
+
+	if ( io->cnt == 0 || io->blocks[io->head].file != io->cur )
+		return 0;
+
+	block = &(io->blocks[io->head]);
+	rval = ioread_wait (io, block);
+
+	if ( rval != 0 )
+		return rval;
+
+	io->held = 1;
+
+	if ( block->error != 0 )
+		return block->error;
+
+	*data = block->data;
+	*len = block->len;
+
+	return 0;
+}
+
+void
+ioread_free (struct ioread *io)
+{
+	size_t i;
+
+	/* The kernel may still write into buffers of pending reads. */
+#ifdef IOREAD_HAVE_URING
+	if ( io->mode == IOREAD_URING ){
+		for ( i = 0; i < io->cnt; i++ ){
+			if ( io->blocks[(io->head + i) % io->depth].state == IOREAD_PENDING
+					&& ioread_wait (io, &(io->blocks[(io->head + i) % io->depth])) != 0 )
+				return;
+		}
+
+		uring_free (&(io->ring));
+	}
+#endif
+
+	if ( io->blocks != NULL ){
+		for ( i = 0; i < io->depth; i++ ){
+			if ( io->blocks[i].data != NULL )
+				free (io->blocks[i].data);
+		}
+
+		free (io->blocks);
+	}
+
+	for ( i = 0; i < io->file_cnt; i++ ){
+		ioread_close_file (&(io->files[i]));
+
+		if ( io->files[i].path != NULL )
+			free (io->files[i].path);
+	}
+
+	if ( io->files != NULL )
+		free (io->files);
+
+	memset (io, 0, sizeof (struct ioread));
+}
+
+#else
+
+int
+ioread_init (struct ioread *io, size_t depth, size_t block_size)
+{
+	memset (io, 0, sizeof (struct ioread));
+
+	return ENOSYS;
+}
+
+int
+ioread_add (struct ioread *io, const char *path)
+{
+	return ENOSYS;
+}
+
+int
+ioread_begin (struct ioread *io)
+{
+	return ENOSYS;
+}
+
+int
+ioread_get (struct ioread *io, const uint8_t **data, size_t *len)
+{
+	*len = 0;
+
+	return ENOSYS;
+}
+
+void
+ioread_free (struct ioread *io)
+{
+}
+
+#endif
+
@@ -0,0 +1,119 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _IOREAD_H
+#define _IOREAD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#define IOREAD_DEPTH 8
+#define IOREAD_BLOCK (1024 * 1024)
+
+enum
+{
+	IOREAD_PLAIN = 1,
+	IOREAD_URING = 2
+};
+
+enum
+{
+	IOREAD_FREE = 0,
+	IOREAD_PENDING = 1,
+	IOREAD_DONE = 2
+};
+
+struct ioread_file
+{
+	char *path;
+	int fd;
+	int error;
+	uint64_t size;
+};
+
+struct ioread_block
+{
+	uint8_t *data;
+#ifndef _WIN32
+	struct iovec iov;
+#endif
+	size_t file;
+	uint64_t offset;
+	size_t want;
+	size_t len;
+	int state;
+	int error;
+};
+
+struct ioread_uring
+{
+	int fd;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	void *sqes;
+	void *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_len;
+	size_t cq_len;
+	size_t sqes_len;
+	unsigned queued;
+};
+
+struct ioread
+{
+	int mode;
+	struct ioread_file *files;
+	size_t file_cnt;
+	size_t cur;
+	int started;
+	struct ioread_block *blocks;
+	size_t depth;
+	size_t block_size;
+	size_t head;
+	size_t cnt;
+	int held;
+	size_t sched_file;
+	uint64_t sched_off;
+	struct ioread_uring ring;
+};
+
+extern int ioread_init (struct ioread *io, size_t depth, size_t block_size);
+
+extern int ioread_add (struct ioread *io, const char *path);
+
+extern int ioread_begin (struct ioread *io);
+
+extern int ioread_get (struct ioread *io, const uint8_t **data, size_t *len);
+
+extern void ioread_free (struct ioread *io);
+
+#endif
+
@@ -226,11 +226,90 @@ lscript_prepare (struct lscript *script, int argc, char *argv[])
 	return 0;
 }
 
+/* Copy functions registered by lscript_add_api into table 'capdiss'. Fields
+ * already defined by a script are left untouched. If the table does not exist
+ * yet, create it, so that the functions are reachable from the main chunk. */
+static int
+lua_export_api (lua_State *lua_state)
+{
+	if ( ! lua_checkstack (lua_state, 4) )
+		return 1;
+
+	lua_getfield (lua_state, LUA_REGISTRYINDEX, LSCRIPT_API_TABLE);
+
+	if ( ! lua_istable (lua_state, -1) ){
+		lua_pop (lua_state, 1);
+		return 0;
+	}
+
+	lua_getglobal (lua_state, CAPDISS_TABLE);
+
+	if ( lua_isnil (lua_state, -1) ){
+		lua_pop (lua_state, 1);
+		lua_newtable (lua_state);
+		lua_pushvalue (lua_state, -1);
+		lua_setglobal (lua_state, CAPDISS_TABLE);
+	} else if ( ! lua_istable (lua_state, -1) ){
+		lua_pop (lua_state, 2);
+		return 0;
+	}
+
+	lua_pushnil (lua_state);
+
+	while ( lua_next (lua_state, -3) != 0 ){
+		lua_pushvalue (lua_state, -2);
+		lua_rawget (lua_state, -4);
+
+		if ( lua_isnil (lua_state, -1) ){
+			lua_pop (lua_state, 1);
+			lua_pushvalue (lua_state, -2);
+			lua_insert (lua_state, -2);
+			lua_rawset (lua_state, -4);
+		} else {
+			lua_pop (lua_state, 2);
+		}
+	}
+
+	lua_pop (lua_state, 2);
+
+	return 0;
+}
+
+int
+lscript_add_api (struct lscript *script, const luaL_Reg *funcs, void *udata)
+{
+	if ( ! lua_checkstack (script->state, 3) ){
+		luaL_error (script->state, "Lua stack is full");
+		return 1;
+	}
+
+	lua_getfield (script->state, LUA_REGISTRYINDEX, LSCRIPT_API_TABLE);
+
+	if ( ! lua_istable (script->state, -1) ){
+		lua_pop (script->state, 1);
+		lua_newtable (script->state);
+		lua_pushvalue (script->state, -1);
+		lua_setfield (script->state, LUA_REGISTRYINDEX, LSCRIPT_API_TABLE);
+	}
+
+	/* Each function receives the module's private data as an upvalue. */
+	lua_pushlightuserdata (script->state, udata);
+	luaL_setfuncs (script->state, funcs, 1);
+	lua_pop (script->state, 1);
+
+	return 0;
+}
+
 int
 lscript_do_payload (struct lscript *script)
 {
 	int rval;
 
+	if ( lua_export_api (script->state) != 0 ){
+		lua_pushstring (script->state, "Lua stack is full");
+		return 1;
+	}
+
 	switch ( script->type ){
 		case LSCRIPT_SRC:
 			rval = lua_load_source (script->state, script->payload);
@@ -248,6 +327,12 @@ lscript_do_payload (struct lscript *script)
 			return 1;
 	}
 
+	/* Script might have replaced table 'capdiss' with its own. */
+	if ( rval == 0 && lua_export_api (script->state) != 0 ){
+		lua_pushstring (script->state, "Lua stack is full");
+		return 1;
+	}
+
 	return rval;
 }
 
@@ -25,8 +25,10 @@
 #define _LSCRIPT_LIST_H
 
 #include <lua.h>
+#include <lauxlib.h>
 
 #define CAPDISS_TABLE "capdiss"
+#define LSCRIPT_API_TABLE "capdiss.api"
 
 enum
 {
@@ -67,6 +69,8 @@ extern int lscript_prepare (struct lscript *script, int argc, char *argv[]);
 
 extern int lscript_do_payload (struct lscript *script);
 
+extern int lscript_add_api (struct lscript *script, const luaL_Reg *funcs, void *udata);
+
 extern int lscript_get_table_item (struct lscript *script, const char *name, int type);
 
 extern int lscript_set_glbstring (struct lscript *script, const char *name, const char *value);
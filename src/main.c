@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <math.h>
 #include <pcap.h>
 #include <getopt.h>
 #include <lua.h>
@@ -34,11 +35,32 @@
 #include <signal.h>
 #include <setjmp.h>
 #include <unistd.h>
+#include <fcntl.h>
 
 #include "capdiss.h"
 #include "pathname.h"
 #include "lscript_list.h"
 #include "flist.h"
+#include "route.h"
+#include "reasm.h"
+#include "dedup.h"
+#include "timer.h"
+#include "budget.h"
+#include "emit.h"
+#include "arrow.h"
+#include "ioread.h"
+#include "reader.h"
+#include "progress.h"
+#include "simd.h"
+#include "matcher.h"
+#include "prefix.h"
+#include "prefetch.h"
+#include "split.h"
+#include "bpfjit.h"
+#include "store.h"
+#include "dataset.h"
+#include "decap.h"
+#include "cache.h"
 
 static int loop;
 static int exitno;
@@ -54,7 +76,54 @@ capdiss_usage (const char *p)
 	fprintf (stderr, "Usage: %s <options> <script-name> [args ...]\n\n\
 Options:\n\
  -f, --file=<pcap-file>    read network frames from a file\n\
+     --files-from=<list>   read names of input files from a file, one per line,\n\
+                           '-' reads the list from stdin\n\
  -F, --filter=<filter>     apply packet filter before reading from a file\n\
+     --no-jit              run packet filters in the libpcap interpreter instead\n\
+                           of translating them to machine code\n\
+ -R, --reassemble          reassemble IP fragments and TCP streams\n\
+     --reasm-memcap=<size> limit memory used by reassembly (default 64M)\n\
+     --reasm-flowcap=<size>\n\
+                           limit data queued per TCP flow (default 1M)\n\
+     --reasm-timeout=<sec> close flows idle for <sec> seconds (default 120)\n\
+ -D, --dedup               drop duplicate frames\n\
+     --dedup-window=<n>    compare a frame with <n> preceding frames (default 1024)\n\
+     --dedup-time=<sec>    ignore duplicates older than <sec> seconds, 0 means\n\
+                           no limit (default 1.0)\n\
+     --dedup-ignore=<list> bytes ignored when comparing frames, comma separated\n\
+                           list of 'ttl', 'ipcsum', 'l2' and <offset>:<length>\n\
+                           (default 'ttl,ipcsum')\n\
+     --decap=<list>        strip encapsulations, position and link-type of the\n\
+                           inner frame and tunnel identifiers are passed to\n\
+                           'each', comma separated list of 'vlan', 'mpls',\n\
+                           'gre', 'vxlan', 'gtp' or 'all'\n\
+     --budget-insns=<n>    limit a call of 'each' to <n> Lua instructions\n\
+     --budget-time=<usec>  limit a call of 'each' to <usec> microseconds\n\
+     --budget-policy=<policy>\n\
+                           what to do if a call exceeds the budget: 'abort'\n\
+                           the program, 'skip' the call, or 'log' it (default\n\
+                           'abort')\n\
+     --emit-output=<file>  write records passed to 'capdiss.emit' to a file\n\
+                           instead of stdout\n\
+     --emit-format=<format>\n\
+                           format of emitted records: 'jsonl', 'csv' or 'bin'\n\
+                           (default 'bin' for regular files, 'jsonl' otherwise)\n\
+     --io-depth=<n>        keep up to <n> reads in flight across input files,\n\
+                           0 reads all files via libpcap (default 8)\n\
+     --io-block=<size>     size of a single read (default 1M)\n\
+     --prefetch=<n>        open and read ahead <n> files following the one\n\
+                           being processed, 0 disables it (default 2)\n\
+     --progress[=<sec>]    report progress every <sec> seconds (default 10)\n\
+     --stats-file=<file>   write progress reports to a file instead of stderr\n\
+ -j, --jobs=<n>            split a single classic pcap file into <n> parts\n\
+                           processed in parallel, results returned by 'finish'\n\
+                           are passed to 'capdiss.merge' in order\n\
+     --cache=<dir>         store results returned by 'finish' for each input\n\
+                           file in <dir>, files with a stored result are not\n\
+                           read again, results are passed to 'capdiss.merge'\n\
+                           in order\n\
+     --cache-hash          identify input files also by a hash of their\n\
+                           contents, not only by size and modification time\n\
  -v, --version             show version information\n\
  -h, --help                show usage information\n", p);
 }
@@ -65,6 +134,750 @@ capdiss_version (const char *p)
 	fprintf (stderr, "%s %u.%u.%u\n%s\n%s\n", p, CAPDISS_VERSION_MAJOR, CAPDISS_VERSION_MINOR, CAPDISS_VERSION_PATCH, pcap_lib_version (), LUA_VERSION);
 }
 
+/* Parse a non-negative decimal number. */
+static int
+capdiss_parse_ulong (const char *str, unsigned long *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtoul (str, &end, 10);
+
+	if ( errno != 0 || end == str || *end != '\0' || strchr (str, '-') != NULL )
+		return 1;
+
+	return 0;
+}
+
+/* Parse a non-negative, finite number of seconds. */
+static int
+capdiss_parse_seconds (const char *str, double *val)
+{
+	char *end;
+
+	errno = 0;
+	*val = strtod (str, &end);
+
+	if ( errno != 0 || end == str || *end != '\0' || ! isfinite (*val) || *val < 0 )
+		return 1;
+
+	return 0;
+}
+
+/* Parse a size with an optional suffix K, M or G. */
+static int
+capdiss_parse_size (const char *str, size_t *size)
+{
+	unsigned long long val;
+	char *end;
+
+	errno = 0;
+	val = strtoull (str, &end, 10);
+
+	if ( errno != 0 || end == str )
+		return 1;
+
+	switch ( *end ){
+		case 'G':
+		case 'g':
+			val *= 1024;
+			/* fall through */
+		case 'M':
+		case 'm':
+			val *= 1024;
+			/* fall through */
+		case 'K':
+		case 'k':
+			val *= 1024;
+			end++;
+			break;
+	}
+
+	if ( *end != '\0' )
+		return 1;
+
+	*size = (size_t) val;
+
+	return 0;
+}
+
+static int
+capdiss_stream_push_flow (struct lscript *script, struct reasm_flow *flow)
+{
+	size_t alen;
+
+	if ( flow->ref >= 0 ){
+		lua_rawgeti (script->state, LUA_REGISTRYINDEX, flow->ref);
+		return 0;
+	}
+
+	alen = (flow->family == 4) ? 4:16;
+
+	lua_createtable (script->state, 0, 6);
+
+	lua_pushnumber (script->state, flow->id);
+	lua_setfield (script->state, -2, "id");
+	lua_pushinteger (script->state, flow->family);
+	lua_setfield (script->state, -2, "family");
+	lua_pushlstring (script->state, (const char*) flow->addr[REASM_DIR_CLIENT], alen);
+	lua_setfield (script->state, -2, "src");
+	lua_pushlstring (script->state, (const char*) flow->addr[REASM_DIR_SERVER], alen);
+	lua_setfield (script->state, -2, "dst");
+	lua_pushinteger (script->state, flow->port[REASM_DIR_CLIENT]);
+	lua_setfield (script->state, -2, "sport");
+	lua_pushinteger (script->state, flow->port[REASM_DIR_SERVER]);
+	lua_setfield (script->state, -2, "dport");
+
+	/* Keep the table for the lifetime of the flow, scripts may store their
+	 * own data in it. */
+	lua_pushvalue (script->state, -1);
+	flow->ref = luaL_ref (script->state, LUA_REGISTRYINDEX);
+
+	return 0;
+}
+
+static int
+capdiss_stream (void *udata, struct reasm_flow *flow, int dir, const uint8_t *data, size_t len)
+{
+	struct lscript *script;
+
+	script = (struct lscript*) udata;
+
+	if ( lscript_get_table_item (script, "stream", LUA_TFUNCTION) != 0 )
+		return 0;
+
+	if ( ! lua_checkstack (script->state, 5) ){
+		lua_pushstring (script->state, "internal error: Lua stack is full");
+		return 1;
+	}
+
+	capdiss_stream_push_flow (script, flow);
+	lua_pushinteger (script->state, dir);
+	lua_pushlstring (script->state, (const char*) data, len);
+
+	if ( lua_pcall (script->state, 3, 0, 0) != LUA_OK )
+		return 1;
+
+	return 0;
+}
+
+static int
+capdiss_stream_close (void *udata, struct reasm_flow *flow)
+{
+	struct lscript *script;
+	int rval;
+
+	script = (struct lscript*) udata;
+	rval = 0;
+
+	if ( lscript_get_table_item (script, "stream_close", LUA_TFUNCTION) == 0 ){
+
+		if ( ! lua_checkstack (script->state, 3) ){
+			lua_pushstring (script->state, "internal error: Lua stack is full");
+			return 1;
+		}
+
+		capdiss_stream_push_flow (script, flow);
+
+		if ( lua_pcall (script->state, 1, 0, 0) != LUA_OK )
+			rval = 1;
+	}
+
+	if ( flow->ref >= 0 ){
+		luaL_unref (script->state, LUA_REGISTRYINDEX, flow->ref);
+		flow->ref = -1;
+	}
+
+	return rval;
+}
+
+static void
+capdiss_reasm_report (const char *p, struct reasm *reasm)
+{
+	fprintf (stderr, "%s: reassembly: %lu flows, %lu segments, %lu bytes delivered, %lu out-of-order, %lu retransmitted, %lu gaps, %lu timed out\n",
+				p, reasm->stats.flows, reasm->stats.segments, reasm->stats.bytes, reasm->stats.ooo, reasm->stats.retrans, reasm->stats.gaps, reasm->stats.timeouts);
+	fprintf (stderr, "%s: reassembly: %lu fragments, %lu datagrams reassembled, %lu fragments dropped, %lu fragments timed out\n",
+				p, reasm->stats.frags, reasm->stats.dgrams, reasm->stats.frag_drops, reasm->stats.frag_timeouts);
+	fprintf (stderr, "%s: reassembly: memory peak %lu of %lu bytes, memcap hit %lu times, flowcap (%lu bytes) hit %lu times\n",
+				p, (unsigned long) reasm->stats.mem_peak, (unsigned long) reasm->memcap, reasm->stats.memcap_hits, (unsigned long) reasm->flowcap, reasm->stats.flowcap_hits);
+}
+
+/* Call a function processing a frame within the execution budget. */
+static int
+capdiss_pcall_frame (const char *p, struct lscript *script, struct budget *budget, int nargs, unsigned long frame)
+{
+	int rval;
+
+	budget_start (budget, script->state);
+	rval = lua_pcall (script->state, nargs, 0, 0);
+	budget_stop (budget, script->state);
+
+	if ( ! budget->exceeded )
+		return rval;
+
+	switch ( budget->policy ){
+		case BUDGET_ABORT:
+			/* Prefix the error with the number of the offending frame, it is
+			 * reported by the caller. */
+			if ( rval != LUA_OK && lua_checkstack (script->state, 3) ){
+				lua_pushstring (script->state, "frame ");
+				lua_pushnumber (script->state, frame);
+				lua_pushstring (script->state, ": ");
+				lua_pushvalue (script->state, -4);
+				lua_concat (script->state, 4);
+				lua_remove (script->state, -2);
+			}
+			break;
+
+		case BUDGET_SKIP:
+			if ( rval != LUA_OK ){
+				fprintf (stderr, "%s: frame %lu: %s, call skipped\n", p, frame, lua_tostring (script->state, -1));
+				lua_pop (script->state, 1);
+				rval = LUA_OK;
+			}
+			break;
+
+		case BUDGET_LOG:
+			fprintf (stderr, "%s: frame %lu: execution budget exceeded\n", p, frame);
+			break;
+	}
+
+	return rval;
+}
+
+/* State of the read loop, shared by function 'each' (push mode) and the
+ * iterator returned by 'capdiss.packets' (pull mode). Functions below return
+ * non-zero on failure and leave an error message on Lua stack. */
+struct capdiss_input
+{
+	const char *p;
+	struct lscript *script;
+	struct flist_path *file;
+	int opened;
+	int pending;
+	int pull;
+	int stopped;
+	struct reader *reader;
+	const char *bpf;
+	struct route_list *routes;
+	struct timer_list *timers;
+	struct dedup *dedup;
+	struct decap *decap;
+	struct decap_result decap_res;
+	struct cache *cache;
+	size_t file_cnt;
+	struct reasm *reasm;
+	struct budget *budget;
+	struct progress *progress;
+	struct split *split;
+	struct prefetch *prefetch;
+	unsigned long pkt_first;
+	unsigned long pkt_cnt;
+	struct pcap_pkthdr *pkt_hdr;
+	const u_char *pkt_data;
+};
+
+/* Pass a partial result of the current file on top of Lua stack to
+ * 'capdiss.merge', along with the position of the file. */
+static int
+capdiss_input_merge (struct capdiss_input *in)
+{
+	lua_State *lua_state;
+
+	lua_state = in->script->state;
+
+	if ( exitno != EXIT_SUCCESS || lscript_get_table_item (in->script, "merge", LUA_TFUNCTION) != 0 ){
+		lua_pop (lua_state, 1);
+		return 0;
+	}
+
+	if ( ! lua_checkstack (lua_state, 1) ){
+		lua_pushstring (lua_state, "internal error: Lua stack is full");
+		return 1;
+	}
+
+	lua_insert (lua_state, -2);
+	lua_pushinteger (lua_state, in->file_cnt);
+
+	if ( lua_pcall (lua_state, 2, 0, 0) != LUA_OK )
+		return 1;
+
+	return 0;
+}
+
+/* Count the current file and look it up in the result cache. Return 1 if its
+ * result was found (and merged) and the file can be skipped, 0 if the file
+ * has to be read, -1 on failure. */
+static int
+capdiss_input_cached (struct capdiss_input *in)
+{
+	lua_State *lua_state;
+
+	in->file_cnt++;
+
+	if ( in->cache == NULL )
+		return 0;
+
+	lua_state = in->script->state;
+
+	if ( ! in->cache->file[in->file_cnt - 1].hit )
+		return 0;
+
+	if ( ! lua_checkstack (lua_state, 3) ){
+		lua_pushstring (lua_state, "internal error: Lua stack is full");
+		return -1;
+	}
+
+	if ( cache_get (in->cache, in->file_cnt - 1, lua_state) != 0 ){
+		lua_pushfstring (lua_state, "cannot decode cached result of file '%s'", in->file->path);
+		return -1;
+	}
+
+	if ( capdiss_input_merge (in) != 0 )
+		return -1;
+
+	return 1;
+}
+
+static int
+capdiss_input_open (struct capdiss_input *in)
+{
+	lua_State *lua_state;
+	const char *linktype;
+	int rval;
+
+	lua_state = in->script->state;
+
+	prefetch_advance (in->prefetch);
+
+	if ( reader_open (in->reader, in->file->path) != 0 ){
+
+		/* Are we reading from a standard input? */
+		if ( in->file->path[0] == '-' && in->file->path[1] == '\0' )
+			lua_pushfstring (lua_state, "cannot interpret input data: %s", in->reader->errbuff);
+		else
+			lua_pushfstring (lua_state, "cannot open file: %s", in->reader->errbuff);
+
+		return 1;
+	}
+
+	in->opened = 1;
+	progress_file (in->progress, in->file->path, &(in->reader->offset));
+
+	/* Reinitialize value of the packet counter for each file. A parallel
+	 * worker continues numbering frames of the preceding ranges. */
+	in->pkt_cnt = in->pkt_first;
+
+	/* Get pcap file data link value and convert it to string. This string
+	 * is passed to Lua function 'begin'. */
+	linktype = pcap_datalink_val_to_name (in->reader->linktype);
+
+	if ( in->bpf != NULL ){
+		rval = reader_setfilter (in->reader, in->bpf);
+
+		if ( rval != 0 ){
+			lua_pushfstring (lua_state, "cannot %s packet filter program: %s", (rval == 1) ? "compile":"apply", in->reader->errbuff);
+			return 1;
+		}
+	}
+
+	/* Recompile filters of the handlers registered via 'capdiss.on', if
+	 * the link-type has changed. */
+	if ( route_set_linktype (in->routes, in->reader->linktype, in->reader->snaplen) != 0 ){
+		lua_pushstring (lua_state, in->routes->errbuff);
+		return 1;
+	}
+
+	if ( exitno == EXIT_SUCCESS && lscript_get_table_item (in->script, "begin", LUA_TFUNCTION) == 0 ){
+
+		if ( ! lua_checkstack (lua_state, 2) ){
+			lua_pushstring (lua_state, "internal error: Lua stack is full");
+			return 1;
+		}
+
+		lua_pushstring (lua_state, (const char*) in->file->path);
+		lua_pushstring (lua_state, linktype);
+
+		if ( lua_pcall (lua_state, 2, 0, 0) != LUA_OK )
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+capdiss_input_close (struct capdiss_input *in)
+{
+	lua_State *lua_state;
+	int rval;
+
+	lua_state = in->script->state;
+
+	/* Streams may span multiple files, flush them after the last one (or
+	 * once function 'main' stopped reading). Each file stands on its own if
+	 * results are cached per file. */
+	if ( in->reasm != NULL && (in->stopped || in->file->next == NULL || in->cache != NULL) && reasm_flush (in->reasm) != 0 )
+		return 1;
+
+	if ( exitno == EXIT_SUCCESS && lscript_get_table_item (in->script, "finish", LUA_TFUNCTION) == 0 ){
+		if ( lua_pcall (lua_state, 0, 1, 0) != LUA_OK )
+			return 1;
+
+		/* Partial result of a parallel worker */
+		if ( in->split != NULL && in->split->index > 0 ){
+			rval = split_put (in->split, lua_state, -1);
+
+			if ( rval != 0 ){
+				lua_pushfstring (lua_state, "cannot store result of function 'finish': %s",
+					(rval == EINVAL) ? "value cannot be serialized":(rval == ELOOP) ? "tables nested too deep":strerror (rval));
+				return 1;
+			}
+		} else {
+			/* Partial result of a file, kept for the following runs (unless
+			 * the file may have been read only in part). */
+			if ( in->cache != NULL ){
+				rval = in->stopped ? 0:cache_put (in->cache, in->file_cnt - 1, in->file->path, lua_state, -1);
+
+				if ( rval != 0 ){
+					lua_pushfstring (lua_state, "cannot store result of function 'finish': %s",
+						(rval == EINVAL) ? "value cannot be serialized":(rval == ELOOP) ? "tables nested too deep":strerror (rval));
+					return 1;
+				}
+			}
+
+			/* Serial runs merge results of files as they are read, the same
+			 * way as results of workers. */
+			lua_pushvalue (lua_state, -1);
+
+			if ( capdiss_input_merge (in) != 0 )
+				return 1;
+		}
+
+		lua_pop (lua_state, 1);
+	}
+
+	/* Close pcap resource, in case we have another file to process... */
+	progress_file_done (in->progress);
+	reader_close (in->reader);
+	in->opened = 0;
+	in->pending = 0;
+
+	return 0;
+}
+
+/* Read the next frame of the current file. Return 1 if a frame was read, 0 at
+ * the end of the file, -1 on failure. */
+static int
+capdiss_input_read (struct capdiss_input *in)
+{
+	lua_State *lua_state;
+	int rval;
+
+	lua_state = in->script->state;
+
+	for ( ;; ){
+		in->progress->phase = PROGRESS_READ;
+		rval = reader_next (in->reader, &(in->pkt_hdr), &(in->pkt_data));
+
+		if ( rval == -1 ){
+			/* Are we reading from a standard input? */
+			if ( in->file->path[0] == '-' && in->file->path[1] == '\0' )
+				lua_pushfstring (lua_state, "reading a frame from input data failed: %s", in->reader->errbuff);
+			else
+				lua_pushfstring (lua_state, "reading a frame from file '%s' failed: %s", in->file->path, in->reader->errbuff);
+
+			return -1;
+		} else if ( rval == -2 ){
+			/* EOF */
+			return 0;
+		}
+
+		in->pkt_cnt++;
+		progress_frame (in->progress, in->pkt_hdr->caplen);
+
+		/* Fire timers that have expired before this frame was captured. */
+		if ( timer_advance (in->timers, lua_state, (int64_t) in->pkt_hdr->ts.tv_sec * 1000000 + in->pkt_hdr->ts.tv_usec) != 0 )
+			return -1;
+
+		/* Duplicate frames are dropped, but still counted, so frame
+		 * numbers match frame's position in a file. */
+		if ( in->dedup != NULL && dedup_frame (in->dedup, in->reader->linktype, in->pkt_hdr, in->pkt_data) == 1 )
+			continue;
+
+		if ( in->decap != NULL )
+			decap_frame (in->decap, in->reader->linktype, in->pkt_data, in->pkt_hdr->caplen, &(in->decap_res));
+
+		return 1;
+	}
+}
+
+/* Push position and link-type of the inner frame, followed by tunnel
+ * identifiers, if decapsulation is enabled. Return the number of values
+ * pushed. */
+static int
+capdiss_input_push_decap (struct capdiss_input *in, lua_State *lua_state)
+{
+	size_t i;
+
+	if ( in->decap == NULL )
+		return 0;
+
+	lua_pushinteger (lua_state, in->decap_res.offset + 1);
+	lua_pushstring (lua_state, pcap_datalink_val_to_name (in->decap_res.linktype));
+
+	for ( i = 0; i < in->decap_res.id_cnt; i++ )
+		lua_pushnumber (lua_state, in->decap_res.id[i]);
+
+	return 2 + in->decap_res.id_cnt;
+}
+
+/* Pass the frame on top of stack of lua_state to the handlers registered via
+ * 'capdiss.on', with the same parameters as function 'each'. Handlers run in
+ * the main Lua state, an error message is left on top of lua_state. */
+static int
+capdiss_input_route (struct capdiss_input *in, lua_State *lua_state, size_t route_cnt)
+{
+	lua_State *main_state;
+	size_t i;
+
+	main_state = in->script->state;
+
+	if ( route_cnt > 0 && ! lua_checkstack (main_state, 6 + DECAP_IDS_MAX) ){
+		lua_pushstring (lua_state, "internal error: Lua stack is full");
+		return 1;
+	}
+
+	for ( i = 0; i < route_cnt; i++ ){
+		lua_pushvalue (lua_state, -1);
+		lua_xmove (lua_state, main_state, 1);
+		lua_rawgeti (main_state, LUA_REGISTRYINDEX, in->routes->match[i]->ref);
+		lua_insert (main_state, -2);
+		lua_pushnumber (main_state, in->pkt_hdr->ts.tv_sec + (in->pkt_hdr->ts.tv_usec / 1000000.0));
+		lua_pushnumber (main_state, in->pkt_cnt);
+
+		if ( capdiss_pcall_frame (in->p, in->script, in->budget, 3 + capdiss_input_push_decap (in, main_state), in->pkt_cnt) != LUA_OK ){
+			lua_xmove (main_state, lua_state, 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int
+capdiss_input_reasm (struct capdiss_input *in)
+{
+	if ( in->reasm != NULL && reasm_frame (in->reasm, in->reader->linktype, in->pkt_hdr, in->pkt_data) != 0 )
+		return 1;
+
+	return 0;
+}
+
+/* Push frame, timestamp and frame number of the next frame (followed by
+ * results of decapsulation, if enabled). Return the number of values pushed,
+ * 0 after the last frame of the last file, -1 on failure. */
+static int
+capdiss_input_next (struct capdiss_input *in, lua_State *lua_state)
+{
+	size_t route_cnt;
+	int rval;
+
+	/* A frame is reassembled once the script is done with it, so that data
+	 * of streams follow the frame carrying them. */
+	if ( in->pending ){
+		in->pending = 0;
+
+		if ( capdiss_input_reasm (in) != 0 )
+			return -1;
+	}
+
+	for ( ;; ){
+		if ( ! in->opened ){
+			if ( in->file == NULL || ! loop )
+				return 0;
+
+			rval = capdiss_input_cached (in);
+
+			if ( rval == -1 )
+				return -1;
+
+			if ( rval == 1 ){
+				in->file = in->file->next;
+				continue;
+			}
+
+			if ( capdiss_input_open (in) != 0 )
+				return -1;
+		}
+
+		rval = capdiss_input_read (in);
+
+		if ( rval == -1 )
+			return -1;
+		else if ( rval == 1 )
+			break;
+
+		if ( capdiss_input_close (in) != 0 )
+			return -1;
+
+		in->file = in->file->next;
+	}
+
+	route_cnt = route_match (in->routes, in->pkt_hdr, in->pkt_data);
+
+	if ( ! lua_checkstack (lua_state, 9 + DECAP_IDS_MAX) ){
+		lua_pushstring (lua_state, "internal error: Lua stack is full");
+		return -1;
+	}
+
+	lua_pushlstring (lua_state, (const char*) in->pkt_data, in->pkt_hdr->caplen);
+
+	if ( capdiss_input_route (in, lua_state, route_cnt) != 0 )
+		return -1;
+
+	in->pending = 1;
+
+	lua_pushnumber (lua_state, in->pkt_hdr->ts.tv_sec + (in->pkt_hdr->ts.tv_usec / 1000000.0));
+	lua_pushnumber (lua_state, in->pkt_cnt);
+
+	return 3 + capdiss_input_push_decap (in, lua_state);
+}
+
+/* Iterator returned by 'capdiss.packets', returns frame, timestamp and frame
+ * number (followed by results of decapsulation, if enabled), or nil after the
+ * last frame of the last file. The read loop belongs to function 'main', the
+ * iterator cannot be called from elsewhere (including functions called while
+ * the next frame is being read). */
+static int
+capdiss_lua_next (lua_State *lua_state)
+{
+	struct capdiss_input *in;
+	int rval;
+
+	in = (struct capdiss_input*) lua_touserdata (lua_state, lua_upvalueindex (1));
+
+	if ( ! in->pull )
+		return luaL_error (lua_state, "frames can be pulled only by function 'main'");
+
+	in->pull = 0;
+	rval = capdiss_input_next (in, lua_state);
+	in->pull = 1;
+
+	if ( rval == -1 )
+		return lua_error (lua_state);
+
+	return rval;
+}
+
+/* capdiss.packets () */
+static int
+capdiss_lua_packets (lua_State *lua_state)
+{
+	lua_pushvalue (lua_state, lua_upvalueindex (1));
+	lua_pushcclosure (lua_state, capdiss_lua_next, 1);
+
+	return 1;
+}
+
+static const luaL_Reg capdiss_input_api[] = {
+	{ "packets", capdiss_lua_packets },
+	{ NULL, NULL }
+};
+
+/* Add an option that changes frames passed to the script to the script hash
+ * of the result cache. */
+static void
+capdiss_cache_option (struct cache *cache, const char *name, const char *value)
+{
+	if ( value == NULL )
+		return;
+
+	cache_salt (cache, name, strlen (name) + 1);
+	cache_salt (cache, value, strlen (value) + 1);
+}
+
+/* Call 'capdiss.done' once all partial results are merged. */
+static int
+capdiss_done (const char *p, struct lscript *script)
+{
+	if ( exitno == EXIT_SUCCESS && lscript_get_table_item (script, "done", LUA_TFUNCTION) == 0 ){
+		if ( lua_pcall (script->state, 0, 0, 0) != LUA_OK ){
+			fprintf (stderr, "%s: %s\n", p, lua_tostring (script->state, -1));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Wait for parallel workers, pass their output through in order and merge
+ * their partial results. */
+static int
+capdiss_reduce (const char *p, struct lscript *script, struct split *split, struct emit *emit, int emit_fd)
+{
+	int i, failed, header, rval;
+
+	failed = split_wait (split);
+	header = (emit->format == EMIT_CSV && emit->column_cnt > 0);
+
+	fflush (stdout);
+
+	for ( i = 1; i <= split->jobs; i++ ){
+		rval = split_output (split, i, STDOUT_FILENO);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot copy output of worker %d: %s\n", p, i, strerror (rval));
+			return 1;
+		}
+
+		if ( emit_fd == -1 )
+			continue;
+
+		/* Each worker writes its own CSV header, only the first one is
+		 * kept. */
+		rval = emit_append (emit, fileno (split->worker[i - 1].emit), header);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot write emitted records: %s\n", p, strerror (rval));
+			return 1;
+		}
+
+		if ( emit->format == EMIT_CSV && lseek (fileno (split->worker[i - 1].emit), 0, SEEK_END) > 0 )
+			header = 1;
+	}
+
+	if ( failed > 0 ){
+		fprintf (stderr, "%s: %d of %d workers failed\n", p, failed, split->jobs);
+		return 1;
+	}
+
+	for ( i = 1; i <= split->jobs && exitno == EXIT_SUCCESS; i++ ){
+		if ( lscript_get_table_item (script, "merge", LUA_TFUNCTION) != 0 )
+			break;
+
+		if ( ! lua_checkstack (script->state, 3) ){
+			fprintf (stderr, "%s: internal error: Lua stack is full\n", p);
+			return 1;
+		}
+
+		rval = split_get (split, i, script->state);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot read result of worker %d: %s\n", p, i, (rval == EINVAL) ? "malformed data":strerror (rval));
+			return 1;
+		}
+
+		lua_pushinteger (script->state, i);
+
+		if ( lua_pcall (script->state, 2, 0, 0) != LUA_OK ){
+			fprintf (stderr, "%s: %s\n", p, lua_tostring (script->state, -1));
+			return 1;
+		}
+	}
+
+	return capdiss_done (p, script);
+}
+
 static void
 capdiss_hardkill (int signo)
 {
@@ -94,41 +907,139 @@ capdiss_terminate (int signo)
 int
 main (int argc, char *argv[])
 {
-	pcap_t *pcap_res;
+	struct ioread io;
+	struct reader reader;
+	struct capdiss_input input;
+	size_t io_depth, io_block;
+	struct progress progress;
+	struct split split;
+	struct split_worker *worker;
+	struct prefetch prefetch;
+	size_t prefetch_files;
+	int list_stdin;
+	unsigned long jobs;
+	const char *stats_file;
+	volatile int stats_fd;
+	unsigned long progress_interval;
 	const u_char *pkt_data;
 	struct pcap_pkthdr *pkt_hdr;
 	struct flist files;
 	struct flist_path *file;
+	struct route_list routes;
+	struct reasm reasm;
+	struct dedup dedup;
+	struct timer_list timers;
+	struct budget budget;
+	unsigned long budget_insns, budget_usec;
+	const char *budget_policy;
+	struct emit emit;
+	const char *emit_output;
+	volatile int emit_format, emit_fd;
+	const char *dedup_ignore;
+	const char *decap_list;
+	struct decap decap;
+	const char * volatile cache_dir;
+	int cache_hash;
+	struct cache cache;
+	struct flist unread;
+	char cache_opt[128];
+	size_t dedup_window;
+	double dedup_time;
+	size_t reasm_memcap, reasm_flowcap;
+	double reasm_timeout;
 	struct stat ifstatus;
-	char errbuff[PCAP_ERRBUF_SIZE];
-	unsigned long int pkt_cnt;
+	size_t route_cnt, file_idx;
+	double pkt_ts;
 	char **script_args;
-	char *bpf, *stdout_type;
-	const char *linktype;
-	struct lscript *script;
+	char * volatile bpf;
+	char *stdout_type;
+	struct lscript * volatile script;
 	struct option opt_long[] = {
 		{ "file", required_argument, 0, 'f' },
+		{ "files-from", required_argument, 0, CAPDISS_OPT_FILES_FROM },
 		{ "filter", required_argument, 0, 'F' },
+		{ "no-jit", no_argument, 0, CAPDISS_OPT_NO_JIT },
+		{ "reassemble", no_argument, 0, 'R' },
+		{ "reasm-memcap", required_argument, 0, CAPDISS_OPT_REASM_MEMCAP },
+		{ "reasm-flowcap", required_argument, 0, CAPDISS_OPT_REASM_FLOWCAP },
+		{ "reasm-timeout", required_argument, 0, CAPDISS_OPT_REASM_TIMEOUT },
+		{ "dedup", no_argument, 0, 'D' },
+		{ "dedup-window", required_argument, 0, CAPDISS_OPT_DEDUP_WINDOW },
+		{ "dedup-time", required_argument, 0, CAPDISS_OPT_DEDUP_TIME },
+		{ "dedup-ignore", required_argument, 0, CAPDISS_OPT_DEDUP_IGNORE },
+		{ "decap", required_argument, 0, CAPDISS_OPT_DECAP },
+		{ "budget-insns", required_argument, 0, CAPDISS_OPT_BUDGET_INSNS },
+		{ "budget-time", required_argument, 0, CAPDISS_OPT_BUDGET_TIME },
+		{ "budget-policy", required_argument, 0, CAPDISS_OPT_BUDGET_POLICY },
+		{ "emit-output", required_argument, 0, CAPDISS_OPT_EMIT_OUTPUT },
+		{ "emit-format", required_argument, 0, CAPDISS_OPT_EMIT_FORMAT },
+		{ "io-depth", required_argument, 0, CAPDISS_OPT_IO_DEPTH },
+		{ "io-block", required_argument, 0, CAPDISS_OPT_IO_BLOCK },
+		{ "prefetch", required_argument, 0, CAPDISS_OPT_PREFETCH },
+		{ "progress", optional_argument, 0, CAPDISS_OPT_PROGRESS },
+		{ "stats-file", required_argument, 0, CAPDISS_OPT_STATS_FILE },
+		{ "jobs", required_argument, 0, 'j' },
+		{ "cache", required_argument, 0, CAPDISS_OPT_CACHE },
+		{ "cache-hash", no_argument, 0, CAPDISS_OPT_CACHE_HASH },
 		{ "help", no_argument, 0, 'h' },
 		{ "version", no_argument, 0, 'v' },
 		{ NULL, 0, 0, 0 }
 	};
-	int rval, c, opt_index;
+	int rval, c, opt_index, has_each, use_dedup;
+	volatile int use_reasm;
 
 	loop = 1;
 	bpf = NULL;
-	pcap_res = NULL;
-	linktype = NULL;
 	script = NULL;
 	exitno = EXIT_SUCCESS;
+	use_reasm = 0;
+	reasm_memcap = REASM_MEMCAP;
+	reasm_flowcap = REASM_FLOWCAP;
+	reasm_timeout = REASM_TIMEOUT;
+	use_dedup = 0;
+	dedup_ignore = DEDUP_IGNORE;
+	decap_list = NULL;
+	cache_dir = NULL;
+	cache_hash = 0;
+	dedup_window = DEDUP_WINDOW;
+	dedup_time = DEDUP_TIME;
+	budget_insns = 0;
+	budget_usec = 0;
+	budget_policy = "abort";
+	emit_output = NULL;
+	emit_format = 0;
+	emit_fd = -1;
+	io_depth = IOREAD_DEPTH;
+	io_block = IOREAD_BLOCK;
+	prefetch_files = PREFETCH_FILES;
+	list_stdin = 0;
+	progress_interval = 0;
+	stats_file = NULL;
+	stats_fd = -1;
+	jobs = 0;
 
 	flist_init (&files);
+	flist_init (&unread);
+	route_list_init (&routes);
+	timer_list_init (&timers);
+	memset (&reasm, 0, sizeof (struct reasm));
+	memset (&dedup, 0, sizeof (struct dedup));
+	memset (&decap, 0, sizeof (struct decap));
+	memset (&cache, 0, sizeof (struct cache));
+	memset (&budget, 0, sizeof (struct budget));
+	memset (&emit, 0, sizeof (struct emit));
+	memset (&io, 0, sizeof (struct ioread));
+	memset (&progress, 0, sizeof (struct progress));
+	memset (&split, 0, sizeof (struct split));
+	memset (&prefetch, 0, sizeof (struct prefetch));
+	split.fd = -1;
+	reader_init (&reader, NULL);
 
 	/* Setup signal handlers */
 	signal (SIGINT, capdiss_terminate);
 	signal (SIGTERM, capdiss_terminate);
 
-	while ( (c = getopt_long (argc, argv, "+f:F:hv", opt_long, &opt_index)) != -1 ){
+	while ( (c = getopt_long (argc, argv, "+f:F:RDj:hv", opt_long, &opt_index)) != -1 ){
 
 		switch ( c ){
 			case 'f':
@@ -139,6 +1050,17 @@ main (int argc, char *argv[])
 				}
 				break;
 
+			case CAPDISS_OPT_FILES_FROM:
+				if ( flist_load (&files, optarg) == 1 ){
+					fprintf (stderr, "%s: cannot read file list '%s': %s\n", argv[0], optarg, strerror (errno));
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+
+				if ( strcmp (optarg, "-") == 0 )
+					list_stdin = 1;
+				break;
+
 			case 'F':
 				/* Prevent a memory leak, if the option is specified multiple
 				 * times. */
@@ -154,6 +1076,154 @@ main (int argc, char *argv[])
 				}
 				break;
 
+			case CAPDISS_OPT_NO_JIT:
+				bpfjit_enable (0);
+				break;
+
+			case 'R':
+				use_reasm = 1;
+				break;
+
+			case CAPDISS_OPT_REASM_MEMCAP:
+				if ( capdiss_parse_size (optarg, &reasm_memcap) != 0 ){
+					fprintf (stderr, "%s: invalid size '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_REASM_FLOWCAP:
+				if ( capdiss_parse_size (optarg, &reasm_flowcap) != 0 ){
+					fprintf (stderr, "%s: invalid size '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_REASM_TIMEOUT:
+				if ( capdiss_parse_seconds (optarg, &reasm_timeout) != 0 || reasm_timeout == 0 ){
+					fprintf (stderr, "%s: invalid timeout '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case 'D':
+				use_dedup = 1;
+				break;
+
+			case CAPDISS_OPT_DEDUP_WINDOW:
+				if ( capdiss_parse_size (optarg, &dedup_window) != 0 || dedup_window == 0 ){
+					fprintf (stderr, "%s: invalid window size '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_DEDUP_TIME:
+				if ( capdiss_parse_seconds (optarg, &dedup_time) != 0 ){
+					fprintf (stderr, "%s: invalid time '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_DEDUP_IGNORE:
+				dedup_ignore = optarg;
+				break;
+
+			case CAPDISS_OPT_DECAP:
+				decap_list = optarg;
+				break;
+
+			case CAPDISS_OPT_BUDGET_INSNS:
+				if ( capdiss_parse_ulong (optarg, &budget_insns) != 0 ){
+					fprintf (stderr, "%s: invalid number of instructions '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_BUDGET_TIME:
+				if ( capdiss_parse_ulong (optarg, &budget_usec) != 0 ){
+					fprintf (stderr, "%s: invalid time '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_BUDGET_POLICY:
+				budget_policy = optarg;
+				break;
+
+			case CAPDISS_OPT_EMIT_OUTPUT:
+				emit_output = optarg;
+				break;
+
+			case CAPDISS_OPT_EMIT_FORMAT:
+				emit_format = emit_parse_format (optarg);
+
+				if ( emit_format == -1 ){
+					fprintf (stderr, "%s: invalid output format '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_IO_DEPTH:
+				if ( capdiss_parse_size (optarg, &io_depth) != 0 ){
+					fprintf (stderr, "%s: invalid number of reads '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_IO_BLOCK:
+				if ( capdiss_parse_size (optarg, &io_block) != 0 || io_block == 0 ){
+					fprintf (stderr, "%s: invalid size '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_PREFETCH:
+				if ( capdiss_parse_size (optarg, &prefetch_files) != 0 ){
+					fprintf (stderr, "%s: invalid number of files '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_PROGRESS:
+				progress_interval = (optarg != NULL) ? strtoul (optarg, NULL, 10):PROGRESS_INTERVAL;
+
+				if ( progress_interval == 0 ){
+					fprintf (stderr, "%s: invalid interval '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_STATS_FILE:
+				stats_file = optarg;
+				break;
+
+			case 'j':
+				if ( capdiss_parse_ulong (optarg, &jobs) != 0 || jobs == 0 || jobs > SPLIT_JOBS_MAX ){
+					fprintf (stderr, "%s: invalid number of jobs '%s'\n", argv[0], optarg);
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+				break;
+
+			case CAPDISS_OPT_CACHE:
+				cache_dir = optarg;
+				break;
+
+			case CAPDISS_OPT_CACHE_HASH:
+				cache_hash = 1;
+				break;
+
 			case 'h':
 				capdiss_usage (argv[0]);
 				exitno = EXIT_SUCCESS;
@@ -176,6 +1246,35 @@ main (int argc, char *argv[])
 		goto cleanup;
 	}
 
+	/* Standard input holds either the file list, or frames. */
+	if ( list_stdin ){
+		for ( file = files.head; file != NULL; file = file->next ){
+			if ( strcmp (file->path, "-") == 0 ){
+				fprintf (stderr, "%s: standard input cannot be read both as a file list and as an input file\n", argv[0]);
+				exitno = EXIT_FAILURE;
+				goto cleanup;
+			}
+		}
+	}
+
+	/* Ranges of a file are processed independently, state spanning frames
+	 * (streams, duplicates) would be cut at the boundaries. */
+	if ( jobs > 0 ){
+		if ( files.head == NULL || files.head->next != NULL || strcmp (files.head->path, "-") == 0 ){
+			fprintf (stderr, "%s: option '--jobs' requires a single input file\n", argv[0]);
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		if ( use_reasm || use_dedup || progress_interval > 0 || stats_file != NULL || cache_dir != NULL ){
+			fprintf (stderr, "%s: option '--jobs' cannot be combined with '--reassemble', '--dedup', '--progress', '--stats-file' or '--cache'\n", argv[0]);
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		io_depth = 0;
+	}
+
 	/* Determine what type the stdout is. This may be helpful for scripts that
 	 * use ASCII color sequences to not use them if stdout is redirected to
 	 * another program via anonymous pipe, or to regular file. */
@@ -216,6 +1315,31 @@ main (int argc, char *argv[])
 			break;
 	}
 
+	/* Records emitted by a script are written in a binary format into regular
+	 * files, in JSON Lines format to terminals and pipes, unless told
+	 * otherwise. */
+	if ( emit_output != NULL ){
+		errno = 0;
+		emit_fd = open (emit_output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+		if ( emit_fd == -1 ){
+			fprintf (stderr, "%s: cannot open file '%s': %s\n", argv[0], emit_output, strerror (errno));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		if ( emit_format == 0 )
+			emit_format = EMIT_BIN;
+	} else if ( emit_format == 0 ){
+		emit_format = (strcmp (stdout_type, "file") == 0) ? EMIT_BIN:EMIT_JSONL;
+	}
+
+	if ( emit_init (&emit, (emit_fd != -1) ? emit_fd:STDOUT_FILENO, emit_format) != 0 ){
+		fprintf (stderr, "%s: cannot initialize output: %s\n", argv[0], strerror (errno));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
 	/* =============== */
 	/* Load Lua script */
 	/* =============== */
@@ -270,6 +1394,243 @@ main (int argc, char *argv[])
 		goto cleanup;
 	}
 
+	/* Progress reports go to stderr, unless told otherwise. Reports are
+	 * also written on SIGUSR1. */
+	if ( stats_file != NULL ){
+		errno = 0;
+		stats_fd = open (stats_file, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+		if ( stats_fd == -1 ){
+			fprintf (stderr, "%s: cannot open file '%s': %s\n", argv[0], stats_file, strerror (errno));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		if ( progress_interval == 0 )
+			progress_interval = PROGRESS_INTERVAL;
+	}
+
+	rval = progress_init (&progress, argv[0], (stats_fd != -1) ? stats_fd:STDERR_FILENO, progress_interval);
+
+	if ( rval != 0 ){
+		fprintf (stderr, "%s: cannot set up progress reports: %s\n", argv[0], strerror (rval));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	for ( file = files.head; file != NULL; file = file->next )
+		progress_add_file (&progress, file->path);
+
+	memset (&input, 0, sizeof (struct capdiss_input));
+	input.p = argv[0];
+	input.script = script;
+	input.file = files.head;
+	input.reader = &reader;
+	input.bpf = bpf;
+	input.routes = &routes;
+	input.timers = &timers;
+	input.dedup = use_dedup ? &dedup:NULL;
+	input.decap = (decap_list != NULL) ? &decap:NULL;
+	input.cache = (cache_dir != NULL) ? &cache:NULL;
+	input.reasm = use_reasm ? &reasm:NULL;
+	input.budget = &budget;
+	input.progress = &progress;
+
+	if ( lscript_add_api (script, capdiss_input_api, &input) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	input.split = &split;
+	input.prefetch = &prefetch;
+
+	if ( lscript_add_api (script, split_api, &split) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, progress_api, &progress) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, route_api, &routes) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, timer_api, &timers) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, emit_api, &emit) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, arrow_api, NULL) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	simd_init ();
+
+	if ( lscript_add_api (script, simd_api, NULL) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, matcher_api, NULL) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, prefix_api, NULL) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, store_api, NULL) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( lscript_add_api (script, dataset_api, NULL) == 1 ){
+		fprintf (stderr, "%s: cannot prepare Lua environment: %s\n", argv[0], lscript_strerror (script));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( budget_init (&budget, budget_insns, budget_usec, budget_policy) != 0 ){
+		fprintf (stderr, "%s: invalid budget policy '%s'\n", argv[0], budget_policy);
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( use_dedup && dedup_init (&dedup, dedup_window, dedup_time, dedup_ignore) != 0 ){
+		fprintf (stderr, "%s: cannot initialize deduplication: %s\n", argv[0], dedup.errbuff);
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( decap_list != NULL && decap_init (&decap, decap_list) != 0 ){
+		fprintf (stderr, "%s: cannot initialize decapsulation: %s\n", argv[0], decap.errbuff);
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	if ( use_reasm && reasm_init (&reasm, reasm_memcap, reasm_flowcap, reasm_timeout, capdiss_stream, capdiss_stream_close, script) != 0 ){
+		fprintf (stderr, "%s: cannot allocate memory: %s\n", argv[0], strerror (errno));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
+
+	/* Stored results are valid for the same script, run with the same
+	 * arguments and options that change frames passed to the script. */
+	if ( cache_dir != NULL ){
+		rval = cache_init (&cache, cache_dir, cache_hash);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot create cache directory '%s': %s\n", argv[0], cache_dir, strerror (rval));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		if ( script->type == LSCRIPT_FILE ){
+			rval = cache_salt_file (&cache, script->payload);
+
+			if ( rval != 0 ){
+				fprintf (stderr, "%s: cannot read file '%s': %s\n", argv[0], script->payload, strerror (rval));
+				exitno = EXIT_FAILURE;
+				goto cleanup;
+			}
+		} else {
+			cache_salt (&cache, script->payload, strlen (script->payload) + 1);
+		}
+
+		for ( c = optind + 1; c < argc; c++ )
+			cache_salt (&cache, argv[c], strlen (argv[c]) + 1);
+
+		capdiss_cache_option (&cache, "filter", bpf);
+		capdiss_cache_option (&cache, "decap", decap_list);
+
+		if ( use_reasm ){
+			snprintf (cache_opt, sizeof (cache_opt), "%lu:%lu:%.17g", (unsigned long) reasm_memcap, (unsigned long) reasm_flowcap, reasm_timeout);
+			capdiss_cache_option (&cache, "reassemble", cache_opt);
+		}
+
+		if ( use_dedup ){
+			snprintf (cache_opt, sizeof (cache_opt), "%lu:%.17g", (unsigned long) dedup_window, dedup_time);
+			capdiss_cache_option (&cache, "dedup", cache_opt);
+			capdiss_cache_option (&cache, "dedup-ignore", dedup_ignore);
+		}
+
+		/* Frames skipped over the budget never reach 'finish'. */
+		if ( budget_insns > 0 || budget_usec > 0 ){
+			snprintf (cache_opt, sizeof (cache_opt), "%lu", budget_insns);
+			capdiss_cache_option (&cache, "budget-insns", cache_opt);
+			snprintf (cache_opt, sizeof (cache_opt), "%lu", budget_usec);
+			capdiss_cache_option (&cache, "budget-time", cache_opt);
+			capdiss_cache_option (&cache, "budget-policy", budget_policy);
+		}
+
+		/* Files with a stored result are neither read, nor read ahead,
+		 * nor queued for reading below. */
+		rval = cache_lookup (&cache, &files, script->state);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot look up cached results: %s\n", argv[0], strerror (rval));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		for ( file = files.head, file_idx = 0; file != NULL; file = file->next, file_idx++ ){
+			if ( ! cache.file[file_idx].hit && flist_add (&unread, file->path) != 0 ){
+				fprintf (stderr, "%s: cannot allocate memory: %s\n", argv[0], strerror (errno));
+				exitno = EXIT_FAILURE;
+				goto cleanup;
+			}
+		}
+	}
+
+	/* Classic pcap files are read in large blocks, several of them in flight
+	 * at once, and parsed natively. The input layer is not available on all
+	 * platforms, libpcap reads the files then. */
+	if ( io_depth > 0 ){
+		rval = ioread_init (&io, io_depth, io_block);
+
+		if ( rval == ENOMEM ){
+			fprintf (stderr, "%s: cannot allocate memory: %s\n", argv[0], strerror (rval));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		if ( rval == 0 ){
+			for ( file = (cache_dir != NULL) ? unread.head:files.head; file != NULL; file = file->next ){
+				/* Standard input is always read by libpcap. */
+				if ( ioread_add (&io, (strcmp (file->path, "-") == 0) ? NULL:file->path) != 0 ){
+					fprintf (stderr, "%s: cannot allocate memory: %s\n", argv[0], strerror (ENOMEM));
+					exitno = EXIT_FAILURE;
+					goto cleanup;
+				}
+			}
+
+			reader_init (&reader, &io);
+		}
+	}
+
 #ifdef _WIN32
 	rval = setjmp (signal_script);
 #else
@@ -290,134 +1651,206 @@ main (int argc, char *argv[])
 		goto cleanup;
 	}
 
-	for ( file = files.head; file != NULL; file = file->next ){
-#ifdef _WIN32
-		pcap_res = pcap_open_offline (file->path, errbuff);
-#else
-		pcap_res = pcap_open_offline_with_tstamp_precision (file->path, PCAP_TSTAMP_PRECISION_MICRO, errbuff);
-#endif
+	/* Workers are forked with the script already loaded, each of them
+	 * processes its range the same way a whole file is processed, the
+	 * parent only collects the results. */
+	if ( jobs > 0 ){
+		if ( split_open (&split, files.head->path, jobs, bpf) != 0 ){
+			fprintf (stderr, "%s: cannot split file '%s': %s\n", argv[0], files.head->path, split.errbuff);
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
 
-		if ( pcap_res == NULL ){
+		rval = split_fork (&split, emit_fd != -1);
 
-			/* Are we reading from a standard input? */
-			if ( file->path[0] == '-' && file->path[1] == '\0' )
-				fprintf (stderr, "%s: cannot interpret input data: %s\n", argv[0], errbuff);
-			else
-				fprintf (stderr, "%s: cannot open file: %s\n", argv[0], errbuff);
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot start workers: %s\n", argv[0], strerror (rval));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		if ( split.index == 0 ){
+			if ( capdiss_reduce (argv[0], script, &split, &emit, emit_fd) != 0 )
+				exitno = EXIT_FAILURE;
+
+			goto pass_signal;
+		}
+
+		worker = &(split.worker[split.index - 1]);
 
+		/* Output of the parent is left untouched. */
+		if ( emit_init (&emit, (emit_fd != -1) ? fileno (worker->emit):STDOUT_FILENO, emit_format) != 0 ){
+			fprintf (stderr, "%s: cannot initialize output: %s\n", argv[0], strerror (errno));
 			exitno = EXIT_FAILURE;
 			goto cleanup;
 		}
 
-		/* Reinitialize value of the packet counter for each file. */
-		pkt_cnt = 0;
+		reader_set_range (&reader, split.map, worker->start, worker->end);
+		input.pkt_first = worker->first;
+	}
 
-		/* Get pcap file data link value and convert it to string. This string
-		 * is passed to Lua function 'begin'. */
-		linktype = pcap_datalink_val_to_name (pcap_datalink (pcap_res));
+	/* Files following the one being processed are opened and read ahead in
+	 * the background, so that a switch to the next file does not wait for
+	 * a cold read. */
+	rval = prefetch_init (&prefetch, (cache_dir != NULL) ? unread.head:files.head, (jobs > 0) ? 0:prefetch_files);
 
-		if ( bpf != NULL ){
-			struct bpf_program bpf_prog;
+	if ( rval != 0 ){
+		fprintf (stderr, "%s: cannot start prefetching of files: %s\n", argv[0], strerror (rval));
+		exitno = EXIT_FAILURE;
+		goto cleanup;
+	}
 
-			rval = pcap_compile (pcap_res, &bpf_prog, bpf, 1, 0);
+	/* Script drives the read loop itself, pulling frames from the iterator
+	 * returned by 'capdiss.packets'. */
+	if ( lscript_get_table_item (script, "main", LUA_TFUNCTION) == 0 ){
+		input.pull = 1;
+		rval = lua_pcall (script->state, 0, 0, 0);
+		input.pull = 0;
 
-			if ( rval == -1 ){
-				fprintf (stderr, "%s: cannot compile packet filter program: %s\n", argv[0], pcap_geterr (pcap_res));
+		if ( rval != LUA_OK ){
+			fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+
+		/* Script may stop iterating before the end of input. Streams are
+		 * closed as if the input ended there, the files left are not read. */
+		input.stopped = 1;
+
+		if ( input.opened ){
+			if ( input.pending && capdiss_input_reasm (&input) != 0 ){
+				fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
 				exitno = EXIT_FAILURE;
 				goto cleanup;
 			}
 
-			rval = pcap_setfilter (pcap_res, &bpf_prog);
-
-			if ( rval == -1 ){
-				pcap_freecode (&bpf_prog);
-				fprintf (stderr, "%s: cannot apply packet filter program: %s\n", argv[0], pcap_geterr (pcap_res));
+			if ( capdiss_input_close (&input) != 0 ){
+				fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
 				exitno = EXIT_FAILURE;
 				goto cleanup;
 			}
 
-			pcap_freecode (&bpf_prog);
+			input.file = input.file->next;
+		} else if ( input.file != NULL && input.reasm != NULL && reasm_flush (input.reasm) != 0 ){
+			fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
 		}
 
-		if ( exitno == EXIT_SUCCESS && lscript_get_table_item (script, "begin", LUA_TFUNCTION) == 0 ){
+		for ( file_idx = 0; input.file != NULL; input.file = input.file->next )
+			file_idx++;
 
-			if ( ! lua_checkstack (script->state, 2) ){
-				fprintf (stderr, "%s: internal error: Lua stack is full\n", argv[0]);
-				exitno = EXIT_FAILURE;
-				goto cleanup;
-			}
+		if ( file_idx > 0 && exitno == EXIT_SUCCESS )
+			fprintf (stderr, "%s: function 'main' returned before reading all files, %lu %s not read\n",
+				argv[0], (unsigned long) file_idx, (file_idx == 1) ? "file was":"files were");
 
-			lua_pushstring (script->state, (const char*) file->path);
-			lua_pushstring (script->state, linktype);
+		if ( jobs == 0 && capdiss_done (argv[0], script) != 0 ){
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
 
-			rval = lua_pcall (script->state, 2, 0, 0);
+		goto pass_signal;
+	}
 
-			if ( rval != LUA_OK ){
-				fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
-				exitno = EXIT_FAILURE;
-				goto cleanup;
-			}
+	for ( ; input.file != NULL; input.file = input.file->next ){
+
+		rval = capdiss_input_cached (&input);
+
+		if ( rval == -1 ){
+			fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		} else if ( rval == 1 ){
+			continue;
+		}
+
+		if ( capdiss_input_open (&input) != 0 ){
+			fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
 		}
 
 		while ( loop ){
-			rval = pcap_next_ex (pcap_res, &pkt_hdr, &pkt_data);
+			rval = capdiss_input_read (&input);
 
 			if ( rval == -1 ){
-				/* Are we reading from a standard input? */
-				if ( file->path[0] == '-' && file->path[1] == '\0' )
-					fprintf (stderr, "%s: reading a frame from input data failed: %s\n", argv[0], pcap_geterr (pcap_res));
-				else
-					fprintf (stderr, "%s: reading a frame from file '%s' failed: %s\n", argv[0], file->path, pcap_geterr (pcap_res));
-
+				fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
 				exitno = EXIT_FAILURE;
 				goto cleanup;
-			} else if ( rval == -2 ){
-				/* EOF */
+			} else if ( rval == 0 ){
 				break;
 			}
 
-			pkt_cnt++;
+			pkt_hdr = input.pkt_hdr;
+			pkt_data = input.pkt_data;
 
-			if ( exitno == EXIT_SUCCESS && lscript_get_table_item (script, "each", LUA_TFUNCTION) == 0 ){
+			/* Frames not matched by any handler registered via 'capdiss.on'
+			 * are passed only to function 'each'. */
+			route_cnt = route_match (&routes, pkt_hdr, pkt_data);
 
-				if ( ! lua_checkstack (script->state, 3) ){
-					fprintf (stderr, "%s: internal error: Lua stack is full\n", argv[0]);
-					exitno = EXIT_FAILURE;
-					goto cleanup;
-				}
+			has_each = (exitno == EXIT_SUCCESS && lscript_get_table_item (script, "each", LUA_TFUNCTION) == 0);
+
+			if ( ! has_each && routes.head == NULL && ! use_reasm && timers.cnt == 0 ){
+				/* Function not found... no reason to continue reading other
+				 * packets. */
+				loop = 0;
+				break;
+			}
+
+			if ( ! has_each && route_cnt == 0 )
+				goto reassemble;
+
+			if ( ! lua_checkstack (script->state, 7 + DECAP_IDS_MAX) ){
+				fprintf (stderr, "%s: internal error: Lua stack is full\n", argv[0]);
+				exitno = EXIT_FAILURE;
+				goto cleanup;
+			}
+
+			/* Push frame data only once, all the handlers share the string. */
+			lua_pushlstring (script->state, (const char*) pkt_data, pkt_hdr->caplen);
+			pkt_ts = pkt_hdr->ts.tv_sec + (pkt_hdr->ts.tv_usec / 1000000.0);
 
-				lua_pushlstring (script->state, (const char*) pkt_data, pkt_hdr->len);
-				lua_pushnumber (script->state, pkt_hdr->ts.tv_sec + (pkt_hdr->ts.tv_usec / 1000000.0));
-				lua_pushnumber (script->state, pkt_cnt);
+			if ( has_each ){
+				lua_insert (script->state, -2);
+				lua_pushvalue (script->state, -2);
+				lua_pushnumber (script->state, pkt_ts);
+				lua_pushnumber (script->state, input.pkt_cnt);
 
-				rval = lua_pcall (script->state, 3, 0, 0);
+				rval = capdiss_pcall_frame (argv[0], script, &budget, 3 + capdiss_input_push_decap (&input, script->state), input.pkt_cnt);
 
 				if ( rval != LUA_OK ){
 					fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
 					exitno = EXIT_FAILURE;
 					goto cleanup;
 				}
-			} else {
-				/* Function not found... no reason to continue reading other
-				 * packets. */
-				loop = 0;
-				break;
 			}
-		}
 
-		if ( exitno == EXIT_SUCCESS && lscript_get_table_item (script, "finish", LUA_TFUNCTION) == 0 ){
-			rval = lua_pcall (script->state, 0, 0, 0);
+			if ( capdiss_input_route (&input, script->state, route_cnt) != 0 ){
+				fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
+				exitno = EXIT_FAILURE;
+				goto cleanup;
+			}
+
+			lua_pop (script->state, 1);
 
-			if ( rval != LUA_OK ){
+reassemble:
+			if ( capdiss_input_reasm (&input) != 0 ){
 				fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
 				exitno = EXIT_FAILURE;
 				goto cleanup;
 			}
 		}
 
-		/* Close pcap resource, in case we have another file to process... */
-		pcap_close (pcap_res);
-		pcap_res = NULL;
+		if ( capdiss_input_close (&input) != 0 ){
+			fprintf (stderr, "%s: %s\n", argv[0], lua_tostring (script->state, -1));
+			exitno = EXIT_FAILURE;
+			goto cleanup;
+		}
+	}
+
+	if ( jobs == 0 && capdiss_done (argv[0], script) != 0 ){
+		exitno = EXIT_FAILURE;
+		goto cleanup;
 	}
 
 pass_signal:
@@ -444,11 +1877,60 @@ pass_signal:
 	}
 
 cleanup:
+	if ( progress.name != NULL ){
+		if ( progress.interval > 0 )
+			progress_report (&progress);
+
+		progress_free (&progress);
+	}
+
+	if ( stats_fd != -1 )
+		close (stats_fd);
+
+	if ( emit.format != 0 ){
+		rval = emit_close (&emit);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "%s: cannot write emitted records: %s\n", argv[0], strerror (rval));
+			exitno = EXIT_FAILURE;
+		}
+	}
+
+	if ( emit_fd != -1 )
+		close (emit_fd);
+
+	if ( budget.offenders > 0 )
+		fprintf (stderr, "%s: execution budget exceeded %lu times\n", argv[0], budget.offenders);
+
+	if ( dedup.ring != NULL ){
+		fprintf (stderr, "%s: deduplication: %lu of %lu frames dropped\n", argv[0], dedup.dropped, dedup.frames);
+		dedup_free (&dedup);
+	}
+
+	if ( decap.mask != 0 )
+		fprintf (stderr, "%s: decapsulation: %lu of %lu frames decapsulated, %lu failed\n", argv[0], decap.decapsulated, decap.frames, decap.failed);
+
+	if ( cache.file != NULL )
+		fprintf (stderr, "%s: result cache: %lu of %lu files skipped, %lu results stored\n", argv[0], cache.hits, (unsigned long) cache.file_cnt, cache.stored);
+
+	cache_free (&cache);
+
+	if ( reasm.htable != NULL ){
+		capdiss_reasm_report (argv[0], &reasm);
+		reasm_free (&reasm);
+	}
+
 	if ( bpf != NULL )
 		free (bpf);
 
-	if ( pcap_res != NULL )
-		pcap_close (pcap_res);
+	reader_free (&reader);
+	ioread_free (&io);
+
+	/* Thread walks the list of files. */
+	prefetch_free (&prefetch);
+
+	/* Files of a worker are closed once its output is flushed. */
+	split_free (&split);
 
 	if ( script != NULL ){
 		lscript_free (script);
@@ -456,6 +1938,9 @@ cleanup:
 	}
 
 	flist_free (&files);
+	flist_free (&unread);
+	route_list_free (&routes);
+	timer_list_free (&timers);
 
 	return exitno;
 }
@@ -0,0 +1,606 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "matcher.h"
+#include "simd.h"
+
+#define MATCHER_MT "capdiss.matcher"
+
+/*
+ * Multi-pattern matching by Aho-Corasick automaton. Patterns are inserted
+ * into a trie, which is then compiled into an array of states numbered in
+ * breadth-first order. States closest to the root, where a scan spends most
+ * of the time, have a complete transition table (failure transitions already
+ * resolved), the rest keep a sorted list of goto transitions and follow
+ * failure links. While in the root state, bytes that cannot start any
+ * pattern are skipped by a vectorized byte set search.
+ */
+
+int
+matcher_init (struct matcher *matcher)
+{
+	memset (matcher, 0, sizeof (struct matcher));
+
+	matcher->node_size = 64;
+	matcher->node = (struct matcher_node*) malloc (sizeof (struct matcher_node) * matcher->node_size);
+
+	if ( matcher->node == NULL )
+		return ENOMEM;
+
+	matcher->node[0].child = MATCHER_NONE;
+	matcher->node[0].sibling = MATCHER_NONE;
+	matcher->node[0].byte = 0;
+	matcher->node_cnt = 1;
+
+	return 0;
+}
+
+static uint32_t
+matcher_node_child (const struct matcher *matcher, uint32_t node, uint8_t byte)
+{
+	uint32_t child;
+
+	for ( child = matcher->node[node].child; child != MATCHER_NONE; child = matcher->node[child].sibling ){
+		if ( matcher->node[child].byte == byte )
+			break;
+	}
+
+	return child;
+}
+
+int
+matcher_add (struct matcher *matcher, const uint8_t *pattern, size_t len)
+{
+	struct matcher_node *node;
+	uint32_t *pat_state;
+	size_t *pat_len;
+	uint32_t state, child;
+	size_t i;
+
+	if ( len == 0 || matcher->compiled )
+		return EINVAL;
+
+	if ( matcher->pat_cnt == matcher->pat_size ){
+		if ( matcher->pat_size >= UINT32_MAX / 2 )
+			return ENOMEM;
+
+		matcher->pat_size = (matcher->pat_size == 0) ? 64:matcher->pat_size * 2;
+
+		pat_state = (uint32_t*) realloc (matcher->pat_state, sizeof (uint32_t) * matcher->pat_size);
+
+		if ( pat_state == NULL )
+			return ENOMEM;
+
+		matcher->pat_state = pat_state;
+
+		pat_len = (size_t*) realloc (matcher->pat_len, sizeof (size_t) * matcher->pat_size);
+
+		if ( pat_len == NULL )
+			return ENOMEM;
+
+		matcher->pat_len = pat_len;
+	}
+
+	state = 0;
+
+	for ( i = 0; i < len; i++ ){
+		child = matcher_node_child (matcher, state, pattern[i]);
+
+		if ( child == MATCHER_NONE ){
+			if ( matcher->node_cnt == matcher->node_size ){
+				if ( matcher->node_size >= UINT32_MAX / 2 )
+					return ENOMEM;
+
+				node = (struct matcher_node*) realloc (matcher->node, sizeof (struct matcher_node) * matcher->node_size * 2);
+
+				if ( node == NULL )
+					return ENOMEM;
+
+				matcher->node = node;
+				matcher->node_size *= 2;
+			}
+
+			child = matcher->node_cnt++;
+			matcher->node[child].child = MATCHER_NONE;
+			matcher->node[child].sibling = matcher->node[state].child;
+			matcher->node[child].byte = pattern[i];
+			matcher->node[state].child = child;
+		}
+
+		state = child;
+	}
+
+	matcher->pat_state[matcher->pat_cnt] = state;
+	matcher->pat_len[matcher->pat_cnt] = len;
+	matcher->pat_cnt++;
+
+	return 0;
+}
+
+/* Goto transition of a compiled state. */
+static uint32_t
+matcher_goto (const struct matcher *matcher, uint32_t state, uint8_t byte)
+{
+	uint32_t lo, hi, mid;
+
+	lo = matcher->edge_start[state];
+	hi = matcher->edge_start[state + 1];
+
+	while ( lo < hi ){
+		mid = lo + (hi - lo) / 2;
+
+		if ( matcher->edge_byte[mid] < byte )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if ( lo < matcher->edge_start[state + 1] && matcher->edge_byte[lo] == byte )
+		return matcher->edge_next[lo];
+
+	return MATCHER_NONE;
+}
+
+static int
+matcher_cmp_node (const void *a, const void *b)
+{
+	return (int) ((const struct matcher_node*) a)->byte - (int) ((const struct matcher_node*) b)->byte;
+}
+
+int
+matcher_compile (struct matcher *matcher)
+{
+	struct matcher_node children[256];
+	uint32_t *order, *num;
+	uint32_t cnt, state, next, child, fail, edge, i;
+	int n, k, b;
+
+	if ( matcher->compiled )
+		return EINVAL;
+
+	cnt = matcher->node_cnt;
+
+	order = (uint32_t*) malloc (sizeof (uint32_t) * cnt);
+	num = (uint32_t*) malloc (sizeof (uint32_t) * cnt);
+	matcher->fail = (uint32_t*) malloc (sizeof (uint32_t) * cnt);
+	matcher->edge_start = (uint32_t*) malloc (sizeof (uint32_t) * (cnt + 1));
+	matcher->edge_byte = (uint8_t*) malloc (cnt);
+	matcher->edge_next = (uint32_t*) malloc (sizeof (uint32_t) * cnt);
+	matcher->report = (uint32_t*) malloc (sizeof (uint32_t) * cnt);
+	matcher->dict = (uint32_t*) malloc (sizeof (uint32_t) * cnt);
+	matcher->out_start = (uint32_t*) calloc (cnt + 1, sizeof (uint32_t));
+	matcher->out_pat = (uint32_t*) malloc (sizeof (uint32_t) * (matcher->pat_cnt + 1));
+	matcher->dense_cnt = (cnt < MATCHER_DENSE) ? cnt:MATCHER_DENSE;
+	matcher->dense = (uint32_t*) malloc (sizeof (uint32_t) * 256 * matcher->dense_cnt);
+
+	if ( order == NULL || num == NULL || matcher->fail == NULL || matcher->edge_start == NULL
+			|| matcher->edge_byte == NULL || matcher->edge_next == NULL || matcher->report == NULL
+			|| matcher->dict == NULL || matcher->out_start == NULL || matcher->out_pat == NULL
+			|| matcher->dense == NULL ){
+		free (order);
+		free (num);
+		return ENOMEM;
+	}
+
+	/* Number trie nodes in breadth-first order. Children of a node get
+	 * consecutive numbers sorted by byte, goto transitions of all states are
+	 * then ranges of a single array. */
+	order[0] = 0;
+	num[0] = 0;
+	next = 1;
+	edge = 0;
+
+	for ( state = 0; state < cnt; state++ ){
+		matcher->edge_start[state] = edge;
+		n = 0;
+
+		for ( child = matcher->node[order[state]].child; child != MATCHER_NONE; child = matcher->node[child].sibling ){
+			children[n] = matcher->node[child];
+			/* Keep index of the node, field child is no longer needed */
+			children[n].child = child;
+			n++;
+		}
+
+		qsort (children, n, sizeof (struct matcher_node), matcher_cmp_node);
+
+		for ( k = 0; k < n; k++ ){
+			order[next] = children[k].child;
+			num[children[k].child] = next;
+			matcher->edge_byte[edge] = children[k].byte;
+			matcher->edge_next[edge] = next;
+			next++;
+			edge++;
+		}
+	}
+
+	matcher->edge_start[cnt] = edge;
+	matcher->state_cnt = cnt;
+
+	free (order);
+	free (matcher->node);
+	matcher->node = NULL;
+
+	/* Failure links, a state of lower depth has always a lower number. */
+	matcher->fail[0] = 0;
+
+	for ( state = 0; state < cnt; state++ ){
+		for ( edge = matcher->edge_start[state]; edge < matcher->edge_start[state + 1]; edge++ ){
+			child = matcher->edge_next[edge];
+
+			if ( state == 0 ){
+				matcher->fail[child] = 0;
+				continue;
+			}
+
+			for ( fail = matcher->fail[state]; ; fail = matcher->fail[fail] ){
+				next = matcher_goto (matcher, fail, matcher->edge_byte[edge]);
+
+				if ( next != MATCHER_NONE || fail == 0 )
+					break;
+			}
+
+			matcher->fail[child] = (next != MATCHER_NONE) ? next:0;
+		}
+	}
+
+	/* Patterns ending in a state */
+	for ( i = 0; i < matcher->pat_cnt; i++ ){
+		matcher->pat_state[i] = num[matcher->pat_state[i]];
+		matcher->out_start[matcher->pat_state[i] + 1]++;
+	}
+
+	free (num);
+
+	for ( state = 0; state < cnt; state++ )
+		matcher->out_start[state + 1] += matcher->out_start[state];
+
+	/* Array dict is used as an insertion cursor here */
+	memcpy (matcher->dict, matcher->out_start, sizeof (uint32_t) * cnt);
+
+	for ( i = 0; i < matcher->pat_cnt; i++ )
+		matcher->out_pat[matcher->dict[matcher->pat_state[i]]++] = i;
+
+	free (matcher->pat_state);
+	matcher->pat_state = NULL;
+
+	/* Report chain: the state itself, if a pattern ends in it, followed by
+	 * the nearest states on the failure path with the same property. */
+	for ( state = 0; state < cnt; state++ ){
+		matcher->dict[state] = (state == 0) ? MATCHER_NONE:matcher->report[matcher->fail[state]];
+		matcher->report[state] = (matcher->out_start[state + 1] > matcher->out_start[state]) ? state:matcher->dict[state];
+	}
+
+	for ( state = 0; state < matcher->dense_cnt; state++ ){
+		for ( b = 0; b < 256; b++ ){
+			next = matcher_goto (matcher, state, b);
+
+			if ( next == MATCHER_NONE )
+				next = (state == 0) ? 0:matcher->dense[matcher->fail[state] * 256 + b];
+
+			matcher->dense[state * 256 + b] = next;
+		}
+	}
+
+	simd_byteset_init (&matcher->first);
+
+	for ( edge = matcher->edge_start[0]; edge < matcher->edge_start[1]; edge++ )
+		simd_byteset_add (&matcher->first, matcher->edge_byte[edge]);
+
+	simd_byteset_compile (&matcher->first);
+
+	matcher->prefilter = matcher->first.cnt <= MATCHER_PREFILTER_MAX;
+	matcher->compiled = 1;
+
+	return 0;
+}
+
+static uint32_t
+matcher_step (const struct matcher *matcher, uint32_t state, uint8_t byte)
+{
+	uint32_t next;
+
+	while ( state >= matcher->dense_cnt ){
+		next = matcher_goto (matcher, state, byte);
+
+		if ( next != MATCHER_NONE )
+			return next;
+
+		state = matcher->fail[state];
+	}
+
+	return matcher->dense[state * 256 + byte];
+}
+
+/* Report all occurrences of patterns in data to callback cb, in order of
+ * their end offset. Scan stops early, if cb returns non-zero. Returns the
+ * number of reported occurrences. */
+size_t
+matcher_scan (const struct matcher *matcher, const uint8_t *data, size_t len, matcher_cb cb, void *udata)
+{
+	uint32_t state, out, i;
+	size_t pos, cnt;
+
+	state = 0;
+	cnt = 0;
+
+	for ( pos = 0; pos < len; pos++ ){
+		if ( state == 0 && matcher->prefilter ){
+			pos += simd_byteset_find (&matcher->first, data + pos, len - pos);
+
+			if ( pos == len )
+				break;
+		}
+
+		state = matcher_step (matcher, state, data[pos]);
+
+		for ( out = matcher->report[state]; out != MATCHER_NONE; out = matcher->dict[out] ){
+			for ( i = matcher->out_start[out]; i < matcher->out_start[out + 1]; i++ ){
+				cnt++;
+
+				if ( cb != NULL && cb (udata, matcher->out_pat[i], pos + 1 - matcher->pat_len[matcher->out_pat[i]]) != 0 )
+					return cnt;
+			}
+		}
+	}
+
+	return cnt;
+}
+
+void
+matcher_free (struct matcher *matcher)
+{
+	free (matcher->node);
+	free (matcher->pat_state);
+	free (matcher->pat_len);
+	free (matcher->dense);
+	free (matcher->fail);
+	free (matcher->edge_start);
+	free (matcher->edge_byte);
+	free (matcher->edge_next);
+	free (matcher->report);
+	free (matcher->dict);
+	free (matcher->out_start);
+	free (matcher->out_pat);
+	memset (matcher, 0, sizeof (struct matcher));
+}
+
+/* ======= */
+/* Lua API */
+/* ======= */
+
+struct matcher_lua_result
+{
+	lua_State *lua_state;
+	lua_Integer base;
+	int cnt;
+};
+
+/* Collect occurrences into two tables, pattern IDs and offsets. Tables are
+ * created on the first occurrence, so that a scan without a match does not
+ * allocate anything. */
+static int
+matcher_lua_collect (void *udata, uint32_t pattern, size_t offset)
+{
+	struct matcher_lua_result *result;
+	lua_State *lua_state;
+
+	result = (struct matcher_lua_result*) udata;
+	lua_state = result->lua_state;
+
+	if ( result->cnt == 0 ){
+		lua_newtable (lua_state);
+		lua_newtable (lua_state);
+	}
+
+	result->cnt++;
+
+	lua_rawgeti (lua_state, -3, pattern + 1);
+	lua_rawseti (lua_state, -3, result->cnt);
+
+	lua_pushinteger (lua_state, result->base + offset + 1);
+	lua_rawseti (lua_state, -2, result->cnt);
+
+	return 0;
+}
+
+static int
+matcher_lua_first (void *udata, uint32_t pattern, size_t offset)
+{
+	struct matcher_lua_result *result;
+
+	result = (struct matcher_lua_result*) udata;
+
+	lua_rawgeti (result->lua_state, -1, pattern + 1);
+	lua_pushinteger (result->lua_state, result->base + offset + 1);
+	result->cnt++;
+
+	return 1;
+}
+
+static const uint8_t*
+matcher_lua_data (lua_State *lua_state, struct matcher **matcher, size_t *len, lua_Integer *base)
+{
+	const uint8_t *data;
+
+	*matcher = (struct matcher*) luaL_checkudata (lua_state, 1, MATCHER_MT);
+	data = simd_lua_range (lua_state, 2, len);
+	*base = data - (const uint8_t*) lua_tostring (lua_state, 2);
+
+	lua_settop (lua_state, 3);
+	lua_getuservalue (lua_state, 1);
+
+	return data;
+}
+
+/* matcher:match (data [, i [, j]]), returns a table of pattern IDs and
+ * a table of offsets of all occurrences, or nil. */
+static int
+matcher_lua_match (lua_State *lua_state)
+{
+	struct matcher *matcher;
+	struct matcher_lua_result result;
+	const uint8_t *data;
+	size_t len;
+
+	data = matcher_lua_data (lua_state, &matcher, &len, &result.base);
+	result.lua_state = lua_state;
+	result.cnt = 0;
+
+	matcher_scan (matcher, data, len, matcher_lua_collect, &result);
+
+	if ( result.cnt == 0 ){
+		lua_pushnil (lua_state);
+		return 1;
+	}
+
+	return 2;
+}
+
+/* matcher:test (data [, i [, j]]), returns pattern ID and offset of the
+ * occurrence ending first, or nil. */
+static int
+matcher_lua_test (lua_State *lua_state)
+{
+	struct matcher *matcher;
+	struct matcher_lua_result result;
+	const uint8_t *data;
+	size_t len;
+
+	data = matcher_lua_data (lua_state, &matcher, &len, &result.base);
+	result.lua_state = lua_state;
+	result.cnt = 0;
+
+	matcher_scan (matcher, data, len, matcher_lua_first, &result);
+
+	if ( result.cnt == 0 ){
+		lua_pushnil (lua_state);
+		return 1;
+	}
+
+	return 2;
+}
+
+static int
+matcher_lua_len (lua_State *lua_state)
+{
+	struct matcher *matcher;
+
+	matcher = (struct matcher*) luaL_checkudata (lua_state, 1, MATCHER_MT);
+
+	lua_pushinteger (lua_state, matcher->pat_cnt);
+
+	return 1;
+}
+
+static int
+matcher_lua_gc (lua_State *lua_state)
+{
+	struct matcher *matcher;
+
+	matcher = (struct matcher*) luaL_checkudata (lua_state, 1, MATCHER_MT);
+
+	matcher_free (matcher);
+
+	return 0;
+}
+
+static const luaL_Reg matcher_methods[] = {
+	{ "match", matcher_lua_match },
+	{ "test", matcher_lua_test },
+	{ NULL, NULL }
+};
+
+/* capdiss.matcher ({ [id] = pattern, ... }) */
+static int
+matcher_lua_new (lua_State *lua_state)
+{
+	struct matcher *matcher;
+	const char *pattern;
+	size_t len;
+	int rval;
+
+	luaL_checktype (lua_state, 1, LUA_TTABLE);
+
+	if ( luaL_newmetatable (lua_state, MATCHER_MT) ){
+		lua_newtable (lua_state);
+		luaL_setfuncs (lua_state, matcher_methods, 0);
+		lua_setfield (lua_state, -2, "__index");
+		lua_pushcfunction (lua_state, matcher_lua_len);
+		lua_setfield (lua_state, -2, "__len");
+		lua_pushcfunction (lua_state, matcher_lua_gc);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	matcher = (struct matcher*) lua_newuserdata (lua_state, sizeof (struct matcher));
+	memset (matcher, 0, sizeof (struct matcher));
+	luaL_setmetatable (lua_state, MATCHER_MT);
+
+	if ( matcher_init (matcher) != 0 )
+		return luaL_error (lua_state, "cannot allocate memory");
+
+	/* IDs of patterns, indexed by the order of insertion */
+	lua_newtable (lua_state);
+	lua_pushnil (lua_state);
+
+	while ( lua_next (lua_state, 1) != 0 ){
+		if ( lua_type (lua_state, -1) != LUA_TSTRING )
+			return luaL_argerror (lua_state, 1, "pattern must be a string");
+
+		pattern = lua_tolstring (lua_state, -1, &len);
+
+		if ( len == 0 )
+			return luaL_argerror (lua_state, 1, "pattern must not be empty");
+
+		rval = matcher_add (matcher, (const uint8_t*) pattern, len);
+
+		if ( rval != 0 )
+			return luaL_error (lua_state, "cannot add pattern: %s", strerror (rval));
+
+		lua_pop (lua_state, 1);
+		lua_pushvalue (lua_state, -1);
+		lua_rawseti (lua_state, -3, matcher->pat_cnt);
+	}
+
+	rval = matcher_compile (matcher);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot compile patterns: %s", strerror (rval));
+
+	lua_setuservalue (lua_state, -2);
+
+	return 1;
+}
+
+const luaL_Reg matcher_api[] = {
+	{ "matcher", matcher_lua_new },
+	{ NULL, NULL }
+};
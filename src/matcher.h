@@ -0,0 +1,95 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _MATCHER_H
+#define _MATCHER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "simd.h"
+
+#define MATCHER_NONE UINT32_MAX
+
+/* Number of states (closest to the root) with a complete transition table. */
+#define MATCHER_DENSE 1024
+
+/* Prefilter is not worth it, if most of the bytes may start a pattern. */
+#define MATCHER_PREFILTER_MAX 32
+
+struct matcher_node
+{
+	uint32_t child;
+	uint32_t sibling;
+	uint8_t byte;
+};
+
+struct matcher
+{
+	/* Trie, exists only until the automaton is compiled */
+	struct matcher_node *node;
+	uint32_t node_cnt;
+	uint32_t node_size;
+
+	/* Patterns */
+	uint32_t *pat_state;
+	size_t *pat_len;
+	uint32_t pat_cnt;
+	uint32_t pat_size;
+
+	/* Automaton, states are numbered in breadth-first order */
+	uint32_t state_cnt;
+	uint32_t dense_cnt;
+	uint32_t *dense;
+	uint32_t *fail;
+	uint32_t *edge_start;
+	uint8_t *edge_byte;
+	uint32_t *edge_next;
+	uint32_t *report;
+	uint32_t *dict;
+	uint32_t *out_start;
+	uint32_t *out_pat;
+
+	struct simd_byteset first;
+	int prefilter;
+	int compiled;
+};
+
+typedef int (*matcher_cb) (void *udata, uint32_t pattern, size_t offset);
+
+extern const luaL_Reg matcher_api[];
+
+extern int matcher_init (struct matcher *matcher);
+
+extern int matcher_add (struct matcher *matcher, const uint8_t *pattern, size_t len);
+
+extern int matcher_compile (struct matcher *matcher);
+
+extern size_t matcher_scan (const struct matcher *matcher, const uint8_t *data, size_t len, matcher_cb cb, void *udata);
+
+extern void matcher_free (struct matcher *matcher);
+
+#endif
+
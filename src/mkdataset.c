@@ -0,0 +1,109 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+
+#include "capdiss.h"
+#include "dataset.h"
+
+static void
+mkdataset_usage (const char *p)
+{
+	fprintf (stderr, "Usage: %s <options> <source> <dataset>\n\n\
+Compile a text file with lines 'key<TAB>value' into a dataset for\n\
+'capdiss.dataset'. Empty lines and lines starting with '#' are ignored.\n\n\
+Options:\n\
+ -d, --delimiter=<char>    separator of a key and a value (default TAB)\n\
+ -s, --strings             store all values as strings, otherwise values that\n\
+                           look like numbers are stored as numbers\n\
+ -v, --version             show version information\n\
+ -h, --help                show usage information\n", p);
+}
+
+int
+main (int argc, char *argv[])
+{
+	unsigned long lineno;
+	char delim;
+	int c, opt_index, strings, rval;
+	struct option opt_long[] = {
+		{ "delimiter", required_argument, 0, 'd' },
+		{ "strings", no_argument, 0, 's' },
+		{ "help", no_argument, 0, 'h' },
+		{ "version", no_argument, 0, 'v' },
+		{ NULL, 0, 0, 0 }
+	};
+
+	delim = '\t';
+	strings = 0;
+
+	while ( (c = getopt_long (argc, argv, "d:shv", opt_long, &opt_index)) != -1 ){
+		switch ( c ){
+			case 'd':
+				if ( strlen (optarg) != 1 ){
+					fprintf (stderr, "%s: delimiter must be a single character\n", argv[0]);
+					return EXIT_FAILURE;
+				}
+				delim = optarg[0];
+				break;
+
+			case 's':
+				strings = 1;
+				break;
+
+			case 'h':
+				mkdataset_usage (argv[0]);
+				return EXIT_SUCCESS;
+
+			case 'v':
+				fprintf (stderr, "%s %u.%u.%u\n", argv[0], CAPDISS_VERSION_MAJOR, CAPDISS_VERSION_MINOR, CAPDISS_VERSION_PATCH);
+				return EXIT_SUCCESS;
+
+			default:
+				mkdataset_usage (argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if ( argc - optind != 2 ){
+		mkdataset_usage (argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	rval = dataset_build (argv[optind], argv[optind + 1], delim, strings, &lineno);
+
+	if ( rval != 0 ){
+		if ( rval == EINVAL && lineno > 0 )
+			fprintf (stderr, "%s: cannot compile '%s': line %lu is too long\n", argv[0], argv[optind], lineno);
+		else
+			fprintf (stderr, "%s: cannot compile '%s': %s\n", argv[0], argv[optind], strerror (rval));
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
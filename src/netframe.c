@@ -0,0 +1,167 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stddef.h>
+#include <stdint.h>
+#include <pcap.h>
+
+#include "netframe.h"
+
+#ifndef DLT_LINUX_SLL
+#define DLT_LINUX_SLL 113
+#endif
+
+#ifndef DLT_LINUX_SLL2
+#define DLT_LINUX_SLL2 276
+#endif
+
+#ifndef DLT_IPV4
+#define DLT_IPV4 228
+#endif
+
+#ifndef DLT_IPV6
+#define DLT_IPV6 229
+#endif
+
+/* LINKTYPE_RAW, pcap_datalink should map it to DLT_RAW, but some versions of
+ * libpcap do not. */
+#define NETFRAME_LINKTYPE_RAW 101
+
+static int
+netframe_raw (const uint8_t *data, size_t len, size_t *offset, uint16_t *ethertype)
+{
+	if ( len < 1 )
+		return 1;
+
+	switch ( data[0] >> 4 ){
+		case 4:
+			*ethertype = NETFRAME_ETHERTYPE_IPV4;
+			break;
+
+		case 6:
+			*ethertype = NETFRAME_ETHERTYPE_IPV6;
+			break;
+
+		default:
+			return 1;
+	}
+
+	*offset = 0;
+
+	return 0;
+}
+
+/* Find an offset of the network layer header in a frame. Return 0 if the
+ * frame carries IPv4 or IPv6 datagram, offset and ethertype are then set
+ * accordingly. */
+int
+netframe_l3 (int linktype, const uint8_t *data, size_t len, size_t *offset, uint16_t *ethertype)
+{
+	size_t off;
+	uint16_t type;
+	uint32_t family;
+
+	switch ( linktype ){
+		case DLT_EN10MB:
+			if ( len < 14 )
+				return 1;
+
+			off = 14;
+			type = netframe_get16 (data + 12);
+
+			/* Skip 802.1Q and 802.1ad tags. */
+			while ( type == 0x8100 || type == 0x88a8 || type == 0x9100 ){
+				if ( len < off + 4 )
+					return 1;
+
+				type = netframe_get16 (data + off + 2);
+				off += 4;
+			}
+			break;
+
+		case DLT_LINUX_SLL:
+			if ( len < 16 )
+				return 1;
+
+			off = 16;
+			type = netframe_get16 (data + 14);
+			break;
+
+		case DLT_LINUX_SLL2:
+			if ( len < 20 )
+				return 1;
+
+			off = 20;
+			type = netframe_get16 (data);
+			break;
+
+		case DLT_NULL:
+		case DLT_LOOP:
+			if ( len < 4 )
+				return 1;
+
+			/* Address family is stored in host byte order of the machine that
+			 * captured the frame, unless link-type is DLT_LOOP. */
+			family = (uint32_t) data[0] | (uint32_t) data[1] << 8 | (uint32_t) data[2] << 16 | (uint32_t) data[3] << 24;
+
+			if ( linktype == DLT_LOOP || (family & 0xffff) == 0 )
+				family = netframe_get32 (data);
+
+			off = 4;
+
+			switch ( family ){
+				case 2:
+					type = NETFRAME_ETHERTYPE_IPV4;
+					break;
+
+				/* AF_INET6 differs among BSDs and Linux. */
+				case 10:
+				case 24:
+				case 28:
+				case 30:
+					type = NETFRAME_ETHERTYPE_IPV6;
+					break;
+
+				default:
+					return 1;
+			}
+			break;
+
+		case DLT_RAW:
+		case NETFRAME_LINKTYPE_RAW:
+		case DLT_IPV4:
+		case DLT_IPV6:
+			return netframe_raw (data, len, offset, ethertype);
+
+		default:
+			return 1;
+	}
+
+	if ( type != NETFRAME_ETHERTYPE_IPV4 && type != NETFRAME_ETHERTYPE_IPV6 )
+		return 1;
+
+	*offset = off;
+	*ethertype = type;
+
+	return 0;
+}
@@ -0,0 +1,39 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _NETFRAME_H
+#define _NETFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define NETFRAME_ETHERTYPE_IPV4 0x0800
+#define NETFRAME_ETHERTYPE_IPV6 0x86dd
+
+#define netframe_get16(p) ((uint16_t) (((const uint8_t*) (p))[0] << 8 | ((const uint8_t*) (p))[1]))
+#define netframe_get32(p) ((uint32_t) ((uint32_t) netframe_get16 (p) << 16 | netframe_get16 ((const uint8_t*) (p) + 2)))
+
+extern int netframe_l3 (int linktype, const uint8_t *data, size_t len, size_t *offset, uint16_t *ethertype);
+
+#endif
+
@@ -0,0 +1,212 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#endif
+
+#include "prefetch.h"
+#include "reader.h"
+
+/* First four bytes of a pcapng file (Section Header Block type). */
+#define PREFETCH_PCAPNG_MAGIC "\x0a\x0d\x0d\x0a"
+
+/*
+ * Files given on the command line are opened one after another, a cold
+ * open and the first reads of each file would stall the processing at every
+ * file boundary. A background thread stays a few files ahead of the one
+ * being processed: it opens the next files, reads and validates their
+ * headers and asks the kernel to read the start of valid capture files into
+ * the page cache. Nothing read by the thread is used directly, the files are
+ * opened again by the reader, which then finds the data already cached.
+ */
+
+#ifndef _WIN32
+
+/* Return 0 if the file looks like a capture file and its start was
+ * scheduled for reading. */
+static int
+prefetch_file (const char *path)
+{
+	uint8_t hdr[READER_HDR_LEN];
+	struct reader_format fmt;
+	ssize_t len;
+	int fd, rval;
+
+	fd = open (path, O_RDONLY);
+
+	if ( fd == -1 )
+		return 1;
+
+	len = pread (fd, hdr, sizeof (hdr), 0);
+	rval = 1;
+
+	if ( len == sizeof (hdr) && (reader_parse_header (&fmt, hdr, len) == 0 || memcmp (hdr, PREFETCH_PCAPNG_MAGIC, 4) == 0) ){
+#ifdef POSIX_FADV_WILLNEED
+		posix_fadvise (fd, 0, PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+#endif
+		rval = 0;
+	}
+
+	close (fd);
+
+	return rval;
+}
+
+static void*
+prefetch_thread (void *arg)
+{
+	struct prefetch *prefetch;
+	const char *path;
+
+	prefetch = (struct prefetch*) arg;
+
+	pthread_mutex_lock (&(prefetch->lock));
+
+	while ( ! prefetch->stop && prefetch->next != NULL ){
+		if ( prefetch->queued >= prefetch->cur + prefetch->ahead ){
+			pthread_cond_wait (&(prefetch->cond), &(prefetch->lock));
+			continue;
+		}
+
+		path = prefetch->next->path;
+		prefetch->next = prefetch->next->next;
+		prefetch->queued++;
+
+		pthread_mutex_unlock (&(prefetch->lock));
+
+		/* Standard input cannot be read ahead. */
+		if ( strcmp (path, "-") != 0 )
+			prefetch_file (path);
+
+		pthread_mutex_lock (&(prefetch->lock));
+	}
+
+	pthread_mutex_unlock (&(prefetch->lock));
+
+	return NULL;
+}
+
+int
+prefetch_init (struct prefetch *prefetch, struct flist_path *files, unsigned long ahead)
+{
+	sigset_t mask, old_mask;
+	int rval;
+
+	memset (prefetch, 0, sizeof (struct prefetch));
+
+	prefetch->next = files;
+	prefetch->ahead = ahead;
+
+	/* Nothing to overlap with a single file */
+	if ( ahead == 0 || files == NULL || files->next == NULL )
+		return 0;
+
+	if ( pthread_mutex_init (&(prefetch->lock), NULL) != 0 )
+		return ENOMEM;
+
+	if ( pthread_cond_init (&(prefetch->cond), NULL) != 0 ){
+		pthread_mutex_destroy (&(prefetch->lock));
+		return ENOMEM;
+	}
+
+	/* Signals are handled by the main thread only, handlers jump back into
+	 * the main loop. */
+	sigfillset (&mask);
+	pthread_sigmask (SIG_SETMASK, &mask, &old_mask);
+
+	rval = pthread_create (&(prefetch->thread), NULL, prefetch_thread, prefetch);
+
+	pthread_sigmask (SIG_SETMASK, &old_mask, NULL);
+
+	if ( rval != 0 ){
+		pthread_cond_destroy (&(prefetch->cond));
+		pthread_mutex_destroy (&(prefetch->lock));
+		return rval;
+	}
+
+	prefetch->running = 1;
+
+	return 0;
+}
+
+/* Called when the next file is opened. */
+void
+prefetch_advance (struct prefetch *prefetch)
+{
+	if ( ! prefetch->running )
+		return;
+
+	pthread_mutex_lock (&(prefetch->lock));
+	prefetch->cur++;
+	pthread_cond_signal (&(prefetch->cond));
+	pthread_mutex_unlock (&(prefetch->lock));
+}
+
+void
+prefetch_free (struct prefetch *prefetch)
+{
+	if ( ! prefetch->running )
+		return;
+
+	pthread_mutex_lock (&(prefetch->lock));
+	prefetch->stop = 1;
+	pthread_cond_signal (&(prefetch->cond));
+	pthread_mutex_unlock (&(prefetch->lock));
+
+	pthread_join (prefetch->thread, NULL);
+	pthread_cond_destroy (&(prefetch->cond));
+	pthread_mutex_destroy (&(prefetch->lock));
+
+	prefetch->running = 0;
+}
+
+#else
+
+int
+prefetch_init (struct prefetch *prefetch, struct flist_path *files, unsigned long ahead)
+{
+	memset (prefetch, 0, sizeof (struct prefetch));
+
+	return 0;
+}
+
+void
+prefetch_advance (struct prefetch *prefetch)
+{
+}
+
+void
+prefetch_free (struct prefetch *prefetch)
+{
+}
+
+#endif
@@ -0,0 +1,64 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _PREFETCH_H
+#define _PREFETCH_H
+
+#include <stdint.h>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#include "flist.h"
+
+/* Number of files read ahead of the one being processed. */
+#define PREFETCH_FILES 2
+
+/* Bytes at the start of a file the kernel is asked to read ahead, the rest
+ * is left to sequential readahead once the file is being read. */
+#define PREFETCH_SIZE (16 * 1024 * 1024)
+
+struct prefetch
+{
+	struct flist_path *next;
+	unsigned long queued;
+	unsigned long cur;
+	unsigned long ahead;
+	int stop;
+	int running;
+#ifndef _WIN32
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	pthread_t thread;
+#endif
+};
+
+extern int prefetch_init (struct prefetch *prefetch, struct flist_path *files, unsigned long ahead);
+
+extern void prefetch_advance (struct prefetch *prefetch);
+
+extern void prefetch_free (struct prefetch *prefetch);
+
+#endif
+
@@ -0,0 +1,1297 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#define PREFIX_X86 1
+#endif
+
+#include "prefix.h"
+
+#define PREFIX_TABLE_MT "capdiss.prefix_table"
+#define PREFIX_SET_MT "capdiss.ip_set"
+#define PREFIX_FILE_MT "capdiss.prefix_file"
+
+/*
+ * Longest prefix match is done by a multibit trie compressed the same way as
+ * poptrie does it. The first 16 bits of an address index an array of leaves
+ * and nodes directly, each node below consumes one more byte, its children
+ * and leaves are found by counting bits in two bitmaps. A lookup touches at
+ * most 2 nodes for IPv4 and 14 for IPv6, no matter how many prefixes the
+ * table has. Prefixes are kept in a plain array, from which
+ * the trie is (re)built on the first lookup after a change.
+ */
+
+/* =================== */
+/* Parsing of prefixes */
+/* =================== */
+
+static int
+prefix_parse_ipv4 (const char *str, const char *end, uint8_t *addr)
+{
+	unsigned int octet;
+	int i, digits;
+
+	for ( i = 0; i < 4; i++ ){
+		if ( i > 0 ){
+			if ( str == end || *str != '.' )
+				return EINVAL;
+			str++;
+		}
+
+		octet = 0;
+
+		for ( digits = 0; str < end && *str >= '0' && *str <= '9'; digits++, str++ ){
+			if ( digits == 3 )
+				return EINVAL;
+			octet = octet * 10 + (*str - '0');
+		}
+
+		if ( digits == 0 || octet > 255 )
+			return EINVAL;
+
+		addr[i] = octet;
+	}
+
+	return (str == end) ? 0:EINVAL;
+}
+
+static int
+prefix_hexval (char c)
+{
+	if ( c >= '0' && c <= '9' )
+		return c - '0';
+	if ( c >= 'a' && c <= 'f' )
+		return c - 'a' + 10;
+	if ( c >= 'A' && c <= 'F' )
+		return c - 'A' + 10;
+	return -1;
+}
+
+static int
+prefix_parse_ipv6 (const char *str, const char *end, uint8_t *addr)
+{
+	unsigned int group[8];
+	const char *p;
+	int n, gap, digits, i;
+
+	n = 0;
+	gap = -1;
+
+	if ( end - str >= 2 && str[0] == ':' && str[1] == ':' ){
+		gap = 0;
+		str += 2;
+	}
+
+	while ( str < end ){
+		/* Dotted IPv4 address in place of the last two groups */
+		for ( p = str; p < end && prefix_hexval (*p) >= 0; p++ );
+
+		if ( p < end && *p == '.' ){
+			if ( n > 6 || prefix_parse_ipv4 (str, end, addr) != 0 )
+				return EINVAL;
+			group[n++] = (addr[0] << 8) | addr[1];
+			group[n++] = (addr[2] << 8) | addr[3];
+			str = end;
+			break;
+		}
+
+		if ( n == 8 )
+			return EINVAL;
+
+		group[n] = 0;
+
+		for ( digits = 0; str < end && prefix_hexval (*str) >= 0; digits++, str++ ){
+			if ( digits == 4 )
+				return EINVAL;
+			group[n] = (group[n] << 4) | prefix_hexval (*str);
+		}
+
+		if ( digits == 0 )
+			return EINVAL;
+
+		n++;
+
+		if ( str == end )
+			break;
+
+		if ( *str != ':' )
+			return EINVAL;
+
+		str++;
+
+		if ( str < end && *str == ':' ){
+			if ( gap != -1 )
+				return EINVAL;
+			gap = n;
+			str++;
+		} else if ( str == end ){
+			return EINVAL;
+		}
+	}
+
+	if ( (gap == -1 && n != 8) || (gap != -1 && n > 7) )
+		return EINVAL;
+
+	memset (addr, 0, 16);
+
+	for ( i = 0; i < n; i++ ){
+		/* Groups after '::' are aligned to the end of the address */
+		int pos = (gap != -1 && i >= gap) ? (8 - n + i):i;
+
+		addr[pos * 2] = group[i] >> 8;
+		addr[pos * 2 + 1] = group[i] & 0xff;
+	}
+
+	return 0;
+}
+
+/* Parse an address, optionally followed by '/' and length of the prefix.
+ * Bits of the address beyond the prefix length are cleared. */
+int
+prefix_parse (const char *str, size_t len, uint8_t *addr, int *family, int *plen)
+{
+	const char *end, *slash;
+	int bits, i;
+
+	end = str + len;
+	slash = memchr (str, '/', len);
+
+	if ( slash == NULL )
+		slash = end;
+
+	if ( memchr (str, ':', slash - str) != NULL ){
+		if ( prefix_parse_ipv6 (str, slash, addr) != 0 )
+			return EINVAL;
+		*family = 6;
+		bits = 128;
+	} else {
+		if ( prefix_parse_ipv4 (str, slash, addr) != 0 )
+			return EINVAL;
+		*family = 4;
+		bits = 32;
+	}
+
+	*plen = bits;
+
+	if ( slash < end ){
+		slash++;
+
+		if ( slash == end || end - slash > 3 )
+			return EINVAL;
+
+		*plen = 0;
+
+		for ( ; slash < end; slash++ ){
+			if ( *slash < '0' || *slash > '9' )
+				return EINVAL;
+			*plen = *plen * 10 + (*slash - '0');
+		}
+
+		if ( *plen > bits )
+			return EINVAL;
+	}
+
+	for ( i = *plen; i < bits; i++ )
+		addr[i / 8] &= ~(0x80 >> (i % 8));
+
+	return 0;
+}
+
+/* Number of bits set in 'vec' at positions [0, b]. */
+static inline __attribute__ ((always_inline)) uint32_t
+prefix_rank (const uint64_t *vec, unsigned int b)
+{
+	uint32_t cnt;
+	unsigned int i;
+
+	cnt = __builtin_popcountll (vec[b >> 6] & ((2ULL << (b & 63)) - 1));
+
+	for ( i = 0; i < (b >> 6); i++ )
+		cnt += __builtin_popcountll (vec[i]);
+
+	return cnt;
+}
+
+static inline __attribute__ ((always_inline)) uint32_t
+prefix_trie_find (const struct prefix_trie *trie, const uint8_t *addr)
+{
+	const struct prefix_node *node;
+	uint32_t leaf;
+	unsigned int b;
+
+	leaf = trie->direct[(addr[0] << 8) | addr[1]];
+
+	if ( (leaf & PREFIX_DIRECT_NODE) == 0 )
+		return leaf;
+
+	node = &(trie->node[leaf & ~PREFIX_DIRECT_NODE]);
+
+	for ( addr += 2;; addr++ ){
+		b = *addr;
+
+		if ( (node->vec[b >> 6] & (1ULL << (b & 63))) == 0 )
+			break;
+
+		node = &(trie->node[node->base_node + prefix_rank (node->vec, b) - 1]);
+	}
+
+	return trie->leaf[node->base_leaf + prefix_rank (node->leafvec, b) - 1];
+}
+
+static uint32_t
+prefix_find_scalar (const struct prefix_trie *trie, const uint8_t *addr)
+{
+	return prefix_trie_find (trie, addr);
+}
+
+#ifdef PREFIX_X86
+/* Counting of bits is most of the work, use the instruction if available */
+__attribute__ ((target ("popcnt")))
+static uint32_t
+prefix_find_popcnt (const struct prefix_trie *trie, const uint8_t *addr)
+{
+	return prefix_trie_find (trie, addr);
+}
+#endif
+
+static uint32_t (*prefix_find) (const struct prefix_trie *trie, const uint8_t *addr) = prefix_find_scalar;
+
+/* ============ */
+/* Prefix table */
+/* ============ */
+
+void
+prefix_table_init (struct prefix_table *table)
+{
+	memset (table, 0, sizeof (struct prefix_table));
+
+	table->ipv4.bits = 32;
+	table->ipv6.bits = 128;
+
+#ifdef PREFIX_X86
+	__builtin_cpu_init ();
+
+	if ( __builtin_cpu_supports ("popcnt") )
+		prefix_find = prefix_find_popcnt;
+#endif
+}
+
+int
+prefix_table_add (struct prefix_table *table, const uint8_t *addr, int family, int plen, uint32_t value)
+{
+	struct prefix_trie *trie;
+	struct prefix_entry *entry;
+	int i;
+
+	trie = (family == 6) ? &(table->ipv6):&(table->ipv4);
+
+	if ( trie->entry_cnt == trie->entry_size ){
+		trie->entry_size = (trie->entry_size == 0) ? 64:trie->entry_size * 2;
+		entry = (struct prefix_entry*) realloc (trie->entry, sizeof (struct prefix_entry) * trie->entry_size);
+
+		if ( entry == NULL )
+			return ENOMEM;
+
+		trie->entry = entry;
+	}
+
+	entry = &(trie->entry[trie->entry_cnt++]);
+	memset (entry, 0, sizeof (struct prefix_entry));
+	memcpy (entry->addr, addr, trie->bits / 8);
+	entry->len = plen;
+
+	for ( i = plen; i < trie->bits; i++ )
+		entry->addr[i / 8] &= ~(0x80 >> (i % 8));
+	entry->value = value;
+
+	trie->compiled = 0;
+
+	return 0;
+}
+
+static int
+prefix_cmp_entry (const void *a, const void *b)
+{
+	const struct prefix_entry *ea, *eb;
+	int cmp;
+
+	ea = (const struct prefix_entry*) a;
+	eb = (const struct prefix_entry*) b;
+
+	cmp = memcmp (ea->addr, eb->addr, sizeof (ea->addr));
+
+	if ( cmp != 0 )
+		return cmp;
+
+	if ( ea->len != eb->len )
+		return (ea->len < eb->len) ? -1:1;
+
+	/* A prefix added later replaces the same prefix added before */
+	return (ea->value < eb->value) ? -1:(ea->value > eb->value);
+}
+
+static int
+prefix_trie_reserve (struct prefix_trie *trie, uint32_t nodes, uint32_t leaves)
+{
+	struct prefix_node *node;
+	uint32_t *leaf;
+
+	while ( trie->node_cnt + nodes > trie->node_size ){
+		trie->node_size = (trie->node_size == 0) ? 64:trie->node_size * 2;
+		node = (struct prefix_node*) realloc (trie->node, sizeof (struct prefix_node) * trie->node_size);
+
+		if ( node == NULL )
+			return ENOMEM;
+
+		trie->node = node;
+	}
+
+	while ( trie->leaf_cnt + leaves > trie->leaf_size ){
+		trie->leaf_size = (trie->leaf_size == 0) ? 256:trie->leaf_size * 2;
+		leaf = (uint32_t*) realloc (trie->leaf, sizeof (uint32_t) * trie->leaf_size);
+
+		if ( leaf == NULL )
+			return ENOMEM;
+
+		trie->leaf = leaf;
+	}
+
+	return 0;
+}
+
+/* Build node 'idx' at 'depth' (in bytes) from prefixes [lo, hi), which all
+ * share the first 'depth' bytes of an address. Prefixes not longer than
+ * 'depth' bytes were already expanded by the ancestors, 'inherit' is a leaf
+ * of the longest of them (pushed down to the leaves of this node). */
+static int
+prefix_trie_build (struct prefix_trie *trie, uint32_t lo, uint32_t hi, int depth, uint32_t inherit, uint32_t idx)
+{
+	struct prefix_node node;
+	const struct prefix_entry *entry;
+	uint32_t leaf[256], child_lo[256], child_hi[256];
+	uint8_t plen[256];
+	uint32_t i, k, span, last, nodes, leaves;
+	int level_end, rval;
+	unsigned int b;
+
+	memset (&node, 0, sizeof (struct prefix_node));
+	memset (plen, 0, sizeof (plen));
+	level_end = (depth + 1) * 8;
+
+	for ( k = 0; k < 256; k++ )
+		leaf[k] = inherit;
+
+	for ( i = lo; i < hi; i++ ){
+		entry = &(trie->entry[i]);
+
+		if ( entry->len <= depth * 8 )
+			continue;
+
+		b = entry->addr[depth];
+
+		if ( entry->len > level_end ){
+			if ( (node.vec[b >> 6] & (1ULL << (b & 63))) == 0 ){
+				node.vec[b >> 6] |= 1ULL << (b & 63);
+				child_lo[b] = i;
+			}
+			child_hi[b] = i + 1;
+			continue;
+		}
+
+		span = 1U << (level_end - entry->len);
+
+		for ( k = b; k < b + span; k++ ){
+			if ( entry->len >= plen[k] ){
+				leaf[k] = i + 1;
+				plen[k] = entry->len;
+			}
+		}
+	}
+
+	nodes = 0;
+	leaves = 0;
+	last = 0;
+
+	for ( k = 0; k < 256; k++ ){
+		if ( node.vec[k >> 6] & (1ULL << (k & 63)) ){
+			nodes++;
+			continue;
+		}
+
+		if ( leaves == 0 || leaf[k] != last ){
+			node.leafvec[k >> 6] |= 1ULL << (k & 63);
+			last = leaf[k];
+			leaves++;
+		}
+	}
+
+	rval = prefix_trie_reserve (trie, nodes, leaves);
+
+	if ( rval != 0 )
+		return rval;
+
+	node.base_node = trie->node_cnt;
+	node.base_leaf = trie->leaf_cnt;
+	trie->node_cnt += nodes;
+
+	for ( k = 0; k < 256; k++ ){
+		if ( node.leafvec[k >> 6] & (1ULL << (k & 63)) )
+			trie->leaf[trie->leaf_cnt++] = leaf[k];
+	}
+
+	trie->node[idx] = node;
+
+	for ( k = 0, i = 0; k < 256; k++ ){
+		if ( (node.vec[k >> 6] & (1ULL << (k & 63))) == 0 )
+			continue;
+
+		/* Children inherit the leaf expanded over their byte */
+		rval = prefix_trie_build (trie, child_lo[k], child_hi[k], depth + 1, leaf[k], node.base_node + i);
+
+		if ( rval != 0 )
+			return rval;
+
+		i++;
+	}
+
+	return 0;
+}
+
+static int
+prefix_trie_compile (struct prefix_trie *trie)
+{
+	const struct prefix_entry *entry;
+	uint32_t i, k, cnt, end, slot, nodes, idx;
+	uint8_t *plen;
+
+	if ( trie->compiled )
+		return 0;
+
+	if ( trie->entry_cnt > 0 )
+		qsort (trie->entry, trie->entry_cnt, sizeof (struct prefix_entry), prefix_cmp_entry);
+
+	for ( i = 0, cnt = 0; i < trie->entry_cnt; i++ ){
+		if ( i + 1 < trie->entry_cnt && trie->entry[i].len == trie->entry[i + 1].len
+				&& memcmp (trie->entry[i].addr, trie->entry[i + 1].addr, sizeof (trie->entry[i].addr)) == 0 )
+			continue;
+		trie->entry[cnt++] = trie->entry[i];
+	}
+
+	trie->entry_cnt = cnt;
+	trie->node_cnt = 0;
+	trie->leaf_cnt = 0;
+
+	if ( trie->direct == NULL ){
+		trie->direct = (uint32_t*) malloc (sizeof (uint32_t) * PREFIX_DIRECT_SIZE);
+
+		if ( trie->direct == NULL )
+			return ENOMEM;
+	}
+
+	plen = (uint8_t*) calloc (PREFIX_DIRECT_SIZE, sizeof (uint8_t));
+
+	if ( plen == NULL )
+		return ENOMEM;
+
+	/* Root of the trie is indexed directly by the first 16 bits of an
+	 * address. Prefixes not longer than that are expanded into leaves,
+	 * longer ones are grouped into nodes, each of them inherits the leaf
+	 * expanded over its slot. */
+	memset (trie->direct, 0, sizeof (uint32_t) * PREFIX_DIRECT_SIZE);
+
+	for ( i = 0; i < trie->entry_cnt; i++ ){
+		entry = &(trie->entry[i]);
+
+		if ( entry->len > 16 )
+			continue;
+
+		slot = (entry->addr[0] << 8) | entry->addr[1];
+
+		for ( k = slot; k < slot + (1U << (16 - entry->len)); k++ ){
+			if ( entry->len >= plen[k] ){
+				trie->direct[k] = i + 1;
+				plen[k] = entry->len;
+			}
+		}
+	}
+
+	free (plen);
+
+	for ( i = 0; i < trie->entry_cnt; i = end ){
+		slot = (trie->entry[i].addr[0] << 8) | trie->entry[i].addr[1];
+		nodes = 0;
+
+		for ( end = i; end < trie->entry_cnt && ((trie->entry[end].addr[0] << 8) | trie->entry[end].addr[1]) == slot; end++ ){
+			if ( trie->entry[end].len > 16 )
+				nodes = 1;
+		}
+
+		if ( nodes == 0 )
+			continue;
+
+		if ( prefix_trie_reserve (trie, 1, 0) != 0 )
+			return ENOMEM;
+
+		idx = trie->node_cnt++;
+
+		if ( prefix_trie_build (trie, i, end, 2, trie->direct[slot], idx) != 0 )
+			return ENOMEM;
+
+		trie->direct[slot] = PREFIX_DIRECT_NODE | idx;
+	}
+
+	trie->compiled = 1;
+
+	return 0;
+}
+
+int
+prefix_table_compile (struct prefix_table *table)
+{
+	int rval;
+
+	rval = prefix_trie_compile (&(table->ipv4));
+
+	if ( rval != 0 )
+		return rval;
+
+	return prefix_trie_compile (&(table->ipv6));
+}
+
+/* Table must be compiled. */
+const struct prefix_entry*
+prefix_table_lookup (const struct prefix_table *table, const uint8_t *addr, int family)
+{
+	const struct prefix_trie *trie;
+	uint32_t leaf;
+
+	trie = (family == 6) ? &(table->ipv6):&(table->ipv4);
+	leaf = prefix_find (trie, addr);
+
+	return (leaf == 0) ? NULL:&(trie->entry[leaf - 1]);
+}
+
+void
+prefix_table_free (struct prefix_table *table)
+{
+	free (table->ipv4.direct);
+	free (table->ipv4.entry);
+	free (table->ipv4.node);
+	free (table->ipv4.leaf);
+	free (table->ipv6.direct);
+	free (table->ipv6.entry);
+	free (table->ipv6.node);
+	free (table->ipv6.leaf);
+	memset (table, 0, sizeof (struct prefix_table));
+}
+
+/* ====================== */
+/* Set of exact addresses */
+/* ====================== */
+
+/* Slots are open addressed and probed linearly. An IPv4 address is stored
+ * with bit 32 set, an IPv6 address takes two slots, all zeros mark a free
+ * slot (address :: is kept aside). */
+
+static inline uint32_t
+prefix_hash_slot (const struct prefix_hash *hash, uint64_t hi, uint64_t lo)
+{
+	return (uint32_t) (((hi * 0x9e3779b97f4a7c15ULL) ^ lo) * 0xff51afd7ed558ccdULL >> 32) & hash->mask;
+}
+
+static int
+prefix_hash_init (struct prefix_hash *hash, int width)
+{
+	hash->width = width;
+	hash->cnt = 0;
+	hash->mask = PREFIX_SET_SIZE - 1;
+	hash->slot = (uint64_t*) calloc (PREFIX_SET_SIZE * width, sizeof (uint64_t));
+
+	return (hash->slot == NULL) ? ENOMEM:0;
+}
+
+static int
+prefix_hash_find (const struct prefix_hash *hash, uint64_t hi, uint64_t lo, uint32_t *pos)
+{
+	const uint64_t *slot;
+	uint32_t i;
+
+	for ( i = prefix_hash_slot (hash, hi, lo);; i = (i + 1) & hash->mask ){
+		slot = &(hash->slot[i * hash->width]);
+
+		if ( slot[0] == lo && (hash->width == 1 || slot[1] == hi) ){
+			*pos = i;
+			return 1;
+		}
+
+		if ( slot[0] == 0 && (hash->width == 1 || slot[1] == 0) ){
+			*pos = i;
+			return 0;
+		}
+	}
+}
+
+static int
+prefix_hash_add (struct prefix_hash *hash, uint64_t hi, uint64_t lo)
+{
+	struct prefix_hash grown;
+	const uint64_t *slot;
+	uint32_t i, pos;
+
+	if ( prefix_hash_find (hash, hi, lo, &pos) )
+		return 0;
+
+	/* Keep the load factor below one half */
+	if ( (hash->cnt + 1) * 2 > hash->mask + 1 ){
+		grown.width = hash->width;
+		grown.cnt = hash->cnt;
+		grown.mask = hash->mask * 2 + 1;
+		grown.slot = (uint64_t*) calloc ((size_t) (grown.mask + 1) * grown.width, sizeof (uint64_t));
+
+		if ( grown.slot == NULL )
+			return ENOMEM;
+
+		for ( i = 0; i <= hash->mask; i++ ){
+			slot = &(hash->slot[i * hash->width]);
+
+			if ( slot[0] == 0 && (hash->width == 1 || slot[1] == 0) )
+				continue;
+
+			prefix_hash_find (&grown, (hash->width == 1) ? 0:slot[1], slot[0], &pos);
+			memcpy (&(grown.slot[pos * grown.width]), slot, sizeof (uint64_t) * hash->width);
+		}
+
+		free (hash->slot);
+		*hash = grown;
+
+		prefix_hash_find (hash, hi, lo, &pos);
+	}
+
+	hash->slot[pos * hash->width] = lo;
+
+	if ( hash->width == 2 )
+		hash->slot[pos * hash->width + 1] = hi;
+
+	hash->cnt++;
+
+	return 0;
+}
+
+static void
+prefix_set_key (const uint8_t *addr, int family, uint64_t *hi, uint64_t *lo)
+{
+	int i;
+
+	*hi = 0;
+	*lo = 0;
+
+	if ( family == 4 ){
+		*lo = ((uint64_t) 1 << 32) | ((uint32_t) addr[0] << 24) | ((uint32_t) addr[1] << 16) | ((uint32_t) addr[2] << 8) | addr[3];
+		return;
+	}
+
+	for ( i = 0; i < 8; i++ ){
+		*hi = (*hi << 8) | addr[i];
+		*lo = (*lo << 8) | addr[i + 8];
+	}
+}
+
+int
+prefix_set_init (struct prefix_set *set)
+{
+	memset (set, 0, sizeof (struct prefix_set));
+
+	if ( prefix_hash_init (&(set->ipv4), 1) != 0 || prefix_hash_init (&(set->ipv6), 2) != 0 )
+		return ENOMEM;
+
+	return 0;
+}
+
+int
+prefix_set_add (struct prefix_set *set, const uint8_t *addr, int family)
+{
+	uint64_t hi, lo;
+
+	prefix_set_key (addr, family, &hi, &lo);
+
+	if ( family == 4 )
+		return prefix_hash_add (&(set->ipv4), hi, lo);
+
+	if ( hi == 0 && lo == 0 ){
+		set->has_zero = 1;
+		return 0;
+	}
+
+	return prefix_hash_add (&(set->ipv6), hi, lo);
+}
+
+int
+prefix_set_contains (const struct prefix_set *set, const uint8_t *addr, int family)
+{
+	uint64_t hi, lo;
+	uint32_t pos;
+
+	prefix_set_key (addr, family, &hi, &lo);
+
+	if ( family == 4 )
+		return prefix_hash_find (&(set->ipv4), hi, lo, &pos);
+
+	if ( hi == 0 && lo == 0 )
+		return set->has_zero;
+
+	return prefix_hash_find (&(set->ipv6), hi, lo, &pos);
+}
+
+void
+prefix_set_free (struct prefix_set *set)
+{
+	free (set->ipv4.slot);
+	free (set->ipv6.slot);
+	memset (set, 0, sizeof (struct prefix_set));
+}
+
+/* ======= */
+/* Lua API */
+/* ======= */
+
+/* Address for a lookup, either a whole 4 or 16 byte string, or an address
+ * of the given family at offset 'i' of a string (e.g. frame data). */
+static const uint8_t*
+prefix_lua_addr (lua_State *lua_state, int arg, int *family)
+{
+	const char *data;
+	lua_Integer i;
+	size_t len;
+
+	data = luaL_checklstring (lua_state, arg, &len);
+
+	if ( lua_isnoneornil (lua_state, arg + 1) ){
+		if ( len != 4 && len != 16 )
+			luaL_argerror (lua_state, arg, "address must be 4 or 16 bytes long");
+
+		*family = (len == 4) ? 4:6;
+
+		return (const uint8_t*) data;
+	}
+
+	i = luaL_checkinteger (lua_state, arg + 1);
+	*family = luaL_optinteger (lua_state, arg + 2, 4);
+
+	if ( *family != 4 && *family != 6 )
+		luaL_argerror (lua_state, arg + 2, "family must be 4 or 6");
+
+	if ( i < 1 || (size_t) (i - 1) + ((*family == 4) ? 4:16) > len )
+		luaL_argerror (lua_state, arg + 1, "address out of range");
+
+	return (const uint8_t*) data + (i - 1);
+}
+
+static void
+prefix_lua_parse (lua_State *lua_state, int arg, uint8_t *addr, int *family, int *plen)
+{
+	const char *str;
+	size_t len;
+
+	if ( lua_type (lua_state, arg) != LUA_TSTRING ){
+		luaL_error (lua_state, "prefix must be a string");
+		return;
+	}
+
+	str = lua_tolstring (lua_state, arg, &len);
+
+	if ( prefix_parse (str, len, addr, family, plen) != 0 )
+		luaL_error (lua_state, "invalid prefix '%s'", str);
+}
+
+/* Add a prefix to the table at index 1, value is on top of the stack. */
+static void
+prefix_lua_table_put (lua_State *lua_state, struct prefix_table *table, const uint8_t *addr, int family, int plen)
+{
+	int rval;
+
+	rval = prefix_table_add (table, addr, family, plen, table->value_cnt + 1);
+
+	if ( rval != 0 ){
+		luaL_error (lua_state, "cannot add prefix: %s", strerror (rval));
+		return;
+	}
+
+	table->value_cnt++;
+
+	lua_getuservalue (lua_state, 1);
+	lua_insert (lua_state, -2);
+	lua_rawseti (lua_state, -2, table->value_cnt);
+	lua_pop (lua_state, 1);
+}
+
+/* Close a file being loaded. Also its finalizer, a callback may raise an
+ * error in the middle of the file. */
+static int
+prefix_lua_file_close (lua_State *lua_state)
+{
+	FILE **file;
+
+	file = (FILE**) luaL_checkudata (lua_state, 1, PREFIX_FILE_MT);
+
+	if ( *file != NULL ){
+		fclose (*file);
+		*file = NULL;
+	}
+
+	return 0;
+}
+
+/* Read a file, one address or prefix per line, optionally followed by
+ * a value separated by white space. Empty lines and lines starting with '#'
+ * are skipped. Calls 'cb' for each line, the value is pushed on the stack. */
+static int
+prefix_lua_load (lua_State *lua_state, const char *path, int with_value, void (*cb) (lua_State*, void*, const uint8_t*, int, int), void *udata)
+{
+	FILE **file;
+	char line[PREFIX_LINE_MAX];
+	uint8_t addr[16];
+	char *p, *end, *value;
+	int lineno;
+	int family, plen, cnt;
+
+	if ( luaL_newmetatable (lua_state, PREFIX_FILE_MT) ){
+		lua_pushcfunction (lua_state, prefix_lua_file_close);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	/* Handle stays on top of the stack, under values passed to 'cb'. */
+	file = (FILE**) lua_newuserdata (lua_state, sizeof (FILE*));
+	*file = NULL;
+	luaL_setmetatable (lua_state, PREFIX_FILE_MT);
+
+	*file = fopen (path, "r");
+
+	if ( *file == NULL )
+		return luaL_error (lua_state, "cannot open file '%s': %s", path, strerror (errno));
+
+	lineno = 0;
+	cnt = 0;
+
+	while ( fgets (line, sizeof (line), *file) != NULL ){
+		lineno++;
+		end = line + strlen (line);
+
+		if ( end > line && end[-1] != '\n' && ! feof (*file) ){
+			fclose (*file);
+			*file = NULL;
+			return luaL_error (lua_state, "%s:%d: line too long", path, lineno);
+		}
+
+		for ( p = line; *p == ' ' || *p == '\t'; p++ );
+
+		while ( end > p && (end[-1] == '\n' || end[-1] == '\r' || end[-1] == ' ' || end[-1] == '\t') )
+			end--;
+
+		*end = '\0';
+
+		if ( p == end || *p == '#' )
+			continue;
+
+		for ( value = p; value < end && *value != ' ' && *value != '\t'; value++ );
+
+		if ( prefix_parse (p, value - p, addr, &family, &plen) != 0
+				|| (! with_value && (value < end || plen != ((family == 4) ? 32:128))) ){
+			fclose (*file);
+			*file = NULL;
+			return luaL_error (lua_state, "%s:%d: invalid %s", path, lineno, with_value ? "prefix":"address");
+		}
+
+		for ( ; value < end && (*value == ' ' || *value == '\t'); value++ );
+
+		if ( value < end )
+			lua_pushlstring (lua_state, value, end - value);
+		else
+			lua_pushboolean (lua_state, 1);
+
+		cb (lua_state, udata, addr, family, plen);
+		cnt++;
+	}
+
+	fclose (*file);
+	*file = NULL;
+	lua_pop (lua_state, 1);
+
+	return cnt;
+}
+
+static void
+prefix_lua_table_line (lua_State *lua_state, void *udata, const uint8_t *addr, int family, int plen)
+{
+	prefix_lua_table_put (lua_state, (struct prefix_table*) udata, addr, family, plen);
+}
+
+/* table:add (prefix [, value]) */
+static int
+prefix_lua_table_add (lua_State *lua_state)
+{
+	struct prefix_table *table;
+	uint8_t addr[16];
+	int family, plen;
+
+	table = (struct prefix_table*) luaL_checkudata (lua_state, 1, PREFIX_TABLE_MT);
+	prefix_lua_parse (lua_state, 2, addr, &family, &plen);
+
+	if ( lua_isnoneornil (lua_state, 3) ){
+		lua_settop (lua_state, 2);
+		lua_pushboolean (lua_state, 1);
+	} else {
+		lua_settop (lua_state, 3);
+	}
+
+	prefix_lua_table_put (lua_state, table, addr, family, plen);
+
+	return 0;
+}
+
+/* table:load (path), returns number of loaded prefixes */
+static int
+prefix_lua_table_load (lua_State *lua_state)
+{
+	struct prefix_table *table;
+	const char *path;
+
+	table = (struct prefix_table*) luaL_checkudata (lua_state, 1, PREFIX_TABLE_MT);
+	path = luaL_checkstring (lua_state, 2);
+
+	lua_pushinteger (lua_state, prefix_lua_load (lua_state, path, 1, prefix_lua_table_line, table));
+
+	return 1;
+}
+
+static struct prefix_table*
+prefix_lua_table_compiled (lua_State *lua_state)
+{
+	struct prefix_table *table;
+	int rval;
+
+	table = (struct prefix_table*) luaL_checkudata (lua_state, 1, PREFIX_TABLE_MT);
+
+	if ( ! table->ipv4.compiled || ! table->ipv6.compiled ){
+		rval = prefix_table_compile (table);
+
+		if ( rval != 0 )
+			luaL_error (lua_state, "cannot compile prefixes: %s", strerror (rval));
+	}
+
+	return table;
+}
+
+/* table:lookup (addr [, i [, family]]), returns value and length of the
+ * longest matching prefix, or nil. */
+static int
+prefix_lua_table_lookup (lua_State *lua_state)
+{
+	struct prefix_table *table;
+	const struct prefix_entry *entry;
+	const uint8_t *addr;
+	int family;
+
+	table = prefix_lua_table_compiled (lua_state);
+	addr = prefix_lua_addr (lua_state, 2, &family);
+	entry = prefix_table_lookup (table, addr, family);
+
+	if ( entry == NULL ){
+		lua_pushnil (lua_state);
+		return 1;
+	}
+
+	lua_getuservalue (lua_state, 1);
+	lua_rawgeti (lua_state, -1, entry->value);
+	lua_pushinteger (lua_state, entry->len);
+
+	return 2;
+}
+
+static int
+prefix_lua_table_len (lua_State *lua_state)
+{
+	struct prefix_table *table;
+
+	table = prefix_lua_table_compiled (lua_state);
+
+	lua_pushinteger (lua_state, table->ipv4.entry_cnt + table->ipv6.entry_cnt);
+
+	return 1;
+}
+
+static int
+prefix_lua_table_gc (lua_State *lua_state)
+{
+	struct prefix_table *table;
+
+	table = (struct prefix_table*) luaL_checkudata (lua_state, 1, PREFIX_TABLE_MT);
+
+	prefix_table_free (table);
+
+	return 0;
+}
+
+static const luaL_Reg prefix_table_methods[] = {
+	{ "add", prefix_lua_table_add },
+	{ "load", prefix_lua_table_load },
+	{ "lookup", prefix_lua_table_lookup },
+	{ NULL, NULL }
+};
+
+/* capdiss.prefix_table ([path | { [prefix] = value, ... } | { prefix, ... }]) */
+static int
+prefix_lua_table_new (lua_State *lua_state)
+{
+	struct prefix_table *table;
+	uint8_t addr[16];
+	int family, plen;
+
+	lua_settop (lua_state, 1);
+
+	if ( luaL_newmetatable (lua_state, PREFIX_TABLE_MT) ){
+		lua_newtable (lua_state);
+		luaL_setfuncs (lua_state, prefix_table_methods, 0);
+		lua_setfield (lua_state, -2, "__index");
+		lua_pushcfunction (lua_state, prefix_lua_table_len);
+		lua_setfield (lua_state, -2, "__len");
+		lua_pushcfunction (lua_state, prefix_lua_table_gc);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	table = (struct prefix_table*) lua_newuserdata (lua_state, sizeof (struct prefix_table));
+	prefix_table_init (table);
+	luaL_setmetatable (lua_state, PREFIX_TABLE_MT);
+
+	/* Values of prefixes, indexed by the order of insertion */
+	lua_newtable (lua_state);
+	lua_setuservalue (lua_state, -2);
+
+	/* Object goes to index 1, the source to index 2 */
+	lua_insert (lua_state, 1);
+
+	switch ( lua_type (lua_state, 2) ){
+		case LUA_TNONE:
+		case LUA_TNIL:
+			break;
+
+		case LUA_TSTRING:
+			prefix_lua_load (lua_state, lua_tostring (lua_state, 2), 1, prefix_lua_table_line, table);
+			break;
+
+		case LUA_TTABLE:
+			lua_pushnil (lua_state);
+
+			while ( lua_next (lua_state, 2) != 0 ){
+				if ( lua_type (lua_state, -2) == LUA_TSTRING ){
+					prefix_lua_parse (lua_state, -2, addr, &family, &plen);
+				} else {
+					prefix_lua_parse (lua_state, -1, addr, &family, &plen);
+					lua_pop (lua_state, 1);
+					lua_pushboolean (lua_state, 1);
+				}
+
+				prefix_lua_table_put (lua_state, table, addr, family, plen);
+			}
+			break;
+
+		default:
+			return luaL_argerror (lua_state, 1, "expected path or table of prefixes");
+	}
+
+	lua_settop (lua_state, 1);
+
+	return 1;
+}
+
+static void
+prefix_lua_set_line (lua_State *lua_state, void *udata, const uint8_t *addr, int family, int plen)
+{
+	int rval;
+
+	lua_pop (lua_state, 1);
+
+	if ( plen != ((family == 4) ? 32:128) ){
+		luaL_error (lua_state, "invalid address: prefix length given");
+		return;
+	}
+
+	rval = prefix_set_add ((struct prefix_set*) udata, addr, family);
+
+	if ( rval != 0 )
+		luaL_error (lua_state, "cannot add address: %s", strerror (rval));
+}
+
+/* set:add (address) */
+static int
+prefix_lua_set_add (lua_State *lua_state)
+{
+	struct prefix_set *set;
+	uint8_t addr[16];
+	int family, plen;
+
+	set = (struct prefix_set*) luaL_checkudata (lua_state, 1, PREFIX_SET_MT);
+	prefix_lua_parse (lua_state, 2, addr, &family, &plen);
+
+	lua_pushboolean (lua_state, 1);
+	prefix_lua_set_line (lua_state, set, addr, family, plen);
+
+	return 0;
+}
+
+/* set:load (path), returns number of loaded addresses */
+static int
+prefix_lua_set_load (lua_State *lua_state)
+{
+	struct prefix_set *set;
+	const char *path;
+
+	set = (struct prefix_set*) luaL_checkudata (lua_state, 1, PREFIX_SET_MT);
+	path = luaL_checkstring (lua_state, 2);
+
+	lua_pushinteger (lua_state, prefix_lua_load (lua_state, path, 0, prefix_lua_set_line, set));
+
+	return 1;
+}
+
+/* set:contains (addr [, i [, family]]) */
+static int
+prefix_lua_set_contains (lua_State *lua_state)
+{
+	struct prefix_set *set;
+	const uint8_t *addr;
+	int family;
+
+	set = (struct prefix_set*) luaL_checkudata (lua_state, 1, PREFIX_SET_MT);
+	addr = prefix_lua_addr (lua_state, 2, &family);
+
+	lua_pushboolean (lua_state, prefix_set_contains (set, addr, family));
+
+	return 1;
+}
+
+static int
+prefix_lua_set_len (lua_State *lua_state)
+{
+	struct prefix_set *set;
+
+	set = (struct prefix_set*) luaL_checkudata (lua_state, 1, PREFIX_SET_MT);
+
+	lua_pushinteger (lua_state, set->ipv4.cnt + set->ipv6.cnt + set->has_zero);
+
+	return 1;
+}
+
+static int
+prefix_lua_set_gc (lua_State *lua_state)
+{
+	struct prefix_set *set;
+
+	set = (struct prefix_set*) luaL_checkudata (lua_state, 1, PREFIX_SET_MT);
+
+	prefix_set_free (set);
+
+	return 0;
+}
+
+static const luaL_Reg prefix_set_methods[] = {
+	{ "add", prefix_lua_set_add },
+	{ "load", prefix_lua_set_load },
+	{ "contains", prefix_lua_set_contains },
+	{ NULL, NULL }
+};
+
+/* capdiss.ip_set ([path | { address, ... }]) */
+static int
+prefix_lua_set_new (lua_State *lua_state)
+{
+	struct prefix_set *set;
+	uint8_t addr[16];
+	int family, plen;
+
+	lua_settop (lua_state, 1);
+
+	if ( luaL_newmetatable (lua_state, PREFIX_SET_MT) ){
+		lua_newtable (lua_state);
+		luaL_setfuncs (lua_state, prefix_set_methods, 0);
+		lua_setfield (lua_state, -2, "__index");
+		lua_pushcfunction (lua_state, prefix_lua_set_len);
+		lua_setfield (lua_state, -2, "__len");
+		lua_pushcfunction (lua_state, prefix_lua_set_gc);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	set = (struct prefix_set*) lua_newuserdata (lua_state, sizeof (struct prefix_set));
+	memset (set, 0, sizeof (struct prefix_set));
+	luaL_setmetatable (lua_state, PREFIX_SET_MT);
+
+	if ( prefix_set_init (set) != 0 )
+		return luaL_error (lua_state, "cannot allocate memory");
+
+	lua_insert (lua_state, 1);
+
+	switch ( lua_type (lua_state, 2) ){
+		case LUA_TNONE:
+		case LUA_TNIL:
+			break;
+
+		case LUA_TSTRING:
+			prefix_lua_load (lua_state, lua_tostring (lua_state, 2), 0, prefix_lua_set_line, set);
+			break;
+
+		case LUA_TTABLE:
+			lua_pushnil (lua_state);
+
+			while ( lua_next (lua_state, 2) != 0 ){
+				prefix_lua_parse (lua_state, -1, addr, &family, &plen);
+				prefix_lua_set_line (lua_state, set, addr, family, plen);
+			}
+			break;
+
+		default:
+			return luaL_argerror (lua_state, 1, "expected path or table of addresses");
+	}
+
+	lua_settop (lua_state, 1);
+
+	return 1;
+}
+
+const luaL_Reg prefix_api[] = {
+	{ "prefix_table", prefix_lua_table_new },
+	{ "ip_set", prefix_lua_set_new },
+	{ NULL, NULL }
+};
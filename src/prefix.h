@@ -0,0 +1,129 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _PREFIX_H
+#define _PREFIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+/* Longest line of a file with prefixes or addresses. */
+#define PREFIX_LINE_MAX 1024
+
+/* Slots of the root of a trie, indexed by the first 16 bits of an address. */
+#define PREFIX_DIRECT_SIZE 65536
+#define PREFIX_DIRECT_NODE 0x80000000U
+
+/* Smallest number of slots of an address set, always a power of two. */
+#define PREFIX_SET_SIZE 64
+
+/*
+ * Node of a compressed multibit trie (stride of 8 bits). Bit 'b' of 'vec' is
+ * set, if the byte 'b' leads to another node, the nodes are stored in a
+ * contiguous block starting at 'base_node', ordered by the byte. Remaining
+ * bytes lead to leaves, runs of bytes with the same leaf share one entry of
+ * a leaf array starting at 'base_leaf', bit 'leafvec' marks start of a run.
+ */
+struct prefix_node
+{
+	uint64_t vec[4];
+	uint64_t leafvec[4];
+	uint32_t base_node;
+	uint32_t base_leaf;
+};
+
+struct prefix_entry
+{
+	uint8_t addr[16];
+	uint32_t value;
+	uint8_t len;
+};
+
+struct prefix_trie
+{
+	int bits;
+
+	/* Prefixes, sorted and without duplicates while the trie is compiled */
+	struct prefix_entry *entry;
+	uint32_t entry_cnt;
+	uint32_t entry_size;
+
+	/* Compiled trie, leaves are indexes to 'entry' increased by one */
+	uint32_t *direct;
+	struct prefix_node *node;
+	uint32_t node_cnt;
+	uint32_t node_size;
+	uint32_t *leaf;
+	uint32_t leaf_cnt;
+	uint32_t leaf_size;
+	int compiled;
+};
+
+struct prefix_table
+{
+	struct prefix_trie ipv4;
+	struct prefix_trie ipv6;
+	uint32_t value_cnt;
+};
+
+struct prefix_hash
+{
+	uint64_t *slot;
+	int width;
+	uint32_t cnt;
+	uint32_t mask;
+};
+
+struct prefix_set
+{
+	struct prefix_hash ipv4;
+	struct prefix_hash ipv6;
+	int has_zero;
+};
+
+extern const luaL_Reg prefix_api[];
+
+extern int prefix_parse (const char *str, size_t len, uint8_t *addr, int *family, int *plen);
+
+extern void prefix_table_init (struct prefix_table *table);
+
+extern int prefix_table_add (struct prefix_table *table, const uint8_t *addr, int family, int plen, uint32_t value);
+
+extern int prefix_table_compile (struct prefix_table *table);
+
+extern const struct prefix_entry* prefix_table_lookup (const struct prefix_table *table, const uint8_t *addr, int family);
+
+extern void prefix_table_free (struct prefix_table *table);
+
+extern int prefix_set_init (struct prefix_set *set);
+
+extern int prefix_set_add (struct prefix_set *set, const uint8_t *addr, int family);
+
+extern int prefix_set_contains (const struct prefix_set *set, const uint8_t *addr, int family);
+
+extern void prefix_set_free (struct prefix_set *set);
+
+#endif
+
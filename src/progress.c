@@ -0,0 +1,486 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include "progress.h"
+
+/*
+ * Progress of the read loop. The loop itself only bumps counters, samples
+ * for rates are taken once a second by SIGALRM handler, reports are written
+ * by the handler as well. That way reports keep coming even if a script is
+ * stuck, and SIGUSR1 dumps the state immediately. Everything called from
+ * the handlers must be async-signal-safe, so reports are formatted by hand.
+ *
+ * Where there are no such signals, the clock is checked every PROGRESS_CHECK
+ * frames.
+ */
+
+static struct progress *progress_active;
+
+struct pbuff
+{
+	char data[1024];
+	size_t len;
+};
+
+static int64_t
+progress_clock (void)
+{
+#ifdef _WIN32
+	return (int64_t) clock () * 1000000 / CLOCKS_PER_SEC;
+#else
+	struct timespec now;
+
+	clock_gettime (CLOCK_MONOTONIC, &now);
+
+	return (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+}
+
+static void
+pbuff_str (struct pbuff *buff, const char *str)
+{
+	while ( *str != '\0' && buff->len < sizeof (buff->data) - 1 )
+		buff->data[buff->len++] = *str++;
+}
+
+static void
+pbuff_uint (struct pbuff *buff, uint64_t val)
+{
+	char num[21];
+	int i;
+
+	i = sizeof (num) - 1;
+	num[i] = '\0';
+
+	do {
+		num[--i] = '0' + (val % 10);
+		val /= 10;
+	} while ( val > 0 );
+
+	pbuff_str (buff, num + i);
+}
+
+/* Size with one decimal digit and a binary prefix, e.g. 12.3M. */
+static void
+pbuff_size (struct pbuff *buff, uint64_t val)
+{
+	static const char *units[] = { "", "K", "M", "G", "T", "P" };
+	uint64_t frac;
+	int unit;
+
+	frac = 0;
+
+	for ( unit = 0; val >= 1024 && unit < 5; unit++ ){
+		frac = (val % 1024) * 10 / 1024;
+		val /= 1024;
+	}
+
+	pbuff_uint (buff, val);
+
+	if ( unit > 0 ){
+		pbuff_str (buff, ".");
+		pbuff_uint (buff, frac);
+	}
+
+	pbuff_str (buff, units[unit]);
+}
+
+static void
+pbuff_time (struct pbuff *buff, uint64_t sec)
+{
+	if ( sec >= 3600 ){
+		pbuff_uint (buff, sec / 3600);
+		pbuff_str (buff, "h");
+	}
+
+	if ( sec >= 60 ){
+		pbuff_uint (buff, (sec / 60) % 60);
+		pbuff_str (buff, "m");
+	}
+
+	pbuff_uint (buff, sec % 60);
+	pbuff_str (buff, "s");
+}
+
+static uint64_t
+progress_input (struct progress *progress)
+{
+	return progress->done_size + ((progress->offset != NULL) ? *(progress->offset):0);
+}
+
+/* Take a sample and update rates. Must not be interrupted by the signal
+ * handlers. */
+static void
+progress_sample (struct progress *progress, int64_t now)
+{
+	struct progress_sample *sample, *first;
+	int64_t dt;
+
+	if ( progress->cnt > 0 ){
+		sample = &(progress->window[(progress->head + progress->cnt - 1) % PROGRESS_WINDOW]);
+
+		/* Timer signals do not arrive exactly a second apart. */
+		if ( now - sample->time < 500000 )
+			return;
+	}
+
+	if ( progress->cnt == PROGRESS_WINDOW ){
+		progress->head = (progress->head + 1) % PROGRESS_WINDOW;
+		progress->cnt--;
+	}
+
+	sample = &(progress->window[(progress->head + progress->cnt) % PROGRESS_WINDOW]);
+	sample->time = now;
+	sample->frames = progress->frames;
+	sample->bytes = progress->bytes;
+	sample->input = progress_input (progress);
+	progress->cnt++;
+
+	first = &(progress->window[progress->head]);
+	dt = sample->time - first->time;
+
+	if ( dt <= 0 )
+		return;
+
+	progress->frame_rate = (sample->frames - first->frames) * 1000000 / dt;
+	progress->byte_rate = (sample->bytes - first->bytes) * 1000000 / dt;
+	progress->input_rate = (sample->input >= first->input) ? (sample->input - first->input) * 1000000 / dt:0;
+}
+
+void
+progress_report (struct progress *progress)
+{
+	struct pbuff buff;
+	uint64_t input, elapsed;
+
+	buff.len = 0;
+	input = progress_input (progress);
+	elapsed = (progress_clock () - progress->start) / 1000000;
+
+	pbuff_str (&buff, progress->name);
+	pbuff_str (&buff, ": ");
+
+	if ( progress->file != NULL ){
+		pbuff_str (&buff, "file ");
+		pbuff_uint (&buff, progress->file_idx);
+		pbuff_str (&buff, "/");
+		pbuff_uint (&buff, progress->file_cnt);
+		pbuff_str (&buff, " '");
+		pbuff_str (&buff, progress->file);
+		pbuff_str (&buff, "' at ");
+		pbuff_size (&buff, (progress->offset != NULL) ? *(progress->offset):0);
+
+		if ( progress->file_size > 0 ){
+			pbuff_str (&buff, " of ");
+			pbuff_size (&buff, progress->file_size);
+			pbuff_str (&buff, " (");
+			pbuff_uint (&buff, ((progress->offset != NULL) ? *(progress->offset):0) * 100 / progress->file_size);
+			pbuff_str (&buff, "%)");
+		}
+
+		pbuff_str (&buff, ", ");
+	}
+
+	pbuff_uint (&buff, progress->frames);
+	pbuff_str (&buff, " frames (");
+	pbuff_uint (&buff, progress->frame_rate);
+	pbuff_str (&buff, "/s), ");
+	pbuff_size (&buff, progress->bytes);
+	pbuff_str (&buff, " bytes (");
+	pbuff_size (&buff, progress->byte_rate);
+	pbuff_str (&buff, "/s), elapsed ");
+	pbuff_time (&buff, elapsed);
+
+	if ( progress->total_size > input && progress->input_rate > 0 ){
+		pbuff_str (&buff, ", eta ");
+		pbuff_time (&buff, (progress->total_size - input) / progress->input_rate);
+	}
+
+	if ( progress->file != NULL )
+		pbuff_str (&buff, (progress->phase == PROGRESS_READ) ? ", reading":", processing");
+
+	pbuff_str (&buff, "\n");
+
+	if ( write (progress->fd, buff.data, buff.len) == -1 )
+		return;
+
+	progress->last_report = progress_clock ();
+}
+
+#ifndef _WIN32
+static void
+progress_signal (int signo)
+{
+	struct progress *progress;
+	int64_t now;
+	int errno_saved;
+
+	progress = progress_active;
+
+	if ( progress == NULL )
+		return;
+
+	errno_saved = errno;
+	now = progress_clock ();
+
+	if ( signo == SIGALRM ){
+		progress_sample (progress, now);
+
+		if ( progress->interval > 0 && now - progress->last_report >= (int64_t) progress->interval * 1000000 - 500000 )
+			progress_report (progress);
+	} else {
+		progress_report (progress);
+	}
+
+	errno = errno_saved;
+}
+
+static void
+progress_block (sigset_t *saved)
+{
+	sigset_t set;
+
+	sigemptyset (&set);
+	sigaddset (&set, SIGALRM);
+	sigaddset (&set, SIGUSR1);
+	sigprocmask (SIG_BLOCK, &set, saved);
+}
+#endif
+
+/* Called every PROGRESS_CHECK frames if there is no timer. */
+void
+progress_poll (struct progress *progress)
+{
+	int64_t now;
+#ifndef _WIN32
+	sigset_t saved;
+
+	progress_block (&saved);
+#endif
+
+	now = progress_clock ();
+	progress_sample (progress, now);
+
+	if ( progress->interval > 0 && now - progress->last_report >= (int64_t) progress->interval * 1000000 )
+		progress_report (progress);
+
+#ifndef _WIN32
+	sigprocmask (SIG_SETMASK, &saved, NULL);
+#endif
+}
+
+int
+progress_init (struct progress *progress, const char *name, int fd, unsigned interval)
+{
+#ifndef _WIN32
+	struct sigaction action;
+	struct itimerval timer;
+#endif
+
+	memset (progress, 0, sizeof (struct progress));
+
+	progress->name = name;
+	progress->fd = fd;
+	progress->interval = interval;
+	progress->start = progress_clock ();
+	progress->last_report = progress->start;
+
+	progress_active = progress;
+
+#ifndef _WIN32
+	/* Restart interrupted system calls, libpcap does not expect EINTR. */
+	memset (&action, 0, sizeof (action));
+	action.sa_handler = progress_signal;
+	action.sa_flags = SA_RESTART;
+	sigemptyset (&action.sa_mask);
+	sigaddset (&action.sa_mask, SIGALRM);
+	sigaddset (&action.sa_mask, SIGUSR1);
+
+	if ( sigaction (SIGUSR1, &action, NULL) == -1 )
+		return errno;
+
+	if ( interval > 0 ){
+		if ( sigaction (SIGALRM, &action, NULL) == -1 )
+			return errno;
+
+		memset (&timer, 0, sizeof (timer));
+		timer.it_interval.tv_sec = 1;
+		timer.it_value.tv_sec = 1;
+
+		if ( setitimer (ITIMER_REAL, &timer, NULL) == -1 )
+			return errno;
+
+		progress->timer = 1;
+	}
+#endif
+
+	return 0;
+}
+
+void
+progress_add_file (struct progress *progress, const char *path)
+{
+	struct stat st;
+
+	progress->file_cnt++;
+
+	if ( stat (path, &st) == 0 && S_ISREG (st.st_mode) )
+		progress->total_size += st.st_size;
+}
+
+void
+progress_file (struct progress *progress, const char *path, const uint64_t *offset)
+{
+	struct stat st;
+
+	progress->file_size = 0;
+
+	if ( stat (path, &st) == 0 && S_ISREG (st.st_mode) )
+		progress->file_size = st.st_size;
+
+	progress->file_idx++;
+	progress->offset = offset;
+	progress->file = path;
+}
+
+void
+progress_file_done (struct progress *progress)
+{
+	uint64_t size;
+
+	size = progress->file_size;
+
+	if ( progress->offset != NULL && *(progress->offset) > size )
+		size = *(progress->offset);
+
+	progress->offset = NULL;
+	progress->file = NULL;
+	progress->done_size += size;
+}
+
+void
+progress_free (struct progress *progress)
+{
+#ifndef _WIN32
+	struct itimerval timer;
+
+	if ( progress->timer ){
+		memset (&timer, 0, sizeof (timer));
+		setitimer (ITIMER_REAL, &timer, NULL);
+		signal (SIGALRM, SIG_DFL);
+		progress->timer = 0;
+	}
+
+	signal (SIGUSR1, SIG_DFL);
+#endif
+
+	progress_active = NULL;
+}
+
+/* capdiss.stats () */
+static int
+progress_lua_stats (lua_State *lua_state)
+{
+	struct progress progress;
+	uint64_t input, offset;
+	int64_t now;
+#ifndef _WIN32
+	sigset_t saved;
+
+	progress_block (&saved);
+#endif
+
+	/* Work on a copy, the signal handlers may not be blocked for long. */
+	now = progress_clock ();
+	progress_sample ((struct progress*) lua_touserdata (lua_state, lua_upvalueindex (1)), now);
+	memcpy (&progress, lua_touserdata (lua_state, lua_upvalueindex (1)), sizeof (struct progress));
+	input = progress_input (&progress);
+	offset = (progress.offset != NULL) ? *(progress.offset):0;
+
+#ifndef _WIN32
+	sigprocmask (SIG_SETMASK, &saved, NULL);
+#endif
+
+	lua_createtable (lua_state, 0, 16);
+
+	lua_pushnumber (lua_state, progress.frames);
+	lua_setfield (lua_state, -2, "frames");
+	lua_pushnumber (lua_state, progress.bytes);
+	lua_setfield (lua_state, -2, "bytes");
+	lua_pushnumber (lua_state, progress.frame_rate);
+	lua_setfield (lua_state, -2, "frame_rate");
+	lua_pushnumber (lua_state, progress.byte_rate);
+	lua_setfield (lua_state, -2, "byte_rate");
+	lua_pushnumber (lua_state, progress.input_rate);
+	lua_setfield (lua_state, -2, "input_rate");
+	lua_pushnumber (lua_state, (now - progress.start) / 1000000.0);
+	lua_setfield (lua_state, -2, "elapsed");
+	lua_pushnumber (lua_state, progress.file_cnt);
+	lua_setfield (lua_state, -2, "file_count");
+	lua_pushnumber (lua_state, progress.file_idx);
+	lua_setfield (lua_state, -2, "file_index");
+
+	if ( progress.file != NULL ){
+		lua_pushstring (lua_state, progress.file);
+		lua_setfield (lua_state, -2, "file");
+		lua_pushnumber (lua_state, offset);
+		lua_setfield (lua_state, -2, "offset");
+		lua_pushnumber (lua_state, progress.file_size);
+		lua_setfield (lua_state, -2, "size");
+	}
+
+	if ( progress.total_size > 0 ){
+		lua_pushnumber (lua_state, progress.total_size);
+		lua_setfield (lua_state, -2, "total_size");
+		lua_pushnumber (lua_state, (input < progress.total_size) ? (double) input / progress.total_size:1.0);
+		lua_setfield (lua_state, -2, "progress");
+
+		if ( progress.input_rate > 0 && input < progress.total_size ){
+			lua_pushnumber (lua_state, (double) (progress.total_size - input) / progress.input_rate);
+			lua_setfield (lua_state, -2, "eta");
+		}
+	}
+
+	return 1;
+}
+
+const luaL_Reg progress_api[] = {
+	{ "stats", progress_lua_stats },
+	{ NULL, NULL }
+};
+
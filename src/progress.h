@@ -0,0 +1,106 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _PROGRESS_H
+#define _PROGRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+/* Number of one second samples the rates are computed over. */
+#define PROGRESS_WINDOW 10
+
+#define PROGRESS_INTERVAL 10
+
+/* Frames read between checks of the clock, where there are no timer
+ * signals. */
+#define PROGRESS_CHECK 4096
+
+enum
+{
+	PROGRESS_READ = 0,
+	PROGRESS_SCRIPT = 1
+};
+
+struct progress_sample
+{
+	int64_t time;
+	uint64_t frames;
+	uint64_t bytes;
+	uint64_t input;
+};
+
+struct progress
+{
+	const char *name;
+	int fd;
+	unsigned interval;
+	uint64_t frames;
+	uint64_t bytes;
+	const char *file;
+	size_t file_idx;
+	size_t file_cnt;
+	uint64_t file_size;
+	const uint64_t *offset;
+	uint64_t done_size;
+	uint64_t total_size;
+	int phase;
+	int64_t start;
+	int64_t last_report;
+	struct progress_sample window[PROGRESS_WINDOW];
+	size_t head;
+	size_t cnt;
+	uint64_t frame_rate;
+	uint64_t byte_rate;
+	uint64_t input_rate;
+	int timer;
+};
+
+#define progress_frame(p, len) do { \
+	(p)->frames++; \
+	(p)->bytes += (len); \
+	(p)->phase = PROGRESS_SCRIPT; \
+	if ( ! (p)->timer && ((p)->frames % PROGRESS_CHECK) == 0 ) \
+		progress_poll (p); \
+} while ( 0 )
+
+extern const luaL_Reg progress_api[];
+
+extern int progress_init (struct progress *progress, const char *name, int fd, unsigned interval);
+
+extern void progress_add_file (struct progress *progress, const char *path);
+
+extern void progress_file (struct progress *progress, const char *path, const uint64_t *offset);
+
+extern void progress_file_done (struct progress *progress);
+
+extern void progress_poll (struct progress *progress);
+
+extern void progress_report (struct progress *progress);
+
+extern void progress_free (struct progress *progress);
+
+#endif
+
@@ -0,0 +1,444 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pcap.h>
+
+#include "reader.h"
+
+/*
+ * Source of frames for the main loop. Classic pcap files are parsed natively
+ * from blocks supplied by the input layer (ioread), or from a range of
+ * a memory mapped file, anything else (pcapng, standard input, or a file the
+ * input layer cannot read) is passed on to libpcap. Filters are applied the
+ * same way libpcap applies them to offline captures.
+ */
+
+#define READER_MAGIC_USEC 0xa1b2c3d4
+#define READER_MAGIC_NSEC 0xa1b23c4d
+
+static uint32_t
+reader_get32 (const uint8_t *data, int swapped)
+{
+	if ( swapped )
+		return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+
+	return ((uint32_t) data[3] << 24) | ((uint32_t) data[2] << 16) | ((uint32_t) data[1] << 8) | data[0];
+}
+
+/* Link-layer header types stored in files which differ from DLT_ values of
+ * the platform. */
+static int
+reader_linktype_to_dlt (int linktype)
+{
+	switch ( linktype ){
+#ifdef DLT_PPP_SERIAL
+		case 50:
+			return DLT_PPP_SERIAL;
+#endif
+#ifdef DLT_PPP_ETHER
+		case 51:
+			return DLT_PPP_ETHER;
+#endif
+		case 100:
+			return DLT_ATM_RFC1483;
+		case 101:
+			return DLT_RAW;
+#ifdef DLT_SLIP_BSDOS
+		case 102:
+			return DLT_SLIP_BSDOS;
+#endif
+#ifdef DLT_PPP_BSDOS
+		case 103:
+			return DLT_PPP_BSDOS;
+#endif
+#ifdef DLT_ATM_CLIP
+		case 106:
+			return DLT_ATM_CLIP;
+#endif
+	}
+
+	return linktype;
+}
+
+/* Parse the header of a classic pcap file. Return 0 on success, 1 if the data
+ * is not a supported pcap file. */
+int
+reader_parse_header (struct reader_format *fmt, const uint8_t *data, size_t len)
+{
+	uint32_t magic;
+
+	if ( len < READER_HDR_LEN )
+		return 1;
+
+	magic = reader_get32 (data, 0);
+
+	if ( magic == READER_MAGIC_USEC || magic == READER_MAGIC_NSEC ){
+		fmt->swapped = 0;
+	} else {
+		magic = reader_get32 (data, 1);
+
+		if ( magic != READER_MAGIC_USEC && magic != READER_MAGIC_NSEC )
+			return 1;
+
+		fmt->swapped = 1;
+	}
+
+	fmt->nsec = (magic == READER_MAGIC_NSEC);
+
+	/* Major version */
+	if ( (fmt->swapped ? ((data[4] << 8) | data[5]):((data[5] << 8) | data[4])) != 2 )
+		return 1;
+
+	fmt->snaplen = reader_get32 (data + 16, fmt->swapped);
+	fmt->linktype = reader_linktype_to_dlt (reader_get32 (data + 20, fmt->swapped) & 0x03ffffff);
+
+	if ( fmt->snaplen <= 0 || fmt->snaplen > READER_SNAPLEN_MAX )
+		fmt->snaplen = READER_SNAPLEN_MAX;
+
+	return 0;
+}
+
+/* Parse a header of a record, return the number of bytes of frame data
+ * stored in the file. */
+uint32_t
+reader_parse_record (const struct reader_format *fmt, const uint8_t *data, struct pcap_pkthdr *hdr)
+{
+	uint32_t caplen;
+
+	hdr->ts.tv_sec = reader_get32 (data, fmt->swapped);
+	hdr->ts.tv_usec = reader_get32 (data + 4, fmt->swapped);
+	caplen = reader_get32 (data + 8, fmt->swapped);
+	hdr->len = reader_get32 (data + 12, fmt->swapped);
+
+	if ( fmt->nsec )
+		hdr->ts.tv_usec /= 1000;
+
+	/* Frames longer than the snapshot length are truncated, the same way
+	 * libpcap does it. */
+	hdr->caplen = (caplen > (uint32_t) fmt->snaplen) ? (uint32_t) fmt->snaplen:caplen;
+
+	return caplen;
+}
+
+/* Get len contiguous bytes of the current file. Return 1 on success, 0 at
+ * the end of the file, -1 on failure. */
+static int
+reader_fetch (struct reader *reader, size_t len, const uint8_t **data)
+{
+	uint8_t *carry;
+	size_t have, cnt;
+	int rval;
+
+	if ( reader->block_len - reader->pos >= len ){
+		*data = reader->block + reader->pos;
+		reader->pos += len;
+		return 1;
+	}
+
+	/* Data span multiple blocks, assemble them in a separate buffer. */
+	if ( reader->carry_size < len ){
+		carry = (uint8_t*) realloc (reader->carry, len);
+
+		if ( carry == NULL ){
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "cannot allocate memory");
+			return -1;
+		}
+
+		reader->carry = carry;
+		reader->carry_size = len;
+	}
+
+	have = reader->block_len - reader->pos;
+
+	/* A mapped range is a single block. */
+	if ( reader->map != NULL ){
+		if ( have == 0 )
+			return 0;
+
+		snprintf (reader->errbuff, sizeof (reader->errbuff), "truncated dump file; tried to read %lu bytes, only got %lu", (unsigned long) len, (unsigned long) have);
+		return -1;
+	}
+
+	if ( have > 0 )
+		memcpy (reader->carry, reader->block + reader->pos, have);
+
+	reader->pos = reader->block_len;
+
+	while ( have < len ){
+		rval = ioread_get (reader->io, &(reader->block), &(reader->block_len));
+		reader->pos = 0;
+
+		if ( rval != 0 ){
+			reader->block_len = 0;
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "%s", strerror (rval));
+			return -1;
+		}
+
+		if ( reader->block_len == 0 ){
+			if ( have == 0 )
+				return 0;
+
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "truncated dump file; tried to read %lu bytes, only got %lu", (unsigned long) len, (unsigned long) have);
+			return -1;
+		}
+
+		cnt = (len - have < reader->block_len) ? len - have:reader->block_len;
+		memcpy (reader->carry + have, reader->block, cnt);
+		have += cnt;
+		reader->pos = cnt;
+	}
+
+	*data = reader->carry;
+
+	return 1;
+}
+
+void
+reader_init (struct reader *reader, struct ioread *io)
+{
+	memset (reader, 0, sizeof (struct reader));
+	reader->io = io;
+}
+
+/* Read records of a memory mapped classic pcap file from offset start (a
+ * record boundary) up to offset end, instead of the input layer. */
+void
+reader_set_range (struct reader *reader, const uint8_t *map, uint64_t start, uint64_t end)
+{
+	reader->map = map;
+	reader->map_start = start;
+	reader->map_end = end;
+}
+
+/* Open the next file. Files must be opened in the same order as they were
+ * added to the input layer. */
+int
+reader_open (struct reader *reader, const char *path)
+{
+	const uint8_t *data;
+
+	reader->native = 0;
+	reader->block_len = 0;
+	reader->pos = 0;
+	reader->offset = 0;
+	reader->cnt = 0;
+
+	if ( reader->map != NULL ){
+		if ( reader_parse_header (&(reader->fmt), reader->map, READER_HDR_LEN) != 0 ){
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "unknown file format");
+			return 1;
+		}
+
+		reader->native = 1;
+		reader->linktype = reader->fmt.linktype;
+		reader->snaplen = reader->fmt.snaplen;
+		reader->block = reader->map;
+		reader->block_len = reader->map_end;
+		reader->pos = reader->map_start;
+		reader->offset = reader->map_start;
+		return 0;
+	}
+
+	if ( reader->io != NULL && ioread_begin (reader->io) == 0
+			&& reader_fetch (reader, READER_HDR_LEN, &data) == 1
+			&& reader_parse_header (&(reader->fmt), data, READER_HDR_LEN) == 0 ){
+		reader->native = 1;
+		reader->linktype = reader->fmt.linktype;
+		reader->snaplen = reader->fmt.snaplen;
+		reader->offset = READER_HDR_LEN;
+		return 0;
+	}
+
+#ifdef _WIN32
+	reader->pcap = pcap_open_offline (path, reader->errbuff);
+#else
+	reader->pcap = pcap_open_offline_with_tstamp_precision (path, PCAP_TSTAMP_PRECISION_MICRO, reader->errbuff);
+#endif
+
+	if ( reader->pcap == NULL )
+		return 1;
+
+	reader->linktype = pcap_datalink (reader->pcap);
+	reader->snaplen = pcap_snapshot (reader->pcap);
+
+	return 0;
+}
+
+/* Return 1 if the filter cannot be compiled, 2 if it cannot be applied. */
+int
+reader_setfilter (struct reader *reader, const char *filter)
+{
+	pcap_t *pcap_dead;
+	int rval;
+
+	if ( reader->has_filter ){
+		bpfjit_free (&(reader->jit));
+		pcap_freecode (&(reader->filter));
+		reader->has_filter = 0;
+	}
+
+	if ( ! reader->native ){
+		if ( pcap_compile (reader->pcap, &(reader->filter), filter, 1, 0) == -1 ){
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "%s", pcap_geterr (reader->pcap));
+			return 1;
+		}
+
+		/* Frames read by libpcap are filtered here if the program can be
+		 * translated to machine code, as libpcap would interpret it. */
+		if ( bpfjit_compile (&(reader->jit), &(reader->filter)) == 0 ){
+			reader->has_filter = 1;
+			return 0;
+		}
+
+		rval = pcap_setfilter (reader->pcap, &(reader->filter));
+		pcap_freecode (&(reader->filter));
+
+		if ( rval == -1 ){
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "%s", pcap_geterr (reader->pcap));
+			return 2;
+		}
+
+		return 0;
+	}
+
+	pcap_dead = pcap_open_dead (reader->linktype, reader->snaplen);
+
+	if ( pcap_dead == NULL ){
+		snprintf (reader->errbuff, sizeof (reader->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	if ( pcap_compile (pcap_dead, &(reader->filter), filter, 1, 0) == -1 ){
+		snprintf (reader->errbuff, sizeof (reader->errbuff), "%s", pcap_geterr (pcap_dead));
+		pcap_close (pcap_dead);
+		return 1;
+	}
+
+	pcap_close (pcap_dead);
+	bpfjit_compile (&(reader->jit), &(reader->filter));
+	reader->has_filter = 1;
+
+	return 0;
+}
+
+/* Same return values as pcap_next_ex: 1 on success, -1 on failure, -2 at the
+ * end of the file. */
+int
+reader_next (struct reader *reader, struct pcap_pkthdr **pkt_hdr, const u_char **pkt_data)
+{
+	const uint8_t *data;
+	uint32_t caplen;
+	long offset;
+	int rval;
+
+	if ( ! reader->native ){
+		do {
+			rval = pcap_next_ex (reader->pcap, pkt_hdr, pkt_data);
+		} while ( rval == 1 && reader->has_filter && bpfjit_filter (&(reader->jit), *pkt_data, (*pkt_hdr)->len, (*pkt_hdr)->caplen) == 0 );
+
+		if ( rval == -1 )
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "%s", pcap_geterr (reader->pcap));
+
+		/* Offset is only needed for progress reports, ftell may cost a
+		 * system call. */
+		if ( rval == 1 && (++reader->cnt % READER_TELL) == 1 && pcap_file (reader->pcap) != NULL ){
+			offset = ftell (pcap_file (reader->pcap));
+
+			if ( offset != -1 )
+				reader->offset = offset;
+		}
+
+		return rval;
+	}
+
+	for ( ;; ){
+		rval = reader_fetch (reader, READER_REC_LEN, &data);
+
+		if ( rval == 0 )
+			return -2;
+		else if ( rval == -1 )
+			return -1;
+
+		caplen = reader_parse_record (&(reader->fmt), data, &(reader->hdr));
+
+		if ( caplen > READER_CAPLEN_MAX ){
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "invalid packet capture length %lu", (unsigned long) caplen);
+			return -1;
+		}
+
+		rval = reader_fetch (reader, caplen, &data);
+
+		if ( rval == 0 ){
+			snprintf (reader->errbuff, sizeof (reader->errbuff), "truncated dump file; tried to read %lu captured bytes, only got 0", (unsigned long) caplen);
+			return -1;
+		} else if ( rval == -1 ){
+			return -1;
+		}
+
+		reader->offset += READER_REC_LEN + caplen;
+
+		if ( reader->has_filter && bpfjit_filter (&(reader->jit), data, reader->hdr.len, reader->hdr.caplen) == 0 )
+			continue;
+
+		*pkt_hdr = &(reader->hdr);
+		*pkt_data = data;
+
+		return 1;
+	}
+}
+
+void
+reader_close (struct reader *reader)
+{
+	if ( reader->pcap != NULL )
+		pcap_close (reader->pcap);
+
+	if ( reader->has_filter ){
+		bpfjit_free (&(reader->jit));
+		pcap_freecode (&(reader->filter));
+	}
+
+	reader->pcap = NULL;
+	reader->has_filter = 0;
+	reader->native = 0;
+	reader->block_len = 0;
+	reader->pos = 0;
+}
+
+void
+reader_free (struct reader *reader)
+{
+	reader_close (reader);
+
+	if ( reader->carry != NULL )
+		free (reader->carry);
+
+	reader->carry = NULL;
+	reader->carry_size = 0;
+}
+
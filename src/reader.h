@@ -0,0 +1,96 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _READER_H
+#define _READER_H
+
+#include <stdint.h>
+#include <pcap.h>
+
+#include "ioread.h"
+#include "bpfjit.h"
+
+#define READER_HDR_LEN 24
+#define READER_REC_LEN 16
+
+/* Largest capture length accepted in a record of a classic pcap file. */
+#define READER_CAPLEN_MAX (256 * 1024 * 1024)
+
+#define READER_SNAPLEN_MAX 262144
+
+/* Frames read by libpcap between updates of the file offset. */
+#define READER_TELL 1024
+
+struct reader_format
+{
+	int swapped;
+	int nsec;
+	int linktype;
+	int snaplen;
+};
+
+struct reader
+{
+	struct ioread *io;
+	pcap_t *pcap;
+	int native;
+	struct reader_format fmt;
+	int linktype;
+	int snaplen;
+	const uint8_t *map;
+	uint64_t map_start;
+	uint64_t map_end;
+	const uint8_t *block;
+	size_t block_len;
+	size_t pos;
+	uint8_t *carry;
+	size_t carry_size;
+	struct pcap_pkthdr hdr;
+	uint64_t offset;
+	unsigned long cnt;
+	struct bpf_program filter;
+	struct bpfjit jit;
+	int has_filter;
+	char errbuff[PCAP_ERRBUF_SIZE];
+};
+
+extern int reader_parse_header (struct reader_format *fmt, const uint8_t *data, size_t len);
+
+extern uint32_t reader_parse_record (const struct reader_format *fmt, const uint8_t *data, struct pcap_pkthdr *hdr);
+
+extern void reader_init (struct reader *reader, struct ioread *io);
+
+extern void reader_set_range (struct reader *reader, const uint8_t *map, uint64_t start, uint64_t end);
+
+extern int reader_open (struct reader *reader, const char *path);
+
+extern int reader_setfilter (struct reader *reader, const char *filter);
+
+extern int reader_next (struct reader *reader, struct pcap_pkthdr **pkt_hdr, const u_char **pkt_data);
+
+extern void reader_close (struct reader *reader);
+
+extern void reader_free (struct reader *reader);
+
+#endif
+
@@ -0,0 +1,962 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <pcap.h>
+
+#include "reasm.h"
+#include "netframe.h"
+
+#define REASM_HSIZE 4096
+#define REASM_DGRAM_MAX 65535
+
+#define SEQ_LT(a, b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)) < 0)
+#define SEQ_LEQ(a, b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)) <= 0)
+#define SEQ_GT(a, b) ((int32_t) ((uint32_t) (a) - (uint32_t) (b)) > 0)
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_RST 0x04
+#define TCP_ACK 0x10
+
+int
+reasm_init (struct reasm *reasm, size_t memcap, size_t flowcap, double timeout, reasm_data_cb on_data, reasm_close_cb on_close, void *udata)
+{
+	memset (reasm, 0, sizeof (struct reasm));
+
+	reasm->memcap = memcap;
+	/* Per-flow limit must hold at least one maximum sized segment. */
+	reasm->flowcap = (flowcap < REASM_DGRAM_MAX) ? REASM_DGRAM_MAX:flowcap;
+	reasm->timeout = timeout;
+	reasm->on_data = on_data;
+	reasm->on_close = on_close;
+	reasm->udata = udata;
+	reasm->hsize = REASM_HSIZE;
+
+	reasm->htable = (struct reasm_flow**) calloc (reasm->hsize, sizeof (struct reasm_flow*));
+
+	if ( reasm->htable == NULL )
+		return 1;
+
+	reasm->dgram_buff = (uint8_t*) malloc (REASM_DGRAM_MAX);
+
+	if ( reasm->dgram_buff == NULL ){
+		free (reasm->htable);
+		reasm->htable = NULL;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void
+reasm_mem_add (struct reasm *reasm, size_t size)
+{
+	reasm->stats.mem += size;
+
+	if ( reasm->stats.mem > reasm->stats.mem_peak )
+		reasm->stats.mem_peak = reasm->stats.mem;
+}
+
+static int
+reasm_mem_avail (struct reasm *reasm, size_t size)
+{
+	return (reasm->stats.mem + size) <= reasm->memcap;
+}
+
+/* ============== */
+/* Flow tracking  */
+/* ============== */
+
+static size_t
+reasm_hash (int family, const uint8_t *src, uint16_t sport, const uint8_t *dst, uint16_t dport)
+{
+	const uint8_t *tmp;
+	uint16_t port;
+	size_t alen, i;
+	uint32_t hash;
+	int cmp;
+
+	alen = (family == 4) ? 4:16;
+
+	/* Both directions must end up in the same bucket. */
+	cmp = memcmp (src, dst, alen);
+
+	if ( cmp > 0 || (cmp == 0 && sport > dport) ){
+		tmp = src; src = dst; dst = tmp;
+		port = sport; sport = dport; dport = port;
+	}
+
+	hash = 2166136261U;
+
+	for ( i = 0; i < alen; i++ )
+		hash = (hash ^ src[i]) * 16777619U;
+
+	for ( i = 0; i < alen; i++ )
+		hash = (hash ^ dst[i]) * 16777619U;
+
+	hash = (hash ^ (sport >> 8)) * 16777619U;
+	hash = (hash ^ (sport & 0xff)) * 16777619U;
+	hash = (hash ^ (dport >> 8)) * 16777619U;
+	hash = (hash ^ (dport & 0xff)) * 16777619U;
+
+	return hash;
+}
+
+static void
+reasm_lru_unlink (struct reasm *reasm, struct reasm_flow *flow)
+{
+	if ( flow->prev != NULL )
+		flow->prev->next = flow->next;
+	else
+		reasm->lru_head = flow->next;
+
+	if ( flow->next != NULL )
+		flow->next->prev = flow->prev;
+	else
+		reasm->lru_tail = flow->prev;
+
+	flow->prev = NULL;
+	flow->next = NULL;
+}
+
+static void
+reasm_lru_push (struct reasm *reasm, struct reasm_flow *flow)
+{
+	flow->prev = NULL;
+	flow->next = reasm->lru_head;
+
+	if ( reasm->lru_head != NULL )
+		reasm->lru_head->prev = flow;
+	else
+		reasm->lru_tail = flow;
+
+	reasm->lru_head = flow;
+}
+
+static struct reasm_flow*
+reasm_flow_lookup (struct reasm *reasm, int family, const uint8_t *src, uint16_t sport, const uint8_t *dst, uint16_t dport, int *dir)
+{
+	struct reasm_flow *flow;
+	size_t alen;
+
+	alen = (family == 4) ? 4:16;
+
+	for ( flow = reasm->htable[reasm_hash (family, src, sport, dst, dport) & (reasm->hsize - 1)]; flow != NULL; flow = flow->hnext ){
+
+		if ( flow->family != family )
+			continue;
+
+		if ( flow->port[0] == sport && flow->port[1] == dport
+				&& memcmp (flow->addr[0], src, alen) == 0 && memcmp (flow->addr[1], dst, alen) == 0 ){
+			*dir = REASM_DIR_CLIENT;
+			return flow;
+		}
+
+		if ( flow->port[1] == sport && flow->port[0] == dport
+				&& memcmp (flow->addr[1], src, alen) == 0 && memcmp (flow->addr[0], dst, alen) == 0 ){
+			*dir = REASM_DIR_SERVER;
+			return flow;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+reasm_htable_grow (struct reasm *reasm)
+{
+	struct reasm_flow **htable, *flow, *flow_next;
+	size_t hsize, i, idx;
+
+	hsize = reasm->hsize * 2;
+	htable = (struct reasm_flow**) calloc (hsize, sizeof (struct reasm_flow*));
+
+	/* Not fatal, chains just get longer. */
+	if ( htable == NULL )
+		return;
+
+	for ( i = 0; i < reasm->hsize; i++ ){
+		for ( flow = reasm->htable[i]; flow != NULL; flow = flow_next ){
+			flow_next = flow->hnext;
+			idx = reasm_hash (flow->family, flow->addr[0], flow->port[0], flow->addr[1], flow->port[1]) & (hsize - 1);
+			flow->hnext = htable[idx];
+			htable[idx] = flow;
+		}
+	}
+
+	free (reasm->htable);
+	reasm->htable = htable;
+	reasm->hsize = hsize;
+}
+
+static struct reasm_flow*
+reasm_flow_new (struct reasm *reasm, int family, const uint8_t *src, uint16_t sport, const uint8_t *dst, uint16_t dport)
+{
+	struct reasm_flow *flow;
+	size_t alen, idx;
+
+	flow = (struct reasm_flow*) calloc (1, sizeof (struct reasm_flow));
+
+	if ( flow == NULL )
+		return NULL;
+
+	alen = (family == 4) ? 4:16;
+
+	flow->id = ++(reasm->next_id);
+	flow->family = family;
+	flow->ref = -1;
+	memcpy (flow->addr[0], src, alen);
+	memcpy (flow->addr[1], dst, alen);
+	flow->port[0] = sport;
+	flow->port[1] = dport;
+
+	if ( reasm->nflows >= reasm->hsize )
+		reasm_htable_grow (reasm);
+
+	idx = reasm_hash (family, src, sport, dst, dport) & (reasm->hsize - 1);
+	flow->hnext = reasm->htable[idx];
+	reasm->htable[idx] = flow;
+
+	reasm_lru_push (reasm, flow);
+
+	reasm->nflows++;
+	reasm->stats.flows++;
+	reasm_mem_add (reasm, sizeof (struct reasm_flow));
+
+	return flow;
+}
+
+static void
+reasm_flow_free (struct reasm *reasm, struct reasm_flow *flow)
+{
+	struct reasm_flow **iter;
+	struct reasm_seg *seg, *seg_next;
+	int dir;
+
+	for ( iter = &(reasm->htable[reasm_hash (flow->family, flow->addr[0], flow->port[0], flow->addr[1], flow->port[1]) & (reasm->hsize - 1)]);
+			*iter != NULL; iter = &((*iter)->hnext) ){
+		if ( *iter == flow ){
+			*iter = flow->hnext;
+			break;
+		}
+	}
+
+	reasm_lru_unlink (reasm, flow);
+
+	for ( dir = 0; dir < 2; dir++ ){
+		for ( seg = flow->half[dir].segs; seg != NULL; seg = seg_next ){
+			seg_next = seg->next;
+			reasm->stats.mem -= sizeof (struct reasm_seg) + seg->len;
+			free (seg);
+		}
+	}
+
+	reasm->nflows--;
+	reasm->stats.mem -= sizeof (struct reasm_flow);
+
+	free (flow);
+}
+
+/* =============== */
+/* Data delivery   */
+/* =============== */
+
+/* Append data to a chunk which is going to be delivered. The chunk might
+ * reference data of a captured frame, in such case they are copied into the
+ * reassembly buffer first. */
+static int
+reasm_chunk_append (struct reasm *reasm, const uint8_t **chunk, size_t *chunk_len, const uint8_t *data, size_t len)
+{
+	uint8_t *buff;
+	size_t size;
+
+	if ( *chunk_len + len > reasm->buff_size ){
+		size = reasm->buff_size * 2;
+
+		if ( size < *chunk_len + len )
+			size = *chunk_len + len;
+
+		if ( *chunk_len > 0 && *chunk == reasm->buff ){
+			buff = (uint8_t*) realloc (reasm->buff, size);
+
+			if ( buff == NULL )
+				return 1;
+		} else {
+			buff = (uint8_t*) malloc (size);
+
+			if ( buff == NULL )
+				return 1;
+
+			if ( *chunk_len > 0 )
+				memcpy (buff, *chunk, *chunk_len);
+
+			if ( reasm->buff != NULL )
+				free (reasm->buff);
+		}
+
+		reasm->buff = buff;
+		reasm->buff_size = size;
+	} else if ( *chunk_len > 0 && *chunk != reasm->buff ){
+		memcpy (reasm->buff, *chunk, *chunk_len);
+	}
+
+	memcpy (reasm->buff + *chunk_len, data, len);
+	*chunk = reasm->buff;
+	*chunk_len += len;
+
+	return 0;
+}
+
+/* Deliver data that are in sequence, optionally starting with a new in-order
+ * piece of data. If force is set, holes in the sequence space are skipped and
+ * all queued data are delivered. */
+static int
+reasm_half_deliver (struct reasm *reasm, struct reasm_flow *flow, int dir, const uint8_t *data, size_t len, int force)
+{
+	struct reasm_half *half;
+	struct reasm_seg *seg;
+	const uint8_t *chunk;
+	size_t chunk_len, skip;
+	uint32_t end;
+
+	half = &(flow->half[dir]);
+	chunk = data;
+	chunk_len = len;
+
+	for ( ;; ){
+
+		while ( half->segs != NULL && SEQ_LEQ (half->segs->seq, half->next_seq) ){
+			seg = half->segs;
+			half->segs = seg->next;
+			half->queued -= seg->len;
+			end = seg->seq + (uint32_t) seg->len;
+
+			if ( SEQ_LT (half->next_seq, end) ){
+				skip = half->next_seq - seg->seq;
+
+				/* Out of memory, data get lost as if they were never
+				 * captured. */
+				if ( reasm_chunk_append (reasm, &chunk, &chunk_len, seg->data + skip, seg->len - skip) != 0 )
+					reasm->stats.gaps++;
+
+				half->next_seq = end;
+			} else {
+				reasm->stats.retrans++;
+			}
+
+			reasm->stats.mem -= sizeof (struct reasm_seg) + seg->len;
+			free (seg);
+		}
+
+		if ( ! force || half->segs == NULL )
+			break;
+
+		/* Skip a hole in the sequence space. Data on both sides of the hole
+		 * are not contiguous, deliver them separately. */
+		if ( chunk_len > 0 ){
+			reasm->stats.bytes += chunk_len;
+
+			if ( reasm->on_data (reasm->udata, flow, dir, chunk, chunk_len) != 0 )
+				return 1;
+
+			chunk_len = 0;
+		}
+
+		reasm->stats.gaps++;
+		half->next_seq = half->segs->seq;
+	}
+
+	if ( chunk_len > 0 ){
+		reasm->stats.bytes += chunk_len;
+
+		if ( reasm->on_data (reasm->udata, flow, dir, chunk, chunk_len) != 0 )
+			return 1;
+	}
+
+	return 0;
+}
+
+static int
+reasm_flow_close (struct reasm *reasm, struct reasm_flow *flow)
+{
+	int dir;
+
+	for ( dir = 0; dir < 2; dir++ ){
+		if ( reasm_half_deliver (reasm, flow, dir, NULL, 0, 1) != 0 )
+			return 1;
+	}
+
+	if ( reasm->on_close (reasm->udata, flow) != 0 )
+		return 1;
+
+	reasm_flow_free (reasm, flow);
+
+	return 0;
+}
+
+/* Close least recently used flows until there is enough memory available. */
+static int
+reasm_evict (struct reasm *reasm, struct reasm_flow *keep, size_t size)
+{
+	struct reasm_flow *flow, *flow_prev;
+
+	reasm->stats.memcap_hits++;
+
+	for ( flow = reasm->lru_tail; flow != NULL && ! reasm_mem_avail (reasm, size); flow = flow_prev ){
+		flow_prev = flow->prev;
+
+		if ( flow == keep )
+			continue;
+
+		if ( reasm_flow_close (reasm, flow) != 0 )
+			return 1;
+	}
+
+	return 0;
+}
+
+/* A segment cannot be queued, deliver everything that was queued and then
+ * the segment itself. Queued data may have covered the segment (in part),
+ * only data following them are delivered. */
+static int
+reasm_half_force (struct reasm *reasm, struct reasm_flow *flow, int dir, uint32_t seq, const uint8_t *data, size_t len)
+{
+	struct reasm_half *half;
+	uint32_t end, skip;
+
+	half = &(flow->half[dir]);
+	end = seq + (uint32_t) len;
+
+	if ( reasm_half_deliver (reasm, flow, dir, NULL, 0, 1) != 0 )
+		return 1;
+
+	if ( SEQ_LEQ (end, half->next_seq) ){
+		reasm->stats.retrans++;
+		return 0;
+	}
+
+	skip = 0;
+
+	/* The new segment is still ahead... skip the hole. */
+	if ( SEQ_GT (seq, half->next_seq) )
+		reasm->stats.gaps++;
+	else
+		skip = half->next_seq - seq;
+
+	half->next_seq = end;
+
+	return reasm_half_deliver (reasm, flow, dir, data + skip, len - skip, 0);
+}
+
+static int
+reasm_half_queue (struct reasm *reasm, struct reasm_flow *flow, int dir, uint32_t seq, const uint8_t *data, size_t len)
+{
+	struct reasm_half *half;
+	struct reasm_seg *seg, **iter;
+	size_t size;
+
+	half = &(flow->half[dir]);
+	size = sizeof (struct reasm_seg) + len;
+
+	if ( half->queued + len > reasm->flowcap ){
+		reasm->stats.flowcap_hits++;
+
+		return reasm_half_force (reasm, flow, dir, seq, data, len);
+	}
+
+	if ( ! reasm_mem_avail (reasm, size) ){
+		if ( reasm_evict (reasm, flow, size) != 0 )
+			return 1;
+
+		if ( ! reasm_mem_avail (reasm, size) )
+			return reasm_half_force (reasm, flow, dir, seq, data, len);
+	}
+
+	seg = (struct reasm_seg*) malloc (size);
+
+	if ( seg == NULL ){
+		reasm->stats.memcap_hits++;
+		return 0;
+	}
+
+	seg->seq = seq;
+	seg->len = len;
+	memcpy (seg->data, data, len);
+
+	/* Keep segments sorted by sequence number. */
+	for ( iter = &(half->segs); *iter != NULL && SEQ_LEQ ((*iter)->seq, seq); iter = &((*iter)->next) )
+		;
+
+	seg->next = *iter;
+	*iter = seg;
+
+	half->queued += len;
+	reasm->stats.ooo++;
+	reasm_mem_add (reasm, size);
+
+	return 0;
+}
+
+static int
+reasm_tcp (struct reasm *reasm, int family, const uint8_t *src, const uint8_t *dst, const uint8_t *tcp, size_t len, double ts)
+{
+	struct reasm_flow *flow;
+	struct reasm_half *half;
+	uint16_t sport, dport;
+	uint32_t seq, end;
+	size_t doff, plen, skip;
+	uint8_t flags;
+	int dir;
+
+	if ( len < 20 )
+		return 0;
+
+	doff = (tcp[12] >> 4) * 4;
+
+	if ( doff < 20 || doff > len )
+		return 0;
+
+	sport = netframe_get16 (tcp);
+	dport = netframe_get16 (tcp + 2);
+	seq = netframe_get32 (tcp + 4);
+	flags = tcp[13];
+	plen = len - doff;
+
+	flow = reasm_flow_lookup (reasm, family, src, sport, dst, dport, &dir);
+
+	if ( flow == NULL ){
+
+		/* Nothing to track. */
+		if ( flags & TCP_RST )
+			return 0;
+
+		if ( ! reasm_mem_avail (reasm, sizeof (struct reasm_flow)) && reasm_evict (reasm, NULL, sizeof (struct reasm_flow)) != 0 )
+			return 1;
+
+		/* Server's reply to a connection request, the initiator is the
+		 * receiver. */
+		if ( (flags & (TCP_SYN | TCP_ACK)) == (TCP_SYN | TCP_ACK) ){
+			flow = reasm_flow_new (reasm, family, dst, dport, src, sport);
+			dir = REASM_DIR_SERVER;
+		} else {
+			flow = reasm_flow_new (reasm, family, src, sport, dst, dport);
+			dir = REASM_DIR_CLIENT;
+		}
+
+		if ( flow == NULL ){
+			reasm->stats.memcap_hits++;
+			return 0;
+		}
+	} else {
+		reasm_lru_unlink (reasm, flow);
+		reasm_lru_push (reasm, flow);
+	}
+
+	flow->last_ts = ts;
+	half = &(flow->half[dir]);
+
+	if ( flags & TCP_RST )
+		return reasm_flow_close (reasm, flow);
+
+	if ( flags & TCP_SYN ){
+		if ( ! half->seq_known ){
+			half->next_seq = seq + 1;
+			half->seq_known = 1;
+		}
+
+		seq++;
+	} else if ( ! half->seq_known ){
+		/* Connection was established before the capture started. */
+		half->next_seq = seq;
+		half->seq_known = 1;
+	}
+
+	if ( flags & TCP_FIN ){
+		half->fin = 1;
+		half->fin_seq = seq + (uint32_t) plen;
+	}
+
+	if ( plen > 0 ){
+		reasm->stats.segments++;
+		end = seq + (uint32_t) plen;
+
+		if ( SEQ_LEQ (end, half->next_seq) ){
+			reasm->stats.retrans++;
+		} else if ( SEQ_LEQ (seq, half->next_seq) ){
+			skip = half->next_seq - seq;
+			half->next_seq = end;
+
+			if ( reasm_half_deliver (reasm, flow, dir, tcp + doff + skip, plen - skip, 0) != 0 )
+				return 1;
+		} else {
+			if ( reasm_half_queue (reasm, flow, dir, seq, tcp + doff, plen) != 0 )
+				return 1;
+		}
+	}
+
+	/* Both sides have sent FIN and all the data were delivered. */
+	if ( flow->half[0].fin && flow->half[1].fin
+			&& SEQ_LEQ (flow->half[0].fin_seq, flow->half[0].next_seq)
+			&& SEQ_LEQ (flow->half[1].fin_seq, flow->half[1].next_seq) )
+		return reasm_flow_close (reasm, flow);
+
+	return 0;
+}
+
+/* =============== */
+/* Defragmentation */
+/* =============== */
+
+static void
+reasm_dgram_free (struct reasm *reasm, struct reasm_dgram *dgram)
+{
+	struct reasm_dgram **iter;
+	struct reasm_frag *frag, *frag_next;
+
+	for ( iter = &(reasm->dgrams); *iter != NULL; iter = &((*iter)->next) ){
+		if ( *iter == dgram ){
+			*iter = dgram->next;
+			break;
+		}
+	}
+
+	if ( reasm->dgrams_tail == dgram ){
+		reasm->dgrams_tail = NULL;
+
+		for ( iter = &(reasm->dgrams); *iter != NULL; iter = &((*iter)->next) )
+			reasm->dgrams_tail = *iter;
+	}
+
+	for ( frag = dgram->frags; frag != NULL; frag = frag_next ){
+		frag_next = frag->next;
+		free (frag);
+	}
+
+	reasm->stats.mem -= dgram->size;
+	free (dgram);
+}
+
+/* Store a fragment. If the datagram is complete, its payload is copied into
+ * dgram_buff and its length is returned. */
+static size_t
+reasm_defrag (struct reasm *reasm, int family, const uint8_t *src, const uint8_t *dst, uint32_t id, uint8_t proto, size_t off, const uint8_t *data, size_t len, int more, double ts)
+{
+	struct reasm_dgram *dgram;
+	struct reasm_frag *frag, **iter;
+	size_t alen, covered, total, skip;
+
+	alen = (family == 4) ? 4:16;
+
+	reasm->stats.frags++;
+
+	if ( off + len > REASM_DGRAM_MAX || len == 0 ){
+		reasm->stats.frag_drops++;
+		return 0;
+	}
+
+	for ( dgram = reasm->dgrams; dgram != NULL; dgram = dgram->next ){
+		if ( dgram->family == family && dgram->id == id && dgram->proto == proto
+				&& memcmp (dgram->addr[0], src, alen) == 0 && memcmp (dgram->addr[1], dst, alen) == 0 )
+			break;
+	}
+
+	if ( ! reasm_mem_avail (reasm, sizeof (struct reasm_frag) + len + ((dgram == NULL) ? sizeof (struct reasm_dgram):0)) ){
+		reasm->stats.memcap_hits++;
+		reasm->stats.frag_drops++;
+		return 0;
+	}
+
+	if ( dgram == NULL ){
+		dgram = (struct reasm_dgram*) calloc (1, sizeof (struct reasm_dgram));
+
+		if ( dgram == NULL ){
+			reasm->stats.frag_drops++;
+			return 0;
+		}
+
+		dgram->family = family;
+		dgram->id = id;
+		dgram->proto = proto;
+		dgram->first_ts = ts;
+		dgram->size = sizeof (struct reasm_dgram);
+		memcpy (dgram->addr[0], src, alen);
+		memcpy (dgram->addr[1], dst, alen);
+
+		/* Keep the list ordered by arrival, the oldest datagram first. */
+		if ( reasm->dgrams_tail == NULL )
+			reasm->dgrams = dgram;
+		else
+			reasm->dgrams_tail->next = dgram;
+
+		reasm->dgrams_tail = dgram;
+		reasm_mem_add (reasm, sizeof (struct reasm_dgram));
+	}
+
+	frag = (struct reasm_frag*) malloc (sizeof (struct reasm_frag) + len);
+
+	if ( frag == NULL ){
+		reasm->stats.frag_drops++;
+		return 0;
+	}
+
+	frag->off = off;
+	frag->len = len;
+	memcpy (frag->data, data, len);
+
+	for ( iter = &(dgram->frags); *iter != NULL && (*iter)->off <= off; iter = &((*iter)->next) )
+		;
+
+	frag->next = *iter;
+	*iter = frag;
+
+	dgram->size += sizeof (struct reasm_frag) + len;
+	reasm_mem_add (reasm, sizeof (struct reasm_frag) + len);
+
+	if ( ! more ){
+		dgram->last_seen = 1;
+		dgram->total = off + len;
+	}
+
+	if ( ! dgram->last_seen )
+		return 0;
+
+	covered = 0;
+
+	for ( frag = dgram->frags; frag != NULL; frag = frag->next ){
+		if ( frag->off > covered )
+			return 0;
+
+		if ( frag->off + frag->len > covered )
+			covered = frag->off + frag->len;
+	}
+
+	if ( covered < dgram->total )
+		return 0;
+
+	/* Datagram is complete. Overlapping data are taken from the fragment with
+	 * the lowest offset. */
+	covered = 0;
+	total = dgram->total;
+
+	for ( frag = dgram->frags; frag != NULL && covered < total; frag = frag->next ){
+		if ( frag->off + frag->len <= covered )
+			continue;
+
+		skip = covered - frag->off;
+		len = frag->len - skip;
+
+		if ( covered + len > total )
+			len = total - covered;
+
+		memcpy (reasm->dgram_buff + covered, frag->data + skip, len);
+		covered += len;
+	}
+
+	reasm->stats.dgrams++;
+	reasm_dgram_free (reasm, dgram);
+
+	return total;
+}
+
+static int
+reasm_ipv4 (struct reasm *reasm, const uint8_t *ip, size_t len, double ts)
+{
+	size_t ihl, tot, foff;
+	uint16_t frag;
+
+	if ( len < 20 || (ip[0] >> 4) != 4 )
+		return 0;
+
+	ihl = (ip[0] & 0x0f) * 4;
+	tot = netframe_get16 (ip + 2);
+
+	/* Truncated frames cannot be reassembled. */
+	if ( ihl < 20 || tot < ihl || tot > len )
+		return 0;
+
+	frag = netframe_get16 (ip + 6);
+	foff = (frag & 0x1fff) * 8;
+
+	if ( (frag & 0x2000) || foff > 0 ){
+		tot = reasm_defrag (reasm, 4, ip + 12, ip + 16, netframe_get16 (ip + 4), ip[9], foff, ip + ihl, tot - ihl, frag & 0x2000, ts);
+
+		if ( tot == 0 || ip[9] != 6 )
+			return 0;
+
+		return reasm_tcp (reasm, 4, ip + 12, ip + 16, reasm->dgram_buff, tot, ts);
+	}
+
+	if ( ip[9] != 6 )
+		return 0;
+
+	return reasm_tcp (reasm, 4, ip + 12, ip + 16, ip + ihl, tot - ihl, ts);
+}
+
+static int
+reasm_ipv6 (struct reasm *reasm, const uint8_t *ip, size_t len, double ts)
+{
+	size_t off, end, hlen;
+	uint16_t frag;
+	uint8_t nh;
+
+	if ( len < 40 || (ip[0] >> 4) != 6 )
+		return 0;
+
+	end = 40 + netframe_get16 (ip + 4);
+
+	/* Truncated frames and jumbograms are not supported. */
+	if ( end > len || end == 40 )
+		return 0;
+
+	nh = ip[6];
+	off = 40;
+
+	for ( ;; ){
+		switch ( nh ){
+			/* Hop-by-Hop, Routing and Destination Options */
+			case 0:
+			case 43:
+			case 60:
+				if ( off + 2 > end )
+					return 0;
+
+				hlen = (ip[off + 1] + 1) * 8;
+				break;
+
+			/* Authentication Header */
+			case 51:
+				if ( off + 2 > end )
+					return 0;
+
+				hlen = (ip[off + 1] + 2) * 4;
+				break;
+
+			/* Fragment Header */
+			case 44:
+				if ( off + 8 > end )
+					return 0;
+
+				frag = netframe_get16 (ip + off + 2);
+
+				len = reasm_defrag (reasm, 6, ip + 8, ip + 24, netframe_get32 (ip + off + 4), ip[off], frag & 0xfff8, ip + off + 8, end - off - 8, frag & 0x0001, ts);
+
+				if ( len == 0 || ip[off] != 6 )
+					return 0;
+
+				return reasm_tcp (reasm, 6, ip + 8, ip + 24, reasm->dgram_buff, len, ts);
+
+			case 6:
+				return reasm_tcp (reasm, 6, ip + 8, ip + 24, ip + off, end - off, ts);
+
+			default:
+				return 0;
+		}
+
+		if ( off + hlen > end )
+			return 0;
+
+		nh = ip[off];
+		off += hlen;
+	}
+}
+
+static int
+reasm_expire (struct reasm *reasm, double ts)
+{
+	while ( reasm->dgrams != NULL && reasm->dgrams->first_ts + reasm->timeout < ts ){
+		reasm->stats.frag_timeouts++;
+		reasm_dgram_free (reasm, reasm->dgrams);
+	}
+
+	while ( reasm->lru_tail != NULL && reasm->lru_tail->last_ts + reasm->timeout < ts ){
+		reasm->stats.timeouts++;
+
+		if ( reasm_flow_close (reasm, reasm->lru_tail) != 0 )
+			return 1;
+	}
+
+	return 0;
+}
+
+/* Feed a frame into the reassembly engine. Non-zero value is returned only if
+ * a callback has failed, frames that cannot be processed are ignored. */
+int
+reasm_frame (struct reasm *reasm, int linktype, const struct pcap_pkthdr *pkt_hdr, const uint8_t *pkt_data)
+{
+	size_t off;
+	uint16_t ethertype;
+	double ts;
+
+	ts = pkt_hdr->ts.tv_sec + (pkt_hdr->ts.tv_usec / 1000000.0);
+
+	if ( reasm_expire (reasm, ts) != 0 )
+		return 1;
+
+	if ( netframe_l3 (linktype, pkt_data, pkt_hdr->caplen, &off, &ethertype) != 0 )
+		return 0;
+
+	if ( ethertype == NETFRAME_ETHERTYPE_IPV4 )
+		return reasm_ipv4 (reasm, pkt_data + off, pkt_hdr->caplen - off, ts);
+
+	return reasm_ipv6 (reasm, pkt_data + off, pkt_hdr->caplen - off, ts);
+}
+
+int
+reasm_flush (struct reasm *reasm)
+{
+	while ( reasm->dgrams != NULL )
+		reasm_dgram_free (reasm, reasm->dgrams);
+
+	while ( reasm->lru_tail != NULL ){
+		if ( reasm_flow_close (reasm, reasm->lru_tail) != 0 )
+			return 1;
+	}
+
+	return 0;
+}
+
+void
+reasm_free (struct reasm *reasm)
+{
+	while ( reasm->dgrams != NULL )
+		reasm_dgram_free (reasm, reasm->dgrams);
+
+	while ( reasm->lru_tail != NULL )
+		reasm_flow_free (reasm, reasm->lru_tail);
+
+	if ( reasm->htable != NULL )
+		free (reasm->htable);
+
+	if ( reasm->buff != NULL )
+		free (reasm->buff);
+
+	if ( reasm->dgram_buff != NULL )
+		free (reasm->dgram_buff);
+
+	reasm->htable = NULL;
+	reasm->buff = NULL;
+	reasm->dgram_buff = NULL;
+}
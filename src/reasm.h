@@ -0,0 +1,148 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _REASM_H
+#define _REASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <pcap.h>
+
+#define REASM_MEMCAP (64 * 1024 * 1024)
+#define REASM_FLOWCAP (1024 * 1024)
+#define REASM_TIMEOUT 120.0
+
+enum
+{
+	REASM_DIR_CLIENT = 0,
+	REASM_DIR_SERVER = 1
+};
+
+struct reasm_seg
+{
+	uint32_t seq;
+	size_t len;
+	struct reasm_seg *next;
+	uint8_t data[];
+};
+
+struct reasm_half
+{
+	uint32_t next_seq;
+	uint32_t fin_seq;
+	int seq_known;
+	int fin;
+	size_t queued;
+	struct reasm_seg *segs;
+};
+
+struct reasm_flow
+{
+	unsigned long id;
+	int family;
+	uint8_t addr[2][16];
+	uint16_t port[2];
+	struct reasm_half half[2];
+	double last_ts;
+	int ref;
+	struct reasm_flow *hnext;
+	struct reasm_flow *prev;
+	struct reasm_flow *next;
+};
+
+struct reasm_frag
+{
+	uint16_t off;
+	uint16_t len;
+	struct reasm_frag *next;
+	uint8_t data[];
+};
+
+struct reasm_dgram
+{
+	int family;
+	uint8_t addr[2][16];
+	uint32_t id;
+	uint8_t proto;
+	int last_seen;
+	size_t total;
+	size_t size;
+	double first_ts;
+	struct reasm_frag *frags;
+	struct reasm_dgram *next;
+};
+
+struct reasm_stats
+{
+	unsigned long frags;
+	unsigned long dgrams;
+	unsigned long frag_timeouts;
+	unsigned long frag_drops;
+	unsigned long flows;
+	unsigned long segments;
+	unsigned long bytes;
+	unsigned long ooo;
+	unsigned long retrans;
+	unsigned long gaps;
+	unsigned long memcap_hits;
+	unsigned long flowcap_hits;
+	unsigned long timeouts;
+	size_t mem;
+	size_t mem_peak;
+};
+
+typedef int (*reasm_data_cb) (void *udata, struct reasm_flow *flow, int dir, const uint8_t *data, size_t len);
+typedef int (*reasm_close_cb) (void *udata, struct reasm_flow *flow);
+
+struct reasm
+{
+	size_t memcap;
+	size_t flowcap;
+	double timeout;
+	struct reasm_flow **htable;
+	size_t hsize;
+	size_t nflows;
+	struct reasm_flow *lru_head;
+	struct reasm_flow *lru_tail;
+	struct reasm_dgram *dgrams;
+	struct reasm_dgram *dgrams_tail;
+	unsigned long next_id;
+	uint8_t *buff;
+	size_t buff_size;
+	uint8_t *dgram_buff;
+	reasm_data_cb on_data;
+	reasm_close_cb on_close;
+	void *udata;
+	struct reasm_stats stats;
+};
+
+extern int reasm_init (struct reasm *reasm, size_t memcap, size_t flowcap, double timeout, reasm_data_cb on_data, reasm_close_cb on_close, void *udata);
+
+extern int reasm_frame (struct reasm *reasm, int linktype, const struct pcap_pkthdr *pkt_hdr, const uint8_t *pkt_data);
+
+extern int reasm_flush (struct reasm *reasm);
+
+extern void reasm_free (struct reasm *reasm);
+
+#endif
+
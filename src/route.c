@@ -0,0 +1,220 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pcap.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "route.h"
+
+void
+route_list_init (struct route_list *routes)
+{
+	memset (routes, 0, sizeof (struct route_list));
+	routes->linktype = -1;
+}
+
+static int
+route_compile (struct route_list *routes, struct route *route)
+{
+	pcap_t *pcap_dead;
+	int rval;
+
+	if ( route->compiled ){
+		bpfjit_free (&(route->jit));
+		pcap_freecode (&(route->prog));
+		route->compiled = 0;
+	}
+
+	pcap_dead = pcap_open_dead (routes->linktype, routes->snaplen);
+
+	if ( pcap_dead == NULL ){
+		snprintf (routes->errbuff, sizeof (routes->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	rval = pcap_compile (pcap_dead, &(route->prog), route->filter, 1, 0);
+
+	if ( rval == -1 ){
+		snprintf (routes->errbuff, sizeof (routes->errbuff), "cannot compile packet filter program '%s': %s", route->filter, pcap_geterr (pcap_dead));
+		pcap_close (pcap_dead);
+		return 1;
+	}
+
+	pcap_close (pcap_dead);
+	bpfjit_compile (&(route->jit), &(route->prog));
+	route->compiled = 1;
+
+	return 0;
+}
+
+int
+route_add (struct route_list *routes, const char *filter, int ref)
+{
+	struct route *route, **match;
+
+	route = (struct route*) malloc (sizeof (struct route));
+
+	if ( route == NULL ){
+		snprintf (routes->errbuff, sizeof (routes->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	memset (route, 0, sizeof (struct route));
+
+	route->filter = strdup (filter);
+	route->ref = ref;
+
+	if ( route->filter == NULL ){
+		free (route);
+		snprintf (routes->errbuff, sizeof (routes->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	/* Every route may match, reserve a slot in the array of matches. */
+	match = (struct route**) realloc (routes->match, sizeof (struct route*) * (routes->cnt + 1));
+
+	if ( match == NULL ){
+		free (route->filter);
+		free (route);
+		snprintf (routes->errbuff, sizeof (routes->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	routes->match = match;
+
+	/* Link-type is not known until the first file is opened, compilation
+	 * is postponed until then. */
+	if ( routes->linktype != -1 && route_compile (routes, route) != 0 ){
+		free (route->filter);
+		free (route);
+		return 1;
+	}
+
+	if ( routes->head == NULL ){
+		routes->head = route;
+		routes->tail = routes->head;
+	} else {
+		routes->tail->next = route;
+		routes->tail = route;
+	}
+
+	routes->cnt++;
+
+	return 0;
+}
+
+int
+route_set_linktype (struct route_list *routes, int linktype, int snaplen)
+{
+	struct route *route;
+
+	if ( routes->linktype == linktype && routes->snaplen == snaplen )
+		return 0;
+
+	routes->linktype = linktype;
+	routes->snaplen = snaplen;
+
+	for ( route = routes->head; route != NULL; route = route->next ){
+		if ( route_compile (routes, route) != 0 )
+			return 1;
+	}
+
+	return 0;
+}
+
+size_t
+route_match (struct route_list *routes, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data)
+{
+	struct route *route;
+	size_t cnt;
+
+	cnt = 0;
+
+	for ( route = routes->head; route != NULL; route = route->next ){
+		if ( bpfjit_filter (&(route->jit), pkt_data, pkt_hdr->len, pkt_hdr->caplen) != 0 )
+			routes->match[cnt++] = route;
+	}
+
+	return cnt;
+}
+
+void
+route_list_free (struct route_list *routes)
+{
+	struct route *route, *route_next;
+
+	route = routes->head;
+
+	while ( route != NULL ){
+		route_next = route->next;
+
+		if ( route->compiled ){
+			bpfjit_free (&(route->jit));
+			pcap_freecode (&(route->prog));
+		}
+
+		free (route->filter);
+		free (route);
+		route = route_next;
+	}
+
+	if ( routes->match != NULL )
+		free (routes->match);
+
+	routes->head = NULL;
+	routes->tail = NULL;
+	routes->match = NULL;
+	routes->cnt = 0;
+}
+
+/* capdiss.on (filter, handler) */
+static int
+route_lua_on (lua_State *lua_state)
+{
+	struct route_list *routes;
+	const char *filter;
+	int ref;
+
+	routes = (struct route_list*) lua_touserdata (lua_state, lua_upvalueindex (1));
+	filter = luaL_checkstring (lua_state, 1);
+	luaL_checktype (lua_state, 2, LUA_TFUNCTION);
+
+	lua_pushvalue (lua_state, 2);
+	ref = luaL_ref (lua_state, LUA_REGISTRYINDEX);
+
+	if ( route_add (routes, filter, ref) != 0 ){
+		luaL_unref (lua_state, LUA_REGISTRYINDEX, ref);
+		return luaL_error (lua_state, "%s", routes->errbuff);
+	}
+
+	return 0;
+}
+
+const luaL_Reg route_api[] = {
+	{ "on", route_lua_on },
+	{ NULL, NULL }
+};
@@ -0,0 +1,67 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _ROUTE_H
+#define _ROUTE_H
+
+#include <pcap.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "bpfjit.h"
+
+struct route
+{
+	char *filter;
+	int ref;
+	int compiled;
+	struct bpf_program prog;
+	struct bpfjit jit;
+	struct route *next;
+};
+
+struct route_list
+{
+	struct route *head;
+	struct route *tail;
+	struct route **match;
+	size_t cnt;
+	int linktype;
+	int snaplen;
+	char errbuff[PCAP_ERRBUF_SIZE];
+};
+
+extern const luaL_Reg route_api[];
+
+extern void route_list_init (struct route_list *routes);
+
+extern int route_add (struct route_list *routes, const char *filter, int ref);
+
+extern int route_set_linktype (struct route_list *routes, int linktype, int snaplen);
+
+extern size_t route_match (struct route_list *routes, const struct pcap_pkthdr *pkt_hdr, const u_char *pkt_data);
+
+extern void route_list_free (struct route_list *routes);
+
+#endif
+
@@ -0,0 +1,295 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "serial.h"
+
+static int
+serial_reserve (struct serial_buff *buff, size_t len)
+{
+	uint8_t *data;
+	size_t size;
+
+	if ( buff->len + len <= buff->size )
+		return 0;
+
+	for ( size = (buff->size > 0) ? buff->size:256; size < buff->len + len; size *= 2 )
+		;
+
+	data = (uint8_t*) realloc (buff->data, size);
+
+	if ( data == NULL )
+		return ENOMEM;
+
+	buff->data = data;
+	buff->size = size;
+
+	return 0;
+}
+
+static int
+serial_append (struct serial_buff *buff, uint8_t type, const void *data, size_t len)
+{
+	if ( serial_reserve (buff, len + 1) != 0 )
+		return ENOMEM;
+
+	buff->data[buff->len++] = type;
+
+	if ( len > 0 )
+		memcpy (buff->data + buff->len, data, len);
+
+	buff->len += len;
+
+	return 0;
+}
+
+static int
+serial_append_le (struct serial_buff *buff, uint8_t type, uint64_t val, size_t len)
+{
+	uint8_t bytes[8];
+	size_t i;
+
+	for ( i = 0; i < len; i++ )
+		bytes[i] = (uint8_t) (val >> (i * 8));
+
+	return serial_append (buff, type, bytes, len);
+}
+
+static uint64_t
+serial_get_le (const uint8_t *data, size_t len)
+{
+	uint64_t val;
+	size_t i;
+
+	val = 0;
+
+	for ( i = 0; i < len; i++ )
+		val |= (uint64_t) data[i] << (i * 8);
+
+	return val;
+}
+
+static int
+serial_encode_value (struct serial_buff *buff, lua_State *lua_state, int idx, int depth)
+{
+	const char *str;
+	lua_Number num;
+	uint64_t bits;
+	size_t len;
+	int rval;
+
+	switch ( lua_type (lua_state, idx) ){
+		case LUA_TNIL:
+			return serial_append (buff, SERIAL_NIL, NULL, 0);
+
+		case LUA_TBOOLEAN:
+			return serial_append (buff, lua_toboolean (lua_state, idx) ? SERIAL_TRUE:SERIAL_FALSE, NULL, 0);
+
+		case LUA_TNUMBER:
+#if LUA_VERSION_NUM >= 503
+			if ( lua_isinteger (lua_state, idx) )
+				return serial_append_le (buff, SERIAL_INTEGER, (uint64_t) lua_tointeger (lua_state, idx), 8);
+#endif
+			num = lua_tonumber (lua_state, idx);
+			memcpy (&bits, &num, sizeof (bits));
+			return serial_append_le (buff, SERIAL_DOUBLE, bits, 8);
+
+		case LUA_TSTRING:
+			str = lua_tolstring (lua_state, idx, &len);
+
+			if ( len > UINT32_MAX )
+				return EINVAL;
+
+			rval = serial_append_le (buff, SERIAL_STRING, len, 4);
+
+			if ( rval != 0 )
+				return rval;
+
+			if ( serial_reserve (buff, len) != 0 )
+				return ENOMEM;
+
+			memcpy (buff->data + buff->len, str, len);
+			buff->len += len;
+
+			return 0;
+
+		case LUA_TTABLE:
+			if ( depth >= SERIAL_DEPTH )
+				return ELOOP;
+
+			if ( ! lua_checkstack (lua_state, 3) )
+				return ENOMEM;
+
+			rval = serial_append (buff, SERIAL_TABLE, NULL, 0);
+
+			if ( rval != 0 )
+				return rval;
+
+			if ( idx < 0 )
+				idx = lua_gettop (lua_state) + idx + 1;
+
+			lua_pushnil (lua_state);
+
+			while ( lua_next (lua_state, idx) != 0 ){
+				rval = serial_encode_value (buff, lua_state, -2, depth + 1);
+
+				if ( rval == 0 )
+					rval = serial_encode_value (buff, lua_state, -1, depth + 1);
+
+				lua_pop (lua_state, 1);
+
+				if ( rval != 0 ){
+					lua_pop (lua_state, 1);
+					return rval;
+				}
+			}
+
+			return serial_append (buff, SERIAL_END, NULL, 0);
+	}
+
+	/* Functions, userdata and threads */
+	return EINVAL;
+}
+
+/* Append a value at index idx to the buffer. Return 0 on success, EINVAL if
+ * the value (or a part of it) cannot be serialized, ELOOP if tables are nested
+ * too deep, ENOMEM if memory cannot be allocated. */
+int
+serial_encode (struct serial_buff *buff, lua_State *lua_state, int idx)
+{
+	return serial_encode_value (buff, lua_state, idx, 0);
+}
+
+static int
+serial_decode_value (lua_State *lua_state, const uint8_t *data, size_t len, size_t *pos, int depth)
+{
+	lua_Number num;
+	uint64_t bits, slen;
+	uint8_t type;
+
+	if ( *pos >= len )
+		return 1;
+
+	type = data[(*pos)++];
+
+	switch ( type ){
+		case SERIAL_NIL:
+			lua_pushnil (lua_state);
+			return 0;
+
+		case SERIAL_FALSE:
+		case SERIAL_TRUE:
+			lua_pushboolean (lua_state, type == SERIAL_TRUE);
+			return 0;
+
+		case SERIAL_INTEGER:
+		case SERIAL_DOUBLE:
+			if ( len - *pos < 8 )
+				return 1;
+
+			bits = serial_get_le (data + *pos, 8);
+			*pos += 8;
+
+			if ( type == SERIAL_INTEGER ){
+				lua_pushinteger (lua_state, (lua_Integer) (int64_t) bits);
+			} else {
+				memcpy (&num, &bits, sizeof (num));
+				lua_pushnumber (lua_state, num);
+			}
+			return 0;
+
+		case SERIAL_STRING:
+			if ( len - *pos < 4 )
+				return 1;
+
+			slen = serial_get_le (data + *pos, 4);
+			*pos += 4;
+
+			if ( len - *pos < slen )
+				return 1;
+
+			lua_pushlstring (lua_state, (const char*) data + *pos, slen);
+			*pos += slen;
+			return 0;
+
+		case SERIAL_TABLE:
+			if ( depth >= SERIAL_DEPTH || ! lua_checkstack (lua_state, 3) )
+				return 1;
+
+			lua_newtable (lua_state);
+
+			for ( ;; ){
+				if ( *pos >= len )
+					return 1;
+
+				if ( data[*pos] == SERIAL_END ){
+					(*pos)++;
+					return 0;
+				}
+
+				if ( serial_decode_value (lua_state, data, len, pos, depth + 1) != 0 )
+					return 1;
+
+				if ( serial_decode_value (lua_state, data, len, pos, depth + 1) != 0 )
+					return 1;
+
+				/* Key cannot be nil (or NaN) */
+				if ( lua_isnil (lua_state, -2) || lua_rawequal (lua_state, -2, -2) == 0 )
+					return 1;
+
+				lua_rawset (lua_state, -3);
+			}
+	}
+
+	return 1;
+}
+
+/* Push a value stored in data on the stack. Return 0 on success, 1 if the data
+ * are malformed (stack is left in an unspecified state then). */
+int
+serial_decode (lua_State *lua_state, const uint8_t *data, size_t len)
+{
+	size_t pos;
+
+	pos = 0;
+
+	if ( serial_decode_value (lua_state, data, len, &pos, 0) != 0 )
+		return 1;
+
+	return (pos == len) ? 0:1;
+}
+
+void
+serial_free (struct serial_buff *buff)
+{
+	if ( buff->data != NULL )
+		free (buff->data);
+
+	memset (buff, 0, sizeof (struct serial_buff));
+}
@@ -0,0 +1,73 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _SERIAL_H
+#define _SERIAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+/* Tables nested deeper are refused, this also catches reference cycles. */
+#define SERIAL_DEPTH 64
+
+/*
+ * Lua values passed between processes and stored on disk:
+ *
+ *   uint8 type, followed by
+ *     SERIAL_NIL, SERIAL_FALSE, SERIAL_TRUE: nothing
+ *     SERIAL_INTEGER: int64
+ *     SERIAL_DOUBLE: IEEE 754 binary64
+ *     SERIAL_STRING: uint32 length followed by data
+ *     SERIAL_TABLE: key and value pairs terminated by SERIAL_END
+ *
+ * All numbers are stored in little-endian byte order.
+ */
+enum
+{
+	SERIAL_NIL = 0,
+	SERIAL_FALSE = 1,
+	SERIAL_TRUE = 2,
+	SERIAL_INTEGER = 3,
+	SERIAL_DOUBLE = 4,
+	SERIAL_STRING = 5,
+	SERIAL_TABLE = 6,
+	SERIAL_END = 7
+};
+
+struct serial_buff
+{
+	uint8_t *data;
+	size_t len;
+	size_t size;
+};
+
+extern int serial_encode (struct serial_buff *buff, lua_State *lua_state, int idx);
+
+extern int serial_decode (lua_State *lua_state, const uint8_t *data, size_t len);
+
+extern void serial_free (struct serial_buff *buff);
+
+#endif
+
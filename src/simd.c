@@ -0,0 +1,690 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#if defined (__x86_64__) && defined (__GNUC__)
+#include <immintrin.h>
+#define SIMD_X86 1
+#endif
+
+#include "simd.h"
+
+/*
+ * Kernels working directly on frame data. Each kernel has a portable
+ * implementation, vectorized variants are chosen by simd_init according to
+ * features of the CPU the program runs on.
+ *
+ * The Internet checksum is computed in host byte order, which is fine for
+ * the one's complement sum as long as the result is swapped back at the end
+ * (RFC 1071, section 2).
+ */
+
+static int simd_level;
+
+static uint64_t (*simd_sum) (const uint8_t *data, size_t len);
+
+static uint32_t (*simd_crc) (const uint8_t *data, size_t len, uint32_t crc);
+
+static size_t (*simd_find) (const struct simd_byteset *set, const uint8_t *data, size_t len);
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t toeplitz_table[SIMD_TOEPLITZ_LEN][256];
+
+static int
+simd_little_endian (void)
+{
+	const uint16_t one = 1;
+
+	return *(const uint8_t*) &one == 1;
+}
+
+/* Sum of 16-bit words (host byte order) of data, not folded. */
+static uint64_t
+simd_sum_scalar (const uint8_t *data, size_t len)
+{
+	uint64_t sum;
+	uint32_t word;
+	uint16_t half;
+
+	sum = 0;
+
+	for ( ; len >= 4; data += 4, len -= 4 ){
+		memcpy (&word, data, 4);
+		sum += word;
+	}
+
+	if ( len >= 2 ){
+		memcpy (&half, data, 2);
+		sum += half;
+		data += 2;
+		len -= 2;
+	}
+
+	/* The last odd byte is padded with zero (in network byte order). */
+	if ( len > 0 ){
+		half = 0;
+		memcpy (&half, data, 1);
+		sum += half;
+	}
+
+	return sum;
+}
+
+static uint32_t
+simd_crc_scalar (const uint8_t *data, size_t len, uint32_t crc)
+{
+	uint32_t lo, hi;
+
+	/* Slicing-by-8 */
+	for ( ; len >= 8; data += 8, len -= 8 ){
+		lo = crc ^ ((uint32_t) data[0] | ((uint32_t) data[1] << 8) | ((uint32_t) data[2] << 16) | ((uint32_t) data[3] << 24));
+		hi = (uint32_t) data[4] | ((uint32_t) data[5] << 8) | ((uint32_t) data[6] << 16) | ((uint32_t) data[7] << 24);
+
+		crc = crc32c_table[7][lo & 0xff] ^ crc32c_table[6][(lo >> 8) & 0xff]
+			^ crc32c_table[5][(lo >> 16) & 0xff] ^ crc32c_table[4][lo >> 24]
+			^ crc32c_table[3][hi & 0xff] ^ crc32c_table[2][(hi >> 8) & 0xff]
+			^ crc32c_table[1][(hi >> 16) & 0xff] ^ crc32c_table[0][hi >> 24];
+	}
+
+	for ( ; len > 0; data++, len-- )
+		crc = crc32c_table[0][(crc ^ *data) & 0xff] ^ (crc >> 8);
+
+	return crc;
+}
+
+#define SIMD_BYTESET_HAS(set, byte) ((set)->map[(byte) >> 3] & (1 << ((byte) & 7)))
+
+static size_t
+simd_find_scalar (const struct simd_byteset *set, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for ( i = 0; i < len; i++ ){
+		if ( SIMD_BYTESET_HAS (set, data[i]) )
+			break;
+	}
+
+	return i;
+}
+
+#ifdef SIMD_X86
+
+/* Each 32-bit lane takes two 16-bit words per iteration, it would overflow
+ * after 32768 iterations. */
+#define SIMD_SUM_ITER 32768
+
+static uint64_t
+simd_sum_sse (const uint8_t *data, size_t len)
+{
+	__m128i zero, acc, v;
+	uint32_t lanes[4];
+	uint64_t sum;
+	size_t block;
+
+	zero = _mm_setzero_si128 ();
+	sum = 0;
+
+	while ( len >= 16 ){
+		block = (len < SIMD_SUM_ITER * 16) ? len:SIMD_SUM_ITER * 16;
+		len -= block & ~((size_t) 15);
+		acc = _mm_setzero_si128 ();
+
+		for ( ; block >= 16; data += 16, block -= 16 ){
+			v = _mm_loadu_si128 ((const __m128i*) data);
+			acc = _mm_add_epi32 (acc, _mm_unpacklo_epi16 (v, zero));
+			acc = _mm_add_epi32 (acc, _mm_unpackhi_epi16 (v, zero));
+		}
+
+		_mm_storeu_si128 ((__m128i*) lanes, acc);
+		sum += (uint64_t) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+	}
+
+	return sum + simd_sum_scalar (data, len);
+}
+
+__attribute__ ((target ("avx2")))
+static uint64_t
+simd_sum_avx2 (const uint8_t *data, size_t len)
+{
+	__m256i zero, acc, v;
+	uint32_t lanes[8];
+	uint64_t sum;
+	size_t block;
+	int i;
+
+	zero = _mm256_setzero_si256 ();
+	sum = 0;
+
+	while ( len >= 32 ){
+		block = (len < SIMD_SUM_ITER * 32) ? len:SIMD_SUM_ITER * 32;
+		len -= block & ~((size_t) 31);
+		acc = _mm256_setzero_si256 ();
+
+		for ( ; block >= 32; data += 32, block -= 32 ){
+			v = _mm256_loadu_si256 ((const __m256i*) data);
+			acc = _mm256_add_epi32 (acc, _mm256_unpacklo_epi16 (v, zero));
+			acc = _mm256_add_epi32 (acc, _mm256_unpackhi_epi16 (v, zero));
+		}
+
+		_mm256_storeu_si256 ((__m256i*) lanes, acc);
+
+		for ( i = 0; i < 8; i++ )
+			sum += lanes[i];
+	}
+
+	return sum + simd_sum_scalar (data, len);
+}
+
+__attribute__ ((target ("sse4.2")))
+static uint32_t
+simd_crc_sse (const uint8_t *data, size_t len, uint32_t crc)
+{
+	uint64_t crc64, word;
+
+	for ( ; len > 0 && ((uintptr_t) data & 7) != 0; data++, len-- )
+		crc = _mm_crc32_u8 (crc, *data);
+
+	crc64 = crc;
+
+	for ( ; len >= 8; data += 8, len -= 8 ){
+		memcpy (&word, data, 8);
+		crc64 = _mm_crc32_u64 (crc64, word);
+	}
+
+	crc = (uint32_t) crc64;
+
+	for ( ; len > 0; data++, len-- )
+		crc = _mm_crc32_u8 (crc, *data);
+
+	return crc;
+}
+
+/* Byte set lookup by nibbles (shufti). A byte is a candidate, if buckets of
+ * its low and high nibble intersect. Buckets may describe a superset of the
+ * set, candidates are confirmed against the bitmap. */
+__attribute__ ((target ("ssse3")))
+static size_t
+simd_find_ssse3 (const struct simd_byteset *set, const uint8_t *data, size_t len)
+{
+	__m128i lo_tbl, hi_tbl, nibble, zero, v, m;
+	unsigned int bits;
+	size_t i;
+	int bit;
+
+	lo_tbl = _mm_loadu_si128 ((const __m128i*) set->lo);
+	hi_tbl = _mm_loadu_si128 ((const __m128i*) set->hi);
+	nibble = _mm_set1_epi8 (0x0f);
+	zero = _mm_setzero_si128 ();
+
+	for ( i = 0; i + 16 <= len; i += 16 ){
+		v = _mm_loadu_si128 ((const __m128i*) (data + i));
+		m = _mm_and_si128 (_mm_shuffle_epi8 (lo_tbl, _mm_and_si128 (v, nibble)),
+				_mm_shuffle_epi8 (hi_tbl, _mm_and_si128 (_mm_srli_epi16 (v, 4), nibble)));
+		bits = ~_mm_movemask_epi8 (_mm_cmpeq_epi8 (m, zero)) & 0xffff;
+
+		for ( ; bits != 0; bits &= bits - 1 ){
+			bit = __builtin_ctz (bits);
+
+			if ( SIMD_BYTESET_HAS (set, data[i + bit]) )
+				return i + bit;
+		}
+	}
+
+	return i + simd_find_scalar (set, data + i, len - i);
+}
+
+__attribute__ ((target ("avx2")))
+static size_t
+simd_find_avx2 (const struct simd_byteset *set, const uint8_t *data, size_t len)
+{
+	__m256i lo_tbl, hi_tbl, nibble, zero, v, m;
+	unsigned int bits;
+	size_t i;
+	int bit;
+
+	lo_tbl = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i*) set->lo));
+	hi_tbl = _mm256_broadcastsi128_si256 (_mm_loadu_si128 ((const __m128i*) set->hi));
+	nibble = _mm256_set1_epi8 (0x0f);
+	zero = _mm256_setzero_si256 ();
+
+	for ( i = 0; i + 32 <= len; i += 32 ){
+		v = _mm256_loadu_si256 ((const __m256i*) (data + i));
+		m = _mm256_and_si256 (_mm256_shuffle_epi8 (lo_tbl, _mm256_and_si256 (v, nibble)),
+				_mm256_shuffle_epi8 (hi_tbl, _mm256_and_si256 (_mm256_srli_epi16 (v, 4), nibble)));
+		bits = ~(unsigned int) _mm256_movemask_epi8 (_mm256_cmpeq_epi8 (m, zero));
+
+		for ( ; bits != 0; bits &= bits - 1 ){
+			bit = __builtin_ctz (bits);
+
+			if ( SIMD_BYTESET_HAS (set, data[i + bit]) )
+				return i + bit;
+		}
+	}
+
+	return i + simd_find_scalar (set, data + i, len - i);
+}
+
+#endif
+
+int
+simd_init (void)
+{
+	uint8_t key[SIMD_TOEPLITZ_LEN + 4];
+	uint32_t crc, window;
+	int i, j, bit, pos;
+
+	/* CRC32C (Castagnoli), reflected polynomial */
+	for ( i = 0; i < 256; i++ ){
+		crc = i;
+
+		for ( j = 0; j < 8; j++ )
+			crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78:(crc >> 1);
+
+		crc32c_table[0][i] = crc;
+	}
+
+	for ( i = 0; i < 256; i++ ){
+		for ( j = 1; j < 8; j++ )
+			crc32c_table[j][i] = crc32c_table[0][crc32c_table[j - 1][i] & 0xff] ^ (crc32c_table[j - 1][i] >> 8);
+	}
+
+	/* Toeplitz hash of a byte at a given position is a XOR of 32-bit
+	 * windows of the key starting at bits set in the byte. */
+	for ( i = 0; i < (int) sizeof (key); i += 2 ){
+		key[i] = SIMD_TOEPLITZ_PATTERN >> 8;
+		key[i + 1] = SIMD_TOEPLITZ_PATTERN & 0xff;
+	}
+
+	for ( pos = 0; pos < SIMD_TOEPLITZ_LEN; pos++ ){
+		for ( i = 0; i < 256; i++ ){
+			toeplitz_table[pos][i] = 0;
+
+			for ( bit = 0; bit < 8; bit++ ){
+				if ( (i & (0x80 >> bit)) == 0 )
+					continue;
+
+				j = pos * 8 + bit;
+				window = ((uint32_t) key[j / 8] << 24) | ((uint32_t) key[j / 8 + 1] << 16) | ((uint32_t) key[j / 8 + 2] << 8) | key[j / 8 + 3];
+
+				if ( j % 8 != 0 )
+					window = (window << (j % 8)) | (key[j / 8 + 4] >> (8 - j % 8));
+
+				toeplitz_table[pos][i] ^= window;
+			}
+		}
+	}
+
+	return simd_select (SIMD_AVX2);
+}
+
+/* Use kernels up to a given level, as far as the CPU supports them. Returns
+ * the level in use. */
+int
+simd_select (int level)
+{
+	simd_level = SIMD_SCALAR;
+	simd_sum = simd_sum_scalar;
+	simd_crc = simd_crc_scalar;
+	simd_find = simd_find_scalar;
+
+#ifdef SIMD_X86
+	if ( level < SIMD_SSE )
+		return simd_level;
+
+	__builtin_cpu_init ();
+
+	/* SSE2 is a part of x86-64 */
+	simd_level = SIMD_SSE;
+	simd_sum = simd_sum_sse;
+
+	if ( __builtin_cpu_supports ("ssse3") )
+		simd_find = simd_find_ssse3;
+
+	if ( __builtin_cpu_supports ("sse4.2") )
+		simd_crc = simd_crc_sse;
+
+	if ( level >= SIMD_AVX2 && __builtin_cpu_supports ("avx2") ){
+		simd_level = SIMD_AVX2;
+		simd_sum = simd_sum_avx2;
+		simd_find = simd_find_avx2;
+	}
+#endif
+
+	return simd_level;
+}
+
+const char*
+simd_name (int level)
+{
+	switch ( level ){
+		case SIMD_SSE:
+			return "sse";
+
+		case SIMD_AVX2:
+			return "avx2";
+	}
+
+	return "scalar";
+}
+
+/* Add data to a partial checksum, sum and result are in network byte order
+ * (as numbers, not in memory). All pieces of data but the last one must have
+ * an even length. */
+uint32_t
+simd_cksum_add (const uint8_t *data, size_t len, uint32_t sum)
+{
+	uint64_t acc;
+
+	acc = simd_sum (data, len);
+
+	while ( acc >> 16 )
+		acc = (acc & 0xffff) + (acc >> 16);
+
+	/* Back to network byte order. */
+	if ( simd_little_endian () )
+		acc = ((acc & 0xff) << 8) | (acc >> 8);
+
+	return simd_cksum_fold (sum + acc);
+}
+
+uint16_t
+simd_cksum_fold (uint32_t sum)
+{
+	while ( sum >> 16 )
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return sum;
+}
+
+/* CRC32C of data, crc is the value for the preceding data (0 initially). */
+uint32_t
+simd_crc32c (const uint8_t *data, size_t len, uint32_t crc)
+{
+	return ~simd_crc (data, len, ~crc);
+}
+
+uint32_t
+simd_toeplitz (const uint8_t *data, size_t len)
+{
+	uint32_t hash;
+	size_t i;
+
+	hash = 0;
+
+	if ( len > SIMD_TOEPLITZ_LEN )
+		len = SIMD_TOEPLITZ_LEN;
+
+	for ( i = 0; i < len; i++ )
+		hash ^= toeplitz_table[i][data[i]];
+
+	return hash;
+}
+
+/* The key repeats every 16 bits, so swapping addresses and ports (shifted by
+ * a multiple of 16 bits) gives the same hash. */
+uint32_t
+simd_flow_hash (const uint8_t *src, const uint8_t *dst, size_t alen, uint16_t sport, uint16_t dport)
+{
+	uint8_t tuple[SIMD_TOEPLITZ_LEN];
+
+	memcpy (tuple, src, alen);
+	memcpy (tuple + alen, dst, alen);
+	tuple[alen * 2] = sport >> 8;
+	tuple[alen * 2 + 1] = sport & 0xff;
+	tuple[alen * 2 + 2] = dport >> 8;
+	tuple[alen * 2 + 3] = dport & 0xff;
+
+	return simd_toeplitz (tuple, alen * 2 + 4);
+}
+
+/* Shannon entropy of bytes, in bits per byte. */
+double
+simd_entropy (const uint8_t *data, size_t len)
+{
+	uint32_t hist[4][256];
+	double entropy, cnt;
+	size_t i;
+
+	if ( len == 0 )
+		return 0.0;
+
+	memset (hist, 0, sizeof (hist));
+
+	/* Separate histograms break dependencies between increments of the same
+	 * counter. */
+	for ( i = 0; i + 4 <= len; i += 4 ){
+		hist[0][data[i]]++;
+		hist[1][data[i + 1]]++;
+		hist[2][data[i + 2]]++;
+		hist[3][data[i + 3]]++;
+	}
+
+	for ( ; i < len; i++ )
+		hist[0][data[i]]++;
+
+	entropy = 0.0;
+
+	for ( i = 0; i < 256; i++ ){
+		cnt = (double) hist[0][i] + hist[1][i] + hist[2][i] + hist[3][i];
+
+		if ( cnt > 0 )
+			entropy -= cnt * log2 (cnt);
+	}
+
+	return log2 ((double) len) + entropy / len;
+}
+
+void
+simd_byteset_init (struct simd_byteset *set)
+{
+	memset (set, 0, sizeof (struct simd_byteset));
+}
+
+void
+simd_byteset_add (struct simd_byteset *set, uint8_t byte)
+{
+	if ( SIMD_BYTESET_HAS (set, byte) )
+		return;
+
+	set->map[byte >> 3] |= 1 << (byte & 7);
+	set->cnt++;
+}
+
+/* Assign bytes of the set to nibble buckets. Bytes sharing a high nibble form
+ * a group, groups with the same set of low nibbles share a bucket. Should
+ * there be more than 8 distinct groups, the remaining ones are merged into
+ * the bucket growing the least. */
+void
+simd_byteset_compile (struct simd_byteset *set)
+{
+	uint16_t group[16], bucket[8];
+	int i, j, k, best, grow, best_grow, used;
+
+	memset (group, 0, sizeof (group));
+	memset (set->lo, 0, sizeof (set->lo));
+	memset (set->hi, 0, sizeof (set->hi));
+	used = 0;
+
+	for ( i = 0; i < 256; i++ ){
+		if ( SIMD_BYTESET_HAS (set, i) )
+			group[i >> 4] |= 1 << (i & 0x0f);
+	}
+
+	for ( i = 0; i < 16; i++ ){
+		if ( group[i] == 0 )
+			continue;
+
+		for ( k = 0; k < used; k++ ){
+			if ( bucket[k] == group[i] )
+				break;
+		}
+
+		if ( k == used && used < 8 ){
+			bucket[used++] = group[i];
+		} else if ( k == used ){
+			best = 0;
+			best_grow = 17;
+
+			for ( j = 0; j < used; j++ ){
+				grow = __builtin_popcount (bucket[j] | group[i]) - __builtin_popcount (bucket[j]);
+
+				if ( grow < best_grow ){
+					best = j;
+					best_grow = grow;
+				}
+			}
+
+			k = best;
+			bucket[k] |= group[i];
+		}
+
+		set->hi[i] |= 1 << k;
+	}
+
+	for ( k = 0; k < used; k++ ){
+		for ( i = 0; i < 16; i++ ){
+			if ( bucket[k] & (1 << i) )
+				set->lo[i] |= 1 << k;
+		}
+	}
+}
+
+/* Offset of the first byte of data present in set, len if there is none. */
+size_t
+simd_byteset_find (const struct simd_byteset *set, const uint8_t *data, size_t len)
+{
+	return simd_find (set, data, len);
+}
+
+/* ======= */
+/* Lua API */
+/* ======= */
+
+/* Get a substring of argument arg given by optional indices i and j (the
+ * following arguments), with the same meaning as in string.sub. */
+const uint8_t*
+simd_lua_range (lua_State *lua_state, int arg, size_t *len)
+{
+	const char *data;
+	lua_Integer i, j, slen;
+
+	data = luaL_checklstring (lua_state, arg, len);
+	slen = *len;
+
+	i = luaL_optinteger (lua_state, arg + 1, 1);
+	j = luaL_optinteger (lua_state, arg + 2, -1);
+
+	if ( i < 0 )
+		i = (-i > slen) ? 1:slen + i + 1;
+	else if ( i == 0 )
+		i = 1;
+
+	if ( j < 0 )
+		j = slen + j + 1;
+	else if ( j > slen )
+		j = slen;
+
+	*len = (i > j) ? 0:(size_t) (j - i + 1);
+
+	return (const uint8_t*) data + (i - 1);
+}
+
+/* capdiss.cksum (data [, i [, j [, sum]]]) */
+static int
+simd_lua_cksum (lua_State *lua_state)
+{
+	const uint8_t *data;
+	uint32_t sum;
+	size_t len;
+
+	data = simd_lua_range (lua_state, 1, &len);
+	sum = simd_cksum_add (data, len, (uint32_t) luaL_optinteger (lua_state, 4, 0));
+
+	lua_pushinteger (lua_state, ~sum & 0xffff);
+	lua_pushinteger (lua_state, sum);
+
+	return 2;
+}
+
+/* capdiss.crc32c (data [, i [, j [, crc]]]) */
+static int
+simd_lua_crc32c (lua_State *lua_state)
+{
+	const uint8_t *data;
+	size_t len;
+
+	data = simd_lua_range (lua_state, 1, &len);
+
+	lua_pushnumber (lua_state, simd_crc32c (data, len, (uint32_t) luaL_optnumber (lua_state, 4, 0)));
+
+	return 1;
+}
+
+/* capdiss.flow_hash (src, dst [, sport [, dport]]) */
+static int
+simd_lua_flow_hash (lua_State *lua_state)
+{
+	const char *src, *dst;
+	size_t slen, dlen;
+
+	src = luaL_checklstring (lua_state, 1, &slen);
+	dst = luaL_checklstring (lua_state, 2, &dlen);
+
+	luaL_argcheck (lua_state, slen == 4 || slen == 16, 1, "binary IPv4 or IPv6 address expected");
+	luaL_argcheck (lua_state, dlen == slen, 2, "address of the same family expected");
+
+	lua_pushnumber (lua_state, simd_flow_hash ((const uint8_t*) src, (const uint8_t*) dst, slen,
+			luaL_optinteger (lua_state, 3, 0), luaL_optinteger (lua_state, 4, 0)));
+
+	return 1;
+}
+
+/* capdiss.entropy (data [, i [, j]]) */
+static int
+simd_lua_entropy (lua_State *lua_state)
+{
+	const uint8_t *data;
+	size_t len;
+
+	data = simd_lua_range (lua_state, 1, &len);
+
+	lua_pushnumber (lua_state, simd_entropy (data, len));
+
+	return 1;
+}
+
+const luaL_Reg simd_api[] = {
+	{ "cksum", simd_lua_cksum },
+	{ "crc32c", simd_lua_crc32c },
+	{ "flow_hash", simd_lua_flow_hash },
+	{ "entropy", simd_lua_entropy },
+	{ NULL, NULL }
+};
+
@@ -0,0 +1,87 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _SIMD_H
+#define _SIMD_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+/* Symmetric Toeplitz key consists of this pattern repeated. */
+#define SIMD_TOEPLITZ_PATTERN 0x6d5a
+
+/* Longest flow tuple: two IPv6 addresses and two ports. */
+#define SIMD_TOEPLITZ_LEN 36
+
+enum
+{
+	SIMD_SCALAR = 0,
+	SIMD_SSE = 1,
+	SIMD_AVX2 = 2
+};
+
+/* Set of bytes searched by simd_byteset_find. Besides an exact bitmap, the
+ * set is described by up to 8 buckets, each being a cross product of a set
+ * of high nibbles and a set of low nibbles. */
+struct simd_byteset
+{
+	uint8_t map[32];
+	uint8_t lo[16];
+	uint8_t hi[16];
+	int cnt;
+};
+
+extern const luaL_Reg simd_api[];
+
+extern int simd_init (void);
+
+extern int simd_select (int level);
+
+extern const char *simd_name (int level);
+
+extern uint32_t simd_cksum_add (const uint8_t *data, size_t len, uint32_t sum);
+
+extern uint16_t simd_cksum_fold (uint32_t sum);
+
+extern uint32_t simd_crc32c (const uint8_t *data, size_t len, uint32_t crc);
+
+extern uint32_t simd_toeplitz (const uint8_t *data, size_t len);
+
+extern uint32_t simd_flow_hash (const uint8_t *src, const uint8_t *dst, size_t alen, uint16_t sport, uint16_t dport);
+
+extern double simd_entropy (const uint8_t *data, size_t len);
+
+extern void simd_byteset_init (struct simd_byteset *set);
+
+extern void simd_byteset_add (struct simd_byteset *set, uint8_t byte);
+
+extern void simd_byteset_compile (struct simd_byteset *set);
+
+extern size_t simd_byteset_find (const struct simd_byteset *set, const uint8_t *data, size_t len);
+
+extern const uint8_t *simd_lua_range (lua_State *lua_state, int arg, size_t *len);
+
+#endif
+
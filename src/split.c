@@ -0,0 +1,637 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <pcap.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <pthread.h>
+#endif
+
+#include "split.h"
+#include "reader.h"
+#include "serial.h"
+
+/*
+ * Parallel processing of a single classic pcap file. The file is mapped into
+ * memory and cut into byte ranges, one per worker. A cut is moved forward to
+ * the nearest offset where a chain of valid record headers begins. Before
+ * the workers are started, frames in each range are counted in parallel, so
+ * that each worker knows the number of frames preceding its range. Workers
+ * are processes, each with a copy of the Lua state. Their standard output,
+ * emitted records and the partial results returned by function 'finish' are
+ * stored in temporary files, read by the parent in the order of ranges.
+ */
+
+#ifndef _WIN32
+
+static uint32_t
+split_get32 (const uint8_t *data, int swapped)
+{
+	if ( swapped )
+		return ((uint32_t) data[0] << 24) | ((uint32_t) data[1] << 16) | ((uint32_t) data[2] << 8) | data[3];
+
+	return ((uint32_t) data[3] << 24) | ((uint32_t) data[2] << 16) | ((uint32_t) data[1] << 8) | data[0];
+}
+
+/* Check whether a record boundary is at offset off. Random data pass all the
+ * checks for several records in a row only with a negligible probability. */
+static int
+split_valid (const struct split *split, uint64_t off)
+{
+	uint32_t usec, caplen, len;
+	int i;
+
+	for ( i = 0; i < SPLIT_SYNC_RECORDS; i++ ){
+		if ( off == split->size )
+			return 1;
+
+		if ( off + READER_REC_LEN > split->size )
+			return 0;
+
+		usec = split_get32 (split->map + off + 4, split->fmt.swapped);
+		caplen = split_get32 (split->map + off + 8, split->fmt.swapped);
+		len = split_get32 (split->map + off + 12, split->fmt.swapped);
+
+		if ( usec >= (split->fmt.nsec ? 1000000000:1000000) || caplen > len || len > READER_CAPLEN_MAX )
+			return 0;
+
+		off += READER_REC_LEN + caplen;
+
+		/* The last record of a truncated file */
+		if ( off > split->size )
+			return i > 0;
+	}
+
+	return 1;
+}
+
+static uint64_t
+split_sync (const struct split *split, uint64_t off)
+{
+	for ( ; off < split->size; off++ ){
+		if ( split_valid (split, off) )
+			break;
+	}
+
+	return off;
+}
+
+/* Count frames in the range of a worker, passing the filter (if any). The
+ * offset following the last record starting in the range is stored in 'next',
+ * it differs from the end of the range, if the cut is not a record boundary
+ * after all. */
+static void*
+split_count (void *arg)
+{
+	struct split_worker *worker;
+	struct split *split;
+	struct pcap_pkthdr hdr;
+	uint64_t off;
+	uint32_t caplen;
+
+	worker = (struct split_worker*) arg;
+	split = worker->split;
+	worker->frames = 0;
+	worker->bad = 0;
+
+	for ( off = worker->start; off < worker->end; off += READER_REC_LEN + caplen ){
+		/* Errors at the end of the file are left to the worker, the count
+		 * is not needed by anyone. */
+		if ( off + READER_REC_LEN > split->size )
+			break;
+
+		caplen = reader_parse_record (&(split->fmt), split->map + off, &hdr);
+
+		if ( caplen > READER_CAPLEN_MAX ){
+			worker->bad = off;
+			break;
+		}
+
+		if ( off + READER_REC_LEN + caplen > split->size )
+			break;
+
+		if ( split->has_filter && bpfjit_filter (&(split->jit), split->map + off + READER_REC_LEN, hdr.len, hdr.caplen) == 0 )
+			continue;
+
+		worker->frames++;
+	}
+
+	worker->next = off;
+
+	return NULL;
+}
+
+/* Map the file, find boundaries of ranges and count frames in them. Return 0
+ * on success, 1 on failure (see errbuff). */
+int
+split_open (struct split *split, const char *path, int jobs, const char *filter)
+{
+	struct stat st;
+	pcap_t *pcap_dead;
+	sigset_t set, saved;
+	uint64_t off;
+	int i, rval;
+
+	memset (split, 0, sizeof (struct split));
+	split->fd = -1;
+
+	split->fd = open (path, O_RDONLY);
+
+	if ( split->fd == -1 || fstat (split->fd, &st) == -1 ){
+		snprintf (split->errbuff, sizeof (split->errbuff), "%s", strerror (errno));
+		return 1;
+	}
+
+	split->size = st.st_size;
+
+	if ( ! S_ISREG (st.st_mode) || split->size < READER_HDR_LEN ){
+		snprintf (split->errbuff, sizeof (split->errbuff), "not a classic pcap file");
+		return 1;
+	}
+
+	split->map = (uint8_t*) mmap (NULL, split->size, PROT_READ, MAP_SHARED, split->fd, 0);
+
+	if ( split->map == MAP_FAILED ){
+		split->map = NULL;
+		snprintf (split->errbuff, sizeof (split->errbuff), "%s", strerror (errno));
+		return 1;
+	}
+
+	if ( reader_parse_header (&(split->fmt), split->map, READER_HDR_LEN) != 0 ){
+		snprintf (split->errbuff, sizeof (split->errbuff), "not a classic pcap file");
+		return 1;
+	}
+
+	if ( filter != NULL ){
+		pcap_dead = pcap_open_dead (split->fmt.linktype, split->fmt.snaplen);
+
+		if ( pcap_dead == NULL ){
+			snprintf (split->errbuff, sizeof (split->errbuff), "cannot allocate memory");
+			return 1;
+		}
+
+		if ( pcap_compile (pcap_dead, &(split->filter), filter, 1, 0) == -1 ){
+			snprintf (split->errbuff, sizeof (split->errbuff), "cannot compile packet filter program: %s", pcap_geterr (pcap_dead));
+			pcap_close (pcap_dead);
+			return 1;
+		}
+
+		pcap_close (pcap_dead);
+		bpfjit_compile (&(split->jit), &(split->filter));
+		split->has_filter = 1;
+	}
+
+	split->worker = (struct split_worker*) calloc (jobs, sizeof (struct split_worker));
+
+	if ( split->worker == NULL ){
+		snprintf (split->errbuff, sizeof (split->errbuff), "cannot allocate memory");
+		return 1;
+	}
+
+	split->jobs = jobs;
+
+	/* Each cut is moved to the nearest record boundary, a range may end up
+	 * empty, if a single record spans it. */
+	off = READER_HDR_LEN;
+
+	for ( i = 0; i < jobs; i++ ){
+		split->worker[i].split = split;
+		split->worker[i].start = off;
+
+		if ( i + 1 < jobs ){
+			off = split_sync (split, READER_HDR_LEN + (split->size - READER_HDR_LEN) * (i + 1) / jobs);
+
+			if ( off < split->worker[i].start )
+				off = split->worker[i].start;
+		} else {
+			off = split->size;
+		}
+
+		split->worker[i].end = off;
+	}
+
+	/* Counting threads take no signals, those are left to the main
+	 * thread. */
+	sigfillset (&set);
+	pthread_sigmask (SIG_SETMASK, &set, &saved);
+
+	for ( i = 0; i < jobs; i++ ){
+		rval = pthread_create (&(split->worker[i].thread), NULL, split_count, &(split->worker[i]));
+
+		if ( rval != 0 ){
+			/* Count the rest here */
+			for ( ; i < jobs; i++ ){
+				split->worker[i].thread = pthread_self ();
+				split_count (&(split->worker[i]));
+			}
+			break;
+		}
+	}
+
+	pthread_sigmask (SIG_SETMASK, &saved, NULL);
+
+	for ( i = 0; i < jobs; i++ ){
+		if ( ! pthread_equal (split->worker[i].thread, pthread_self ()) )
+			pthread_join (split->worker[i].thread, NULL);
+	}
+
+	for ( i = 0; i < jobs; i++ ){
+		/* A cut was made inside of a record, whose data look like a chain
+		 * of records (a capture of a pcap file transfer, for example).
+		 * Move the start of the range and count it again. */
+		if ( i > 0 && split->worker[i].start != split->worker[i - 1].next ){
+			split->worker[i].start = split->worker[i - 1].next;
+
+			if ( split->worker[i].end < split->worker[i].start )
+				split->worker[i].end = split->worker[i].start;
+
+			split->worker[i - 1].end = split->worker[i].start;
+			split_count (&(split->worker[i]));
+		}
+
+		if ( split->worker[i].bad != 0 ){
+			snprintf (split->errbuff, sizeof (split->errbuff), "invalid record at offset %llu", (unsigned long long) split->worker[i].bad);
+			return 1;
+		}
+
+		split->worker[i].first = (i > 0) ? split->worker[i - 1].first + split->worker[i - 1].frames:0;
+	}
+
+	return 0;
+}
+
+/* Start the workers. Return 0 on success (index is set to the number of the
+ * worker in a worker process, 0 in the parent), or an error number. */
+int
+split_fork (struct split *split, int emit_file)
+{
+	struct split_worker *worker;
+	pid_t pid;
+	int i, j;
+
+	for ( i = 0; i < split->jobs; i++ ){
+		worker = &(split->worker[i]);
+
+		worker->out = tmpfile ();
+		worker->result = tmpfile ();
+
+		if ( emit_file )
+			worker->emit = tmpfile ();
+
+		if ( worker->out == NULL || worker->result == NULL || (emit_file && worker->emit == NULL) )
+			return errno;
+	}
+
+	/* Do not let the workers write data buffered by the parent. */
+	fflush (stdout);
+	fflush (stderr);
+
+	for ( i = 0; i < split->jobs; i++ ){
+		pid = fork ();
+
+		if ( pid == 0 ){
+			split->index = i + 1;
+
+			if ( dup2 (fileno (split->worker[i].out), STDOUT_FILENO) == -1 )
+				_exit (EXIT_FAILURE);
+
+			return 0;
+		}
+
+		if ( pid == -1 ){
+			for ( j = 0; j < i; j++ ){
+				kill (split->worker[j].pid, SIGTERM);
+				waitpid (split->worker[j].pid, NULL, 0);
+				split->worker[j].pid = 0;
+			}
+
+			return EAGAIN;
+		}
+
+		split->worker[i].pid = pid;
+	}
+
+	return 0;
+}
+
+/* Wait for all the workers, return the number of workers that failed. */
+int
+split_wait (struct split *split)
+{
+	int i, failed;
+
+	failed = 0;
+
+	for ( i = 0; i < split->jobs; i++ ){
+		while ( waitpid (split->worker[i].pid, &(split->worker[i].status), 0) == -1 ){
+			if ( errno != EINTR ){
+				split->worker[i].status = -1;
+				break;
+			}
+		}
+
+		split->worker[i].pid = 0;
+
+		if ( ! WIFEXITED (split->worker[i].status) || WEXITSTATUS (split->worker[i].status) != EXIT_SUCCESS )
+			failed++;
+	}
+
+	return failed;
+}
+
+static int
+split_write (int fd, const uint8_t *data, size_t len)
+{
+	ssize_t rval;
+
+	while ( len > 0 ){
+		rval = write (fd, data, len);
+
+		if ( rval == -1 ){
+			if ( errno == EINTR )
+				continue;
+
+			return errno;
+		}
+
+		data += rval;
+		len -= rval;
+	}
+
+	return 0;
+}
+
+/* Store the partial result of a worker, the value at index idx. */
+int
+split_put (struct split *split, lua_State *lua_state, int idx)
+{
+	struct serial_buff buff;
+	int fd, rval;
+
+	memset (&buff, 0, sizeof (struct serial_buff));
+
+	rval = serial_encode (&buff, lua_state, idx);
+
+	if ( rval == 0 ){
+		fd = fileno (split->worker[split->index - 1].result);
+
+		if ( ftruncate (fd, 0) == -1 || lseek (fd, 0, SEEK_SET) == -1 )
+			rval = errno;
+		else
+			rval = split_write (fd, buff.data, buff.len);
+	}
+
+	serial_free (&buff);
+
+	return rval;
+}
+
+static int
+split_read (FILE *file, uint8_t **data, size_t *len)
+{
+	off_t size;
+	ssize_t rval;
+	size_t have;
+	int fd;
+
+	*data = NULL;
+	*len = 0;
+
+	fd = fileno (file);
+	size = lseek (fd, 0, SEEK_END);
+
+	if ( size == -1 || lseek (fd, 0, SEEK_SET) == -1 )
+		return errno;
+
+	*len = size;
+	*data = (uint8_t*) malloc (size + 1);
+
+	if ( *data == NULL )
+		return ENOMEM;
+
+	for ( have = 0; have < *len; have += rval ){
+		rval = read (fd, *data + have, *len - have);
+
+		if ( rval == -1 && errno == EINTR ){
+			rval = 0;
+			continue;
+		}
+
+		if ( rval <= 0 ){
+			free (*data);
+			*data = NULL;
+			return (rval == 0) ? EIO:errno;
+		}
+	}
+
+	return 0;
+}
+
+/* Push the partial result of the worker (counted from 1) on the stack. A worker
+ * that has not returned anything contributes nil. Return 0 on success, EINVAL
+ * if the result is malformed, or other error number. */
+int
+split_get (struct split *split, int index, lua_State *lua_state)
+{
+	uint8_t *data;
+	size_t len;
+	int top, rval;
+
+	rval = split_read (split->worker[index - 1].result, &data, &len);
+
+	if ( rval != 0 )
+		return rval;
+
+	top = lua_gettop (lua_state);
+
+	if ( len == 0 )
+		lua_pushnil (lua_state);
+	else if ( serial_decode (lua_state, data, len) != 0 )
+		rval = EINVAL;
+
+	free (data);
+
+	if ( rval != 0 )
+		lua_settop (lua_state, top);
+
+	return rval;
+}
+
+/* Copy standard output of the worker (counted from 1) to fd. */
+int
+split_output (struct split *split, int index, int fd)
+{
+	uint8_t buff[65536];
+	ssize_t len;
+	int src, rval;
+
+	src = fileno (split->worker[index - 1].out);
+
+	if ( lseek (src, 0, SEEK_SET) == -1 )
+		return errno;
+
+	for ( ;; ){
+		len = read (src, buff, sizeof (buff));
+
+		if ( len == -1 && errno == EINTR )
+			continue;
+
+		if ( len == -1 )
+			return errno;
+
+		if ( len == 0 )
+			break;
+
+		rval = split_write (fd, buff, len);
+
+		if ( rval != 0 )
+			return rval;
+	}
+
+	return 0;
+}
+
+void
+split_free (struct split *split)
+{
+	int i;
+
+	if ( split->worker != NULL ){
+		for ( i = 0; i < split->jobs; i++ ){
+			if ( split->worker[i].out != NULL )
+				fclose (split->worker[i].out);
+
+			if ( split->worker[i].emit != NULL )
+				fclose (split->worker[i].emit);
+
+			if ( split->worker[i].result != NULL )
+				fclose (split->worker[i].result);
+		}
+
+		free (split->worker);
+	}
+
+	if ( split->has_filter ){
+		bpfjit_free (&(split->jit));
+		pcap_freecode (&(split->filter));
+	}
+
+	if ( split->map != NULL )
+		munmap (split->map, split->size);
+
+	if ( split->fd != -1 )
+		close (split->fd);
+
+	memset (split, 0, sizeof (struct split));
+	split->fd = -1;
+}
+
+#else
+
+int
+split_open (struct split *split, const char *path, int jobs, const char *filter)
+{
+	memset (split, 0, sizeof (struct split));
+	split->fd = -1;
+	snprintf (split->errbuff, sizeof (split->errbuff), "%s", strerror (ENOSYS));
+
+	return 1;
+}
+
+int
+split_fork (struct split *split, int emit_file)
+{
+	return ENOSYS;
+}
+
+int
+split_wait (struct split *split)
+{
+	return split->jobs;
+}
+
+int
+split_put (struct split *split, lua_State *lua_state, int idx)
+{
+	return ENOSYS;
+}
+
+int
+split_get (struct split *split, int index, lua_State *lua_state)
+{
+	return ENOSYS;
+}
+
+int
+split_output (struct split *split, int index, int fd)
+{
+	return ENOSYS;
+}
+
+void
+split_free (struct split *split)
+{
+	memset (split, 0, sizeof (struct split));
+	split->fd = -1;
+}
+
+#endif
+
+/* ======= */
+/* Lua API */
+/* ======= */
+
+/* capdiss.worker (), returns the number of the worker and the number of all
+ * workers, zeros if the file is not processed in parallel (or in the parent
+ * process). */
+static int
+split_lua_worker (lua_State *lua_state)
+{
+	struct split *split;
+
+	split = (struct split*) lua_touserdata (lua_state, lua_upvalueindex (1));
+
+	lua_pushinteger (lua_state, split->index);
+	lua_pushinteger (lua_state, (split->index > 0) ? split->jobs:0);
+
+	return 2;
+}
+
+const luaL_Reg split_api[] = {
+	{ "worker", split_lua_worker },
+	{ NULL, NULL }
+};
@@ -0,0 +1,99 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _SPLIT_H
+#define _SPLIT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pcap.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <pthread.h>
+#endif
+
+#include "reader.h"
+
+#define SPLIT_JOBS_MAX 256
+
+/* Consecutive records that must be valid for an offset to be accepted as
+ * a record boundary. */
+#define SPLIT_SYNC_RECORDS 8
+
+struct split;
+
+struct split_worker
+{
+	struct split *split;
+	uint64_t start;
+	uint64_t end;
+	uint64_t next;
+	unsigned long frames;
+	unsigned long first;
+	uint64_t bad;
+	FILE *out;
+	FILE *emit;
+	FILE *result;
+	int status;
+#ifndef _WIN32
+	pid_t pid;
+	pthread_t thread;
+#endif
+};
+
+struct split
+{
+	int fd;
+	uint8_t *map;
+	uint64_t size;
+	struct reader_format fmt;
+	struct bpf_program filter;
+	struct bpfjit jit;
+	int has_filter;
+	struct split_worker *worker;
+	int jobs;
+	int index;
+	char errbuff[PCAP_ERRBUF_SIZE];
+};
+
+extern const luaL_Reg split_api[];
+
+extern int split_open (struct split *split, const char *path, int jobs, const char *filter);
+
+extern int split_fork (struct split *split, int emit_file);
+
+extern int split_wait (struct split *split);
+
+extern int split_put (struct split *split, lua_State *lua_state, int idx);
+
+extern int split_get (struct split *split, int index, lua_State *lua_state);
+
+extern int split_output (struct split *split, int index, int fd);
+
+extern void split_free (struct split *split);
+
+#endif
+
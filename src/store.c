@@ -0,0 +1,915 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "store.h"
+
+/*
+ * Key/value store with a bounded memory budget. Entries are held in a hash
+ * table, once the budget is exceeded the least recently updated entries are
+ * written to a temporary file (a run), sorted by key. Iteration merges all
+ * runs with entries left in memory, values of a key found in more than one
+ * place are combined by the merge function of the store.
+ */
+
+#define STORE_MT "capdiss.store"
+
+#define STORE_HASH_M 0xc6a4a7935bd1e995ULL
+
+/* Memory taken by an entry, including an estimate of the malloc overhead. */
+#define STORE_ENTRY_MEM(len) (sizeof (struct store_entry) + (len) + 16)
+
+static uint64_t
+store_hash (const char *data, size_t len)
+{
+	uint64_t hash, k;
+	size_t i;
+
+	hash = 0x9e3779b97f4a7c15ULL ^ (len * STORE_HASH_M);
+
+	for ( i = 0; i + 8 <= len; i += 8 ){
+		memcpy (&k, data + i, 8);
+		k *= STORE_HASH_M;
+		k ^= k >> 47;
+		k *= STORE_HASH_M;
+		hash ^= k;
+		hash *= STORE_HASH_M;
+	}
+
+	if ( i < len ){
+		k = 0;
+		memcpy (&k, data + i, len - i);
+		hash ^= k;
+		hash *= STORE_HASH_M;
+	}
+
+	hash ^= hash >> 47;
+	hash *= STORE_HASH_M;
+	hash ^= hash >> 47;
+
+	return hash;
+}
+
+static const char*
+store_key (const struct store_entry *entry)
+{
+	return (const char*) (entry + 1);
+}
+
+static int
+store_keycmp (const char *a, size_t a_len, const char *b, size_t b_len)
+{
+	size_t len;
+	int rval;
+
+	/* An empty key may come with a NULL buffer. */
+	len = (a_len < b_len) ? a_len:b_len;
+
+	if ( len > 0 ){
+		rval = memcmp (a, b, len);
+
+		if ( rval != 0 )
+			return rval;
+	}
+
+	return (a_len < b_len) ? -1:(a_len > b_len);
+}
+
+static int
+store_entry_cmp (const void *a, const void *b)
+{
+	const struct store_entry *ea, *eb;
+
+	ea = *((const struct store_entry**) a);
+	eb = *((const struct store_entry**) b);
+
+	return store_keycmp (store_key (ea), ea->key_len, store_key (eb), eb->key_len);
+}
+
+static int
+store_entry_tick_cmp (const void *a, const void *b)
+{
+	const struct store_entry *ea, *eb;
+
+	ea = *((const struct store_entry**) a);
+	eb = *((const struct store_entry**) b);
+
+	return (ea->tick < eb->tick) ? -1:(ea->tick > eb->tick);
+}
+
+static double
+store_combine (int merge, double a, double b)
+{
+	switch ( merge ){
+		case STORE_MERGE_MIN:
+			return (b < a) ? b:a;
+
+		case STORE_MERGE_MAX:
+			return (b > a) ? b:a;
+
+		default:
+			return a + b;
+	}
+}
+
+int
+store_init (struct store *store, size_t memcap, int merge, const char *dir)
+{
+	memset (store, 0, sizeof (struct store));
+
+	store->memcap = (memcap < STORE_MEMCAP_MIN) ? STORE_MEMCAP_MIN:memcap;
+	store->merge = merge;
+	store->slot_cnt = STORE_SLOTS;
+	store->slot = (struct store_entry**) calloc (store->slot_cnt, sizeof (struct store_entry*));
+
+	if ( store->slot == NULL )
+		return ENOMEM;
+
+	store->mem = store->slot_cnt * sizeof (struct store_entry*);
+
+	if ( dir != NULL ){
+		store->dir = strdup (dir);
+
+		if ( store->dir == NULL ){
+			free (store->slot);
+			store->slot = NULL;
+			return ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+static void
+store_insert (struct store_entry **slot, size_t slot_cnt, struct store_entry *entry)
+{
+	size_t idx;
+
+	idx = entry->hash & (slot_cnt - 1);
+	entry->next = slot[idx];
+	slot[idx] = entry;
+}
+
+/* Double the number of slots, the store keeps working if it fails. */
+static void
+store_grow (struct store *store)
+{
+	struct store_entry **slot, *entry, *entry_next;
+	size_t i;
+
+	slot = (struct store_entry**) calloc (store->slot_cnt * 2, sizeof (struct store_entry*));
+
+	if ( slot == NULL )
+		return;
+
+	for ( i = 0; i < store->slot_cnt; i++ ){
+		for ( entry = store->slot[i]; entry != NULL; entry = entry_next ){
+			entry_next = entry->next;
+			store_insert (slot, store->slot_cnt * 2, entry);
+		}
+	}
+
+	free (store->slot);
+
+	store->mem += store->slot_cnt * sizeof (struct store_entry*);
+	store->slot = slot;
+	store->slot_cnt *= 2;
+}
+
+/* Temporary file for a run, removed once closed. */
+static FILE*
+store_tmpfile (struct store *store)
+{
+#ifndef _WIN32
+	FILE *file;
+	char *path;
+	int fd, err;
+
+	if ( store->dir == NULL )
+		return tmpfile ();
+
+	path = (char*) malloc (strlen (store->dir) + sizeof ("/capdiss-store-XXXXXX"));
+
+	if ( path == NULL )
+		return NULL;
+
+	sprintf (path, "%s/capdiss-store-XXXXXX", store->dir);
+
+	fd = mkstemp (path);
+
+	if ( fd == -1 ){
+		free (path);
+		return NULL;
+	}
+
+	unlink (path);
+	free (path);
+
+	file = fdopen (fd, "w+b");
+
+	if ( file == NULL ){
+		err = errno;
+		close (fd);
+		errno = err;
+	}
+
+	return file;
+#else
+	/* Runs always go to the default temporary directory. */
+	return tmpfile ();
+#endif
+}
+
+/* Record of a run: length of the key, the key and the value, all in host
+ * byte order. */
+static int
+store_write_record (FILE *file, const char *key, uint32_t key_len, double value)
+{
+	if ( fwrite (&key_len, sizeof (uint32_t), 1, file) != 1
+			|| fwrite (key, 1, key_len, file) != key_len
+			|| fwrite (&value, sizeof (double), 1, file) != 1 )
+		return (errno != 0) ? errno:EIO;
+
+	return 0;
+}
+
+/* Move a cursor to the next record. Return 1 on success, 0 at the end and -1
+ * on failure (with errno set). */
+static int
+store_cursor_next (struct store_cursor *cursor)
+{
+	struct store_entry *entry;
+	uint32_t len;
+	char *key;
+
+	if ( cursor->file == NULL ){
+		if ( cursor->entry_pos == cursor->entry_cnt )
+			return 0;
+
+		entry = cursor->entry[cursor->entry_pos++];
+		cursor->cur_key = store_key (entry);
+		cursor->cur_len = entry->key_len;
+		cursor->cur_value = entry->value;
+
+		return 1;
+	}
+
+	if ( cursor->left == 0 )
+		return 0;
+
+	if ( fread (&len, sizeof (uint32_t), 1, cursor->file) != 1 || len > STORE_KEY_MAX ){
+		errno = EIO;
+		return -1;
+	}
+
+	if ( len > cursor->key_size ){
+		key = (char*) realloc (cursor->key, len);
+
+		if ( key == NULL )
+			return -1;
+
+		cursor->key = key;
+		cursor->key_size = len;
+	}
+
+	if ( fread (cursor->key, 1, len, cursor->file) != len || fread (&(cursor->cur_value), sizeof (double), 1, cursor->file) != 1 ){
+		errno = EIO;
+		return -1;
+	}
+
+	cursor->left--;
+	cursor->cur_key = cursor->key;
+	cursor->cur_len = len;
+
+	return 1;
+}
+
+static int
+store_heap_less (const struct store_iter *iter, size_t a, size_t b)
+{
+	const struct store_cursor *ca, *cb;
+	int rval;
+
+	ca = &(iter->cursor[a]);
+	cb = &(iter->cursor[b]);
+	rval = store_keycmp (ca->cur_key, ca->cur_len, cb->cur_key, cb->cur_len);
+
+	return rval < 0 || (rval == 0 && a < b);
+}
+
+static void
+store_heap_down (struct store_iter *iter, size_t pos)
+{
+	size_t child, tmp;
+
+	for ( ;; ){
+		child = pos * 2 + 1;
+
+		if ( child >= iter->heap_cnt )
+			break;
+
+		if ( child + 1 < iter->heap_cnt && store_heap_less (iter, iter->heap[child + 1], iter->heap[child]) )
+			child++;
+
+		if ( ! store_heap_less (iter, iter->heap[child], iter->heap[pos]) )
+			break;
+
+		tmp = iter->heap[pos];
+		iter->heap[pos] = iter->heap[child];
+		iter->heap[child] = tmp;
+		pos = child;
+	}
+}
+
+void
+store_iter_end (struct store *store)
+{
+	struct store_iter *iter;
+	size_t i;
+
+	iter = store->iter;
+
+	if ( iter == NULL )
+		return;
+
+	if ( iter->cursor != NULL ){
+		for ( i = 0; i < iter->cursor_cnt; i++ ){
+			free (iter->cursor[i].key);
+			free (iter->cursor[i].entry);
+		}
+
+		free (iter->cursor);
+	}
+
+	free (iter->heap);
+	free (iter->key);
+	free (iter);
+
+	store->iter = NULL;
+}
+
+/* Start a merge of all runs, and of entries in memory if 'with_memory' is
+ * set. */
+static int
+store_merge_start (struct store *store, int with_memory)
+{
+	struct store_iter *iter;
+	struct store_entry *entry;
+	size_t i, n;
+	int rval;
+
+	store_iter_end (store);
+
+	iter = (struct store_iter*) calloc (1, sizeof (struct store_iter));
+
+	if ( iter == NULL )
+		return ENOMEM;
+
+	store->iter = iter;
+	store->iter_serial++;
+
+	iter->cursor_cnt = store->run_cnt + (with_memory ? 1:0);
+	iter->cursor = (struct store_cursor*) calloc (iter->cursor_cnt + 1, sizeof (struct store_cursor));
+	iter->heap = (size_t*) calloc (iter->cursor_cnt + 1, sizeof (size_t));
+
+	if ( iter->cursor == NULL || iter->heap == NULL ){
+		rval = ENOMEM;
+		goto fail;
+	}
+
+	for ( i = 0; i < store->run_cnt; i++ ){
+		iter->cursor[i].file = store->run[i].file;
+		iter->cursor[i].left = store->run[i].cnt;
+
+		if ( fseek (store->run[i].file, 0, SEEK_SET) != 0 ){
+			rval = errno;
+			goto fail;
+		}
+	}
+
+	if ( with_memory && store->cnt > 0 ){
+		iter->cursor[store->run_cnt].entry = (struct store_entry**) malloc (store->cnt * sizeof (struct store_entry*));
+
+		if ( iter->cursor[store->run_cnt].entry == NULL ){
+			rval = ENOMEM;
+			goto fail;
+		}
+
+		for ( n = 0, i = 0; i < store->slot_cnt; i++ ){
+			for ( entry = store->slot[i]; entry != NULL; entry = entry->next )
+				iter->cursor[store->run_cnt].entry[n++] = entry;
+		}
+
+		iter->cursor[store->run_cnt].entry_cnt = n;
+		qsort (iter->cursor[store->run_cnt].entry, n, sizeof (struct store_entry*), store_entry_cmp);
+	}
+
+	for ( i = 0; i < iter->cursor_cnt; i++ ){
+		rval = store_cursor_next (&(iter->cursor[i]));
+
+		if ( rval == -1 ){
+			rval = errno;
+			goto fail;
+		}
+
+		if ( rval == 1 )
+			iter->heap[iter->heap_cnt++] = i;
+	}
+
+	for ( i = iter->heap_cnt / 2; i > 0; i-- )
+		store_heap_down (iter, i - 1);
+
+	return 0;
+
+fail:
+	store_iter_end (store);
+
+	return rval;
+}
+
+int
+store_iter_start (struct store *store)
+{
+	return store_merge_start (store, 1);
+}
+
+/* Next key in order with the combined value. Return 1 on success, 0 at the
+ * end and -1 on failure (with errno set). The key is valid until the next
+ * call. */
+int
+store_iter_next (struct store *store, const char **key, size_t *key_len, double *value)
+{
+	struct store_iter *iter;
+	struct store_cursor *cursor;
+	char *buff;
+	int first, rval;
+
+	iter = store->iter;
+
+	if ( iter == NULL || iter->heap_cnt == 0 )
+		return 0;
+
+	first = 1;
+
+	while ( iter->heap_cnt > 0 ){
+		cursor = &(iter->cursor[iter->heap[0]]);
+
+		if ( first ){
+			if ( cursor->cur_len > iter->key_size ){
+				buff = (char*) realloc (iter->key, cursor->cur_len);
+
+				if ( buff == NULL )
+					return -1;
+
+				iter->key = buff;
+				iter->key_size = cursor->cur_len;
+			}
+
+			if ( cursor->cur_len > 0 )
+				memcpy (iter->key, cursor->cur_key, cursor->cur_len);
+
+			iter->key_len = cursor->cur_len;
+			iter->value = cursor->cur_value;
+			first = 0;
+		} else if ( store_keycmp (cursor->cur_key, cursor->cur_len, iter->key, iter->key_len) == 0 ){
+			iter->value = store_combine (store->merge, iter->value, cursor->cur_value);
+		} else {
+			break;
+		}
+
+		rval = store_cursor_next (cursor);
+
+		if ( rval == -1 )
+			return -1;
+
+		if ( rval == 0 )
+			iter->heap[0] = iter->heap[--iter->heap_cnt];
+
+		store_heap_down (iter, 0);
+	}
+
+	*key = (iter->key != NULL) ? iter->key:"";
+	*key_len = iter->key_len;
+	*value = iter->value;
+
+	return 1;
+}
+
+/* Merge all runs into one. */
+static int
+store_compact (struct store *store)
+{
+	const char *key;
+	size_t key_len, i;
+	uint64_t cnt;
+	double value;
+	FILE *file;
+	int rval;
+
+	file = store_tmpfile (store);
+
+	if ( file == NULL )
+		return errno;
+
+	rval = store_merge_start (store, 0);
+
+	if ( rval != 0 ){
+		fclose (file);
+		return rval;
+	}
+
+	cnt = 0;
+	errno = 0;
+
+	while ( (rval = store_iter_next (store, &key, &key_len, &value)) == 1 ){
+		rval = store_write_record (file, key, key_len, value);
+
+		if ( rval != 0 )
+			break;
+
+		cnt++;
+	}
+
+	if ( rval == -1 )
+		rval = errno;
+
+	store_iter_end (store);
+
+	if ( rval == 0 && fflush (file) != 0 )
+		rval = errno;
+
+	if ( rval != 0 ){
+		fclose (file);
+		return rval;
+	}
+
+	for ( i = 0; i < store->run_cnt; i++ )
+		fclose (store->run[i].file);
+
+	store->run[0].file = file;
+	store->run[0].cnt = cnt;
+	store->run_cnt = 1;
+
+	return 0;
+}
+
+/* Write the least recently updated entries to a new run, until memory use
+ * drops to half of the budget. */
+static int
+store_spill (struct store *store)
+{
+	struct store_entry **entry, *tmp;
+	struct store_run *run;
+	size_t i, n, cnt, mem;
+	FILE *file;
+	int rval;
+
+	rval = 0;
+	entry = (struct store_entry**) malloc (store->cnt * sizeof (struct store_entry*));
+
+	if ( entry == NULL )
+		return ENOMEM;
+
+	for ( n = 0, i = 0; i < store->slot_cnt; i++ ){
+		for ( tmp = store->slot[i]; tmp != NULL; tmp = tmp->next )
+			entry[n++] = tmp;
+	}
+
+	qsort (entry, n, sizeof (struct store_entry*), store_entry_tick_cmp);
+
+	for ( cnt = 0, mem = store->mem; cnt < n && mem > store->memcap / 2; cnt++ )
+		mem -= STORE_ENTRY_MEM (entry[cnt]->key_len);
+
+	qsort (entry, cnt, sizeof (struct store_entry*), store_entry_cmp);
+
+	run = (struct store_run*) realloc (store->run, (store->run_cnt + 1) * sizeof (struct store_run));
+
+	if ( run == NULL ){
+		free (entry);
+		return ENOMEM;
+	}
+
+	store->run = run;
+
+	file = store_tmpfile (store);
+
+	if ( file == NULL ){
+		rval = errno;
+		free (entry);
+		return rval;
+	}
+
+	errno = 0;
+
+	for ( i = 0; i < cnt; i++ ){
+		rval = store_write_record (file, store_key (entry[i]), entry[i]->key_len, entry[i]->value);
+
+		if ( rval != 0 )
+			break;
+	}
+
+	if ( rval == 0 && fflush (file) != 0 )
+		rval = errno;
+
+	if ( rval != 0 ){
+		fclose (file);
+		free (entry);
+		return rval;
+	}
+
+	store->run[store->run_cnt].file = file;
+	store->run[store->run_cnt].cnt = cnt;
+	store->run_cnt++;
+	store->spilled += cnt;
+
+	/* Rebuild the hash table from entries kept in memory */
+	memset (store->slot, 0, store->slot_cnt * sizeof (struct store_entry*));
+
+	for ( i = cnt; i < n; i++ )
+		store_insert (store->slot, store->slot_cnt, entry[i]);
+
+	for ( i = 0; i < cnt; i++ )
+		free (entry[i]);
+
+	store->cnt = n - cnt;
+	store->mem = mem;
+
+	free (entry);
+
+	if ( store->run_cnt >= STORE_RUNS_MAX )
+		return store_compact (store);
+
+	return 0;
+}
+
+/* Combine a value with the value of a key, an update ends an iteration in
+ * progress. */
+int
+store_update (struct store *store, const char *key, size_t key_len, double value)
+{
+	struct store_entry *entry;
+	uint64_t hash;
+
+	if ( key_len > STORE_KEY_MAX )
+		return EINVAL;
+
+	store_iter_end (store);
+
+	hash = store_hash (key, key_len);
+
+	for ( entry = store->slot[hash & (store->slot_cnt - 1)]; entry != NULL; entry = entry->next ){
+		if ( entry->hash == hash && entry->key_len == key_len && memcmp (store_key (entry), key, key_len) == 0 ){
+			entry->value = store_combine (store->merge, entry->value, value);
+			entry->tick = ++store->tick;
+			return 0;
+		}
+	}
+
+	entry = (struct store_entry*) malloc (sizeof (struct store_entry) + key_len);
+
+	if ( entry == NULL )
+		return ENOMEM;
+
+	entry->hash = hash;
+	entry->tick = ++store->tick;
+	entry->value = value;
+	entry->key_len = key_len;
+	memcpy ((char*) (entry + 1), key, key_len);
+
+	store_insert (store->slot, store->slot_cnt, entry);
+	store->cnt++;
+	store->mem += STORE_ENTRY_MEM (key_len);
+
+	if ( store->cnt > store->slot_cnt )
+		store_grow (store);
+
+	if ( store->mem > store->memcap )
+		return store_spill (store);
+
+	return 0;
+}
+
+void
+store_free (struct store *store)
+{
+	struct store_entry *entry, *entry_next;
+	size_t i;
+
+	store_iter_end (store);
+
+	if ( store->slot != NULL ){
+		for ( i = 0; i < store->slot_cnt; i++ ){
+			for ( entry = store->slot[i]; entry != NULL; entry = entry_next ){
+				entry_next = entry->next;
+				free (entry);
+			}
+		}
+
+		free (store->slot);
+	}
+
+	for ( i = 0; i < store->run_cnt; i++ )
+		fclose (store->run[i].file);
+
+	free (store->run);
+	free (store->dir);
+
+	memset (store, 0, sizeof (struct store));
+}
+
+/* store:update (key [, n]), combines 'n' (default 1) with the value of the
+ * key */
+static int
+store_lua_update (lua_State *lua_state)
+{
+	struct store *store;
+	const char *key;
+	size_t key_len;
+	int rval;
+
+	store = (struct store*) luaL_checkudata (lua_state, 1, STORE_MT);
+	key = luaL_checklstring (lua_state, 2, &key_len);
+
+	rval = store_update (store, key, key_len, luaL_optnumber (lua_state, 3, 1));
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot update store: %s", strerror (rval));
+
+	return 0;
+}
+
+static int
+store_lua_iter (lua_State *lua_state)
+{
+	struct store *store;
+	const char *key;
+	size_t key_len;
+	double value;
+	int rval;
+
+	store = (struct store*) luaL_checkudata (lua_state, lua_upvalueindex (1), STORE_MT);
+
+	if ( store->iter == NULL || (unsigned long) lua_tointeger (lua_state, lua_upvalueindex (2)) != store->iter_serial )
+		return luaL_error (lua_state, "cannot iterate over store: store was modified");
+
+	rval = store_iter_next (store, &key, &key_len, &value);
+
+	if ( rval == -1 )
+		return luaL_error (lua_state, "cannot iterate over store: %s", strerror (errno));
+
+	if ( rval == 0 ){
+		store_iter_end (store);
+		lua_pushnil (lua_state);
+		return 1;
+	}
+
+	lua_pushlstring (lua_state, key, key_len);
+	lua_pushnumber (lua_state, value);
+
+	return 2;
+}
+
+/* store:pairs (), iterates over keys in byte order */
+static int
+store_lua_pairs (lua_State *lua_state)
+{
+	struct store *store;
+	int rval;
+
+	store = (struct store*) luaL_checkudata (lua_state, 1, STORE_MT);
+
+	rval = store_iter_start (store);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot iterate over store: %s", strerror (rval));
+
+	lua_pushvalue (lua_state, 1);
+	lua_pushinteger (lua_state, (lua_Integer) store->iter_serial);
+	lua_pushcclosure (lua_state, store_lua_iter, 2);
+
+	return 1;
+}
+
+static int
+store_lua_gc (lua_State *lua_state)
+{
+	struct store *store;
+
+	store = (struct store*) luaL_checkudata (lua_state, 1, STORE_MT);
+
+	store_free (store);
+
+	return 0;
+}
+
+static const luaL_Reg store_methods[] = {
+	{ "update", store_lua_update },
+	{ "pairs", store_lua_pairs },
+	{ NULL, NULL }
+};
+
+/* capdiss.store ([{ memory = <bytes>, dir = <path>, merge = 'sum' | 'min' | 'max' }]) */
+static int
+store_lua_new (lua_State *lua_state)
+{
+	static const char *merge_name[] = { "sum", "min", "max", NULL };
+	struct store *store;
+	const char *dir, *name;
+	size_t memcap;
+	int merge, rval;
+
+	memcap = STORE_MEMCAP;
+	merge = STORE_MERGE_SUM;
+	dir = NULL;
+
+	lua_settop (lua_state, 1);
+
+	if ( ! lua_isnil (lua_state, 1) ){
+		luaL_checktype (lua_state, 1, LUA_TTABLE);
+
+		lua_getfield (lua_state, 1, "memory");
+
+		if ( ! lua_isnil (lua_state, -1) ){
+			if ( ! lua_isnumber (lua_state, -1) || lua_tonumber (lua_state, -1) < 0 )
+				return luaL_argerror (lua_state, 1, "invalid memory budget");
+
+			memcap = (size_t) lua_tonumber (lua_state, -1);
+		}
+
+		lua_getfield (lua_state, 1, "dir");
+
+		if ( ! lua_isnil (lua_state, -1) ){
+			if ( ! lua_isstring (lua_state, -1) )
+				return luaL_argerror (lua_state, 1, "invalid directory");
+
+			dir = lua_tostring (lua_state, -1);
+		}
+
+		lua_getfield (lua_state, 1, "merge");
+
+		if ( ! lua_isnil (lua_state, -1) ){
+			name = lua_tostring (lua_state, -1);
+
+			for ( merge = 0; name != NULL && merge_name[merge] != NULL; merge++ ){
+				if ( strcmp (name, merge_name[merge]) == 0 )
+					break;
+			}
+
+			if ( name == NULL || merge_name[merge] == NULL )
+				return luaL_argerror (lua_state, 1, "invalid merge function");
+		}
+	}
+
+	if ( luaL_newmetatable (lua_state, STORE_MT) ){
+		lua_newtable (lua_state);
+		luaL_setfuncs (lua_state, store_methods, 0);
+		lua_setfield (lua_state, -2, "__index");
+		lua_pushcfunction (lua_state, store_lua_gc);
+		lua_setfield (lua_state, -2, "__gc");
+	}
+
+	lua_pop (lua_state, 1);
+
+	store = (struct store*) lua_newuserdata (lua_state, sizeof (struct store));
+	rval = store_init (store, memcap, merge, dir);
+
+	if ( rval != 0 )
+		return luaL_error (lua_state, "cannot create store: %s", strerror (rval));
+
+	luaL_setmetatable (lua_state, STORE_MT);
+
+	return 1;
+}
+
+const luaL_Reg store_api[] = {
+	{ "store", store_lua_new },
+	{ NULL, NULL }
+};
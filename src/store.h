@@ -0,0 +1,131 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _STORE_H
+#define _STORE_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+/* Default and smallest memory budget of a store. */
+#define STORE_MEMCAP (64 * 1024 * 1024)
+#define STORE_MEMCAP_MIN (64 * 1024)
+
+/* Initial number of slots of the hash table, always a power of two. */
+#define STORE_SLOTS 1024
+
+/* Runs on disk are merged into one when there are this many of them. */
+#define STORE_RUNS_MAX 32
+
+/* Longest key of a store. */
+#define STORE_KEY_MAX (1024 * 1024)
+
+enum
+{
+	STORE_MERGE_SUM = 0,
+	STORE_MERGE_MIN,
+	STORE_MERGE_MAX
+};
+
+/* Key of the entry follows the structure. */
+struct store_entry
+{
+	struct store_entry *next;
+	uint64_t hash;
+	uint64_t tick;
+	double value;
+	uint32_t key_len;
+};
+
+/*
+ * Source of a merge, either a run on disk or entries held in memory sorted by
+ * key.
+ */
+struct store_cursor
+{
+	FILE *file;
+	uint64_t left;
+	char *key;
+	size_t key_size;
+	struct store_entry **entry;
+	size_t entry_cnt;
+	size_t entry_pos;
+	const char *cur_key;
+	uint32_t cur_len;
+	double cur_value;
+};
+
+struct store_iter
+{
+	struct store_cursor *cursor;
+	size_t cursor_cnt;
+	size_t *heap;
+	size_t heap_cnt;
+	char *key;
+	size_t key_len;
+	size_t key_size;
+	double value;
+};
+
+struct store_run
+{
+	FILE *file;
+	uint64_t cnt;
+};
+
+struct store
+{
+	struct store_entry **slot;
+	size_t slot_cnt;
+	size_t cnt;
+	size_t mem;
+	size_t memcap;
+	uint64_t tick;
+	int merge;
+	char *dir;
+	struct store_run *run;
+	size_t run_cnt;
+	uint64_t spilled;
+	struct store_iter *iter;
+	unsigned long iter_serial;
+};
+
+extern const luaL_Reg store_api[];
+
+extern int store_init (struct store *store, size_t memcap, int merge, const char *dir);
+
+extern int store_update (struct store *store, const char *key, size_t key_len, double value);
+
+extern int store_iter_start (struct store *store);
+
+extern int store_iter_next (struct store *store, const char **key, size_t *key_len, double *value);
+
+extern void store_iter_end (struct store *store);
+
+extern void store_free (struct store *store);
+
+#endif
+
@@ -0,0 +1,466 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+/*
+ * Equivalence test and micro-benchmark of the BPF translator. Programs are
+ * run both by bpf_filter of libpcap and as machine code, on the same data,
+ * and must return the same value:
+ *
+ *   - random programs using every instruction, with operands biased towards
+ *     edge cases (packet boundaries, shifts by 32, division by zero...),
+ *     kept only if accepted by bpf_validate,
+ *   - programs compiled by pcap_compile from common filter expressions.
+ *
+ * Usage: bpfjit_test [seed [programs]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <pcap.h>
+
+#include "bpfjit.h"
+
+/* Not defined by older versions of libpcap. */
+#ifndef BPF_MOD
+#define BPF_MOD 0x90
+#endif
+
+#ifndef BPF_XOR
+#define BPF_XOR 0xa0
+#endif
+
+#define TEST_PROGRAMS 20000
+#define TEST_RUNS 20
+#define TEST_INSNS_MAX 40
+#define TEST_PKT_LEN 128
+#define TEST_BENCH_FRAMES (1024 * 1024)
+#define TEST_BENCH_LEN 64
+
+static const uint16_t test_ops[] = {
+	BPF_RET | BPF_K, BPF_RET | BPF_A,
+	BPF_LD | BPF_W | BPF_ABS, BPF_LD | BPF_H | BPF_ABS, BPF_LD | BPF_B | BPF_ABS,
+	BPF_LD | BPF_W | BPF_IND, BPF_LD | BPF_H | BPF_IND, BPF_LD | BPF_B | BPF_IND,
+	BPF_LD | BPF_W | BPF_LEN, BPF_LDX | BPF_W | BPF_LEN, BPF_LDX | BPF_MSH | BPF_B,
+	BPF_LD | BPF_IMM, BPF_LDX | BPF_IMM, BPF_LD | BPF_MEM, BPF_LDX | BPF_MEM, BPF_ST, BPF_STX,
+	BPF_JMP | BPF_JA,
+	BPF_JMP | BPF_JGT | BPF_K, BPF_JMP | BPF_JGE | BPF_K, BPF_JMP | BPF_JEQ | BPF_K, BPF_JMP | BPF_JSET | BPF_K,
+	BPF_JMP | BPF_JGT | BPF_X, BPF_JMP | BPF_JGE | BPF_X, BPF_JMP | BPF_JEQ | BPF_X, BPF_JMP | BPF_JSET | BPF_X,
+	BPF_ALU | BPF_ADD | BPF_X, BPF_ALU | BPF_SUB | BPF_X, BPF_ALU | BPF_MUL | BPF_X, BPF_ALU | BPF_DIV | BPF_X,
+	BPF_ALU | BPF_MOD | BPF_X, BPF_ALU | BPF_AND | BPF_X, BPF_ALU | BPF_OR | BPF_X, BPF_ALU | BPF_XOR | BPF_X,
+	BPF_ALU | BPF_LSH | BPF_X, BPF_ALU | BPF_RSH | BPF_X,
+	BPF_ALU | BPF_ADD | BPF_K, BPF_ALU | BPF_SUB | BPF_K, BPF_ALU | BPF_MUL | BPF_K, BPF_ALU | BPF_DIV | BPF_K,
+	BPF_ALU | BPF_MOD | BPF_K, BPF_ALU | BPF_AND | BPF_K, BPF_ALU | BPF_OR | BPF_K, BPF_ALU | BPF_XOR | BPF_K,
+	BPF_ALU | BPF_LSH | BPF_K, BPF_ALU | BPF_RSH | BPF_K,
+	BPF_ALU | BPF_NEG, BPF_MISC | BPF_TAX, BPF_MISC | BPF_TXA
+};
+
+#define TEST_OPS (sizeof (test_ops) / sizeof (test_ops[0]))
+
+static const char *test_filters[] = {
+	"",
+	"ip",
+	"ip6",
+	"tcp",
+	"udp",
+	"icmp",
+	"port 53",
+	"tcp port 80 or tcp port 443",
+	"udp and not port 53",
+	"host 10.0.0.1",
+	"net 192.168.0.0/16",
+	"src net 10.0.0.0/8 and dst port 22",
+	"ip[8] < 64",
+	"tcp[tcpflags] & (tcp-syn|tcp-fin) != 0",
+	"ip and ip[6:2] & 0x1fff = 0",
+	"ip6 and tcp",
+	"vlan and ip",
+	"greater 100",
+	"less 60",
+	"ether[0] & 1 = 1",
+	"portrange 1000-2000",
+	NULL
+};
+
+static double
+test_clock (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Operand biased towards values the translator handles specially. */
+static uint32_t
+test_operand (void)
+{
+	switch ( rand () % 6 ){
+		case 0:
+			return rand () % 8;
+
+		case 1:
+			return rand () % (TEST_PKT_LEN + 16);
+
+		case 2:
+			return (uint32_t) rand () * 2654435761U;
+
+		case 3:
+			return 0xffffffffU - rand () % 8;
+
+		case 4:
+			return 32 + rand () % 4;
+	}
+
+	return rand () % 40;
+}
+
+static void
+test_program (struct bpf_insn *insns, int len)
+{
+	int i, rem;
+
+	for ( i = 0; i < len; i++ ){
+		insns[i].code = test_ops[rand () % TEST_OPS];
+		insns[i].k = test_operand ();
+		insns[i].jt = 0;
+		insns[i].jf = 0;
+
+		/* Jumps land on one of the following instructions */
+		rem = len - i - 2;
+
+		if ( BPF_CLASS (insns[i].code) == BPF_JMP ){
+			if ( rem < 0 ){
+				insns[i].code = BPF_RET | BPF_A;
+			} else {
+				insns[i].jt = rand () % (rem + 1);
+				insns[i].jf = rand () % (rem + 1);
+
+				if ( insns[i].code == (BPF_JMP | BPF_JA) )
+					insns[i].k = rand () % (rem + 1);
+			}
+		}
+
+		if ( BPF_CLASS (insns[i].code) == BPF_ST || BPF_CLASS (insns[i].code) == BPF_STX || BPF_MODE (insns[i].code) == BPF_MEM )
+			insns[i].k %= BPF_MEMWORDS;
+	}
+
+	insns[len - 1].code = (rand () % 2) ? (BPF_RET | BPF_A):(BPF_RET | BPF_K);
+}
+
+static void
+test_packet (u_char *pkt, u_int *wirelen, u_int *buflen)
+{
+	int i;
+
+	*buflen = rand () % (TEST_PKT_LEN - 28);
+	*wirelen = *buflen + (rand () % 2) * (rand () % 2000);
+
+	for ( i = 0; i < TEST_PKT_LEN; i++ )
+		pkt[i] = (rand () % 3) ? (rand () % 64):rand ();
+}
+
+/* Packet made up of an Ethernet header followed by an IPv4 or IPv6 header
+ * and a TCP or UDP header, with some of its bytes randomized. */
+static void
+test_frame (u_char *pkt, u_int *wirelen, u_int *buflen)
+{
+	int i, ip6, l4;
+
+	memset (pkt, 0, TEST_PKT_LEN);
+
+	ip6 = rand () % 3 == 0;
+	pkt[0] = rand () % 2;
+
+	/* 802.1Q tag, the rest of the frame follows it */
+	if ( rand () % 8 == 0 ){
+		pkt[12] = 0x81;
+		pkt[14] = rand () % 16;
+		pkt[15] = rand ();
+		pkt += 4;
+	}
+
+	pkt[12] = ip6 ? 0x86:0x08;
+	pkt[13] = ip6 ? 0xdd:0x00;
+
+	if ( ip6 ){
+		pkt[14] = 0x60;
+		pkt[20] = (rand () % 2) ? 6:17;
+		pkt[22] = 0x20;
+		pkt[38] = 0x20;
+		l4 = 54;
+	} else {
+		pkt[14] = 0x45;
+		pkt[20] = (rand () % 4 == 0) ? 0x20:0;
+		pkt[22] = rand () % 128;
+		pkt[23] = (rand () % 2) ? 6:((rand () % 2) ? 17:1);
+		pkt[26] = (rand () % 2) ? 10:192;
+		pkt[27] = (rand () % 2) ? 0:168;
+		pkt[29] = 1;
+		pkt[30] = 10;
+		l4 = 34;
+	}
+
+	pkt[l4 + 1] = (rand () % 2) ? 53:rand ();
+	pkt[l4 + 2] = rand () % 8;
+	pkt[l4 + 3] = (rand () % 2) ? 22:((rand () % 2) ? 80:rand ());
+	pkt[l4 + 13] = rand ();
+
+	for ( i = 0; i < 4; i++ )
+		pkt[rand () % (l4 + 20)] ^= 1 << (rand () % 8);
+
+	*buflen = l4 + 20 + rand () % 40;
+	*wirelen = *buflen + rand () % 2 * rand () % 100;
+
+	if ( rand () % 8 == 0 )
+		*buflen = rand () % (l4 + 20);
+}
+
+static int
+test_compare (const struct bpf_insn *insns, int len, const struct bpfjit *jit, const u_char *pkt, u_int wirelen, u_int buflen)
+{
+	u_int expect, got;
+	int i;
+
+	expect = bpf_filter (insns, pkt, wirelen, buflen);
+	got = bpfjit_filter (jit, pkt, wirelen, buflen);
+
+	if ( expect == got )
+		return 0;
+
+	fprintf (stderr, "bpfjit: mismatch (wirelen %u, buflen %u): bpf_filter %u, translated %u\n", wirelen, buflen, expect, got);
+
+	for ( i = 0; i < len; i++ )
+		fprintf (stderr, "  %3d: code 0x%04x jt %u jf %u k 0x%08x\n", i, insns[i].code, insns[i].jt, insns[i].jf, insns[i].k);
+
+	return 1;
+}
+
+static int
+test_random (unsigned long programs)
+{
+	struct bpf_insn insns[TEST_INSNS_MAX];
+	struct bpf_program prog;
+	struct bpfjit jit;
+	u_char pkt[TEST_PKT_LEN];
+	u_int wirelen, buflen;
+	unsigned long cnt, runs;
+	int len, i, rval;
+
+	cnt = 0;
+	runs = 0;
+
+	while ( cnt < programs ){
+		len = 1 + rand () % TEST_INSNS_MAX;
+		test_program (insns, len);
+
+		if ( ! bpf_validate (insns, len) )
+			continue;
+
+		prog.bf_len = len;
+		prog.bf_insns = insns;
+
+		rval = bpfjit_compile (&jit, &prog);
+
+		if ( rval != 0 ){
+			fprintf (stderr, "bpfjit: valid program not translated: %s\n", strerror (rval));
+			return 1;
+		}
+
+		for ( i = 0; i < TEST_RUNS; i++ ){
+			test_packet (pkt, &wirelen, &buflen);
+
+			if ( test_compare (insns, len, &jit, pkt, wirelen, buflen) != 0 ){
+				bpfjit_free (&jit);
+				return 1;
+			}
+
+			runs++;
+		}
+
+		bpfjit_free (&jit);
+		cnt++;
+	}
+
+	printf ("bpfjit: %lu random programs, %lu runs, no mismatch\n", cnt, runs);
+
+	return 0;
+}
+
+static int
+test_filters_compiled (unsigned long runs)
+{
+	struct bpf_program prog;
+	struct bpfjit jit;
+	pcap_t *pcap;
+	u_char pkt[TEST_PKT_LEN];
+	u_int wirelen, buflen;
+	unsigned long i;
+	int f, cnt, rval;
+
+	pcap = pcap_open_dead (DLT_EN10MB, 65535);
+
+	if ( pcap == NULL ){
+		fprintf (stderr, "bpfjit: cannot open pcap handle\n");
+		return 1;
+	}
+
+	cnt = 0;
+	rval = 0;
+
+	for ( f = 0; test_filters[f] != NULL && rval == 0; f++ ){
+		/* All of the expressions are valid, a failure means a broken
+		 * libpcap setup and must not pass unnoticed. */
+		if ( pcap_compile (pcap, &prog, test_filters[f], 1, 0) == -1 ){
+			fprintf (stderr, "bpfjit: cannot compile filter '%s': %s\n", test_filters[f], pcap_geterr (pcap));
+			rval = 1;
+			break;
+		}
+
+		if ( bpfjit_compile (&jit, &prog) != 0 ){
+			fprintf (stderr, "bpfjit: filter '%s' not translated\n", test_filters[f]);
+			pcap_freecode (&prog);
+			rval = 1;
+			break;
+		}
+
+		for ( i = 0; i < runs && rval == 0; i++ ){
+			test_frame (pkt, &wirelen, &buflen);
+			rval = test_compare (prog.bf_insns, prog.bf_len, &jit, pkt, wirelen, buflen);
+		}
+
+		if ( rval != 0 )
+			fprintf (stderr, "bpfjit: filter '%s'\n", test_filters[f]);
+
+		bpfjit_free (&jit);
+		pcap_freecode (&prog);
+		cnt++;
+	}
+
+	pcap_close (pcap);
+
+	if ( rval == 0 )
+		printf ("bpfjit: %d compiled filters, %lu runs each, no mismatch\n", cnt, runs);
+
+	return rval;
+}
+
+/* Time of 'port 53' per frame, interpreted and translated. */
+static int
+test_bench (void)
+{
+	struct bpf_program prog;
+	struct bpfjit jit;
+	pcap_t *pcap;
+	u_char *frames, *pkt;
+	u_int buflen, wirelen;
+	unsigned long hits[2];
+	double start, elapsed[2];
+	int i;
+
+	pcap = pcap_open_dead (DLT_EN10MB, 65535);
+
+	if ( pcap == NULL ){
+		fprintf (stderr, "bpfjit: cannot open pcap handle\n");
+		return 1;
+	}
+
+	if ( pcap_compile (pcap, &prog, "port 53", 1, 0) == -1 ){
+		fprintf (stderr, "bpfjit: cannot compile filter 'port 53': %s\n", pcap_geterr (pcap));
+		pcap_close (pcap);
+		return 1;
+	}
+
+	frames = (u_char*) malloc ((size_t) TEST_BENCH_FRAMES * TEST_PKT_LEN);
+
+	if ( frames == NULL ){
+		fprintf (stderr, "bpfjit: cannot allocate memory\n");
+		pcap_freecode (&prog);
+		pcap_close (pcap);
+		return 1;
+	}
+
+	for ( i = 0; i < TEST_BENCH_FRAMES; i++ )
+		test_frame (frames + (size_t) i * TEST_PKT_LEN, &wirelen, &buflen);
+
+	bpfjit_compile (&jit, &prog);
+
+	hits[0] = 0;
+	start = test_clock ();
+
+	for ( i = 0, pkt = frames; i < TEST_BENCH_FRAMES; i++, pkt += TEST_PKT_LEN )
+		hits[0] += bpf_filter (prog.bf_insns, pkt, TEST_BENCH_LEN, TEST_BENCH_LEN) != 0;
+
+	elapsed[0] = test_clock () - start;
+
+	hits[1] = 0;
+	start = test_clock ();
+
+	for ( i = 0, pkt = frames; i < TEST_BENCH_FRAMES; i++, pkt += TEST_PKT_LEN )
+		hits[1] += bpfjit_filter (&jit, pkt, TEST_BENCH_LEN, TEST_BENCH_LEN) != 0;
+
+	elapsed[1] = test_clock () - start;
+
+	printf ("bpfjit: 'port 53', %d frames (%lu matching): bpf_filter %.1f ns, %s %.1f ns per frame\n",
+		TEST_BENCH_FRAMES, hits[0], elapsed[0] * 1e9 / TEST_BENCH_FRAMES,
+		(jit.func != NULL) ? "translated":"bpfjit_filter", elapsed[1] * 1e9 / TEST_BENCH_FRAMES);
+
+	bpfjit_free (&jit);
+	pcap_freecode (&prog);
+	pcap_close (pcap);
+	free (frames);
+
+	return hits[0] != hits[1];
+}
+
+int
+main (int argc, char *argv[])
+{
+	struct bpf_insn ret = { BPF_RET | BPF_K, 0, 0, 1 };
+	struct bpf_program prog;
+	struct bpfjit jit;
+	unsigned long programs;
+
+	srand ((argc > 1) ? strtoul (argv[1], NULL, 10):1);
+	programs = (argc > 2) ? strtoul (argv[2], NULL, 10):TEST_PROGRAMS;
+
+	bpfjit_enable (1);
+
+	prog.bf_len = 1;
+	prog.bf_insns = &ret;
+
+	if ( bpfjit_compile (&jit, &prog) != 0 ){
+		printf ("bpfjit: translation is not available on this platform, test skipped\n");
+		return EXIT_SUCCESS;
+	}
+
+	bpfjit_free (&jit);
+
+	if ( test_random (programs) != 0 || test_filters_compiled (TEST_RUNS * 1000) != 0 || test_bench () != 0 )
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
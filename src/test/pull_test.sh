@@ -0,0 +1,93 @@
+#!/bin/sh
+#
+# Test of the pull mode: function 'main' returning before the end of input
+# must still close the streams and report the files left unread.
+#
+# Usage: pull_test.sh [capdiss]
+
+capdiss=${1:-./capdiss}
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+# Write bytes given as decimal numbers.
+bytes ()
+{
+	for b in "$@"; do
+		printf "\\$(printf %o "$b")"
+	done
+}
+
+# Write a pcap file header (little-endian, Ethernet).
+pcap_header ()
+{
+	bytes 212 195 178 161  2 0 4 0  0 0 0 0  0 0 0 0  255 255 0 0  1 0 0 0
+}
+
+# Write a TCP segment from 10.0.0.1:1234 to 10.0.0.2:80, given a timestamp,
+# the last byte of a sequence number, TCP flags and a payload.
+tcp_frame ()
+{
+	len=$((54 + ${#4}))
+
+	bytes "$1" 0 0 0  0 0 0 0  "$len" 0 0 0  "$len" 0 0 0
+	bytes 0 0 0 0 0 2  0 0 0 0 0 1  8 0
+	bytes 69 0 0 $((len - 14))  0 1 64 0  64 6 0 0  10 0 0 1  10 0 0 2
+	bytes 4 210 0 80  0 0 0 "$2"  0 0 0 0  80 "$3" 255 255  0 0 0 0
+	printf '%s' "$4"
+}
+
+{
+	pcap_header
+	tcp_frame 1 99 2 ""
+	tcp_frame 2 100 16 "hello"
+	tcp_frame 3 105 16 "again"
+} > "$dir/a.pcap"
+
+{
+	pcap_header
+	tcp_frame 4 110 16 "world"
+} > "$dir/b.pcap"
+
+cat > "$dir/script.lua" <<'EOF'
+function capdiss.stream (flow, dir, data)
+	print ("stream", data)
+end
+
+function capdiss.stream_close (flow)
+	print ("close")
+end
+
+function capdiss.main ()
+	for frame, ts, num in capdiss.packets () do
+		if num == 2 then
+			return
+		end
+	end
+end
+
+function capdiss.finish ()
+	print ("finish")
+end
+EOF
+
+printf 'stream\thello\nclose\nfinish\n' > "$dir/expect"
+
+if ! "$capdiss" -R -f "$dir/a.pcap" -f "$dir/b.pcap" "$dir/script.lua" > "$dir/out" 2> "$dir/err"; then
+	echo "pull_test: capdiss failed:" >&2
+	cat "$dir/err" >&2
+	exit 1
+fi
+
+if ! cmp -s "$dir/expect" "$dir/out"; then
+	echo "pull_test: unexpected output:" >&2
+	cat "$dir/out" >&2
+	exit 1
+fi
+
+if ! grep -q "1 file was not read" "$dir/err"; then
+	echo "pull_test: unread file not reported:" >&2
+	cat "$dir/err" >&2
+	exit 1
+fi
+
+echo "pull_test: OK"
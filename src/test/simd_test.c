@@ -0,0 +1,305 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+/*
+ * Test of the data kernels against straightforward reference
+ * implementations, at every level of vectorization supported by the CPU.
+ *
+ * Usage: simd_test [seed]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "simd.h"
+
+#define TEST_BUF_LEN (3 * 1024 * 1024)
+#define TEST_ROUNDS 3000
+
+/* Key and IPv4 vector of the RSS verification suite by Microsoft,
+ * 66.9.149.187:2794 -> 161.142.100.80:1766 hashes to 0x51ccc178. */
+static const uint8_t rss_key[40] = {
+	0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2, 0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3,
+	0x8f, 0xb0, 0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4, 0x77, 0xcb, 0x2d, 0xa3,
+	0x80, 0x30, 0xf2, 0x0c, 0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa
+};
+
+static const uint8_t rss_tuple[12] = { 66, 9, 149, 187, 161, 142, 100, 80, 0x0a, 0xea, 0x06, 0xe6 };
+
+#define RSS_HASH 0x51ccc178
+
+static int test_errors;
+
+static void
+test_fail (int level, const char *kernel, size_t len)
+{
+	fprintf (stderr, "simd: %s: %s differs from reference (length %lu)\n", simd_name (level), kernel, (unsigned long) len);
+	test_errors++;
+}
+
+static uint16_t
+ref_cksum (const uint8_t *data, size_t len)
+{
+	uint64_t sum;
+	size_t i;
+
+	sum = 0;
+
+	for ( i = 0; i + 1 < len; i += 2 )
+		sum += (data[i] << 8) | data[i + 1];
+
+	if ( len % 2 )
+		sum += data[len - 1] << 8;
+
+	while ( sum >> 16 )
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return sum;
+}
+
+static uint32_t
+ref_crc32c (const uint8_t *data, size_t len)
+{
+	uint32_t crc;
+	size_t i;
+	int bit;
+
+	crc = 0xffffffff;
+
+	for ( i = 0; i < len; i++ ){
+		crc ^= data[i];
+
+		for ( bit = 0; bit < 8; bit++ )
+			crc = (crc & 1) ? (crc >> 1) ^ 0x82f63b78:(crc >> 1);
+	}
+
+	return ~crc;
+}
+
+/* Key must be 4 bytes longer than data. */
+static uint32_t
+ref_toeplitz (const uint8_t *data, size_t len, const uint8_t *key)
+{
+	uint32_t hash, window;
+	size_t i;
+	int bit;
+
+	hash = 0;
+	window = ((uint32_t) key[0] << 24) | ((uint32_t) key[1] << 16) | ((uint32_t) key[2] << 8) | key[3];
+
+	for ( i = 0; i < len; i++ ){
+		for ( bit = 7; bit >= 0; bit-- ){
+			if ( data[i] & (1 << bit) )
+				hash ^= window;
+
+			window = (window << 1) | ((key[i + 4] >> bit) & 1);
+		}
+	}
+
+	return hash;
+}
+
+static double
+ref_entropy (const uint8_t *data, size_t len)
+{
+	double hist[256], entropy, p;
+	size_t i;
+
+	if ( len == 0 )
+		return 0.0;
+
+	memset (hist, 0, sizeof (hist));
+
+	for ( i = 0; i < len; i++ )
+		hist[data[i]]++;
+
+	entropy = 0.0;
+
+	for ( i = 0; i < 256; i++ ){
+		if ( hist[i] == 0 )
+			continue;
+
+		p = hist[i] / len;
+		entropy -= p * log2 (p);
+	}
+
+	return entropy;
+}
+
+static size_t
+ref_find (const uint8_t *map, const uint8_t *data, size_t len)
+{
+	size_t i;
+
+	for ( i = 0; i < len; i++ ){
+		if ( map[data[i]] )
+			break;
+	}
+
+	return i;
+}
+
+static void
+test_find (int level, uint8_t *buf, size_t len)
+{
+	struct simd_byteset set;
+	uint8_t map[256], byte;
+	size_t i, pos;
+	int cnt;
+
+	simd_byteset_init (&set);
+	memset (map, 0, sizeof (map));
+
+	for ( cnt = 1 + rand () % 40; cnt > 0; cnt-- ){
+		byte = rand ();
+		simd_byteset_add (&set, byte);
+		map[byte] = 1;
+	}
+
+	simd_byteset_compile (&set);
+
+	/* Data free of the set with a single byte of it planted */
+	for ( i = 0; i < len; i++ ){
+		while ( map[buf[i]] )
+			buf[i]++;
+	}
+
+	if ( len > 0 && rand () % 4 != 0 ){
+		pos = rand () % len;
+
+		for ( i = 0; map[i] == 0; i++ )
+			;
+
+		buf[pos] = i;
+	}
+
+	if ( simd_byteset_find (&set, buf, len) != ref_find (map, buf, len) )
+		test_fail (level, "byteset find", len);
+}
+
+static void
+test_level (int level, uint8_t *buf)
+{
+	uint8_t key[SIMD_TOEPLITZ_LEN + 4], src[16], dst[16];
+	const uint8_t *data;
+	uint16_t sport, dport;
+	size_t i, len, half;
+	int round;
+
+	for ( i = 0; i < sizeof (key); i += 2 ){
+		key[i] = SIMD_TOEPLITZ_PATTERN >> 8;
+		key[i + 1] = SIMD_TOEPLITZ_PATTERN & 0xff;
+	}
+
+	for ( i = 0; i < TEST_BUF_LEN; i++ )
+		buf[i] = rand ();
+
+	if ( simd_crc32c ((const uint8_t*) "123456789", 9, 0) != 0xe3069283 )
+		test_fail (level, "crc32c check value", 9);
+
+	for ( round = 0; round < TEST_ROUNDS; round++ ){
+		/* Unaligned data, mostly short, a few long enough to overflow
+		 * narrow accumulators. */
+		data = buf + rand () % 64;
+		len = (round % 100 == 0) ? (size_t) rand () % (TEST_BUF_LEN - 64):(size_t) rand () % 3000;
+
+		if ( simd_cksum_add (data, len, 0) != ref_cksum (data, len) )
+			test_fail (level, "checksum", len);
+
+		if ( simd_crc32c (data, len, 0) != ref_crc32c (data, len) )
+			test_fail (level, "crc32c", len);
+
+		half = len / 2;
+
+		if ( simd_crc32c (data + half, len - half, simd_crc32c (data, half, 0)) != ref_crc32c (data, len) )
+			test_fail (level, "crc32c continued", len);
+
+		if ( fabs (simd_entropy (data, len) - ref_entropy (data, len)) > 1e-9 )
+			test_fail (level, "entropy", len);
+
+		if ( len > SIMD_TOEPLITZ_LEN )
+			len = SIMD_TOEPLITZ_LEN;
+
+		if ( simd_toeplitz (data, len) != ref_toeplitz (data, len, key) )
+			test_fail (level, "toeplitz", len);
+
+		memcpy (src, data, sizeof (src));
+		memcpy (dst, data + sizeof (src), sizeof (dst));
+		sport = rand ();
+		dport = rand ();
+
+		if ( simd_flow_hash (src, dst, 4, sport, dport) != simd_flow_hash (dst, src, 4, dport, sport)
+				|| simd_flow_hash (src, dst, 16, sport, dport) != simd_flow_hash (dst, src, 16, dport, sport) )
+			test_fail (level, "flow hash symmetry", 0);
+
+		test_find (level, buf + TEST_BUF_LEN - 4096 + rand () % 64, rand () % 2048);
+	}
+
+	/* Largest possible words, worst case of lane overflow */
+	memset (buf, 0xff, TEST_BUF_LEN);
+
+	if ( simd_cksum_add (buf, TEST_BUF_LEN, 0) != ref_cksum (buf, TEST_BUF_LEN) )
+		test_fail (level, "checksum of 0xff", TEST_BUF_LEN);
+}
+
+int
+main (int argc, char *argv[])
+{
+	uint8_t *buf;
+	int level, max, errors;
+
+	srand ((argc > 1) ? strtoul (argv[1], NULL, 10):1);
+
+	/* Reference Toeplitz hash must agree with the published vector. */
+	if ( ref_toeplitz (rss_tuple, sizeof (rss_tuple), rss_key) != RSS_HASH ){
+		fprintf (stderr, "simd: reference toeplitz fails the RSS vector\n");
+		return EXIT_FAILURE;
+	}
+
+	buf = (uint8_t*) malloc (TEST_BUF_LEN);
+
+	if ( buf == NULL ){
+		fprintf (stderr, "simd: cannot allocate memory\n");
+		return EXIT_FAILURE;
+	}
+
+	max = simd_init ();
+
+	for ( level = SIMD_AVX2; level >= SIMD_SCALAR; level-- ){
+		if ( level > max ){
+			printf ("simd: %s not supported, skipped\n", simd_name (level));
+			continue;
+		}
+
+		errors = test_errors;
+		simd_select (level);
+		test_level (level, buf);
+		printf ("simd: %s: %s\n", simd_name (level), (test_errors > errors) ? "failed":"ok");
+	}
+
+	free (buf);
+
+	return (test_errors > 0) ? EXIT_FAILURE:EXIT_SUCCESS;
+}
@@ -0,0 +1,338 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "timer.h"
+
+/* Timers are driven by capture time (timestamps of frames), not by wall-clock
+ * time. Capture time may jump by hours between two frames, so instead of a
+ * wheel with fixed resolution timers are kept in a binary heap ordered by
+ * their deadlines. All timers that expire in a gap between two frames are
+ * fired in order, periodic timers once for each elapsed interval, but for no
+ * more than TIMER_CATCHUP_MAX of the latest intervals. Timers still pending
+ * at the end of input never fire. */
+
+void
+timer_list_init (struct timer_list *timers)
+{
+	memset (timers, 0, sizeof (struct timer_list));
+}
+
+static int
+timer_heap_push (struct timer_list *timers, struct timer *timer)
+{
+	struct timer **heap;
+	size_t i, parent;
+
+	if ( timers->cnt == timers->size ){
+		heap = (struct timer**) realloc (timers->heap, sizeof (struct timer*) * (timers->size + 16));
+
+		if ( heap == NULL )
+			return 1;
+
+		timers->heap = heap;
+		timers->size += 16;
+	}
+
+	for ( i = timers->cnt++; i > 0; i = parent ){
+		parent = (i - 1) / 2;
+
+		/* Timers with equal deadlines fire in the order of registration. */
+		if ( timers->heap[parent]->deadline < timer->deadline
+				|| (timers->heap[parent]->deadline == timer->deadline && timers->heap[parent]->id < timer->id) )
+			break;
+
+		timers->heap[i] = timers->heap[parent];
+	}
+
+	timers->heap[i] = timer;
+
+	return 0;
+}
+
+static struct timer*
+timer_heap_pop (struct timer_list *timers)
+{
+	struct timer *top, *last;
+	size_t i, child;
+
+	top = timers->heap[0];
+	last = timers->heap[--(timers->cnt)];
+
+	for ( i = 0; (child = i * 2 + 1) < timers->cnt; i = child ){
+
+		if ( child + 1 < timers->cnt
+				&& (timers->heap[child + 1]->deadline < timers->heap[child]->deadline
+				|| (timers->heap[child + 1]->deadline == timers->heap[child]->deadline && timers->heap[child + 1]->id < timers->heap[child]->id)) )
+			child++;
+
+		if ( last->deadline < timers->heap[child]->deadline
+				|| (last->deadline == timers->heap[child]->deadline && last->id < timers->heap[child]->id) )
+			break;
+
+		timers->heap[i] = timers->heap[child];
+	}
+
+	if ( timers->cnt > 0 )
+		timers->heap[i] = last;
+
+	return top;
+}
+
+/* Set a deadline of a timer relative to the current time. For periodic
+ * timers, deadlines are aligned to a multiple of the interval, so that
+ * i.e. per-second statistics are calculated for whole seconds. */
+static void
+timer_arm (struct timer_list *timers, struct timer *timer)
+{
+	if ( timer->interval > 0 )
+		timer->deadline = (timers->now / timer->interval + 1) * timer->interval;
+	else
+		timer->deadline += timers->now;
+}
+
+static void
+timer_free (lua_State *lua_state, struct timer *timer)
+{
+	luaL_unref (lua_state, LUA_REGISTRYINDEX, timer->ref);
+	free (timer);
+}
+
+int
+timer_advance (struct timer_list *timers, lua_State *lua_state, int64_t now)
+{
+	struct timer *timer;
+	size_t i;
+
+	if ( ! timers->now_known ){
+		timers->now = now;
+		timers->now_known = 1;
+
+		/* Timers registered before the first frame was read. */
+		for ( i = 0; i < timers->pending_cnt; i++ ){
+			timer_arm (timers, timers->pending[i]);
+
+			if ( timer_heap_push (timers, timers->pending[i]) != 0 ){
+				lua_pushstring (lua_state, "cannot allocate memory");
+				return 1;
+			}
+
+			timers->pending[i] = NULL;
+		}
+
+		timers->pending_cnt = 0;
+	}
+
+	while ( timers->cnt > 0 && timers->heap[0]->deadline <= now ){
+		timer = timer_heap_pop (timers);
+
+		if ( ! timer->active ){
+			timer_free (lua_state, timer);
+			continue;
+		}
+
+		/* A gap of days (or a bogus timestamp) would fire a short periodic
+		 * timer billions of times, skip the oldest intervals. */
+		if ( timer->interval > 0 && (now - timer->deadline) / timer->interval >= TIMER_CATCHUP_MAX )
+			timer->deadline += ((now - timer->deadline) / timer->interval - TIMER_CATCHUP_MAX + 1) * timer->interval;
+
+		/* Callbacks see the time of the deadline, not of the frame. */
+		timers->now = timer->deadline;
+		timers->current = timer;
+
+		if ( ! lua_checkstack (lua_state, 3) ){
+			lua_pushstring (lua_state, "internal error: Lua stack is full");
+			return 1;
+		}
+
+		lua_rawgeti (lua_state, LUA_REGISTRYINDEX, timer->ref);
+		lua_pushnumber (lua_state, timer->deadline / 1000000.0);
+		lua_pushnumber (lua_state, timer->id);
+
+		if ( lua_pcall (lua_state, 2, 0, 0) != LUA_OK ){
+			timers->current = NULL;
+			timer_free (lua_state, timer);
+			return 1;
+		}
+
+		timers->current = NULL;
+
+		if ( ! timer->active || timer->interval == 0 ){
+			timer_free (lua_state, timer);
+			continue;
+		}
+
+		timer->deadline += timer->interval;
+
+		if ( timer_heap_push (timers, timer) != 0 ){
+			timer_free (lua_state, timer);
+			lua_pushstring (lua_state, "cannot allocate memory");
+			return 1;
+		}
+	}
+
+	if ( now > timers->now )
+		timers->now = now;
+
+	return 0;
+}
+
+void
+timer_list_free (struct timer_list *timers)
+{
+	size_t i;
+
+	/* References are released along with Lua state. */
+	for ( i = 0; i < timers->cnt; i++ )
+		free (timers->heap[i]);
+
+	for ( i = 0; i < timers->pending_cnt; i++ )
+		free (timers->pending[i]);
+
+	if ( timers->heap != NULL )
+		free (timers->heap);
+
+	if ( timers->pending != NULL )
+		free (timers->pending);
+
+	memset (timers, 0, sizeof (struct timer_list));
+}
+
+static int
+timer_lua_add (lua_State *lua_state, int periodic)
+{
+	struct timer_list *timers;
+	struct timer *timer, **pending;
+	lua_Number interval;
+
+	timers = (struct timer_list*) lua_touserdata (lua_state, lua_upvalueindex (1));
+	interval = luaL_checknumber (lua_state, 1);
+	luaL_checktype (lua_state, 2, LUA_TFUNCTION);
+
+	if ( periodic && interval < 0.000001 )
+		return luaL_argerror (lua_state, 1, "interval must be at least 1 microsecond");
+
+	if ( interval < 0 )
+		return luaL_argerror (lua_state, 1, "time must not be negative");
+
+	timer = (struct timer*) malloc (sizeof (struct timer));
+
+	if ( timer == NULL )
+		return luaL_error (lua_state, "cannot allocate memory");
+
+	timer->id = ++(timers->next_id);
+	timer->interval = periodic ? (int64_t) (interval * 1000000.0 + 0.5):0;
+	timer->deadline = periodic ? 0:(int64_t) (interval * 1000000.0 + 0.5);
+	timer->active = 1;
+
+	if ( timers->now_known ){
+		timer_arm (timers, timer);
+
+		if ( timer_heap_push (timers, timer) != 0 ){
+			free (timer);
+			return luaL_error (lua_state, "cannot allocate memory");
+		}
+	} else {
+		pending = (struct timer**) realloc (timers->pending, sizeof (struct timer*) * (timers->pending_cnt + 1));
+
+		if ( pending == NULL ){
+			free (timer);
+			return luaL_error (lua_state, "cannot allocate memory");
+		}
+
+		timers->pending = pending;
+		timers->pending[timers->pending_cnt++] = timer;
+	}
+
+	lua_pushvalue (lua_state, 2);
+	timer->ref = luaL_ref (lua_state, LUA_REGISTRYINDEX);
+
+	lua_pushnumber (lua_state, timer->id);
+
+	return 1;
+}
+
+/* capdiss.every (interval, callback) */
+static int
+timer_lua_every (lua_State *lua_state)
+{
+	return timer_lua_add (lua_state, 1);
+}
+
+/* capdiss.after (time, callback) */
+static int
+timer_lua_after (lua_State *lua_state)
+{
+	return timer_lua_add (lua_state, 0);
+}
+
+/* capdiss.cancel (id) */
+static int
+timer_lua_cancel (lua_State *lua_state)
+{
+	struct timer_list *timers;
+	unsigned long id;
+	size_t i;
+
+	timers = (struct timer_list*) lua_touserdata (lua_state, lua_upvalueindex (1));
+	id = (unsigned long) luaL_checknumber (lua_state, 1);
+
+	/* Cancelled timers are freed once they get to the top of the heap. */
+	if ( timers->current != NULL && timers->current->id == id ){
+		timers->current->active = 0;
+		lua_pushboolean (lua_state, 1);
+		return 1;
+	}
+
+	for ( i = 0; i < timers->cnt; i++ ){
+		if ( timers->heap[i]->id == id && timers->heap[i]->active ){
+			timers->heap[i]->active = 0;
+			lua_pushboolean (lua_state, 1);
+			return 1;
+		}
+	}
+
+	for ( i = 0; i < timers->pending_cnt; i++ ){
+		if ( timers->pending[i]->id == id && timers->pending[i]->active ){
+			timers->pending[i]->active = 0;
+			lua_pushboolean (lua_state, 1);
+			return 1;
+		}
+	}
+
+	lua_pushboolean (lua_state, 0);
+
+	return 1;
+}
+
+const luaL_Reg timer_api[] = {
+	{ "every", timer_lua_every },
+	{ "after", timer_lua_after },
+	{ "cancel", timer_lua_cancel },
+	{ NULL, NULL }
+};
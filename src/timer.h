@@ -0,0 +1,66 @@
+/*
+* capdiss - capture file dissector with embedded Lua interpreter.
+*
+* Copyright (c) 2016, CodeWard.org
+*
+* Permission is hereby granted, free of charge, to any person obtaining a copy of
+* this software and associated documentation files (the "Software"), to deal in
+* the Software without restriction, including without limitation the rights to
+* use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+* of the Software, and to permit persons to whom the Software is furnished to do
+* so, subject to the following conditions:
+*
+* The above copyright notice and this permission notice shall be included in all
+* copies or substantial portions of the Software.
+
+* THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+* IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+* FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+* AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+* LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+* OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+* SOFTWARE.
+*/
+#ifndef _TIMER_H
+#define _TIMER_H
+
+#include <stdint.h>
+#include <lua.h>
+#include <lauxlib.h>
+
+/* Most elapsed intervals a periodic timer fires for in a single gap between
+ * two frames. */
+#define TIMER_CATCHUP_MAX 65536
+
+struct timer
+{
+	unsigned long id;
+	int64_t deadline;
+	int64_t interval;
+	int ref;
+	int active;
+};
+
+struct timer_list
+{
+	struct timer **heap;
+	size_t cnt;
+	size_t size;
+	struct timer **pending;
+	size_t pending_cnt;
+	struct timer *current;
+	int64_t now;
+	int now_known;
+	unsigned long next_id;
+};
+
+extern const luaL_Reg timer_api[];
+
+extern void timer_list_init (struct timer_list *timers);
+
+extern int timer_advance (struct timer_list *timers, lua_State *lua_state, int64_t now);
+
+extern void timer_list_free (struct timer_list *timers);
+
+#endif
+